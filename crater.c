@@ -5,11 +5,16 @@
 #include <stdio.h>
 
 #include "src/assembler.h"
+#include "src/batch.h"
+#include "src/bench.h"
 #include "src/config.h"
 #include "src/disassembler.h"
 #include "src/emulator.h"
+#include "src/golden.h"
+#include "src/link.h"
 #include "src/logging.h"
 #include "src/rom.h"
+#include "src/search.h"
 
 /*
     Main function.
@@ -33,6 +38,11 @@ int main(int argc, char *argv[])
     } else if (config->disassemble) {
         retval = disassemble_file(config->src_path, config->dst_path);
         retval = retval ? EXIT_SUCCESS : EXIT_FAILURE;
+    } else if (config->bench_audio) {
+        bench_audio();
+    } else if (config->batch_path) {
+        if (!batch_file(config))
+            retval = EXIT_FAILURE;
     } else {
         ROM rom;
         const char* errmsg;
@@ -40,6 +50,27 @@ int main(int argc, char *argv[])
         if ((errmsg = rom_open(&rom, config->rom_path))) {
             ERROR("couldn't load ROM image '%s': %s", config->rom_path, errmsg)
             retval = EXIT_FAILURE;
+        } else if (config->bench) {
+            if (!(config->lanes ? bench_lanes(&rom, config) :
+                                  bench_emulator(&rom, config)))
+                retval = EXIT_FAILURE;
+            rom_close(&rom);
+        } else if (config->hashes_path) {
+            if (!golden_write(&rom, config))
+                retval = EXIT_FAILURE;
+            rom_close(&rom);
+        } else if (config->check_path) {
+            if (!golden_check(&rom, config))
+                retval = EXIT_FAILURE;
+            rom_close(&rom);
+        } else if (config->search_path) {
+            if (!search_rom(&rom, config))
+                retval = EXIT_FAILURE;
+            rom_close(&rom);
+        } else if (config->link_path) {
+            if (!link_roms(&rom, config))
+                retval = EXIT_FAILURE;
+            rom_close(&rom);
         } else {
             printf("crater: emulating: %s\n", rom.name);
             emulate(&rom, config);
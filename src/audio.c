@@ -0,0 +1,277 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include "audio.h"
+#include "logging.h"
+#include "pacer.h"
+#include "util.h"
+
+#define CHUNK_SIZE 1024
+
+/*
+    SDL audio callback: copy queued samples into the device's buffer.
+
+    If the ring runs dry, the rest of the buffer repeats the last sample played
+    rather than dropping to silence, which would click.
+*/
+static void audio_callback(void *userdata, uint8_t *stream, int len)
+{
+    Audio *audio = userdata;
+    float *out = (float*) stream;
+    size_t count = len / (2 * sizeof(float));
+    size_t read = ring_read(&audio->ring, out, count);
+
+    if (read) {
+        audio->last[0] = out[2 * read - 2];
+        audio->last[1] = out[2 * read - 1];
+    }
+    if (read < count) {
+        for (size_t i = read; i < count; i++) {
+            out[2 * i]     = audio->last[0];
+            out[2 * i + 1] = audio->last[1];
+        }
+        atomic_fetch_add_explicit(&audio->underruns, 1, memory_order_relaxed);
+    }
+}
+
+/*
+    Make sure a scratch buffer can hold the given number of stereo samples of
+    the given size, and return it.
+*/
+static void* reserve(void *buffer, size_t *size, size_t count, size_t elem)
+{
+    if (count > *size) {
+        *size = count;
+        buffer = cr_realloc(buffer, 2 * elem * count);
+    }
+    return buffer;
+}
+
+/*
+    Initialize an Audio object with no device, resampling at the given quality.
+
+    Until audio_open() succeeds, it plays nothing, but can still record.
+*/
+void audio_init(Audio *audio, ResampleQuality quality)
+{
+    audio->device = 0;
+    audio->quality = quality;
+    audio->output = NULL;
+    audio->output_size = 0;
+    audio->recording = false;
+    audio->rate = PSG_DEFAULT_RATE;
+    audio->ratio = 1.0;
+    audio->speed = 1.0;
+    audio->blocking = false;
+    audio->started = false;
+    audio->last[0] = audio->last[1] = 0;
+    atomic_init(&audio->underruns, 0);
+    atomic_init(&audio->overruns, 0);
+    ring_init(&audio->ring, AUDIO_RING_SIZE, 2 * sizeof(float));
+}
+
+/*
+    Open the default audio device at the given sample rate, resampling the
+    GameGear's output to it.
+
+    Return whether it worked.
+*/
+bool audio_open(Audio *audio, unsigned rate)
+{
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+        WARN("SDL failed to initialize audio: %s", SDL_GetError())
+        return false;
+    }
+
+    SDL_AudioSpec want = {0}, have;
+    want.freq = rate;
+    want.format = AUDIO_F32SYS;
+    want.channels = 2;
+    want.samples = AUDIO_DEVICE_SAMPLES;
+    want.callback = audio_callback;
+    want.userdata = audio;
+
+    audio->device = SDL_OpenAudioDevice(NULL, 0, &want, &have,
+        SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    if (!audio->device) {
+        WARN("SDL failed to open an audio device: %s", SDL_GetError())
+        return false;
+    }
+    audio->rate = have.freq;
+    resampler_init(&audio->resampler, audio->quality, PSG_DEFAULT_RATE,
+                   audio->rate);
+    DEBUG("Using audio device at %d Hz (%u samples, %s resampling)",
+          have.freq, have.samples, resampler_quality_name(audio->quality))
+    return true;
+}
+
+/*
+    Start recording the GameGear's audio output to a WAV file.
+
+    This works whether or not a device was opened. Return whether the file was
+    opened.
+*/
+bool audio_record(Audio *audio, const char *path)
+{
+    if (!wav_open(&audio->wav, path, AUDIO_WAV_RATE))
+        return false;
+    resampler_init(&audio->wav_resampler, audio->quality, PSG_DEFAULT_RATE,
+                   AUDIO_WAV_RATE);
+    audio->wav_output = NULL;
+    audio->wav_output_size = 0;
+    audio->recording = true;
+    return true;
+}
+
+/*
+    Close the audio device and any recording, and free the buffers.
+*/
+void audio_close(Audio *audio)
+{
+    if (audio->device) {
+        SDL_CloseAudioDevice(audio->device);
+        resampler_free(&audio->resampler);
+        audio->device = 0;
+    }
+    if (audio->recording) {
+        wav_close(&audio->wav);
+        resampler_free(&audio->wav_resampler);
+        free(audio->wav_output);
+        audio->recording = false;
+    }
+    free(audio->output);
+    ring_free(&audio->ring);
+}
+
+/*
+    Set whether audio_update() should wait for room in the ring buffer.
+
+    When blocking, the audio device's clock paces the emulator, so the output
+    rate is left alone instead of being adjusted to match the video.
+*/
+void audio_set_blocking(Audio *audio, bool blocking)
+{
+    audio->blocking = blocking;
+}
+
+/*
+    Tell the audio system how many frames per second are actually emulated.
+
+    If this isn't GG_FPS (e.g. when following a 59.94 Hz display), the
+    resampling ratio is scaled so that a second of emulated frames still plays
+    back in a second, leaving rate control to deal only with the remaining
+    drift.
+*/
+void audio_set_frame_rate(Audio *audio, double fps)
+{
+    audio->speed = GG_FPS / fps;
+}
+
+/*
+    Block until the ring buffer has drained to its target fill level.
+
+    This sleeps for the time the device needs to play the excess samples,
+    rather than polling.
+*/
+static void wait_for_room(Audio *audio)
+{
+    size_t target = ring_capacity(&audio->ring) / 2, used;
+
+    while ((used = ring_used(&audio->ring)) > target) {
+        uint64_t delay = (used - target) * 1000000000ULL / audio->rate;
+        pacer_sleep_until(get_time_ns() + delay);
+    }
+}
+
+/*
+    Append a chunk of the GameGear's output to the WAV recording.
+*/
+static void record_chunk(Audio *audio, const int16_t *chunk, size_t count)
+{
+    size_t max = resampler_max_output(&audio->wav_resampler, count);
+    audio->wav_output = reserve(audio->wav_output, &audio->wav_output_size,
+                                max, sizeof(int16_t));
+
+    size_t written = resampler_run(&audio->wav_resampler, chunk, count,
+                                   audio->wav_output, SAMPLE_INT16);
+    wav_write(&audio->wav, audio->wav_output, written);
+}
+
+/*
+    Resample a chunk of the GameGear's output and queue it for the device.
+*/
+static void play_chunk(Audio *audio, const int16_t *chunk, size_t count)
+{
+    size_t max = resampler_max_output(&audio->resampler, count);
+    audio->output = reserve(audio->output, &audio->output_size, max,
+                            sizeof(float));
+
+    size_t written = resampler_run(&audio->resampler, chunk, count,
+                                   audio->output, SAMPLE_FLOAT);
+    if (ring_write(&audio->ring, audio->output, written) < written)
+        atomic_fetch_add_explicit(&audio->overruns, 1, memory_order_relaxed);
+}
+
+/*
+    Move the GameGear's latest samples into the ring buffer, and nudge the
+    resampling ratio to keep the ring half full.
+
+    The emulator runs on the video clock, which never exactly matches the audio
+    device's clock. Rather than letting the ring slowly drain or overflow, the
+    output rate is scaled by up to AUDIO_MAX_RATE_DELTA in proportion to how
+    far the fill level is from its target; this is far too small a pitch change
+    to hear. In blocking mode, the rate is fixed and we wait for room in the
+    ring instead. The GameGear itself always produces audio at the same rate.
+
+    If play is false (e.g. while fast-forwarding, for frames that aren't
+    shown), the samples are only recorded, and never reach the device.
+*/
+void audio_update(Audio *audio, GameGear *gg, bool play)
+{
+    int16_t chunk[2 * CHUNK_SIZE];
+    size_t count;
+
+    play = play && audio->device;
+    if (!play && !audio->recording) {
+        gamegear_read_audio(gg, NULL, SIZE_MAX);
+        return;
+    }
+
+    if (play && audio->blocking && audio->started)
+        wait_for_room(audio);
+
+    while ((count = gamegear_read_audio(gg, chunk, CHUNK_SIZE))) {
+        if (audio->recording)
+            record_chunk(audio, chunk, count);
+        if (play)
+            play_chunk(audio, chunk, count);
+    }
+    if (!play)
+        return;
+
+    size_t capacity = ring_capacity(&audio->ring);
+    double fill = (double) ring_used(&audio->ring) / capacity;
+    if (!audio->blocking)
+        audio->ratio = 1.0 + AUDIO_MAX_RATE_DELTA * (1.0 - 2.0 * fill);
+    resampler_set_rates(&audio->resampler, PSG_DEFAULT_RATE / audio->speed,
+                        audio->rate * audio->ratio);
+
+    if (!audio->started && fill >= 0.5) {
+        SDL_PauseAudioDevice(audio->device, 0);
+        audio->started = true;
+    }
+}
+
+/*
+    Fill in the current state of the audio buffer and its error counters.
+*/
+void audio_get_stats(Audio *audio, AudioStats *stats)
+{
+    stats->fill = ring_used(&audio->ring);
+    stats->capacity = ring_capacity(&audio->ring);
+    stats->underruns = atomic_load_explicit(&audio->underruns,
+                                            memory_order_relaxed);
+    stats->overruns = atomic_load_explicit(&audio->overruns,
+                                           memory_order_relaxed);
+    stats->ratio = audio->ratio;
+}
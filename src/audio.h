@@ -0,0 +1,72 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL.h>
+
+#include "gamegear.h"
+#include "resample.h"
+#include "ring.h"
+#include "wav.h"
+
+#define AUDIO_RING_SIZE 4096
+#define AUDIO_DEVICE_SAMPLES 512
+#define AUDIO_MAX_RATE_DELTA 0.005
+#define AUDIO_WAV_RATE 44100
+
+/* Structs */
+
+/*
+    Audio output through an SDL device.
+
+    The emulation thread resamples each frame's samples to the device rate and
+    pushes them into the ring, and the device callback drains it on SDL's audio
+    thread. Neither side ever blocks. Output can also be recorded to a WAV file,
+    through a resampler of its own that is never rate-controlled.
+*/
+typedef struct {
+    Ring ring;
+    SDL_AudioDeviceID device;
+    ResampleQuality quality;
+    Resampler resampler;
+    float *output;
+    size_t output_size;
+    double rate;
+    double ratio;
+    double speed;
+    bool blocking;
+    bool started;
+    float last[2];
+
+    bool recording;
+    WavWriter wav;
+    Resampler wav_resampler;
+    int16_t *wav_output;
+    size_t wav_output_size;
+
+    atomic_ulong underruns;
+    atomic_ulong overruns;
+} Audio;
+
+typedef struct {
+    size_t fill;
+    size_t capacity;
+    unsigned long underruns;
+    unsigned long overruns;
+    double ratio;
+} AudioStats;
+
+/* Functions */
+
+void audio_init(Audio*, ResampleQuality);
+bool audio_open(Audio*, unsigned);
+bool audio_record(Audio*, const char*);
+void audio_close(Audio*);
+void audio_set_blocking(Audio*, bool);
+void audio_set_frame_rate(Audio*, double);
+void audio_update(Audio*, GameGear*, bool);
+void audio_get_stats(Audio*, AudioStats*);
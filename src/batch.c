@@ -0,0 +1,573 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "batch.h"
+#include "logging.h"
+#include "state.h"
+#include "util.h"
+
+#define LINE_PIXELS GG_SCREEN_WIDTH
+#define SCREEN_PIXELS (GG_SCREEN_WIDTH * GG_SCREEN_HEIGHT)
+#define MAX_FIELDS 4
+
+/*
+    A worker's queue of jobs, as a range of rounds. Worker i starts out with
+    job (round * workers + i) for every round from head up to tail. It takes
+    its own jobs from the head; a worker whose queue runs dry steals from the
+    tail of another's, so a few long jobs don't leave the rest of the threads
+    idle.
+*/
+typedef struct {
+    pthread_mutex_t lock;
+    size_t head, tail;
+} JobQueue;
+
+/*
+    Everything a worker thread reuses from one job to the next: its GameGear,
+    the screen it draws to and a hash of each of its lines, and a buffer for
+    the final state.
+*/
+typedef struct {
+    GameGear *gg;
+    uint32_t *pixels;
+    uint64_t line_hashes[GG_SCREEN_HEIGHT];
+    GGState *state;
+    JobQueue queue;
+
+    BatchJob *job;
+    Movie movie;
+    unsigned long frames;
+} Worker;
+
+typedef struct {
+    BatchJob *jobs;
+    size_t count;
+    Worker *workers;
+    unsigned nworkers;
+} Batch;
+
+/*
+    A file loaded once for every job that uses it. Movies and states are only
+    valid for the ROM they were loaded with, so they are looked up by both.
+*/
+typedef struct {
+    char *path;
+    const ROM *rom;
+    void *data;
+} Resource;
+
+typedef struct {
+    Resource *items;
+    size_t count, capacity;
+} Resources;
+
+/*
+    The jobs read from a job file, with the line each came from and the files
+    they share.
+*/
+typedef struct {
+    BatchJob *jobs;
+    size_t *lines;
+    const char **names;
+    size_t count, capacity;
+    Resources roms, movies, states;
+    BIOS *bios;
+} JobFile;
+
+static _Thread_local Worker *current;
+
+/*
+    GameGear callback for batch runs: hash the frame into the job's chain,
+    throw away its audio, and move the movie along.
+
+    Only lines that were redrawn are hashed again; the rest are the same as
+    in the frame before.
+*/
+static void batch_callback(GameGear *gg)
+{
+    Worker *worker = current;
+    BatchJob *job = worker->job;
+    const bool *dirty = gamegear_get_dirty_lines(gg);
+
+    for (int line = 0; line < GG_SCREEN_HEIGHT; line++) {
+        if (dirty[line])
+            worker->line_hashes[line] = hash64(
+                worker->pixels + line * LINE_PIXELS,
+                LINE_PIXELS * sizeof(uint32_t), 0);
+    }
+    job->video_hash = hash64(worker->line_hashes,
+                             sizeof(worker->line_hashes), job->video_hash);
+    gamegear_read_audio(gg, NULL, SIZE_MAX);
+
+    job->frames_run++;
+    if (job->movie)
+        movie_play(&worker->movie, gg);
+    if (job->frames_run >= worker->frames)
+        gamegear_power_off(gg);
+}
+
+/*
+    Run a job on the worker's GameGear, which is reset first so that nothing
+    is left over from the job before.
+*/
+static void run_job(Worker *worker, BatchJob *job)
+{
+    GameGear *gg = worker->gg;
+
+    worker->job = job;
+    worker->frames = job->frames ? job->frames : job->movie->frames;
+    job->frames_run = 0;
+    job->video_hash = job->state_hash = 0;
+    job->exception[0] = '\0';
+
+    memset(worker->pixels, 0x00, SCREEN_PIXELS * sizeof(uint32_t));
+    uint64_t blank = hash64(worker->pixels,
+                            LINE_PIXELS * sizeof(uint32_t), 0);
+    for (int line = 0; line < GG_SCREEN_HEIGHT; line++)
+        worker->line_hashes[line] = blank;
+
+    gamegear_reset(gg);
+    gamegear_set_speed(gg, PACER_UNTHROTTLED);
+    gamegear_attach_callback(gg, batch_callback);
+    gamegear_attach_display(gg, worker->pixels,
+                            LINE_PIXELS * sizeof(uint32_t));
+    gamegear_load_rom(gg, job->rom);
+    if (job->bios)
+        gamegear_load_bios(gg, job->bios);
+    if (job->state)
+        gamegear_load_state(gg, job->state);
+    if (job->movie) {
+        worker->movie = *job->movie;
+        movie_begin(&worker->movie, gg);
+    }
+    gamegear_simulate(gg);
+
+    const char *exc = gamegear_get_exception(gg);
+    if (exc)
+        snprintf(job->exception, GG_EXC_BUFF_SIZE, "%s", exc);
+    gamegear_save_state(gg, worker->state);
+    job->state_hash = state_hash(worker->state, job->rom);
+}
+
+/*
+    Take the next job from the front of a worker's own queue. Return whether
+    there was one.
+*/
+static bool pop_job(Batch *batch, unsigned index, size_t *job)
+{
+    JobQueue *queue = &batch->workers[index].queue;
+    bool found = false;
+
+    pthread_mutex_lock(&queue->lock);
+    if (queue->head < queue->tail) {
+        *job = queue->head++ * batch->nworkers + index;
+        found = true;
+    }
+    pthread_mutex_unlock(&queue->lock);
+    return found;
+}
+
+/*
+    Take a job from the back of another worker's queue, trying each in turn.
+    Return whether one was found.
+*/
+static bool steal_job(Batch *batch, unsigned index, size_t *job)
+{
+    for (unsigned i = 1; i < batch->nworkers; i++) {
+        unsigned victim = (index + i) % batch->nworkers;
+        JobQueue *queue = &batch->workers[victim].queue;
+        bool found = false;
+
+        pthread_mutex_lock(&queue->lock);
+        if (queue->head < queue->tail) {
+            *job = --queue->tail * batch->nworkers + victim;
+            found = true;
+        }
+        pthread_mutex_unlock(&queue->lock);
+        if (found)
+            return true;
+    }
+    return false;
+}
+
+/*
+    Pool task for a batch: run jobs until there are none left anywhere.
+*/
+static void run_worker(void *context, unsigned index, unsigned count)
+{
+    Batch *batch = context;
+    Worker *worker = &batch->workers[index];
+    size_t job;
+
+    (void) count;
+    current = worker;
+    while (pop_job(batch, index, &job) || steal_job(batch, index, &job))
+        run_job(worker, &batch->jobs[job]);
+    current = NULL;
+}
+
+/*
+    Run a batch of jobs across the given number of threads (zero for one per
+    CPU), filling in their results. Return the number of threads used.
+
+    Each thread gets one GameGear, reset between jobs rather than created
+    again, and drawing with the given render mode. Jobs without a movie must
+    have a positive frame count, and a movie with a starting state of its own
+    can't be combined with another state.
+*/
+unsigned batch_run(BatchJob *jobs, size_t count, unsigned threads,
+                   VDPRenderMode render_mode)
+{
+    if (!count)
+        return 0;
+    if (!threads)
+        threads = pool_cpu_count();
+    if (threads > count)
+        threads = count;
+
+    ThreadPool *pool = pool_create(threads);
+    Batch batch = {jobs, count, NULL, pool_size(pool)};
+
+    batch.workers = cr_calloc(batch.nworkers, sizeof(Worker));
+    for (unsigned i = 0; i < batch.nworkers; i++) {
+        Worker *worker = &batch.workers[i];
+        worker->gg = gamegear_create();
+        gamegear_set_render_mode(worker->gg, render_mode);
+        worker->pixels = cr_malloc(SCREEN_PIXELS * sizeof(uint32_t));
+        worker->state = cr_malloc(sizeof(GGState));
+        pthread_mutex_init(&worker->queue.lock, NULL);
+        worker->queue.head = 0;
+        worker->queue.tail = i < count ? (count - i - 1) / batch.nworkers + 1
+                                       : 0;
+    }
+
+    pool_run(pool, run_worker, &batch);
+    pool_destroy(pool);
+
+    for (unsigned i = 0; i < batch.nworkers; i++) {
+        Worker *worker = &batch.workers[i];
+        pthread_mutex_destroy(&worker->queue.lock);
+        gamegear_destroy(worker->gg);
+        free(worker->pixels);
+        free(worker->state);
+    }
+    free(batch.workers);
+    return batch.nworkers;
+}
+
+/*
+    Return the data loaded from the given file for the given ROM, or NULL if
+    it hasn't been loaded yet.
+*/
+static void* find_resource(const Resources *list, const char *path,
+                           const ROM *rom)
+{
+    for (size_t i = 0; i < list->count; i++) {
+        if (list->items[i].rom == rom && !strcmp(list->items[i].path, path))
+            return list->items[i].data;
+    }
+    return NULL;
+}
+
+/*
+    Remember the data loaded from the given file for the given ROM.
+*/
+static const char* add_resource(Resources *list, const char *path,
+                                const ROM *rom, void *data)
+{
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 16;
+        list->items = cr_realloc(list->items,
+                                 list->capacity * sizeof(Resource));
+    }
+    Resource *item = &list->items[list->count++];
+    item->path = cr_strdup(path);
+    item->rom = rom;
+    item->data = data;
+    return item->path;
+}
+
+/*
+    Load a ROM image, or return the one already loaded from the same path.
+    NULL is returned if it couldn't be loaded.
+*/
+static const ROM* get_rom(JobFile *file, const char *path, const char **name)
+{
+    for (size_t i = 0; i < file->roms.count; i++) {
+        if (!strcmp(file->roms.items[i].path, path)) {
+            *name = file->roms.items[i].path;
+            return file->roms.items[i].data;
+        }
+    }
+
+    ROM *rom = cr_malloc(sizeof(ROM));
+    const char *error = rom_open(rom, path);
+    if (error) {
+        ERROR("couldn't load ROM image '%s': %s", path, error)
+        free(rom);
+        return NULL;
+    }
+    *name = add_resource(&file->roms, path, NULL, rom);
+    return rom;
+}
+
+/*
+    Load a movie for a ROM, or return the one already loaded. NULL is
+    returned if it couldn't be loaded.
+*/
+static const Movie* get_movie(JobFile *file, const char *path,
+                              const ROM *rom)
+{
+    Movie *movie = find_resource(&file->movies, path, rom);
+    if (movie)
+        return movie;
+
+    movie = cr_malloc(sizeof(Movie));
+    if (!movie_load(movie, path, rom)) {
+        movie_free(movie);
+        free(movie);
+        return NULL;
+    }
+    add_resource(&file->movies, path, rom, movie);
+    return movie;
+}
+
+/*
+    Load a state for a ROM, or return the one already loaded. NULL is
+    returned if it couldn't be loaded.
+*/
+static const GGState* get_state(JobFile *file, const char *path,
+                                const ROM *rom)
+{
+    GGState *state = find_resource(&file->states, path, rom);
+    if (state)
+        return state;
+
+    state = cr_malloc(sizeof(GGState));
+    if (!state_load(path, state, rom)) {
+        free(state);
+        return NULL;
+    }
+    add_resource(&file->states, path, rom, state);
+    return state;
+}
+
+/*
+    Parse one line of a job file, adding its job to the list. Blank lines and
+    comments are skipped.
+
+    A job is a ROM path and a frame count, then optionally the path to a movie
+    to play and the path to a state to start from; "-" leaves out either one,
+    or the frame count when there is a movie to take it from. Return whether
+    the line was valid.
+*/
+static bool parse_job(JobFile *file, const char *path, size_t lineno,
+                      char *line)
+{
+    char *fields[MAX_FIELDS], *save;
+    size_t nfields = 0;
+
+    for (char *tok = strtok_r(line, " \t\r\n", &save); tok;
+            tok = strtok_r(NULL, " \t\r\n", &save)) {
+        if (tok[0] == '#')
+            break;
+        if (nfields == MAX_FIELDS) {
+            ERROR("%s:%zu: too many fields", path, lineno)
+            return false;
+        }
+        fields[nfields++] = tok;
+    }
+    if (!nfields)
+        return true;
+    if (nfields < 2) {
+        ERROR("%s:%zu: expected a ROM and a frame count", path, lineno)
+        return false;
+    }
+
+    if (file->count == file->capacity) {
+        file->capacity = file->capacity ? 2 * file->capacity : 64;
+        file->jobs = cr_realloc(file->jobs,
+                                file->capacity * sizeof(BatchJob));
+        file->lines = cr_realloc(file->lines,
+                                 file->capacity * sizeof(size_t));
+        file->names = cr_realloc(file->names,
+                                 file->capacity * sizeof(const char*));
+    }
+    BatchJob *job = &file->jobs[file->count];
+    job->bios = file->bios;
+    job->movie = NULL;
+    job->state = NULL;
+    job->frames = 0;
+
+    if (!(job->rom = get_rom(file, fields[0], &file->names[file->count])))
+        return false;
+    if (nfields > 2 && strcmp(fields[2], "-") &&
+            !(job->movie = get_movie(file, fields[2], job->rom)))
+        return false;
+    if (nfields > 3 && strcmp(fields[3], "-") &&
+            !(job->state = get_state(file, fields[3], job->rom)))
+        return false;
+
+    if (strcmp(fields[1], "-")) {
+        char *end;
+        long frames = strtol(fields[1], &end, 10);
+        if (*end || frames <= 0) {
+            ERROR("%s:%zu: frame count of %s is not a positive integer",
+                  path, lineno, fields[1])
+            return false;
+        }
+        job->frames = frames;
+    } else if (!job->movie || !job->movie->frames) {
+        ERROR("%s:%zu: a frame count is needed without a movie to play",
+              path, lineno)
+        return false;
+    }
+    if (job->movie && job->movie->start && job->state) {
+        ERROR("%s:%zu: can't load a state for a movie that has its own",
+              path, lineno)
+        return false;
+    }
+
+    file->lines[file->count++] = lineno;
+    return true;
+}
+
+/*
+    Read every job from a job file. Return whether it worked.
+*/
+static bool read_jobs(JobFile *file, const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        ERROR_ERRNO("couldn't open job file '%s'", path)
+        return false;
+    }
+
+    char *line = NULL;
+    size_t size = 0, lineno = 0;
+    bool ok = true;
+    while (ok && getline(&line, &size, fp) >= 0)
+        ok = parse_job(file, path, ++lineno, line);
+    if (ok && ferror(fp)) {
+        ERROR_ERRNO("couldn't read job file '%s'", path)
+        ok = false;
+    }
+    free(line);
+    fclose(fp);
+    return ok;
+}
+
+/*
+    Free everything loaded for a job file.
+*/
+static void free_jobs(JobFile *file)
+{
+    for (size_t i = 0; i < file->roms.count; i++) {
+        rom_close(file->roms.items[i].data);
+        free(file->roms.items[i].data);
+        free(file->roms.items[i].path);
+    }
+    for (size_t i = 0; i < file->movies.count; i++) {
+        movie_free(file->movies.items[i].data);
+        free(file->movies.items[i].data);
+        free(file->movies.items[i].path);
+    }
+    for (size_t i = 0; i < file->states.count; i++) {
+        free(file->states.items[i].data);
+        free(file->states.items[i].path);
+    }
+    free(file->roms.items);
+    free(file->movies.items);
+    free(file->states.items);
+    free(file->jobs);
+    free(file->lines);
+    free(file->names);
+    if (file->bios)
+        bios_close(file->bios);
+}
+
+/*
+    Write one line per job, in the order they were given: the line of the job
+    file it came from, its ROM, whether it ran to the end, how many frames it
+    ran, the chained hash of its screens, the hash of its final state, and
+    the exception that stopped it, if any.
+*/
+static void write_results(FILE *fp, const JobFile *file)
+{
+    for (size_t i = 0; i < file->count; i++) {
+        const BatchJob *job = &file->jobs[i];
+        fprintf(fp, "%zu %s %s frames=%lu video=%016llx state=%016llx",
+                file->lines[i], file->names[i],
+                job->exception[0] ? "failed" : "ok", job->frames_run,
+                (unsigned long long) job->video_hash,
+                (unsigned long long) job->state_hash);
+        if (job->exception[0])
+            fprintf(fp, " exception=\"%s\"", job->exception);
+        fputc('\n', fp);
+    }
+}
+
+/*
+    Run every job in the file at config->batch_path on config->threads
+    threads, and write their results to config->results_path, or stdout if
+    there is none.
+
+    Return whether every job was loaded and ran without an exception.
+*/
+bool batch_file(const Config *config)
+{
+    JobFile file;
+    bool ok = false;
+
+    memset(&file, 0, sizeof(file));
+    if (config->bios_path && !(file.bios = bios_open(config->bios_path)))
+        return false;
+    if (!read_jobs(&file, config->batch_path))
+        goto cleanup;
+    if (!file.count) {
+        ERROR("no jobs in '%s'", config->batch_path)
+        goto cleanup;
+    }
+
+    uint64_t start = get_time_ns();
+    unsigned threads = batch_run(file.jobs, file.count, config->threads,
+                                 config->render_mode);
+    double seconds = (get_time_ns() - start) / 1e9;
+
+    const char *path = config->results_path;
+    FILE *out = stdout;
+    if (path && !(out = fopen(path, "w"))) {
+        ERROR_ERRNO("couldn't write results to '%s'", path)
+        goto cleanup;
+    }
+    write_results(out, &file);
+    if (path) {
+        bool written = !ferror(out);
+        if (fclose(out) || !written) {
+            ERROR_ERRNO("couldn't write results to '%s'", path)
+            goto cleanup;
+        }
+    }
+
+    unsigned long long frames = 0;
+    size_t failed = 0;
+    for (size_t i = 0; i < file.count; i++) {
+        frames += file.jobs[i].frames_run;
+        if (file.jobs[i].exception[0])
+            failed++;
+    }
+    fprintf(path ? stdout : stderr,
+            "crater: ran %zu jobs (%llu frames) on %u threads in %.2f s, "
+            "%.0f fps; %zu failed\n", file.count, frames, threads, seconds,
+            frames / seconds, failed);
+    ok = !failed;
+
+    cleanup:
+    free_jobs(&file);
+    return ok;
+}
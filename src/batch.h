@@ -0,0 +1,47 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "gamegear.h"
+#include "movie.h"
+#include "pool.h"
+#include "rom.h"
+
+#define BATCH_MAX_THREADS POOL_MAX_THREADS
+
+/* Structs */
+
+/*
+    One emulation run in a batch: a ROM started from power-on, a saved state,
+    or the start of a movie, then run for a number of frames (or until the
+    movie ends, if frames is zero) with the movie's buttons held, if any.
+
+    The ROM, BIOS, movie and state are only read, so any number of jobs
+    (and threads) can share them. The rest of the fields are filled in by
+    batch_run(): a hash chained over every frame's screen, a hash of the final
+    state as printed by --play, and the exception that stopped the run early,
+    if any (otherwise an empty string).
+*/
+typedef struct {
+    const ROM *rom;
+    const BIOS *bios;
+    const Movie *movie;
+    const GGState *state;
+    unsigned long frames;
+
+    unsigned long frames_run;
+    uint64_t video_hash;
+    uint64_t state_hash;
+    char exception[GG_EXC_BUFF_SIZE];
+} BatchJob;
+
+/* Functions */
+
+unsigned batch_run(BatchJob*, size_t, unsigned, VDPRenderMode);
+bool batch_file(const Config*);
@@ -0,0 +1,575 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "gamegear.h"
+#include "lanes.h"
+#include "logging.h"
+#include "movie.h"
+#include "resample.h"
+#include "state.h"
+#include "util.h"
+
+#define BENCH_AUDIO_SECONDS 60
+#define BENCH_AUDIO_FRAME (PSG_DEFAULT_RATE / GG_FPS)
+#define BENCH_AUDIO_CHUNK 1024
+
+/* Real Z80 clock speed, for comparison */
+#define BENCH_Z80_MHZ 3.579545
+
+/* Frames each lane holds its buttons for in the lanes benchmark */
+#define BENCH_LANE_HOLD 15
+
+typedef struct {
+    double seconds;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t hash;
+} BenchRun;
+
+/*
+    State shared with the frame callback during a run. The callback stands in
+    for a frontend: it expands changed lines to ARGB and drains the audio, but
+    has nowhere to send them. With a movie, it also holds the movie's buttons
+    for each frame, and keeps holding the last ones if the movie runs out.
+*/
+static struct {
+    unsigned long frame, warmup, frames;
+    uint64_t start, cycles, instructions;
+    BenchRun *run;
+    GGProfile *profile;
+    Movie *movie;
+    uint8_t *indices;
+    uint16_t *palettes;
+    uint32_t *pixels;
+    int16_t audio[2 * BENCH_AUDIO_CHUNK];
+} bench;
+
+/*
+    Fill a frame's worth of input with a few detuned square waves, roughly
+    what the PSG produces.
+*/
+static void make_input(int16_t *samples, size_t count, size_t offset)
+{
+    for (size_t i = 0; i < count; i++) {
+        size_t t = offset + i;
+        int level = ((t / 37) % 2 ? 4000 : -4000) +
+                    ((t / 91) % 2 ? 3000 : -3000) + ((t / 13) % 2 ? 800 : 0);
+        samples[2 * i] = level;
+        samples[2 * i + 1] = -level / 2;
+    }
+}
+
+/*
+    Resample BENCH_AUDIO_SECONDS of audio one frame at a time, and return the
+    output rate in samples per second of wall time.
+*/
+static double run_resampler(ResampleQuality quality, double out_rate,
+    SampleFormat format)
+{
+    int16_t input[2 * BENCH_AUDIO_FRAME];
+    float output[2 * 2 * BENCH_AUDIO_FRAME];
+    Resampler rs;
+    size_t frames = BENCH_AUDIO_SECONDS * GG_FPS, total = 0;
+    uint64_t elapsed = 0;
+
+    resampler_init(&rs, quality, PSG_DEFAULT_RATE, out_rate);
+    for (size_t frame = 0; frame < frames; frame++) {
+        make_input(input, BENCH_AUDIO_FRAME, frame * BENCH_AUDIO_FRAME);
+
+        uint64_t start = get_time_ns();
+        total += resampler_run(&rs, input, BENCH_AUDIO_FRAME, output, format);
+        elapsed += get_time_ns() - start;
+    }
+    resampler_free(&rs);
+    return total * 1e9 / elapsed;
+}
+
+/*
+    Measure the audio resampler's throughput at each quality level and print
+    the results.
+
+    Each level is run on a typical conversion (to 44.1 kHz) and on a rate
+    controlled one (48 kHz plus half a percent), in both output formats.
+*/
+void bench_audio()
+{
+    const struct {
+        const char *name;
+        double rate;
+    } conversions[] = {
+        {"48k->44.1k", 44100},
+        {"48k->48k+0.5%", PSG_DEFAULT_RATE * 1.005}
+    };
+
+    printf("%-8s %-14s %14s %14s\n", "quality", "conversion",
+           "int16 (Msps)", "float (Msps)");
+    for (ResampleQuality q = RESAMPLE_FAST; q <= RESAMPLE_BEST; q++) {
+        for (size_t c = 0; c < sizeof(conversions) / sizeof(*conversions);
+                c++) {
+            double int16 = run_resampler(q, conversions[c].rate, SAMPLE_INT16);
+            double fl = run_resampler(q, conversions[c].rate, SAMPLE_FLOAT);
+            printf("%-8s %-14s %14.2f %14.2f\n", resampler_quality_name(q),
+                   conversions[c].name, int16 / 1e6, fl / 1e6);
+        }
+    }
+    printf("(stereo samples per second; real time is %.3f Msps)\n",
+           PSG_DEFAULT_RATE / 1e6);
+}
+
+/*
+    Mark the start of the measured part of a run.
+*/
+static void start_measuring(const GameGear *gg)
+{
+    bench.start = get_time_ns();
+    bench.cycles = gg->cpu.cycles;
+    bench.instructions = gg->cpu.instructions;
+    if (bench.profile)
+        memset(bench.profile, 0, sizeof(GGProfile));
+}
+
+/*
+    GameGear callback for benchmark runs.
+*/
+static void bench_callback(GameGear *gg)
+{
+    const bool *dirty = gamegear_get_dirty_lines(gg);
+
+    for (int line = 0; line < GG_SCREEN_HEIGHT; line++) {
+        if (dirty[line])
+            gamegear_expand_line(bench.indices, bench.palettes, line,
+                                 bench.pixels + line * GG_SCREEN_WIDTH);
+    }
+    while (gamegear_read_audio(gg, bench.audio, BENCH_AUDIO_CHUNK));
+    if (bench.movie)
+        movie_play(bench.movie, gg);
+
+    bench.frame++;
+    if (bench.frame == bench.warmup)
+        start_measuring(gg);
+    if (bench.frame == bench.warmup + bench.frames) {
+        bench.run->seconds = (get_time_ns() - bench.start) / 1e9;
+        bench.run->cycles = gg->cpu.cycles - bench.cycles;
+        bench.run->instructions = gg->cpu.instructions - bench.instructions;
+        gamegear_power_off(gg);
+    }
+}
+
+/*
+    Emulate the ROM from power-on, or from the start of the movie being
+    played, as fast as possible, for the configured number of frames (plus
+    warm-up).
+
+    If profile is not NULL, time spent in each component is stored in it. A
+    hash of the final state is stored in the run, so that runs can be checked
+    against each other. Return whether the run finished without an exception.
+*/
+static bool run_emulator(const ROM *rom, const BIOS *bios,
+    const Config *config, BenchRun *run, GGProfile *profile)
+{
+    GameGear *gg = gamegear_create();
+    bool ok = true;
+
+    bench.frame = 0;
+    bench.warmup = config->warmup;
+    bench.frames = config->frames;
+    bench.run = run;
+    bench.profile = profile;
+
+    gamegear_set_render_mode(gg, config->render_mode);
+    gamegear_set_speed(gg, PACER_UNTHROTTLED);
+    gamegear_attach_callback(gg, bench_callback);
+    gamegear_attach_indexed_display(gg, bench.indices, bench.palettes);
+    gamegear_attach_profile(gg, profile);
+    gamegear_load_rom(gg, rom);
+    if (bios)
+        gamegear_load_bios(gg, bios);
+    if (bench.movie)
+        movie_begin(bench.movie, gg);
+
+    if (!bench.warmup)
+        start_measuring(gg);
+    gamegear_simulate(gg);
+
+    if (gamegear_get_exception(gg)) {
+        ERROR("caught exception: %s", gamegear_get_exception(gg))
+        ok = false;
+    }
+    GGState *state = cr_malloc(sizeof(GGState));
+    gamegear_save_state(gg, state);
+    run->hash = state_hash(state, rom);
+    free(state);
+    gamegear_destroy(gg);
+    return ok;
+}
+
+/*
+    Comparison function for sorting doubles with qsort().
+*/
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double*) a, y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+    Return the median of the given values.
+*/
+static double median(const double *values, size_t count)
+{
+    double *sorted = cr_malloc(count * sizeof(double)), result;
+
+    memcpy(sorted, values, count * sizeof(double));
+    qsort(sorted, count, sizeof(double), compare_doubles);
+    if (count % 2)
+        result = sorted[count / 2];
+    else
+        result = (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+    free(sorted);
+    return result;
+}
+
+/*
+    Return the sample standard deviation of the given values.
+*/
+static double stddev(const double *values, size_t count)
+{
+    double mean = 0, sum = 0;
+
+    if (count < 2)
+        return 0;
+    for (size_t i = 0; i < count; i++)
+        mean += values[i] / count;
+    for (size_t i = 0; i < count; i++)
+        sum += (values[i] - mean) * (values[i] - mean);
+    return sqrt(sum / (count - 1));
+}
+
+/*
+    Write a string as a JSON string literal.
+*/
+static void write_json_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (; *str; str++) {
+        unsigned char c = *str;
+        if (c == '"' || c == '\\')
+            fprintf(fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(fp, "\\u%04x", c);
+        else
+            fputc(c, fp);
+    }
+    fputc('"', fp);
+}
+
+/*
+    Write benchmark results as a JSON object.
+
+    fps, mhz and ips hold one value per run; profile holds the profiled run's
+    component times.
+*/
+static void write_json(FILE *fp, const ROM *rom, const Config *config,
+    const double *fps, const double *mhz, const double *ips,
+    const GGProfile *profile, uint64_t hash)
+{
+    double total = profile->cpu + profile->vdp + profile->psg +
+                   profile->callback;
+    unsigned i;
+
+    fprintf(fp, "{\n  \"rom\": ");
+    write_json_string(fp, rom->name);
+    fprintf(fp, ",\n  \"frames\": %lu,\n  \"warmup\": %lu,\n"
+            "  \"repeat\": %u,\n  \"fps\": [", config->frames,
+            config->warmup, config->repeat);
+    for (i = 0; i < config->repeat; i++)
+        fprintf(fp, "%s%.3f", i ? ", " : "", fps[i]);
+    fprintf(fp, "],\n  \"z80_mhz\": [");
+    for (i = 0; i < config->repeat; i++)
+        fprintf(fp, "%s%.4f", i ? ", " : "", mhz[i]);
+    fprintf(fp, "],\n  \"instructions_per_sec\": [");
+    for (i = 0; i < config->repeat; i++)
+        fprintf(fp, "%s%.0f", i ? ", " : "", ips[i]);
+    fprintf(fp, "],\n  \"state_hash\": \"%016llx\"",
+            (unsigned long long) hash);
+    fprintf(fp, ",\n  \"breakdown\": {\"cpu\": %.4f, \"vdp\": %.4f, "
+            "\"psg\": %.4f, \"callback\": %.4f}\n}\n",
+            profile->cpu / total, profile->vdp / total, profile->psg / total,
+            profile->callback / total);
+}
+
+/*
+    Benchmark the emulator on a ROM, without a frontend or any throttling.
+
+    The ROM is run from power-on config->repeat times, and the median and
+    standard deviation of each run's speed are reported. A final run times
+    each component separately (which slows it down a little, so it is not
+    included in the other results). With config->play_path, every run plays
+    that movie instead of pressing nothing. Each run should end in the same
+    state; a warning is given if not. Return whether every run succeeded.
+*/
+bool bench_emulator(const ROM *rom, const Config *config)
+{
+    unsigned n = config->repeat, i;
+    double *fps = cr_malloc(3 * n * sizeof(double)), *mhz = fps + n,
+           *ips = mhz + n, total;
+    BenchRun run;
+    GGProfile profile;
+    Movie movie;
+    uint64_t hash = 0;
+    BIOS *bios = NULL;
+    FILE *out = stdout, *json = NULL;
+    bool ok = false;
+
+    bench.movie = NULL;
+    if (config->bios_path && !(bios = bios_open(config->bios_path)))
+        goto cleanup;
+    if (config->play_path) {
+        bench.movie = &movie;
+        if (!movie_load(&movie, config->play_path, rom))
+            goto cleanup;
+        if (movie.frames < config->warmup + config->frames)
+            WARN("movie is only %zu frames long; its last buttons will be "
+                 "held after it ends", movie.frames)
+    }
+    if (config->json_path) {
+        if (!strcmp(config->json_path, "-")) {
+            json = stdout;
+            out = stderr;
+        } else if (!(json = fopen(config->json_path, "w"))) {
+            ERROR_ERRNO("couldn't open JSON output file")
+            goto cleanup;
+        }
+    }
+
+    bench.indices = cr_malloc(GG_SCREEN_WIDTH * GG_SCREEN_HEIGHT);
+    bench.palettes = cr_malloc(
+        sizeof(uint16_t) * GG_PALETTE_SIZE * GG_SCREEN_HEIGHT);
+    bench.pixels = cr_malloc(
+        sizeof(uint32_t) * GG_SCREEN_WIDTH * GG_SCREEN_HEIGHT);
+
+    fprintf(out, "crater: benchmarking: %s (%lu frames, %lu warm-up, "
+            "%u runs)\n", rom->name, config->frames, config->warmup, n);
+    for (i = 0; i < n; i++) {
+        if (!run_emulator(rom, bios, config, &run, NULL))
+            goto cleanup;
+        fps[i] = config->frames / run.seconds;
+        mhz[i] = run.cycles / run.seconds / 1e6;
+        ips[i] = run.instructions / run.seconds;
+        fprintf(out, "run %u: %.1f fps, %.2f MHz, %.2f M instructions/s\n",
+                i + 1, fps[i], mhz[i], ips[i] / 1e6);
+        if (i && run.hash != hash)
+            WARN("run %u ended in a different state from run 1", i + 1)
+        hash = i ? hash : run.hash;
+    }
+    if (!run_emulator(rom, bios, config, &run, &profile))
+        goto cleanup;
+    if (json)
+        write_json(json, rom, config, fps, mhz, ips, &profile, hash);
+
+    total = profile.cpu + profile.vdp + profile.psg + profile.callback;
+    fprintf(out, "\nfps:        %.1f median, %.1f stddev (%.2fx real time)\n",
+            median(fps, n), stddev(fps, n), median(fps, n) / GG_FPS);
+    fprintf(out, "z80:        %.2f MHz median (%.2fx real time), "
+            "%.2f M instructions/s\n", median(mhz, n),
+            median(mhz, n) / BENCH_Z80_MHZ, median(ips, n) / 1e6);
+    fprintf(out, "breakdown:  cpu %.1f%%, vdp %.1f%%, psg %.1f%%, "
+            "callback %.1f%%\n", 100 * profile.cpu / total,
+            100 * profile.vdp / total, 100 * profile.psg / total,
+            100 * profile.callback / total);
+    fprintf(out, "            (from a separate profiled run at %.1f fps)\n",
+            config->frames / run.seconds);
+    fprintf(out, "state hash: %016llx\n", (unsigned long long) hash);
+    ok = true;
+
+    cleanup:
+    if (json && json != stdout)
+        fclose(json);
+    if (bios)
+        bios_close(bios);
+    if (bench.movie)
+        movie_free(bench.movie);
+    bench.movie = NULL;
+    free(bench.indices);
+    free(bench.palettes);
+    free(bench.pixels);
+    bench.indices = NULL;
+    bench.palettes = NULL;
+    bench.pixels = NULL;
+    free(fps);
+    return ok;
+}
+
+/*
+    Return the buttons a lane holds during a frame of the lanes benchmark: a
+    new random combination every BENCH_LANE_HOLD frames, different for each
+    lane, like agents exploring a game.
+*/
+static uint8_t lane_buttons(unsigned lane, unsigned long frame)
+{
+    uint64_t key = frame / BENCH_LANE_HOLD;
+    return hash64(&key, sizeof(key), lane) & 0x7F;
+}
+
+/*
+    Return a hash of a GameGear's state.
+*/
+static uint64_t hash_machine(const GameGear *gg, const ROM *rom)
+{
+    GGState *state = cr_malloc(sizeof(GGState));
+    gamegear_save_state(gg, state);
+    uint64_t hash = state_hash(state, rom);
+    free(state);
+    return hash;
+}
+
+/*
+    Run a GameGear for config->frames frames with the buttons of the given
+    lane. Return false on an exception.
+*/
+static bool run_single(GameGear *gg, unsigned lane, const Config *config)
+{
+    bool ok = true;
+
+    for (unsigned long frame = 0; frame < config->frames && ok; frame++) {
+        gamegear_set_buttons(gg, lane_buttons(lane, frame));
+        ok = gamegear_simulate_frame(gg);
+        gamegear_read_audio(gg, NULL, SIZE_MAX);
+    }
+    return ok;
+}
+
+/*
+    Run config->lanes copies of a GameGear one after another, each for
+    config->frames frames with its own buttons, storing a hash of each one's
+    final state. Return the time taken in seconds, or a negative number on
+    an exception.
+*/
+static double run_scalar(const GameGear *root, const ROM *rom,
+    const Config *config, uint64_t *hashes)
+{
+    uint64_t start = get_time_ns(), elapsed = 0;
+
+    for (unsigned lane = 0; lane < config->lanes; lane++) {
+        GameGear *gg = gamegear_fork(root);
+        bool ok = run_single(gg, lane, config);
+        elapsed += get_time_ns() - start;
+        hashes[lane] = hash_machine(gg, rom);
+        gamegear_destroy(gg);
+        if (!ok)
+            return -1;
+        start = get_time_ns();
+    }
+    return elapsed / 1e9;
+}
+
+/*
+    Run the same lanes as run_scalar() in lock-step, checking that each one
+    ends in the same state. Return the time taken in seconds, or a negative
+    number on an exception or a mismatch; the share of lane-frames that were
+    actually emulated is stored in share.
+*/
+static double run_lanes(const GameGear *root, const ROM *rom,
+    const Config *config, const uint64_t *hashes, double *share)
+{
+    uint64_t start = get_time_ns();
+    Lanes *lanes = lanes_create(root, rom, config->lanes);
+    bool ok = true;
+
+    for (unsigned long frame = 0; frame < config->frames && ok; frame++) {
+        for (unsigned lane = 0; lane < config->lanes; lane++)
+            lanes_set_buttons(lanes, lane, lane_buttons(lane, frame));
+        ok = lanes_run_frame(lanes);
+    }
+    double seconds = (get_time_ns() - start) / 1e9;
+    *share = (double) lanes->emulated / lanes->frames;
+
+    for (unsigned lane = 0; lane < config->lanes && ok; lane++) {
+        if (hash_machine(lanes_get(lanes, lane), rom) != hashes[lane]) {
+            ERROR("lane %u ended in a different state from its scalar run",
+                  lane + 1)
+            ok = false;
+        }
+    }
+    lanes_destroy(lanes);
+    return ok ? seconds : -1;
+}
+
+/*
+    Run the first lane once more, untimed, with a display attached as in a
+    normal run, and check that it ends in the same state as it did without
+    one. Return whether it did.
+*/
+static bool check_displayed(const GameGear *root, const ROM *rom,
+    const Config *config, uint64_t hash)
+{
+    GameGear *gg = gamegear_fork(root);
+    uint8_t *indices = cr_malloc(GG_SCREEN_WIDTH * GG_SCREEN_HEIGHT);
+    uint16_t *palettes = cr_malloc(
+        GG_SCREEN_HEIGHT * GG_PALETTE_SIZE * sizeof(uint16_t));
+    bool ok;
+
+    gamegear_attach_indexed_display(gg, indices, palettes);
+    ok = run_single(gg, 0, config) && hash_machine(gg, rom) == hash;
+    gamegear_destroy(gg);
+    free(indices);
+    free(palettes);
+    if (!ok)
+        ERROR("lane 1 ended in a different state with a display attached")
+    return ok;
+}
+
+/*
+    Benchmark running config->lanes instances of a ROM in lock-step against
+    running them independently, on one thread.
+
+    Every instance starts from power-on and holds random buttons, changing
+    every BENCH_LANE_HOLD frames, for config->frames frames. Both ways must
+    end with every instance in the same state, which must also be the same
+    as with a display attached. Return whether they did.
+*/
+bool bench_lanes(const ROM *rom, const Config *config)
+{
+    GameGear *root = gamegear_create();
+    uint64_t *hashes = cr_malloc(config->lanes * sizeof(uint64_t));
+    BIOS *bios = NULL;
+    double scalar, lanes, share;
+    bool ok = false;
+
+    if (config->bios_path && !(bios = bios_open(config->bios_path)))
+        goto cleanup;
+    gamegear_load_rom(root, rom);
+    if (bios)
+        gamegear_load_bios(root, bios);
+    gamegear_power_on(root);
+
+    printf("crater: benchmarking %u lanes: %s (%lu frames each)\n",
+           config->lanes, rom->name, config->frames);
+    if ((scalar = run_scalar(root, rom, config, hashes)) < 0 ||
+            (lanes = run_lanes(root, rom, config, hashes, &share)) < 0 ||
+            !check_displayed(root, rom, config, hashes[0])) {
+        ERROR("caught an exception or a mismatch; no results")
+        goto cleanup;
+    }
+
+    double frames = (double) config->lanes * config->frames;
+    printf("scalar:     %.1f fps aggregate (%u instances, one at a time)\n",
+           frames / scalar, config->lanes);
+    printf("lanes:      %.1f fps aggregate (%.2fx), emulating %.1f%% of "
+           "lane-frames\n", frames / lanes, scalar / lanes, 100 * share);
+    ok = true;
+
+    cleanup:
+    gamegear_power_off(root);
+    gamegear_destroy(root);
+    if (bios)
+        bios_close(bios);
+    free(hashes);
+    return ok;
+}
@@ -0,0 +1,20 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "config.h"
+#include "rom.h"
+
+#define BENCH_DEFAULT_FRAMES 3600
+#define BENCH_DEFAULT_WARMUP 120
+#define BENCH_DEFAULT_REPEAT 5
+#define BENCH_MAX_REPEAT 1000
+
+/* Functions */
+
+void bench_audio();
+bool bench_emulator(const ROM*, const Config*);
+bool bench_lanes(const ROM*, const Config*);
@@ -9,6 +9,13 @@
 #include <sys/types.h>
 
 #include "config.h"
+#include "batch.h"
+#include "bench.h"
+#include "lanes.h"
+#include "link.h"
+#include "runahead.h"
+#include "rewind.h"
+#include "search.h"
 #include "logging.h"
 #include "util.h"
 #include "version.h"
@@ -46,6 +53,91 @@ static void print_help(const char *arg1)
 "                      (applies to windowed mode only; defaults to 4)\n"
 "    -q, --square      force a square pixel aspect ratio instead of the more\n"
 "                      faithful 8:7 PAR\n"
+"    -F, --filter <name>\n"
+"                      upscale the screen on the CPU before display: \"none\"\n"
+"                      (default) leaves it to the GPU; \"nearest\" scales by\n"
+"                      the --scale factor with aspect correction; \"scale2x\",\n"
+"                      \"scale3x\" and \"xbr\" smooth edges at 2x, 3x and 2x\n"
+"    -R, --render <mode>\n"
+"                      how to draw the screen: \"sync\" (default) draws each\n"
+"                      scanline as it is emulated; \"lazy\" draws batches of\n"
+"                      scanlines only when something changes mid-frame;\n"
+"                      \"thread\" draws them on a separate thread (output is\n"
+"                      identical in all modes)\n"
+"    -P, --pacing <mode>\n"
+"                      how to keep emulation at full speed: \"deadline\"\n"
+"                      (default) sleeps until each frame's start time;\n"
+"                      \"audio\" runs as fast as the sound card consumes\n"
+"                      samples; \"vsync\" runs one frame per display refresh\n"
+"    -T, --threaded    emulate on a separate thread from drawing and input,\n"
+"                      so a slow display never holds up the game (can't be\n"
+"                      used with vsync pacing)\n"
+"    -Q, --audio-quality <level>\n"
+"                      how carefully to resample audio for the sound card:\n"
+"                      \"fast\", \"medium\" (default), or \"best\"\n"
+"    -W, --wav <path>  record audio to the given WAV file (16-bit, 44.1 kHz)\n"
+"    -S, --speed <n>   run n times faster than real time, showing only every\n"
+"                      n-th frame; \"max\" runs as fast as possible (holding\n"
+"                      tab while playing does the same)\n"
+"    -H, --headless    run as fast as possible without a window or sound,\n"
+"                      printing the speed once per second\n"
+"    --frames <n>      stop after emulating n frames\n"
+"    -A, --run-ahead <n>\n"
+"                      show each frame as it will be n frames later (1-3),\n"
+"                      hiding the game's own input lag\n"
+"    --run-ahead-thread\n"
+"                      with --run-ahead, emulate the frames ahead on a\n"
+"                      separate thread\n"
+"    --rewind <n>      keep the last n seconds (default 60) to rewind through\n"
+"                      by holding backspace; 0 turns rewinding off\n"
+"    --record <path>   record the buttons held each frame to a movie file\n"
+"    --play <path>     play back a movie file recorded with --record, then\n"
+"                      print a hash of the final state and exit\n"
+"    --load-state <path>\n"
+"                      start from a state file saved with F5 instead of\n"
+"                      power-on (also where --record starts the movie)\n",
+    arg1);
+    fputs(
+"    --bench           measure how fast the emulator runs the ROM, with no\n"
+"                      window, sound or throttling, and exit (runs for 3600\n"
+"                      frames unless --frames is given)\n"
+"    --bench-audio     measure the speed of the audio resampler and exit\n"
+"    --warmup <n>      with --bench, frames to run before measuring (120)\n"
+"    --repeat <n>      with --bench, number of measured runs (5)\n"
+"    --json <path>     with --bench, also write results as JSON to the\n"
+"                      given file, or \"-\" for stdout\n"
+"    --lanes <n>       with --bench, compare running n copies of the ROM with\n"
+"                      random input in lock-step against running them one\n"
+"                      at a time\n"
+"    --hashes <path>   run with no window or sound and write a hash of every\n"
+"                      frame to the given file (needs --frames or --play)\n"
+"    --hash-audio      with --hashes, also hash each frame's audio\n"
+"    --hash-ram        with --hashes, also hash the RAM after each frame\n"
+"    --check <path>    run like --hashes, comparing against a file it wrote;\n"
+"                      stop at the first frame that differs and save an\n"
+"                      image of it\n"
+"    --batch <path>    run every job in the given file (one per line: a ROM,\n"
+"                      a frame count, and optionally a movie and a state to\n"
+"                      start from) with no window or sound, and exit\n"
+"    --threads <n>     with --batch, number of jobs to run at once (defaults\n"
+"                      to one per CPU)\n"
+"    --results <path>  with --batch, write each job's hashes to the given\n"
+"                      file instead of stdout\n"
+"    --search <path>   try every combination of buttons, step by step, to\n"
+"                      find the inputs that maximize --goal within --frames,\n"
+"                      and save them to the given movie file\n"
+"    --goal <addr>[:<n>]\n"
+"                      with --search, the memory address (in hex) of the\n"
+"                      value to maximize, n bytes long (1-4, little-endian)\n"
+"    --step <n>        with --search, frames to hold each input for (15)\n"
+"    --beam <n>        with --search, best states to keep after each step\n"
+"                      and search on from (8)\n"
+"    --link <rom>      connect a second Game Gear running the given ROM with\n"
+"                      a Gear-to-Gear cable, run both for --frames with no\n"
+"                      window or sound, each on its own thread, and print\n"
+"                      the state each ends in\n"
+"    --quantum <n>     with --link, scanlines each Game Gear may run before\n"
+"                      waiting for the other (1-32, default 1)\n"
 "    -a, --assemble <in> [<out>]\n"
 "                      convert z80 assembly source code into a binary file that\n"
 "                      can be run by crater\n"
@@ -53,7 +145,7 @@ static void print_help(const char *arg1)
 "                      convert a binary file into z80 assembly source code\n"
 "    -r, --overwrite   allow crater to write assembler output to the same\n"
 "                      filename as the input\n",
-    arg1);
+    stdout);
 }
 
 /*
@@ -274,6 +366,342 @@ static int parse_opt_arg(Config *config, Arguments *args, const char *arg)
     else if (arg_check(arg, "q", "square")) {
         config->square_par = true;
     }
+    else if (arg_check(arg, "F", "filter")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the filter option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        if (!scaler_parse_filter(next, &config->filter)) {
+            ERROR("unknown filter: %s", next)
+            return CONFIG_EXIT_FAILURE;
+        }
+    }
+    else if (arg_check(arg, "R", "render")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the render option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        if (!strcmp(next, "sync")) {
+            config->render_mode = VDP_RENDER_SYNC;
+        } else if (!strcmp(next, "lazy")) {
+            config->render_mode = VDP_RENDER_LAZY;
+        } else if (!strcmp(next, "thread")) {
+            config->render_mode = VDP_RENDER_THREAD;
+        } else {
+            ERROR("unknown render mode: %s", next)
+            return CONFIG_EXIT_FAILURE;
+        }
+    }
+    else if (arg_check(arg, "P", "pacing")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the pacing option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        if (!pacer_parse_mode(next, &config->pacing)) {
+            ERROR("unknown pacing mode: %s", next)
+            return CONFIG_EXIT_FAILURE;
+        }
+    }
+    else if (arg_check(arg, "T", "threaded")) {
+        config->threaded = true;
+    }
+    else if (arg_check(arg, "Q", "audio-quality")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the audio quality option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        if (!resampler_parse_quality(next, &config->audio_quality)) {
+            ERROR("unknown audio quality: %s", next)
+            return CONFIG_EXIT_FAILURE;
+        }
+    }
+    else if (arg_check(arg, "W", "wav")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the wav option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        config->wav_path = cr_strdup(next);
+    }
+    else if (arg_check(arg, "S", "speed")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the speed option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        if (!strcmp(next, "max")) {
+            config->speed = PACER_UNTHROTTLED;
+        } else {
+            long speed = strtol(next, NULL, 10);
+            if (speed <= 0 || speed > SPEED_MAX) {
+                ERROR("speed of %s is not an integer or is out of range", next)
+                return CONFIG_EXIT_FAILURE;
+            }
+            config->speed = speed;
+        }
+    }
+    else if (arg_check(arg, "H", "headless")) {
+        config->headless = true;
+    }
+    else if (!strcmp(arg, "frames")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the frames option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        long frames = strtol(next, NULL, 10);
+        if (frames <= 0) {
+            ERROR("frame count of %s is not a positive integer", next)
+            return CONFIG_EXIT_FAILURE;
+        }
+        config->frames = frames;
+    }
+    else if (arg_check(arg, "A", "run-ahead")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the run-ahead option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        long frames = strtol(next, NULL, 10);
+        if (frames <= 0 || frames > RUNAHEAD_MAX_FRAMES) {
+            ERROR("run-ahead of %s is not an integer or is out of range", next)
+            return CONFIG_EXIT_FAILURE;
+        }
+        config->run_ahead = frames;
+    }
+    else if (!strcmp(arg, "run-ahead-thread")) {
+        config->run_ahead_thread = true;
+    }
+    else if (!strcmp(arg, "rewind")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the rewind option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        long seconds = strtol(next, NULL, 10);
+        if (seconds < 0 || seconds > REWIND_MAX_SECONDS) {
+            ERROR("rewind of %s is not an integer or is out of range", next)
+            return CONFIG_EXIT_FAILURE;
+        }
+        config->rewind = seconds;
+    }
+    else if (!strcmp(arg, "record")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the record option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        free(config->record_path);
+        config->record_path = cr_strdup(next);
+    }
+    else if (!strcmp(arg, "play")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the play option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        free(config->play_path);
+        config->play_path = cr_strdup(next);
+    }
+    else if (!strcmp(arg, "load-state")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the load-state option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        free(config->load_state_path);
+        config->load_state_path = cr_strdup(next);
+    }
+    else if (!strcmp(arg, "bench")) {
+        config->bench = true;
+    }
+    else if (!strcmp(arg, "warmup")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the warmup option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        long warmup = strtol(next, NULL, 10);
+        if (warmup < 0) {
+            ERROR("warm-up of %s is not a non-negative integer", next)
+            return CONFIG_EXIT_FAILURE;
+        }
+        config->warmup = warmup;
+    }
+    else if (!strcmp(arg, "repeat")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the repeat option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        long repeat = strtol(next, NULL, 10);
+        if (repeat <= 0 || repeat > BENCH_MAX_REPEAT) {
+            ERROR("repeat count of %s is not an integer or is out of range",
+                  next)
+            return CONFIG_EXIT_FAILURE;
+        }
+        config->repeat = repeat;
+    }
+    else if (!strcmp(arg, "lanes")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the lanes option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        long lanes = strtol(next, NULL, 10);
+        if (lanes <= 0 || lanes > LANES_MAX) {
+            ERROR("lane count of %s is not an integer or is out of range",
+                  next)
+            return CONFIG_EXIT_FAILURE;
+        }
+        config->lanes = lanes;
+    }
+    else if (!strcmp(arg, "json")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the json option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        free(config->json_path);
+        config->json_path = cr_strdup(next);
+    }
+    else if (!strcmp(arg, "hashes")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the hashes option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        free(config->hashes_path);
+        config->hashes_path = cr_strdup(next);
+    }
+    else if (!strcmp(arg, "check")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the check option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        free(config->check_path);
+        config->check_path = cr_strdup(next);
+    }
+    else if (!strcmp(arg, "batch")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the batch option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        free(config->batch_path);
+        config->batch_path = cr_strdup(next);
+    }
+    else if (!strcmp(arg, "threads")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the threads option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        long threads = strtol(next, NULL, 10);
+        if (threads <= 0 || threads > BATCH_MAX_THREADS) {
+            ERROR("thread count of %s is not an integer or is out of range",
+                  next)
+            return CONFIG_EXIT_FAILURE;
+        }
+        config->threads = threads;
+    }
+    else if (!strcmp(arg, "results")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the results option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        free(config->results_path);
+        config->results_path = cr_strdup(next);
+    }
+    else if (!strcmp(arg, "search")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the search option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        free(config->search_path);
+        config->search_path = cr_strdup(next);
+    }
+    else if (!strcmp(arg, "goal")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the goal option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        char *end;
+        long addr = strtol(next[0] == '$' ? next + 1 : next, &end, 16);
+        long bytes = *end == ':' ? strtol(end + 1, &end, 10) : 1;
+        if (*end || addr < 0 || addr > 0xFFFF || bytes < 1 || bytes > 4) {
+            ERROR("goal of %s is not an address and size, or is out of range",
+                  next)
+            return CONFIG_EXIT_FAILURE;
+        }
+        config->goal_addr = addr;
+        config->goal_bytes = bytes;
+    }
+    else if (!strcmp(arg, "step")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the step option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        long step = strtol(next, NULL, 10);
+        if (step <= 0) {
+            ERROR("step of %s is not a positive integer", next)
+            return CONFIG_EXIT_FAILURE;
+        }
+        config->search_step = step;
+    }
+    else if (!strcmp(arg, "beam")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the beam option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        long beam = strtol(next, NULL, 10);
+        if (beam <= 0 || beam > SEARCH_MAX_BEAM) {
+            ERROR("beam of %s is not an integer or is out of range", next)
+            return CONFIG_EXIT_FAILURE;
+        }
+        config->search_beam = beam;
+    }
+    else if (!strcmp(arg, "link")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the link option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        free(config->link_path);
+        config->link_path = cr_strdup(next);
+    }
+    else if (!strcmp(arg, "quantum")) {
+        const char *next = consume_next(args);
+        if (!next) {
+            ERROR("the quantum option requires an argument")
+            return CONFIG_EXIT_FAILURE;
+        }
+        long quantum = strtol(next, NULL, 10);
+        if (quantum <= 0 || quantum > LINK_MAX_QUANTUM) {
+            ERROR("quantum of %s is not an integer or is out of range", next)
+            return CONFIG_EXIT_FAILURE;
+        }
+        config->link_quantum = quantum;
+    }
+    else if (!strcmp(arg, "hash-audio")) {
+        config->hash_audio = true;
+    }
+    else if (!strcmp(arg, "hash-ram")) {
+        config->hash_ram = true;
+    }
+    else if (!strcmp(arg, "bench-audio")) {
+        config->bench_audio = true;
+    }
     else if (arg_check(arg, "a", "assemble")) {
         if (args->paths_read >= 1) {
             config->src_path = config->rom_path;
@@ -316,7 +744,12 @@ static int parse_args(Config *config, int argc, char *argv[])
             return retval;
     }
 
-    if (!config->assemble && !config->disassemble) {
+    if (config->batch_path && args.paths_read) {
+        ERROR("batch mode takes its ROMs from the job file, not arguments")
+        return CONFIG_EXIT_FAILURE;
+    }
+    if (!config->assemble && !config->disassemble && !config->bench_audio &&
+            !config->batch_path) {
         if (args.paths_read >= 2) {
             ERROR("too many arguments given - emulator mode accepts one ROM file")
             return CONFIG_EXIT_FAILURE;
@@ -372,10 +805,151 @@ static bool sanity_check(Config *config)
     } else if (config->assemble && config->disassemble) {
         ERROR("cannot assemble and disassemble at the same time")
         return false;
+    } else if (assembler && (config->bench_audio || config->bench)) {
+        ERROR("cannot benchmark in assembler mode")
+        return false;
+    } else if (config->bench && config->bench_audio) {
+        ERROR("cannot benchmark the emulator and audio at the same time")
+        return false;
+    } else if (config->hashes_path && config->check_path) {
+        ERROR("cannot write and check frame hashes at the same time")
+        return false;
+    } else if ((config->hashes_path || config->check_path) && config->bench) {
+        ERROR("cannot check frame hashes when benchmarking")
+        return false;
+    } else if ((config->hash_audio || config->hash_ram) &&
+               !config->hashes_path) {
+        ERROR("the hash-audio and hash-ram options require --hashes")
+        return false;
+    } else if (config->hashes_path && !config->frames && !config->play_path) {
+        ERROR("writing frame hashes requires --frames or --play")
+        return false;
+    } else if ((config->hashes_path || config->check_path) &&
+               (config->record_path || config->load_state_path)) {
+        ERROR("cannot record a movie or load a state when checking frame "
+              "hashes; use --play")
+        return false;
+    } else if ((config->bench || config->hashes_path || config->check_path ||
+                config->search_path || config->link_path) &&
+               (config->headless || config->fullscreen ||
+                config->scale || config->square_par ||
+                config->filter || config->pacing ||
+                config->threaded ||
+                config->speed != 1 || config->wav_path ||
+                config->run_ahead ||
+                config->audio_quality != RESAMPLE_MEDIUM)) {
+        ERROR("cannot specify display, sound or pacing options when "
+              "benchmarking, checking frame hashes, searching or linking")
+        return false;
+    } else if (!config->bench && (config->warmup != BENCH_DEFAULT_WARMUP ||
+                                  config->repeat != BENCH_DEFAULT_REPEAT ||
+                                  config->json_path || config->lanes)) {
+        ERROR("benchmark options require --bench")
+        return false;
+    } else if (config->batch_path && (config->bench || config->bench_audio ||
+                                      config->hashes_path ||
+                                      config->check_path ||
+                                      config->frames || config->sav_path ||
+                                      config->record_path ||
+                                      config->play_path ||
+                                      config->load_state_path)) {
+        ERROR("cannot give a ROM's frames, save, movie or state, or benchmark "
+              "or check hashes, in batch mode; put runs in the job file")
+        return false;
+    } else if (config->batch_path && (config->headless || config->fullscreen ||
+                                      config->scale || config->square_par ||
+                                      config->filter || config->pacing ||
+                                      config->threaded ||
+                                      config->speed != 1 ||
+                                      config->wav_path || config->run_ahead ||
+                                      config->audio_quality !=
+                                          RESAMPLE_MEDIUM)) {
+        ERROR("cannot specify display, sound or pacing options in batch mode")
+        return false;
+    } else if (!config->batch_path && config->results_path) {
+        ERROR("the results option requires --batch")
+        return false;
+    } else if (!config->batch_path && !config->search_path &&
+               config->threads) {
+        ERROR("the threads option requires --batch or --search")
+        return false;
+    } else if (!config->search_path && (config->goal_bytes ||
+               config->search_step != SEARCH_DEFAULT_STEP ||
+               config->search_beam != SEARCH_DEFAULT_BEAM)) {
+        ERROR("the goal, step and beam options require --search")
+        return false;
+    } else if (config->search_path && (!config->goal_bytes ||
+                                       !config->frames)) {
+        ERROR("searching requires --goal and --frames")
+        return false;
+    } else if (config->search_path && (config->bench || config->batch_path ||
+                                       config->hashes_path ||
+                                       config->check_path ||
+                                       config->record_path ||
+                                       config->play_path)) {
+        ERROR("cannot benchmark, check hashes, or record or play a movie "
+              "when searching")
+        return false;
+    } else if (!config->link_path &&
+               config->link_quantum != LINK_DEFAULT_QUANTUM) {
+        ERROR("the quantum option requires --link")
+        return false;
+    } else if (config->link_path && !config->frames) {
+        ERROR("linking requires --frames")
+        return false;
+    } else if (config->link_path && (config->bench || config->batch_path ||
+                                     config->hashes_path ||
+                                     config->check_path ||
+                                     config->search_path ||
+                                     config->record_path ||
+                                     config->play_path ||
+                                     config->load_state_path)) {
+        ERROR("cannot benchmark, check hashes, search, record or play a "
+              "movie, or load a state when linking")
+        return false;
+    } else if (config->lanes && (config->play_path || config->json_path ||
+                                 config->warmup != BENCH_DEFAULT_WARMUP ||
+                                 config->repeat != BENCH_DEFAULT_REPEAT)) {
+        ERROR("cannot play a movie, write JSON, or warm up or repeat runs "
+              "when benchmarking lanes")
+        return false;
     } else if (assembler && (config->fullscreen || config->scale ||
-                             config->square_par)) {
+                             config->square_par || config->render_mode ||
+                             config->filter || config->pacing ||
+                             config->threaded ||
+                             config->audio_quality != RESAMPLE_MEDIUM ||
+                             config->wav_path || config->speed != 1 ||
+                             config->headless || config->frames ||
+                             config->run_ahead || config->record_path ||
+                             config->play_path || config->load_state_path ||
+                             config->hashes_path || config->check_path ||
+                             config->batch_path || config->search_path ||
+                             config->link_path)) {
         ERROR("cannot specify emulator options in assembler mode")
         return false;
+    } else if (config->headless && (config->fullscreen || config->scale ||
+                                    config->square_par || config->filter ||
+                                    config->pacing || config->threaded ||
+                                    config->speed != 1 ||
+                                    config->run_ahead)) {
+        ERROR("cannot specify display or pacing options in headless mode")
+        return false;
+    } else if (config->record_path && config->play_path) {
+        ERROR("cannot record and play a movie at the same time")
+        return false;
+    } else if (config->play_path && config->load_state_path) {
+        ERROR("cannot load a state while playing a movie; it has its own")
+        return false;
+    } else if (config->bench && (config->record_path ||
+                                 config->load_state_path)) {
+        ERROR("cannot record a movie or load a state when benchmarking")
+        return false;
+    } else if (config->threaded && config->pacing == PACE_VSYNC) {
+        ERROR("cannot use vsync pacing with emulation on its own thread")
+        return false;
+    } else if (config->run_ahead_thread && !config->run_ahead) {
+        ERROR("the run-ahead-thread option requires --run-ahead")
+        return false;
     } else if (assembler && !config->src_path) {
         ERROR("assembler mode requires an input file")
         return false;
@@ -402,7 +976,12 @@ static bool set_defaults(Config *config)
         ERROR("refusing to overwrite the assembler input file; pass -r to override")
         return false;
     }
-    if (!assembler && !config->sav_path && !config->no_saving) {
+    if (config->bench && !config->frames) {
+        config->frames = BENCH_DEFAULT_FRAMES;
+    }
+    if (!assembler && !config->bench_audio && !config->bench &&
+            !config->batch_path && !config->search_path &&
+            !config->link_path && !config->sav_path && !config->no_saving) {
         const char *ext = ".sav";
         config->sav_path = cr_malloc(sizeof(char) *
             (strlen(config->rom_path) + strlen(ext) + 1));
@@ -428,15 +1007,50 @@ int config_create(Config** config_ptr, int argc, char* argv[])
     config->debug = 0;
     config->assemble = false;
     config->disassemble = false;
+    config->bench_audio = false;
+    config->bench = false;
+    config->headless = false;
     config->fullscreen = false;
     config->no_saving = false;
     config->scale = 0;
     config->square_par = false;
+    config->filter = SCALE_NONE;
+    config->render_mode = VDP_RENDER_SYNC;
+    config->pacing = PACE_DEADLINE;
+    config->threaded = false;
+    config->audio_quality = RESAMPLE_MEDIUM;
+    config->speed = 1;
+    config->frames = 0;
+    config->run_ahead = 0;
+    config->run_ahead_thread = false;
+    config->rewind = REWIND_DEFAULT_SECONDS;
+    config->warmup = BENCH_DEFAULT_WARMUP;
+    config->repeat = BENCH_DEFAULT_REPEAT;
+    config->lanes = 0;
+    config->threads = 0;
+    config->search_step = SEARCH_DEFAULT_STEP;
+    config->search_beam = SEARCH_DEFAULT_BEAM;
+    config->goal_addr = 0;
+    config->goal_bytes = 0;
+    config->link_quantum = LINK_DEFAULT_QUANTUM;
     config->rom_path = NULL;
     config->sav_path = NULL;
     config->bios_path = NULL;
     config->src_path = NULL;
     config->dst_path = NULL;
+    config->wav_path = NULL;
+    config->json_path = NULL;
+    config->record_path = NULL;
+    config->play_path = NULL;
+    config->load_state_path = NULL;
+    config->hashes_path = NULL;
+    config->check_path = NULL;
+    config->batch_path = NULL;
+    config->results_path = NULL;
+    config->search_path = NULL;
+    config->link_path = NULL;
+    config->hash_audio = false;
+    config->hash_ram = false;
     config->overwrite = false;
 
     retval = parse_args(config, argc, argv);
@@ -461,6 +1075,17 @@ void config_destroy(Config *config)
     free(config->bios_path);
     free(config->src_path);
     free(config->dst_path);
+    free(config->wav_path);
+    free(config->json_path);
+    free(config->record_path);
+    free(config->play_path);
+    free(config->load_state_path);
+    free(config->hashes_path);
+    free(config->check_path);
+    free(config->batch_path);
+    free(config->results_path);
+    free(config->search_path);
+    free(config->link_path);
     free(config);
 }
 
@@ -478,10 +1103,54 @@ void config_dump_args(const Config* config)
     DEBUG("- no_saving:   %s", config->no_saving   ? "true" : "false")
     DEBUG("- scale:       %d", config->scale)
     DEBUG("- square_par:  %s", config->square_par  ? "true" : "false")
+    DEBUG("- filter:      %s", scaler_filter_name(config->filter))
+    DEBUG("- render_mode: %s",
+        config->render_mode == VDP_RENDER_THREAD ? "thread" :
+        config->render_mode == VDP_RENDER_LAZY   ? "lazy"   : "sync")
+    DEBUG("- pacing:      %s", pacer_mode_name(config->pacing))
+    DEBUG("- threaded:    %s", config->threaded    ? "true" : "false")
+    DEBUG("- audio_qual:  %s", resampler_quality_name(config->audio_quality))
+    DEBUG("- speed:       %u", config->speed)
+    DEBUG("- headless:    %s", config->headless    ? "true" : "false")
+    DEBUG("- frames:      %lu", config->frames)
+    DEBUG("- run_ahead:   %u", config->run_ahead)
+    DEBUG("- ra_thread:   %s", config->run_ahead_thread ? "true" : "false")
+    DEBUG("- rewind:      %u", config->rewind)
+    DEBUG("- bench_audio: %s", config->bench_audio ? "true" : "false")
+    DEBUG("- bench:       %s", config->bench       ? "true" : "false")
+    DEBUG("- warmup:      %lu", config->warmup)
+    DEBUG("- repeat:      %u", config->repeat)
+    DEBUG("- lanes:       %u", config->lanes)
     DEBUG("- rom_path:    %s", config->rom_path  ? config->rom_path  : "(null)")
     DEBUG("- sav_path:    %s", config->sav_path  ? config->sav_path  : "(null)")
     DEBUG("- bios_path:   %s", config->bios_path ? config->bios_path : "(null)")
     DEBUG("- src_path:    %s", config->src_path  ? config->src_path  : "(null)")
     DEBUG("- dst_path:    %s", config->dst_path  ? config->dst_path  : "(null)")
+    DEBUG("- wav_path:    %s", config->wav_path  ? config->wav_path  : "(null)")
+    DEBUG("- json_path:   %s", config->json_path ? config->json_path : "(null)")
+    DEBUG("- record_path: %s",
+          config->record_path ? config->record_path : "(null)")
+    DEBUG("- play_path:   %s", config->play_path ? config->play_path : "(null)")
+    DEBUG("- load_state:  %s",
+          config->load_state_path ? config->load_state_path : "(null)")
+    DEBUG("- hashes_path: %s",
+          config->hashes_path ? config->hashes_path : "(null)")
+    DEBUG("- check_path:  %s",
+          config->check_path ? config->check_path : "(null)")
+    DEBUG("- batch_path:  %s",
+          config->batch_path ? config->batch_path : "(null)")
+    DEBUG("- threads:     %u", config->threads)
+    DEBUG("- results:     %s",
+          config->results_path ? config->results_path : "(null)")
+    DEBUG("- search_path: %s",
+          config->search_path ? config->search_path : "(null)")
+    DEBUG("- goal:        %04X:%u", config->goal_addr, config->goal_bytes)
+    DEBUG("- step:        %u", config->search_step)
+    DEBUG("- beam:        %u", config->search_beam)
+    DEBUG("- link_path:   %s",
+          config->link_path ? config->link_path : "(null)")
+    DEBUG("- quantum:     %u", config->link_quantum)
+    DEBUG("- hash_audio:  %s", config->hash_audio ? "true" : "false")
+    DEBUG("- hash_ram:    %s", config->hash_ram   ? "true" : "false")
     DEBUG("- overwrite:   %s", config->overwrite ? "true" : "false")
 }
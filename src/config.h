@@ -5,6 +5,11 @@
 
 #include <stdbool.h>
 
+#include "pacer.h"
+#include "resample.h"
+#include "scale.h"
+#include "vdp.h"
+
 #define ROMS_DIR "roms"
 #define CONTROLLER_DB_PATH "gamecontrollerdb.txt"
 
@@ -18,21 +23,59 @@
 */
 #define SCALE_MAX 128
 
+/* Largest fixed fast-forward multiplier; beyond that, use "max". */
+#define SPEED_MAX 64
+
 /* Structs */
 
 typedef struct {
     int debug;
     bool assemble;
     bool disassemble;
+    bool bench_audio;
+    bool bench;
+    bool headless;
     bool fullscreen;
     bool no_saving;
     unsigned scale;
     bool square_par;
+    ScaleFilter filter;
+    VDPRenderMode render_mode;
+    PaceMode pacing;
+    bool threaded;
+    ResampleQuality audio_quality;
+    unsigned speed;
+    unsigned long frames;
+    unsigned run_ahead;
+    bool run_ahead_thread;
+    unsigned rewind;
+    unsigned long warmup;
+    unsigned repeat;
+    unsigned lanes;
+    unsigned threads;
+    unsigned search_step;
+    unsigned search_beam;
+    unsigned goal_addr;
+    unsigned goal_bytes;
+    unsigned link_quantum;
     char *rom_path;
     char *sav_path;
     char *bios_path;
     char *src_path;
     char *dst_path;
+    char *wav_path;
+    char *json_path;
+    char *record_path;
+    char *play_path;
+    char *load_state_path;
+    char *hashes_path;
+    char *check_path;
+    char *batch_path;
+    char *results_path;
+    char *search_path;
+    char *link_path;
+    bool hash_audio;
+    bool hash_ram;
     bool overwrite;
 } Config;
 
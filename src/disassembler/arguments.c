@@ -34,7 +34,7 @@ typedef ArgType ArgTable[3][256];
 
 typedef struct {
     uint8_t index, opcode, arg1, arg2;
-    ArgTable *table;
+    const ArgTable *table;
 } Instr;
 
 /* Temporary aliases to make table definitions concise */
@@ -85,7 +85,7 @@ typedef struct {
 
 /* Argument tables */
 
-static ArgTable instr_args = {
+static const ArgTable instr_args = {
     {
         __, BC, NB, BC, B_, B_, B_, __, AF, HL, A_, BC, C_, C_, C_, __,
         ML, DE, ND, DE, D_, D_, D_, __, ML, HL, A_, DE, E_, E_, E_, __,
@@ -125,7 +125,7 @@ static ArgTable instr_args = {
     { __ }
 };
 
-static ArgTable instr_args_extended = {
+static const ArgTable instr_args_extended = {
     {
         __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,
         __, __, __, __, __, __, __, __, __, __, __, __, __, __, __, __,
@@ -165,7 +165,7 @@ static ArgTable instr_args_extended = {
     { __ }
 };
 
-static ArgTable instr_args_bits = {
+static const ArgTable instr_args_bits = {
     {
         B_, C_, D_, E_, H_, L_, NH, A_, B_, C_, D_, E_, H_, L_, NH, A_,
         B_, C_, D_, E_, H_, L_, NH, A_, B_, C_, D_, E_, H_, L_, NH, A_,
@@ -205,7 +205,7 @@ static ArgTable instr_args_bits = {
     { __ }
 };
 
-static ArgTable instr_args_index = {
+static const ArgTable instr_args_index = {
     {
         __, __, __, __, __, __, __, __, __, XY, __, __, __, __, __, __,
         __, __, __, __, __, __, __, __, __, XY, __, __, __, __, __, __,
@@ -245,7 +245,7 @@ static ArgTable instr_args_index = {
     { __ }
 };
 
-static ArgTable instr_args_index_bits = {
+static const ArgTable instr_args_index_bits = {
     {
         II, II, II, II, II, II, II, II, II, II, II, II, II, II, II, II,
         II, II, II, II, II, II, II, II, II, II, II, II, II, II, II, II,
@@ -1,30 +1,106 @@
 /* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
    Released under the terms of the MIT License. See LICENSE for details. */
 
+#include <pthread.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <string.h>
 #include <unistd.h>
 #include <SDL.h>
 
 #include "emulator.h"
+#include "audio.h"
 #include "config.h"
 #include "gamegear.h"
+#include "hud.h"
 #include "logging.h"
+#include "movie.h"
+#include "pacer.h"
+#include "pool.h"
+#include "rewind.h"
+#include "runahead.h"
 #include "save.h"
+#include "scale.h"
+#include "state.h"
+#include "triple.h"
 #include "util.h"
 
+#define NS_PER_SEC 1000000000
+#define INPUT_QUEUE_SIZE 256
+
 typedef struct {
     SDL_GameController **items;
     int num, capacity;
 } Controllers;
 
+/*
+    A finished frame, as handed from the emulation thread to the main thread.
+
+    Each line is stamped with the number of the last frame that changed it,
+    so the main thread can tell which lines are new to it even when it misses
+    frames in between.
+*/
+typedef struct {
+    uint64_t number;
+    uint64_t stamps[GG_SCREEN_HEIGHT];
+    uint8_t indices[GG_SCREEN_WIDTH * GG_SCREEN_HEIGHT];
+    uint16_t palettes[GG_PALETTE_SIZE * GG_SCREEN_HEIGHT];
+    bool hud_shown;
+    HudText hud;
+} Frame;
+
 typedef struct {
     GameGear *gg;
     SDL_Window *window;
     SDL_Renderer *renderer;
-    SDL_Texture *texture;
-    uint32_t *pixels;
+    SDL_Texture *textures[2];
+    int current;
+    bool stale[2][GG_SCREEN_HEIGHT];
+    uint8_t *indices;
+    uint16_t *palettes;
+    const uint8_t *shown_indices;
+    const uint16_t *shown_palettes;
+    const HudText *shown_hud;
+    uint32_t *frame;
+    Scaler scaler;
+    ThreadPool *pool;
+    Audio audio;
+    PaceMode pacing;
+    double fps;
+    unsigned speed, applied_speed;
+    atomic_bool fast_forward;
+    bool headless;
+    bool changed;
+    RunAhead run_ahead;
+    bool rewind_enabled;
+    Rewind rewind;
+    atomic_bool rewinding;
+    Hud hud;
+    atomic_bool show_hud;
+    bool hud_shown;
+    atomic_uint_least64_t draw_time, draws;
+    atomic_uint_least64_t frames;
+    uint64_t max_frames;
+    uint64_t last_present;
+    uint64_t meter_start, meter_frames;
     Controllers controllers;
+    const ROM *rom;
+    char *state_path;
+    atomic_bool save_requested, load_requested;
+    Movie movie;
+    bool recording, playing;
+
+    bool threaded;
+    pthread_t thread;
+    atomic_bool running;
+    atomic_bool notified;
+    uint32_t frame_event;
+    Ring input;
+    TripleBuffer frames_out;
+    uint64_t stamps[GG_SCREEN_HEIGHT];
+    uint64_t shown;
 } Emulator;
 
 static Emulator emu;
@@ -85,6 +161,38 @@ static void setup_input()
     emu.controllers.capacity = n;
 }
 
+/*
+    Decide how to pace frames, once the window exists.
+
+    Vsync pacing runs one frame per display refresh, so it only makes sense if
+    the display is close to the Game Gear's own rate; otherwise we fall back to
+    deadline pacing.
+*/
+static void setup_pacing(Config *config)
+{
+    SDL_DisplayMode mode;
+    int display;
+
+    emu.pacing = config->pacing;
+    emu.fps = GG_FPS;
+    if (emu.pacing != PACE_VSYNC)
+        return;
+
+    display = SDL_GetWindowDisplayIndex(emu.window);
+    if (display < 0 || SDL_GetCurrentDisplayMode(display, &mode) < 0 ||
+            !mode.refresh_rate) {
+        WARN("couldn't get the display's refresh rate; using deadline pacing")
+        emu.pacing = PACE_DEADLINE;
+    } else if (mode.refresh_rate < GG_FPS * 0.95 ||
+               mode.refresh_rate > GG_FPS * 1.05) {
+        WARN("display refresh rate of %d Hz is too far from %d Hz; "
+             "using deadline pacing", mode.refresh_rate, GG_FPS)
+        emu.pacing = PACE_DEADLINE;
+    } else {
+        emu.fps = mode.refresh_rate;
+    }
+}
+
 /*
     Set up SDL for drawing the game.
 */
@@ -107,9 +215,12 @@ static void setup_graphics(Config *config)
         SDL_WINDOWPOS_UNDEFINED, width, height, flags);
     if (!emu.window)
         FATAL("SDL failed to create a window: %s", SDL_GetError());
+    setup_pacing(config);
 
-    emu.renderer = SDL_CreateRenderer(emu.window, -1,
-        SDL_RENDERER_ACCELERATED|SDL_RENDERER_PRESENTVSYNC);
+    // Only wait for vsync when it is what paces us; otherwise it would fight
+    // with the pacer and add latency:
+    emu.renderer = SDL_CreateRenderer(emu.window, -1, SDL_RENDERER_ACCELERATED|
+        (emu.pacing == PACE_VSYNC ? SDL_RENDERER_PRESENTVSYNC : 0));
     if (!emu.renderer) {
         // Fall back to software renderer (or a hardware renderer
         // without vsync, if one exists?)
@@ -122,19 +233,43 @@ static void setup_graphics(Config *config)
     SDL_GetRendererInfo(emu.renderer, &info);
     DEBUG("Using %s renderer", info.name);
 
-    emu.texture = SDL_CreateTexture(emu.renderer, SDL_PIXELFORMAT_ARGB8888,
-        SDL_TEXTUREACCESS_STREAMING, GG_SCREEN_WIDTH, GG_SCREEN_HEIGHT);
+    emu.pool = NULL;
+    emu.frame = NULL;
+    if (config->filter != SCALE_NONE) {
+        emu.pool = pool_create(pool_default_size());
+        emu.frame = cr_malloc(
+            sizeof(uint32_t) * GG_SCREEN_WIDTH * GG_SCREEN_HEIGHT);
+    }
+    scaler_init(&emu.scaler, config->filter, GG_SCREEN_WIDTH,
+        GG_SCREEN_HEIGHT, config->scale, !config->square_par, emu.pool);
+    DEBUG("Using %s filter (%ux%u)", scaler_filter_name(config->filter),
+          emu.scaler.width, emu.scaler.height);
 
-    if (!emu.texture)
-        FATAL("SDL failed to create a texture: %s", SDL_GetError());
+    // Frames alternate between two textures, so we never write to the one
+    // that the GPU may still be reading from for the last frame:
+    for (int i = 0; i < 2; i++) {
+        emu.textures[i] = SDL_CreateTexture(emu.renderer,
+            SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING,
+            emu.scaler.width, emu.scaler.height);
+        if (!emu.textures[i])
+            FATAL("SDL failed to create a texture: %s", SDL_GetError());
+        SDL_SetTextureBlendMode(emu.textures[i], SDL_BLENDMODE_BLEND);
+        memset(emu.stale[i], true, sizeof(emu.stale[i]));
+    }
+    emu.current = 0;
+    emu.changed = true;
 
-    emu.pixels = cr_malloc(
-        sizeof(uint32_t) * GG_SCREEN_WIDTH * GG_SCREEN_HEIGHT);
+    emu.indices = cr_malloc(
+        sizeof(uint8_t) * GG_SCREEN_WIDTH * GG_SCREEN_HEIGHT);
+    emu.palettes = cr_malloc(
+        sizeof(uint16_t) * GG_PALETTE_SIZE * GG_SCREEN_HEIGHT);
+    emu.shown_indices = emu.indices;
+    emu.shown_palettes = emu.palettes;
+    emu.shown_hud = NULL;
 
     SDL_RenderSetLogicalSize(emu.renderer,
         config->square_par ? GG_SCREEN_WIDTH  : GG_LOGICAL_WIDTH,
         config->square_par ? GG_SCREEN_HEIGHT : GG_LOGICAL_HEIGHT);
-    SDL_SetTextureBlendMode(emu.texture, SDL_BLENDMODE_BLEND);
     SDL_ShowCursor(SDL_DISABLE);
 
     SDL_SetRenderDrawColor(emu.renderer, 0x00, 0x00, 0x00, 0xFF);
@@ -152,36 +287,381 @@ static void setup_sdl(Config *config)
 
     setup_input();
     setup_graphics(config);
+    if (!audio_open(&emu.audio, PSG_DEFAULT_RATE) &&
+            emu.pacing == PACE_AUDIO) {
+        WARN("no audio device; using deadline pacing")
+        emu.pacing = PACE_DEADLINE;
+    }
+    audio_set_blocking(&emu.audio, emu.pacing == PACE_AUDIO);
+    audio_set_frame_rate(&emu.audio, emu.fps);
+    DEBUG("Using %s pacing at %g fps", pacer_mode_name(emu.pacing), emu.fps)
+}
+
+/*
+    Return the speed we are currently running at, as understood by
+    gamegear_set_speed().
+*/
+static unsigned get_speed()
+{
+    return emu.fast_forward ? PACER_UNTHROTTLED : emu.speed;
+}
+
+/*
+    Decide whether the frame that just finished should be shown.
+
+    At a fixed speed of k, only every k-th frame is drawn; when unthrottled,
+    frames are drawn at most as often as the Game Gear would draw them in real
+    time. Skipped frames also skip their audio, since the sound card can only
+    play so fast.
+*/
+static bool should_present()
+{
+    unsigned speed = get_speed();
+    uint64_t now;
+
+    if (emu.headless)
+        return false;
+    if (speed == 1)
+        return true;
+    if (speed != PACER_UNTHROTTLED)
+        return emu.frames % speed == 0;
+
+    now = get_time_ns();
+    if (now - emu.last_present < NS_PER_SEC / GG_FPS)
+        return false;
+    emu.last_present = now;
+    return true;
+}
+
+/*
+    Report how fast we are running compared to real time, once per second.
+
+    This goes to the window title, or to stdout when headless. It is called by
+    whichever thread draws frames, after each one.
+*/
+static void update_speed_meter()
+{
+    uint64_t now = get_time_ns(), frames = emu.frames, elapsed;
+    char title[32];
+
+    if (!emu.meter_start) {
+        emu.meter_start = now;
+        emu.meter_frames = frames;
+    }
+    elapsed = now - emu.meter_start;
+    if (elapsed < NS_PER_SEC)
+        return;
+
+    double fps = (frames - emu.meter_frames) * (double) NS_PER_SEC / elapsed;
+    if (emu.headless) {
+        printf("%.2fx (%.1f fps)\n", fps / GG_FPS, fps);
+        fflush(stdout);
+    } else if (get_speed() != 1) {
+        snprintf(title, sizeof(title), "crater - %.2fx", fps / GG_FPS);
+        SDL_SetWindowTitle(emu.window, title);
+    }
+    emu.meter_start = now;
+    emu.meter_frames = frames;
+}
+
+/*
+    Start or stop fast-forwarding at full speed, e.g. while a key is held.
+
+    The GameGear picks up the new speed after its current frame.
+*/
+static void set_fast_forward(bool state)
+{
+    if (emu.fast_forward == state)
+        return;
+    emu.fast_forward = state;
+    emu.meter_start = emu.meter_frames = 0;
+    if (get_speed() == 1)
+        SDL_SetWindowTitle(emu.window, "crater");
+}
+
+/*
+    Tell the GameGear about a change in speed. This is done from the frame
+    callback, so that the pacer never changes under the emulation thread.
+*/
+static void apply_speed(GameGear *gg)
+{
+    unsigned speed = get_speed();
+    if (speed != emu.applied_speed) {
+        gamegear_set_speed(gg, speed);
+        emu.applied_speed = speed;
+    }
+}
+
+/*
+    Run the upscaling filter over the frame and write it into the current
+    texture.
+
+    Filters look at neighboring lines, so the whole texture is redone. The
+    overlay, if shown, is drawn before filtering, like the game itself.
+*/
+static void draw_filtered()
+{
+    SDL_Texture *texture = emu.textures[emu.current];
+    bool *stale = emu.stale[emu.current];
+    int line, pitch;
+    void *texels;
+
+    for (line = 0; line < GG_SCREEN_HEIGHT; line++) {
+        if (stale[line]) {
+            uint32_t *row = emu.frame + line * GG_SCREEN_WIDTH;
+            gamegear_expand_line(emu.shown_indices, emu.shown_palettes, line,
+                                 row);
+            if (emu.shown_hud)
+                hud_draw_line(emu.shown_hud, line, row);
+            stale[line] = false;
+        }
+    }
+
+    if (SDL_LockTexture(texture, NULL, &texels, &pitch) < 0)
+        FATAL("SDL failed to lock texture: %s", SDL_GetError());
+    scaler_run(&emu.scaler, emu.frame, texels, pitch);
+    SDL_UnlockTexture(texture);
+}
+
+/*
+    Write the frame into the current texture without filtering.
+
+    The GameGear draws palette indices, which are expanded straight into the
+    texture. Only runs of scanlines that changed since this texture was last
+    drawn are updated; the rest of it still holds what it did then.
+*/
+static void draw_unfiltered()
+{
+    SDL_Texture *texture = emu.textures[emu.current];
+    bool *stale = emu.stale[emu.current];
+    int start, end, line, pitch;
+    void *texels;
+
+    for (start = 0; start < GG_SCREEN_HEIGHT; start = end) {
+        if (!stale[start]) {
+            end = start + 1;
+            continue;
+        }
+        for (end = start + 1; end < GG_SCREEN_HEIGHT && stale[end]; end++);
+
+        SDL_Rect rect = {0, start, GG_SCREEN_WIDTH, end - start};
+        if (SDL_LockTexture(texture, &rect, &texels, &pitch) < 0)
+            FATAL("SDL failed to lock texture: %s", SDL_GetError());
+        for (line = start; line < end; line++) {
+            uint32_t *row = (uint32_t*) ((uint8_t*) texels +
+                                         (line - start) * pitch);
+            gamegear_expand_line(emu.shown_indices, emu.shown_palettes, line,
+                                 row);
+            if (emu.shown_hud)
+                hud_draw_line(emu.shown_hud, line, row);
+            stale[line] = false;
+        }
+        SDL_UnlockTexture(texture);
+    }
+}
+
+/*
+    Mark lines of the display that changed since it was last drawn.
+
+    They become stale in both textures, since neither has seen them yet.
+    Main thread only.
+*/
+static void mark_lines(const bool *dirty)
+{
+    for (int line = 0; line < GG_SCREEN_HEIGHT; line++) {
+        if (dirty[line]) {
+            emu.stale[0][line] = emu.stale[1][line] = true;
+            emu.changed = true;
+        }
+    }
 }
 
 /*
     Actually send the pixel data to the screen.
+
+    If any lines changed, we switch to the other texture and bring it up to
+    date; otherwise, the current one is shown again as is.
 */
 static void draw_frame()
 {
-    void *pixels;
-    int pitch;
-    if (SDL_LockTexture(emu.texture, NULL, &pixels, &pitch) < 0)
-        FATAL("SDL failed to lock texture: %s", SDL_GetError());
-    if (pitch != sizeof(uint32_t) * GG_SCREEN_WIDTH)
-        FATAL("SDL returned an unexpected texture pitch: %d, expected %zu",
-            pitch, sizeof(uint32_t) * GG_SCREEN_WIDTH);
-    memcpy(pixels, emu.pixels, sizeof(uint32_t) * GG_SCREEN_WIDTH * GG_SCREEN_HEIGHT);
-    SDL_UnlockTexture(emu.texture);
+    uint64_t start = get_time_ns();
+
+    if (emu.changed) {
+        emu.current ^= 1;
+        if (emu.scaler.filter != SCALE_NONE)
+            draw_filtered();
+        else
+            draw_unfiltered();
+        emu.changed = false;
+    }
 
     SDL_SetRenderDrawColor(emu.renderer, 0x00, 0x00, 0x00, 0xFF);
     SDL_RenderClear(emu.renderer);
-    SDL_RenderCopy(emu.renderer, emu.texture, NULL, NULL);
+    SDL_RenderCopy(emu.renderer, emu.textures[emu.current], NULL, NULL);
     SDL_RenderPresent(emu.renderer);
+
+    emu.draw_time += get_time_ns() - start;
+    emu.draws++;
+}
+
+/*
+    Note lines of the display that changed in a frame just emulated.
+
+    With emulation on its own thread, they are stamped with the frame's number
+    for the main thread to compare against the last frame it drew.
+*/
+static void track_lines(const bool *dirty)
+{
+    if (!emu.threaded) {
+        mark_lines(dirty);
+        return;
+    }
+    for (int line = 0; line < GG_SCREEN_HEIGHT; line++) {
+        if (dirty[line])
+            emu.stamps[line] = emu.frames;
+    }
+}
+
+/*
+    Hand the frame just emulated over to the main thread to be drawn, and wake
+    it up if it isn't already due to look.
+*/
+static void publish_frame()
+{
+    Frame *frame = triple_back(&emu.frames_out);
+    frame->number = emu.frames;
+    memcpy(frame->stamps, emu.stamps, sizeof(frame->stamps));
+    memcpy(frame->indices, emu.indices, sizeof(frame->indices));
+    memcpy(frame->palettes, emu.palettes, sizeof(frame->palettes));
+    frame->hud_shown = emu.hud_shown;
+    if (emu.hud_shown)
+        frame->hud = emu.hud.text;
+    triple_publish(&emu.frames_out);
+
+    if (!atomic_exchange(&emu.notified, true)) {
+        SDL_Event event = {.type = emu.frame_event};
+        SDL_PushEvent(&event);
+    }
+}
+
+/*
+    Draw the latest frame from the emulation thread, if there is a new one.
+    Frames that came and went in the meantime are never seen.
+*/
+static void present_frame()
+{
+    bool dirty[GG_SCREEN_HEIGHT];
+    const Frame *frame;
+
+    atomic_store(&emu.notified, false);
+    if (!triple_acquire(&emu.frames_out))
+        return;
+
+    frame = triple_front(&emu.frames_out);
+    for (int line = 0; line < GG_SCREEN_HEIGHT; line++)
+        dirty[line] = frame->stamps[line] > emu.shown;
+    emu.shown = frame->number;
+    emu.shown_indices = frame->indices;
+    emu.shown_palettes = frame->palettes;
+    emu.shown_hud = frame->hud_shown ? &frame->hud : NULL;
+    mark_lines(dirty);
+    draw_frame();
+}
+
+/*
+    Show or hide the overlay if asked to, and bring it up to date, redrawing
+    the lines it covers if anything changed.
+
+    This runs on the emulation thread, which owns the GameGear's profile.
+*/
+static void update_hud(GameGear *gg)
+{
+    bool shown = emu.show_hud, changed = false;
+    AudioStats audio;
+
+    if (shown != emu.hud_shown) {
+        emu.hud_shown = shown;
+        hud_init(&emu.hud, !emu.threaded);
+        gamegear_attach_profile(gg, shown ? &emu.hud.profile : NULL);
+        if (!emu.threaded)
+            emu.shown_hud = shown ? &emu.hud.text : NULL;
+        changed = true;
+    }
+    if (shown) {
+        audio_get_stats(&emu.audio, &audio);
+        changed |= hud_update(&emu.hud, gg, emu.draw_time, emu.draws,
+                              (double) audio.fill / audio.capacity);
+    }
+
+    if (changed) {
+        bool dirty[GG_SCREEN_HEIGHT] = {false};
+        for (int line = HUD_TOP; line < HUD_TOP + HUD_HEIGHT; line++)
+            dirty[line] = true;
+        track_lines(dirty);
+    }
+}
+
+/*
+    Show the frame just emulated, or hand it over to be shown.
+*/
+static void show_frame()
+{
+    if (emu.threaded)
+        publish_frame();
+    else
+        draw_frame();
+}
+
+/*
+    Press or release a Game Gear button.
+
+    With emulation on its own thread, this goes through the input queue, to
+    be picked up at the next scanline. Input is ignored while playing a movie.
+*/
+static void send_input(GameGear *gg, GGButton button, bool state)
+{
+    if (emu.playing)
+        return;
+    if (!emu.threaded) {
+        gamegear_input(gg, button, state);
+        return;
+    }
+
+    GGInputEvent event = {get_time_ns(), button, state};
+    if (!ring_write(&emu.input, &event, 1))
+        WARN("input queue is full; dropping a button press")
 }
 
 /*
     Handle a keyboard press; translate it into a Game Gear button press.
+
+    Holding tab fast-forwards, holding backspace rewinds, F1 shows or hides
+    the performance overlay, and F5 and F7 save and load the state.
 */
 static void handle_keypress(GameGear *gg, SDL_Keycode key, bool state)
 {
     GGButton button;
     switch (key) {
+        case SDLK_TAB:
+            set_fast_forward(state);
+            return;
+        case SDLK_BACKSPACE:
+            emu.rewinding = state;
+            return;
+        case SDLK_F1:
+            if (state)
+                emu.show_hud = !emu.show_hud;
+            return;
+        case SDLK_F5:
+            if (state)
+                emu.save_requested = true;
+            return;
+        case SDLK_F7:
+            if (state && (emu.recording || emu.playing))
+                WARN("can't load a state during a movie")
+            else if (state)
+                emu.load_requested = true;
+            return;
         case SDLK_UP:
         case SDLK_w:
             button = BUTTON_UP;        break;
@@ -209,7 +689,7 @@ static void handle_keypress(GameGear *gg, SDL_Keycode key, bool state)
         default:
             return;
     }
-    gamegear_input(gg, button, state);
+    send_input(gg, button, state);
 }
 
 /*
@@ -237,7 +717,7 @@ static void handle_controller_input(
         default:
             return;
     }
-    gamegear_input(gg, button, state);
+    send_input(gg, button, state);
 }
 
 /*
@@ -309,45 +789,192 @@ static void handle_controller_removed(int id)
 }
 
 /*
-    Handle SDL events, mainly quit events and button presses.
+    Handle an SDL event, mainly quit events and button presses.
+*/
+static void handle_event(GameGear *gg, const SDL_Event *event)
+{
+    switch (event->type) {
+        case SDL_QUIT:
+            gamegear_power_off(gg);
+            break;
+        case SDL_KEYDOWN:
+            if (!event->key.repeat)
+                handle_keypress(gg, event->key.keysym.sym, true);
+            break;
+        case SDL_KEYUP:
+            handle_keypress(gg, event->key.keysym.sym, false);
+            break;
+        case SDL_CONTROLLERBUTTONDOWN:
+            handle_controller_input(gg, event->cbutton.button, true);
+            break;
+        case SDL_CONTROLLERBUTTONUP:
+            handle_controller_input(gg, event->cbutton.button, false);
+            break;
+        case SDL_CONTROLLERDEVICEADDED:
+            handle_controller_added(event->cdevice.which);
+            break;
+        case SDL_CONTROLLERDEVICEREMOVED:
+            handle_controller_removed(event->cdevice.which);
+            break;
+    }
+}
+
+/*
+    Handle all pending SDL events, stopping early if told to quit.
 */
 static void handle_events(GameGear *gg)
 {
     SDL_Event event;
     while (SDL_PollEvent(&event)) {
-        switch (event.type) {
-            case SDL_QUIT:
-                gamegear_power_off(gg);
-                return;
-            case SDL_KEYDOWN:
-                handle_keypress(gg, event.key.keysym.sym, true);
-                break;
-            case SDL_KEYUP:
-                handle_keypress(gg, event.key.keysym.sym, false);
-                break;
-            case SDL_CONTROLLERBUTTONDOWN:
-                handle_controller_input(gg, event.cbutton.button, true);
-                break;
-            case SDL_CONTROLLERBUTTONUP:
-                handle_controller_input(gg, event.cbutton.button, false);
-                break;
-            case SDL_CONTROLLERDEVICEADDED:
-                handle_controller_added(event.cdevice.which);
-                break;
-            case SDL_CONTROLLERDEVICEREMOVED:
-                handle_controller_removed(event.cdevice.which);
-                break;
-        }
+        handle_event(gg, &event);
+        if (event.type == SDL_QUIT)
+            return;
+    }
+}
+
+/*
+    Save or load the state if asked to since the last frame.
+
+    This happens here rather than when the key is pressed, as the GameGear
+    may be running on another thread.
+*/
+static void handle_state_requests(GameGear *gg)
+{
+    bool save = atomic_exchange(&emu.save_requested, false);
+    bool load = atomic_exchange(&emu.load_requested, false);
+    if (!save && !load)
+        return;
+
+    GGState *state = cr_malloc(sizeof(GGState));
+    if (save) {
+        gamegear_save_state(gg, state);
+        if (state_save(emu.state_path, state, emu.rom))
+            DEBUG("Saved state to %s", emu.state_path)
     }
+    if (load && state_load(emu.state_path, state, emu.rom)) {
+        gamegear_load_state(gg, state);
+        DEBUG("Loaded state from %s", emu.state_path)
+    }
+    free(state);
 }
 
 /*
-    GameGear callback: Draw the current frame and handle SDL event logic.
+    Record the buttons held for the next frame, or hold the ones the movie
+    says to, stopping once it's over.
+
+    While recording with emulation on its own thread, input waits in the
+    queue until here instead of being picked up mid-frame, so that buttons
+    only ever change between frames.
+*/
+static void handle_movie(GameGear *gg)
+{
+    if (emu.recording) {
+        GGInputEvent event;
+        while (emu.threaded && ring_read(&emu.input, &event, 1))
+            gamegear_input(gg, event.button, event.state);
+        movie_record(&emu.movie, gg);
+    } else if (!movie_play(&emu.movie, gg)) {
+        gamegear_power_off(gg);
+    }
+}
+
+/*
+    GameGear callback: Queue audio, draw the current frame and handle SDL event
+    logic.
+
+    When running faster than real time, only some frames are shown; the rest
+    are only recorded, if we're recording. With run-ahead, input is handled
+    first, so that the frame shown already reflects it. With emulation on its
+    own thread, frames are handed over to the main thread instead, which
+    handles input by itself. Rewinding goes back a frame before anything runs
+    ahead from there.
 */
 static void frame_callback(GameGear *gg)
 {
-    draw_frame();
-    handle_events(gg);
+    bool present = should_present();
+
+    emu.frames++;
+    audio_update(&emu.audio, gg, present);
+    if (!emu.headless && !emu.run_ahead.threaded)
+        track_lines(gamegear_get_dirty_lines(gg));
+    if (!emu.headless)
+        update_hud(gg);
+    if (emu.rewind_enabled) {
+        if (emu.rewinding)
+            rewind_step(&emu.rewind, gg);
+        else
+            rewind_push(&emu.rewind, gg);
+    }
+
+    if (present && emu.run_ahead.frames) {
+        bool dirty[GG_SCREEN_HEIGHT] = {false};
+
+        if (!emu.threaded)
+            handle_events(gg);
+        runahead_begin(&emu.run_ahead, gg, dirty);
+        track_lines(dirty);
+        show_frame();
+        runahead_end(&emu.run_ahead, gg);
+    } else if (present) {
+        show_frame();
+        if (!emu.threaded)
+            handle_events(gg);
+    }
+    handle_state_requests(gg);
+    apply_speed(gg);
+    if (!emu.threaded)
+        update_speed_meter();
+    if (emu.recording || emu.playing)
+        handle_movie(gg);
+
+    if (emu.max_frames && emu.frames >= emu.max_frames)
+        gamegear_power_off(gg);
+}
+
+/*
+    Emulation thread: run the GameGear until it stops, then wake up the main
+    thread so that it notices.
+*/
+static void* run_emulation(void *arg)
+{
+    (void) arg;
+    gamegear_simulate(emu.gg);
+
+    atomic_store(&emu.running, false);
+    SDL_Event event = {.type = emu.frame_event};
+    SDL_PushEvent(&event);
+    return NULL;
+}
+
+/*
+    Run the GameGear on its own thread until it stops.
+
+    Meanwhile, the main thread sleeps until there is an SDL event or a new
+    frame, so input is queued as soon as it arrives, and a slow present (e.g.
+    a compositor hiccup) only delays the picture, never the emulation.
+*/
+static void simulate_threaded()
+{
+    SDL_Event event;
+
+    emu.running = true;
+    if (pthread_create(&emu.thread, NULL, run_emulation, NULL))
+        FATAL("couldn't start the emulation thread")
+
+    while (emu.running) {
+        if (!SDL_WaitEvent(&event)) {
+            ERROR("SDL failed to wait for events: %s", SDL_GetError())
+            gamegear_power_off(emu.gg);
+            break;
+        }
+        if (event.type == emu.frame_event) {
+            present_frame();
+            update_speed_meter();
+        } else {
+            handle_event(emu.gg, &event);
+        }
+    }
+    pthread_join(emu.thread, NULL);
 }
 
 /*
@@ -355,8 +982,35 @@ static void frame_callback(GameGear *gg)
 */
 static void cleanup_sdl()
 {
-    free(emu.pixels);
-    SDL_DestroyTexture(emu.texture);
+    AudioStats audio;
+    audio_get_stats(&emu.audio, &audio);
+    DEBUG("Audio buffer: %zu/%zu samples, %lu underruns, %lu overruns",
+          audio.fill, audio.capacity, audio.underruns, audio.overruns)
+    audio_close(&emu.audio);
+
+    PacerStats pacing;
+    gamegear_get_pacing_stats(emu.gg, &pacing);
+    DEBUG("Frame time: %.3f ms mean, %.3f ms jitter, %.3f-%.3f ms range, "
+          "%llu/%llu late", pacing.mean, pacing.jitter, pacing.min,
+          pacing.max, (unsigned long long) pacing.late,
+          (unsigned long long) pacing.frames)
+
+    if (emu.threaded) {
+        GGInputStats input;
+        gamegear_get_input_stats(emu.gg, &input);
+        DEBUG("Input delay: %.3f ms mean, %.3f ms max over %llu events",
+              input.events ? input.total / 1e6 / input.events : 0.0,
+              input.max / 1e6, (unsigned long long) input.events)
+    }
+
+    free(emu.indices);
+    free(emu.palettes);
+    free(emu.frame);
+    scaler_free(&emu.scaler);
+    if (emu.pool)
+        pool_destroy(emu.pool);
+    SDL_DestroyTexture(emu.textures[0]);
+    SDL_DestroyTexture(emu.textures[1]);
     SDL_DestroyRenderer(emu.renderer);
     SDL_DestroyWindow(emu.window);
     for (int i = 0; i < emu.controllers.num; i++)
@@ -367,11 +1021,80 @@ static void cleanup_sdl()
 
     emu.window = NULL;
     emu.renderer = NULL;
-    emu.texture = NULL;
+    emu.textures[0] = emu.textures[1] = NULL;
     emu.controllers.items = NULL;
     emu.controllers.num = emu.controllers.capacity = 0;
 }
 
+/*
+    Print a hash of the GameGear's state, so that runs of the same movie can
+    be checked against each other.
+*/
+static void print_state_hash(GameGear *gg)
+{
+    GGState *state = cr_malloc(sizeof(GGState));
+    gamegear_save_state(gg, state);
+    printf("State hash: %016llx\n",
+           (unsigned long long) state_hash(state, emu.rom));
+    free(state);
+}
+
+/*
+    Set up recording or playing a movie, and load the starting state if one
+    was given. Return whether it worked.
+*/
+static bool setup_movie(Config *config)
+{
+    emu.recording = config->record_path;
+    emu.playing = config->play_path;
+
+    if (emu.playing) {
+        if (!movie_load(&emu.movie, config->play_path, emu.rom))
+            return false;
+        movie_begin(&emu.movie, emu.gg);
+        return true;
+    }
+
+    movie_init(&emu.movie);
+    if (config->load_state_path) {
+        GGState *state = cr_malloc(sizeof(GGState));
+        bool ok = state_load(config->load_state_path, state, emu.rom);
+        if (ok) {
+            gamegear_load_state(emu.gg, state);
+            if (emu.recording)
+                movie_set_start(&emu.movie, state);
+        }
+        free(state);
+        if (!ok)
+            return false;
+    }
+    return true;
+}
+
+/*
+    Report why the GameGear stopped, and finish off the movie if there is one.
+*/
+static void report_stop(Config *config)
+{
+    bool finished = emu.max_frames && emu.frames >= emu.max_frames;
+
+    if (gamegear_get_exception(emu.gg))
+        ERROR("caught exception: %s", gamegear_get_exception(emu.gg))
+    else if (finished)
+        DEBUG("Stopped after %llu frames", (unsigned long long) emu.frames)
+    else if (emu.playing && emu.movie.pos >= emu.movie.frames)
+        DEBUG("Movie ended after %llu frames", (unsigned long long) emu.frames)
+    else
+        WARN("caught signal, stopping...")
+    if (DEBUG_LEVEL)
+        gamegear_print_state(emu.gg);
+
+    if (emu.playing || (emu.recording && finished))
+        print_state_hash(emu.gg);
+    if (emu.recording && movie_save(&emu.movie, config->record_path, emu.rom))
+        DEBUG("Saved movie to %s", config->record_path)
+}
+
 /*
     Emulate a ROM in a Game Gear while handling I/O with the host computer.
 
@@ -379,8 +1102,12 @@ static void cleanup_sdl()
 */
 void emulate(ROM *rom, Config *config)
 {
+    // Movies start with blank cartridge RAM, so they play back the same way
+    bool use_save = !config->no_saving && !config->record_path &&
+        !config->play_path;
+
     Save save;
-    if (!config->no_saving) {
+    if (use_save) {
         if (!save_init(&save, config->sav_path, rom))
             return;
     }
@@ -393,29 +1120,97 @@ void emulate(ROM *rom, Config *config)
 
     emu.gg = gamegear_create();
     signal(SIGINT, handle_sigint);
-    setup_sdl(config);
 
+    emu.headless = config->headless;
+    emu.speed = emu.applied_speed =
+        config->headless ? PACER_UNTHROTTLED : config->speed;
+    emu.threaded = config->threaded;
+    emu.fast_forward = emu.changed = false;
+    emu.show_hud = emu.hud_shown = false;
+    emu.draw_time = emu.draws = 0;
+    emu.frames = emu.last_present = 0;
+    emu.meter_start = emu.meter_frames = 0;
+    emu.max_frames = config->frames;
+    emu.rom = rom;
+    emu.state_path = cr_malloc(sizeof(char) *
+        (strlen(config->rom_path) + strlen(".state") + 1));
+    strcpy(emu.state_path, config->rom_path);
+    strcat(emu.state_path, ".state");
+    emu.save_requested = emu.load_requested = false;
+    audio_init(&emu.audio, config->audio_quality);
+    if (config->wav_path)
+        audio_record(&emu.audio, config->wav_path);
+
+    if (emu.headless) {
+        emu.pacing = PACE_DEADLINE;
+        emu.fps = GG_FPS;
+    } else {
+        setup_sdl(config);
+    }
+
+    emu.rewind_enabled = config->rewind && !emu.headless &&
+        !config->record_path && !config->play_path;
+    emu.rewinding = false;
+    if (emu.rewind_enabled)
+        rewind_init(&emu.rewind, config->rewind * GG_FPS, rom);
+
+    emu.run_ahead.frames = 0;
+    emu.run_ahead.threaded = false;
+    if (config->run_ahead)
+        runahead_init(&emu.run_ahead, config->run_ahead,
+            config->run_ahead_thread, rom, bios, emu.indices, emu.palettes);
+    // With a run-ahead thread, only the GameGear running ahead draws:
+    if (!emu.headless && !emu.run_ahead.threaded)
+        gamegear_attach_indexed_display(emu.gg, emu.indices, emu.palettes);
+
+    if (emu.threaded) {
+        ring_init(&emu.input, INPUT_QUEUE_SIZE, sizeof(GGInputEvent));
+        triple_init(&emu.frames_out, sizeof(Frame));
+        memset(emu.stamps, 0, sizeof(emu.stamps));
+        emu.shown = 0;
+        emu.notified = false;
+        emu.frame_event = SDL_RegisterEvents(1);
+        if (emu.frame_event == (uint32_t) -1)
+            FATAL("SDL failed to register an event: %s", SDL_GetError())
+        if (!config->record_path)
+            gamegear_attach_input_queue(emu.gg, &emu.input);
+    }
+
+    gamegear_set_render_mode(emu.gg, config->render_mode);
+    gamegear_set_pacing(emu.gg, emu.pacing, emu.fps);
+    gamegear_set_speed(emu.gg, emu.speed);
     gamegear_attach_callback(emu.gg, frame_callback);
-    gamegear_attach_display(emu.gg, emu.pixels);
     gamegear_load_rom(emu.gg, rom);
     if (bios)
         gamegear_load_bios(emu.gg, bios);
-    if (!config->no_saving)
+    if (use_save)
         gamegear_load_save(emu.gg, &save);
 
-    gamegear_simulate(emu.gg);
+    if (setup_movie(config)) {
+        if (emu.threaded)
+            simulate_threaded();
+        else
+            gamegear_simulate(emu.gg);
+        report_stop(config);
+    }
+    movie_free(&emu.movie);
 
-    if (gamegear_get_exception(emu.gg))
-        ERROR("caught exception: %s", gamegear_get_exception(emu.gg))
+    if (config->run_ahead)
+        runahead_free(&emu.run_ahead);
+    if (emu.rewind_enabled)
+        rewind_free(&emu.rewind);
+    if (emu.headless)
+        audio_close(&emu.audio);
     else
-        WARN("caught signal, stopping...")
-    if (DEBUG_LEVEL)
-        gamegear_print_state(emu.gg);
-
-    cleanup_sdl();
+        cleanup_sdl();
+    if (emu.threaded) {
+        ring_free(&emu.input);
+        triple_free(&emu.frames_out);
+    }
     signal(SIGINT, SIG_DFL);
     gamegear_destroy(emu.gg);
     emu.gg = NULL;
-    if (!config->no_saving)
+    free(emu.state_path);
+    if (use_save)
         save_free(&save);
 }
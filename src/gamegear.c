@@ -1,10 +1,12 @@
 /* Copyright (C) 2014-2017 Ben Kurtovic <ben.kurtovic@gmail.com>
    Released under the terms of the MIT License. See LICENSE for details. */
 
+#include <math.h>
 #include <stdlib.h>
-#include <unistd.h>
+#include <string.h>
 
 #include "gamegear.h"
+#include "link.h"
 #include "logging.h"
 #include "util.h"
 
@@ -12,7 +14,6 @@
 #define CPU_CLOCK_SPEED (3579545.)
 #define CYCLES_PER_FRAME (CPU_CLOCK_SPEED / GG_FPS)
 #define CYCLES_PER_LINE (CYCLES_PER_FRAME / VDP_LINES_PER_FRAME)
-#define NS_PER_FRAME (1000 * 1000 * 1000 / GG_FPS)
 
 #define SET_EXC(...) snprintf(gg->exc_buffer, GG_EXC_BUFF_SIZE, __VA_ARGS__);
 
@@ -32,9 +33,22 @@ GameGear* gamegear_create()
     psg_init(&gg->psg);
     io_init(&gg->io, &gg->mmu, &gg->vdp, &gg->psg);
     z80_init(&gg->cpu, &gg->mmu, &gg->io);
+    gg->vdp.clock = &gg->cpu.cycles;
+    gg->psg.clock = &gg->cpu.cycles;
+    psg_set_rate(&gg->psg, CPU_CLOCK_SPEED, PSG_DEFAULT_RATE);
+    pacer_init(&gg->pacer, PACE_DEADLINE, GG_FPS);
 
     gg->powered = false;
     gg->callback = NULL;
+    gg->profile = NULL;
+    gg->input = NULL;
+    gg->input_stats = (GGInputStats) {0, 0, 0};
+    gg->link = NULL;
+    gg->line = 0;
+    gg->mid_line = false;
+    gg->line_left = 0;
+    gg->until = NULL;
+    gg->until_arg = NULL;
     gg->exc_buffer[0] = '\0';
     return gg;
 }
@@ -52,6 +66,59 @@ void gamegear_destroy(GameGear *gg)
     free(gg);
 }
 
+/*
+    Return a GameGear to how gamegear_create() left it, so it can be reused
+    for another run without allocating a new one.
+
+    Its ROM, BIOS, save, cartridge RAM, attachments, pacing, and running totals
+    are all forgotten; the render mode and audio rate are kept. Calling this
+    function while the GameGear is powered on has no effect.
+*/
+void gamegear_reset(GameGear *gg)
+{
+    if (gg->powered)
+        return;
+    gamegear_attach_link(gg, NULL);
+    mmu_reset(&gg->mmu);
+    io_init(&gg->io, &gg->mmu, &gg->vdp, &gg->psg);
+    z80_init(&gg->cpu, &gg->mmu, &gg->io);
+    pacer_init(&gg->pacer, PACE_DEADLINE, GG_FPS);
+
+    gamegear_detach(gg);
+    gg->input = NULL;
+    gg->input_stats = (GGInputStats) {0, 0, 0};
+    gg->exc_buffer[0] = '\0';
+}
+
+/*
+    Create a new GameGear that is a copy of one that has been running, e.g. to
+    try different inputs from the same point. It can be made at any point,
+    like gamegear_save_state(), and carries on from the same one.
+
+    The copy shares the original's ROM and BIOS, which must outlive it, and
+    has the same state, buttons, render mode and audio rate, but nothing
+    attached and no save. It is left on, so frames can be run on it right away
+    with gamegear_simulate_frame(), and it can be moved to other states of
+    the same game with gamegear_load_state().
+*/
+GameGear* gamegear_fork(const GameGear *gg)
+{
+    GameGear *fork = gamegear_create();
+    GGState *state = cr_malloc(sizeof(GGState));
+
+    memcpy(fork->mmu.rom_banks, gg->mmu.rom_banks,
+           sizeof(gg->mmu.rom_banks));
+    fork->mmu.bios_rom = gg->mmu.bios_rom;
+    vdp_set_render_mode(&fork->vdp, gg->vdp.render_mode);
+    psg_set_rate(&fork->psg, CPU_CLOCK_SPEED, gg->psg.rate);
+
+    gamegear_save_state(gg, state);
+    gamegear_load_state(fork, state);
+    gamegear_copy_input(fork, gg);
+    free(state);
+    return fork;
+}
+
 /*
     Load a ROM image into the GameGear object.
 
@@ -90,6 +157,59 @@ void gamegear_load_save(GameGear *gg, Save *save)
     mmu_load_save(&gg->mmu, save);
 }
 
+/*
+    Choose how the GameGear's VDP draws scanlines; see vdp_set_render_mode().
+
+    This can be called at any time, although it is cheapest before the first
+    frame, as switching modes redraws every scanline.
+*/
+void gamegear_set_render_mode(GameGear *gg, VDPRenderMode mode)
+{
+    vdp_set_render_mode(&gg->vdp, mode);
+}
+
+/*
+    Choose how gamegear_simulate() keeps frames in real time.
+
+    In deadline mode, it sleeps until each frame is due at the given rate. In
+    the other modes, the frame callback is expected to block (on the audio
+    device or the display), so the rate is only used for statistics.
+*/
+void gamegear_set_pacing(GameGear *gg, PaceMode mode, double fps)
+{
+    pacer_init(&gg->pacer, mode, fps);
+}
+
+/*
+    Run the GameGear faster than real time; see pacer_set_speed().
+
+    A speed of one is normal, and PACER_UNTHROTTLED runs as fast as possible.
+*/
+void gamegear_set_speed(GameGear *gg, unsigned speed)
+{
+    pacer_set_speed(&gg->pacer, speed);
+}
+
+/*
+    Fill in frame timing statistics for the current (or last) simulation.
+*/
+void gamegear_get_pacing_stats(const GameGear *gg, PacerStats *stats)
+{
+    pacer_get_stats(&gg->pacer, stats);
+}
+
+/*
+    Get the GameGear's running totals: cycles and instructions run, cycles
+    spent halted, and ROM bank switches.
+*/
+void gamegear_get_counters(const GameGear *gg, GGCounters *counters)
+{
+    counters->cycles = gg->cpu.cycles;
+    counters->instructions = gg->cpu.instructions;
+    counters->halted_cycles = gg->cpu.halted_cycles;
+    counters->bank_switches = gg->mmu.bank_switches;
+}
+
 /*
     Update the GameGear's button/joystick state.
 
@@ -104,6 +224,41 @@ void gamegear_input(GameGear *gg, GGButton button, bool state)
         io_set_button(&gg->io, button, state);
 }
 
+/*
+    Return the buttons currently held, as a mask with bit (1 << button) set
+    for each one.
+*/
+uint8_t gamegear_get_buttons(const GameGear *gg)
+{
+    return (~gg->io.buttons & 0x3F) | (!gg->io.start << BUTTON_START);
+}
+
+/*
+    Hold exactly the buttons in a mask from gamegear_get_buttons().
+*/
+void gamegear_set_buttons(GameGear *gg, uint8_t buttons)
+{
+    for (GGButton button = BUTTON_UP; button <= BUTTON_START; button++)
+        gamegear_input(gg, button, buttons & (1 << button));
+}
+
+/*
+    Give a GameGear the same buttons held as another one.
+*/
+void gamegear_copy_input(GameGear *gg, const GameGear *other)
+{
+    gg->io.buttons = other->io.buttons;
+    gg->io.start = other->io.start;
+}
+
+/*
+    Get statistics on how long events waited in the input queue.
+*/
+void gamegear_get_input_stats(const GameGear *gg, GGInputStats *stats)
+{
+    *stats = gg->input_stats;
+}
+
 /*
     Power on the GameGear.
 
@@ -114,13 +269,27 @@ static void power_on(GameGear *gg)
 {
     gg->exc_buffer[0] = '\0';
     gg->powered = true;
+    gg->line = 0;
+    gg->mid_line = false;
 
     mmu_power(&gg->mmu);
     vdp_power(&gg->vdp);
+    psg_power(&gg->psg);
     io_power(&gg->io);
     z80_power(&gg->cpu);
 }
 
+/*
+    Power on the GameGear without running it, so that frames can be run one at
+    a time with gamegear_simulate_frame(). If it is already on, this does
+    nothing.
+*/
+void gamegear_power_on(GameGear *gg)
+{
+    if (!gg->powered)
+        power_on(gg);
+}
+
 /*
     Power off the GameGear.
 
@@ -133,6 +302,36 @@ void gamegear_power_off(GameGear *gg)
     gg->powered = false;
 }
 
+/*
+    Take button presses from a queue of GGInputEvents, e.g. filled by another
+    thread, instead of (or as well as) gamegear_input().
+
+    The queue is checked between scanlines, so input lands as soon as the
+    emulator gets to it rather than once per frame. It is only ever read from
+    the thread running gamegear_simulate(). NULL (the default) detaches it.
+*/
+void gamegear_attach_input_queue(GameGear *gg, Ring *queue)
+{
+    gg->input = queue;
+}
+
+/*
+    Plug one end of a Gear-to-Gear cable into the GameGear's link port,
+    unplugging whatever was there; NULL (the default) just unplugs it.
+
+    The other end must be plugged into a GameGear run on another thread, and
+    each must be unplugged when it stops running, or the other will wait for
+    it forever.
+*/
+void gamegear_attach_link(GameGear *gg, struct LinkEnd *end)
+{
+    if (gg->link)
+        link_unplug(gg->link);
+    gg->link = end;
+    if (end)
+        link_plug(end, &gg->io);
+}
+
 /*
     Set a callback to be triggered whenever the GameGear completes a frame.
 
@@ -143,15 +342,65 @@ void gamegear_attach_callback(GameGear *gg, GGFrameCallback callback)
     gg->callback = callback;
 }
 
+/*
+    Measure where time goes while simulating, adding to the given profile.
+
+    Timing every scanline has a small cost of its own, so this is best left
+    off (NULL, the default) except when benchmarking.
+*/
+void gamegear_attach_profile(GameGear *gg, GGProfile *profile)
+{
+    gg->profile = profile;
+}
+
 /*
     Set a display to written to whenever the GameGear draws a pixel.
 
-    The array must be (GG_SCREEN_WIDTH * GG_SCREEN_HEIGHT) pixels large, where
+    The array must hold GG_SCREEN_HEIGHT rows of GG_SCREEN_WIDTH pixels, where
     each pixel is a 32-bit integer in ARGB order (i.e., A is the top 8 bits).
+    Rows are pitch bytes apart, which must be a multiple of four; this lets
+    the GameGear draw straight into e.g. a larger image or locked texture
+    memory. Use (GG_SCREEN_WIDTH * sizeof(uint32_t)) for a packed array.
+
+    The GameGear only redraws scanlines that have changed since the previous
+    frame, so the array must not be modified by anyone else while attached.
 */
-void gamegear_attach_display(GameGear *gg, uint32_t *pixels)
+void gamegear_attach_display(GameGear *gg, uint32_t *pixels, size_t pitch)
 {
     gg->vdp.pixels = pixels;
+    gg->vdp.pitch = pitch / sizeof(uint32_t);
+    vdp_draw_indexed(&gg->vdp, NULL, NULL);
+}
+
+/*
+    Set an indexed display to be written to instead of ARGB pixels.
+
+    indices must be (GG_SCREEN_WIDTH * GG_SCREEN_HEIGHT) bytes large; each
+    byte is the CRAM entry (0-31) of one pixel. palettes must hold
+    (GG_SCREEN_HEIGHT * GG_PALETTE_SIZE) colors: for each line, the BGR444
+    color of every CRAM entry while it was drawn. gamegear_expand_line() turns
+    a line of this into ARGB pixels.
+
+    The same rule about modifying the arrays applies as with
+    gamegear_attach_display().
+*/
+void gamegear_attach_indexed_display(GameGear *gg, uint8_t *indices,
+    uint16_t *palettes)
+{
+    gg->vdp.pixels = NULL;
+    vdp_draw_indexed(&gg->vdp, indices, palettes);
+}
+
+/*
+    Convert the given line of an indexed display into ARGB pixels.
+
+    The output array must be GG_SCREEN_WIDTH pixels large.
+*/
+void gamegear_expand_line(const uint8_t *indices, const uint16_t *palettes,
+    uint8_t line, uint32_t *pixels)
+{
+    vdp_expand_line(indices  + line * GG_SCREEN_WIDTH,
+                    palettes + line * GG_PALETTE_SIZE, pixels);
 }
 
 /*
@@ -162,68 +411,386 @@ void gamegear_attach_display(GameGear *gg, uint32_t *pixels)
 void gamegear_detach(GameGear *gg)
 {
     gg->callback = NULL;
+    gg->profile = NULL;
     gg->vdp.pixels = NULL;
+    vdp_draw_indexed(&gg->vdp, NULL, NULL);
 }
 
 /*
-    Simulate the GameGear for one frame.
+    Set the sample rate of the GameGear's audio output, in Hz.
 
-    This function simulates the number of clock cycles corresponding to 1/60th
-    of a second. The return value indicates whether an exception flag has been
-    set somewhere. If true, emulation must be stopped.
+    Samples already generated are kept. The rate can be nudged slightly while
+    running to keep the output in step with an audio device.
 */
-static bool simulate_frame(GameGear *gg)
+void gamegear_set_audio_rate(GameGear *gg, double rate)
 {
-    size_t line;
-    bool except;
+    psg_set_rate(&gg->psg, CPU_CLOCK_SPEED, rate);
+}
 
-    for (line = 0; line < VDP_LINES_PER_FRAME; line++) {
-        except = z80_do_cycles(&gg->cpu, CYCLES_PER_LINE);
-        if (except)
-            return true;
+/*
+    Read up to count stereo samples of audio output, returning the number read.
+
+    Samples are signed 16-bit integers interleaved left-right, so the array
+    must hold (2 * count) values. Audio is generated once per frame; if it
+    isn't read, the oldest samples are dropped.
+*/
+size_t gamegear_read_audio(GameGear *gg, int16_t *samples, size_t count)
+{
+    return psg_read_samples(&gg->psg, samples, count);
+}
+
+/*
+    Return which scanlines of the display were redrawn during the last frame.
+
+    The returned array has GG_SCREEN_HEIGHT elements, one per line, and is
+    owned by the GameGear. Lines that are false hold the same pixels as they
+    did in the frame before; frontends can use this to avoid re-uploading them.
+*/
+const bool* gamegear_get_dirty_lines(const GameGear *gg)
+{
+    return gg->vdp.dirty_lines;
+}
+
+/*
+    Apply any button presses waiting in the input queue.
+*/
+static void poll_input(GameGear *gg)
+{
+    GGInputStats *stats = &gg->input_stats;
+    GGInputEvent event;
+
+    while (ring_read(gg->input, &event, 1)) {
+        gamegear_input(gg, event.button, event.state);
+
+        uint64_t delay = get_time_ns() - event.time;
+        stats->events++;
+        stats->total += delay;
+        if (delay > stats->max)
+            stats->max = delay;
+    }
+}
+
+/*
+    Keep a linked GameGear in step with the other end of its cable, taking
+    an NMI if a serial byte that asked for one came in.
+*/
+static void sync_link(GameGear *gg)
+{
+    link_sync(gg->link);
+    if (gg->io.nmi) {
+        gg->io.nmi = false;
+        z80_nmi(&gg->cpu);
+    }
+}
+
+/*
+    Start a scanline: apply any queued input, and give the CPU the line's
+    share of cycles, less (or plus) what the previous line ran over (or had
+    left over).
+*/
+static void start_line(GameGear *gg)
+{
+    if (gg->input)
+        poll_input(gg);
+    gg->line_left = CYCLES_PER_LINE + gg->cpu.pending_cycles;
+    gg->cpu.pending_cycles = 0;
+    gg->mid_line = true;
+}
+
+/*
+    Run the CPU for the given number of cycles, timing it if we are
+    profiling. Return whether an exception flag has been set.
+*/
+static bool run_cpu(GameGear *gg, double cycles)
+{
+    if (!gg->profile)
+        return z80_do_cycles(&gg->cpu, cycles);
+
+    uint64_t start = get_time_ns();
+    bool except = z80_do_cycles(&gg->cpu, cycles);
+    gg->profile->cpu += get_time_ns() - start;
+    return except;
+}
+
+/*
+    Finish a frame: render what is left of it and generate its audio.
+*/
+static void end_frame(GameGear *gg)
+{
+    GGProfile *profile = gg->profile;
+
+    if (!profile) {
+        vdp_sync(&gg->vdp);
+        psg_sync(&gg->psg);
+        return;
+    }
+
+    uint64_t start = get_time_ns();
+    vdp_sync(&gg->vdp);
+    uint64_t end = get_time_ns();
+    profile->vdp += end - start;
+    psg_sync(&gg->psg);
+    profile->psg += get_time_ns() - end;
+    profile->frames++;
+}
+
+/*
+    Finish a scanline once the CPU has run all of its cycles. Return whether
+    it was the last one of the frame.
+*/
+static bool end_line(GameGear *gg)
+{
+    if (gg->profile) {
+        uint64_t start = get_time_ns();
+        vdp_simulate_line(&gg->vdp);
+        gg->profile->vdp += get_time_ns() - start;
+    } else {
         vdp_simulate_line(&gg->vdp);
     }
-    return false;
+    if (gg->link)
+        sync_link(gg);
+
+    gg->mid_line = false;
+    if (++gg->line < VDP_LINES_PER_FRAME)
+        return false;
+    gg->line = 0;
+    end_frame(gg);
+    return true;
+}
+
+/*
+    Simulate the GameGear for up to the given number of CPU cycles and
+    scanlines (finishing the one in progress counts as one), stopping early
+    at the end of a frame if asked to, or when the CPU's watch fires.
+
+    A line's cycles can be run in any number of pieces; only the last piece
+    finishes the line. Budgets are whole cycles and a line's share is always
+    taken off exactly, so however a frame is cut up, the CPU runs the same
+    instructions between the same scanlines as it would running the frame
+    in one go.
+*/
+static GGRunReason run(GameGear *gg, double cycles, uint64_t lines,
+    bool frame)
+{
+    if (!gg->powered)
+        return GG_RUN_OFF;
+    if (gg->cpu.except)
+        return GG_RUN_EXCEPTION;
+
+    while (cycles > 0 && lines > 0) {
+        if (!gg->mid_line)
+            start_line(gg);
+
+        double give = gg->line_left < cycles ? gg->line_left : cycles;
+        bool except = run_cpu(gg, give);
+        gg->line_left -= give;
+        cycles -= give;
+
+        // Hand back the cycles the CPU didn't get to (or, after an
+        // exception, took over the budget), so it stops in the same state
+        // however the line was cut up:
+        bool stopped = gg->cpu.stopped;
+        if ((stopped && gg->cpu.pending_cycles > 0) || except) {
+            gg->line_left += gg->cpu.pending_cycles;
+            cycles += gg->cpu.pending_cycles;
+            gg->cpu.pending_cycles = 0;
+        }
+        if (except)
+            return GG_RUN_EXCEPTION;
+
+        if (gg->line_left <= 0) {
+            bool ended = end_line(gg);
+            lines--;
+            if (!gg->powered)
+                return GG_RUN_OFF;
+            if (ended && frame)
+                return stopped ? GG_RUN_BREAK : GG_RUN_FRAME;
+        }
+        if (stopped)
+            return GG_RUN_BREAK;
+    }
+    return GG_RUN_BUDGET;
+}
+
+/*
+    Call the frame callback, timing it if we are profiling.
+*/
+static void run_callback(GameGear *gg)
+{
+    if (gg->profile) {
+        uint64_t start = get_time_ns();
+        gg->callback(gg);
+        gg->profile->callback += get_time_ns() - start;
+    } else {
+        gg->callback(gg);
+    }
 }
 
 /*
     Simulate the GameGear.
 
-    The GameGear must start out in an unpowered state; it will be powered only
-    during the simulation. This function blocks until the simulation ends,
-    either by an exception occurring or someone calling gamegear_power_off().
+    The GameGear is powered on at the start, unless it is already on (because
+    a state was loaded), in which case it carries on from there; it will be
+    powered only during the simulation. This function blocks until the
+    simulation ends, either by an exception occurring or someone calling
+    gamegear_power_off().
 
     If a callback has been set with gamegear_set_callback(), then we'll trigger
-    it after every frame has been simulated (sixty times per second).
+    it after every frame has been simulated (sixty times per second, unless
+    changed with gamegear_set_pacing()).
 
     Exceptions can be retrieved after this call with gamegear_get_exception().
     If the simulation ended normally, then that function will return NULL.
 */
 void gamegear_simulate(GameGear *gg)
 {
-    if (gg->powered)
-        return;
-
-    DEBUG("GameGear: powering on")
-    power_on(gg);
+    if (!gg->powered) {
+        DEBUG("GameGear: powering on")
+        power_on(gg);
+    }
 
+    pacer_reset(&gg->pacer);
     while (gg->powered) {
-        uint64_t start = get_time_ns(), delta;
-
-        if (simulate_frame(gg) || !gg->powered)
+        if (run(gg, INFINITY, UINT64_MAX, true) != GG_RUN_FRAME)
             break;
         if (gg->callback)
-            gg->callback(gg);
-
-        delta = get_time_ns() - start;
-        if (delta < NS_PER_FRAME)
-            usleep((NS_PER_FRAME - delta) / 1000);
+            run_callback(gg);
+        pacer_wait(&gg->pacer);
     }
 
     DEBUG("GameGear: powering off")
     gamegear_power_off(gg);
 }
 
+/*
+    Simulate a single frame, without calling the frame callback or waiting.
+
+    This is meant to be called from within the frame callback, e.g. to run
+    ahead of the frame being shown; the GameGear must be powered on. Return
+    false if an exception occurred (or it was powered off meanwhile).
+*/
+bool gamegear_simulate_frame(GameGear *gg)
+{
+    return gamegear_run_frame(gg) == GG_RUN_FRAME;
+}
+
+/*
+    Run the GameGear for the given number of CPU cycles, without calling the
+    frame callback or waiting; frames are finished along the way as usual.
+
+    The last instruction may run over the budget by a few cycles, which are
+    then taken off the next call's, so that many small budgets add up to the
+    same as one large one. Return GG_RUN_BUDGET when done.
+*/
+GGRunReason gamegear_run_cycles(GameGear *gg, uint64_t cycles)
+{
+    return run(gg, cycles, UINT64_MAX, false);
+}
+
+/*
+    Run the GameGear to the end of the given number of scanlines, like
+    gamegear_run_cycles(); if one was left partly run, it is the first.
+*/
+GGRunReason gamegear_run_lines(GameGear *gg, unsigned lines)
+{
+    return run(gg, INFINITY, lines, false);
+}
+
+/*
+    Run the GameGear to the end of the current frame, returning GG_RUN_FRAME.
+*/
+GGRunReason gamegear_run_frame(GameGear *gg)
+{
+    return run(gg, INFINITY, UINT64_MAX, true);
+}
+
+/*
+    CPU watch for gamegear_run_until().
+*/
+static bool check_until(void *arg)
+{
+    const GameGear *gg = arg;
+    return gg->until(gg, gg->until_arg);
+}
+
+/*
+    Run the GameGear until the given predicate, called with arg after every
+    instruction, returns true (GG_RUN_BREAK), or else to the end of the
+    current frame (GG_RUN_FRAME), for a debugger to check breakpoints or
+    step one instruction at a time. The predicate may look at the GameGear,
+    but not change it.
+
+    This is slower than the other gamegear_run_*() functions, but leaves the
+    GameGear in a state they can carry on from exactly.
+*/
+GGRunReason gamegear_run_until(GameGear *gg, GGPredicate predicate,
+    void *arg)
+{
+    GGRunReason reason;
+
+    gg->until = predicate;
+    gg->until_arg = arg;
+    z80_set_watch(&gg->cpu, check_until, gg);
+    reason = run(gg, INFINITY, UINT64_MAX, true);
+    z80_set_watch(&gg->cpu, NULL, NULL);
+    gg->until = NULL;
+    gg->until_arg = NULL;
+    return reason;
+}
+
+/*
+    Return the scanline the GameGear is on, from 0 to VDP_LINES_PER_FRAME - 1
+    (0 between frames). This counts lines as they are run, unlike the VDP's
+    V counter.
+*/
+unsigned gamegear_get_line(const GameGear *gg)
+{
+    return gg->line;
+}
+
+/*
+    Take a snapshot of the GameGear's state.
+
+    This is cheap enough (a few microseconds; cartridge RAM and buffered audio
+    are only copied as far as they are used) to do every frame. It may also be
+    done partway through a frame run a piece at a time with the
+    gamegear_run_*() functions, e.g. when a debugger stops on a breakpoint;
+    the scanline and the cycles left of it are kept too. See state.h to save
+    snapshots to files.
+*/
+void gamegear_save_state(const GameGear *gg, GGState *state)
+{
+    z80_save_state(&gg->cpu, &state->cpu);
+    mmu_save_state(&gg->mmu, &state->mmu);
+    vdp_save_state(&gg->vdp, &state->vdp);
+    psg_save_state(&gg->psg, &state->psg);
+    io_save_state(&gg->io, &state->io);
+    state->line = gg->line;
+    state->mid_line = gg->mid_line;
+    state->line_left = gg->mid_line ? gg->line_left : 0;
+}
+
+/*
+    Restore a snapshot taken by gamegear_save_state().
+
+    The GameGear must have the same ROM and BIOS loaded as when the snapshot
+    was taken. Button states are kept as they are. If the GameGear is off, it
+    is left on, so that gamegear_simulate() resumes from the snapshot.
+*/
+void gamegear_load_state(GameGear *gg, const GGState *state)
+{
+    gg->powered = true;
+    gg->line = state->line;
+    gg->mid_line = state->mid_line;
+    gg->line_left = state->line_left;
+    gg->exc_buffer[0] = '\0';
+    z80_load_state(&gg->cpu, &state->cpu);
+    mmu_load_state(&gg->mmu, &state->mmu);
+    vdp_load_state(&gg->vdp, &state->vdp);
+    psg_load_state(&gg->psg, &state->psg);
+    io_load_state(&gg->io, &state->io);
+}
+
 /*
     If an exception flag has been set in the GameGear, return the reason.
 
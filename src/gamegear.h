@@ -4,11 +4,14 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "io.h"
 #include "mmu.h"
+#include "pacer.h"
 #include "psg.h"
+#include "ring.h"
 #include "rom.h"
 #include "save.h"
 #include "z80.h"
@@ -19,6 +22,7 @@
 #define GG_PIXEL_HEIGHT 7
 #define GG_LOGICAL_WIDTH  (GG_SCREEN_WIDTH  * GG_PIXEL_WIDTH)
 #define GG_LOGICAL_HEIGHT (GG_SCREEN_HEIGHT * GG_PIXEL_HEIGHT)
+#define GG_PALETTE_SIZE VDP_PALETTE_SIZE
 
 #define GG_FPS 60
 #define GG_EXC_BUFF_SIZE 128
@@ -27,17 +31,22 @@
 
 struct GameGear;
 typedef void (*GGFrameCallback)(struct GameGear*);
+typedef bool (*GGPredicate)(const struct GameGear*, void*);
 
-typedef struct GameGear {
-    Z80 cpu;
-    MMU mmu;
-    VDP vdp;
-    PSG psg;
-    IO io;
-    bool powered;
-    GGFrameCallback callback;
-    char exc_buffer[GG_EXC_BUFF_SIZE];
-} GameGear;
+/*
+    Why one of the gamegear_run_*() functions returned: it ran what it was
+    asked to (GG_RUN_BUDGET), it finished a frame (GG_RUN_FRAME), the
+    predicate given to gamegear_run_until() came true (GG_RUN_BREAK), the
+    CPU raised an exception (GG_RUN_EXCEPTION; see gamegear_get_exception()),
+    or the GameGear is off (GG_RUN_OFF).
+*/
+typedef enum {
+    GG_RUN_BUDGET,
+    GG_RUN_FRAME,
+    GG_RUN_BREAK,
+    GG_RUN_EXCEPTION,
+    GG_RUN_OFF
+} GGRunReason;
 
 typedef enum {
     BUTTON_UP        = 0,
@@ -49,20 +58,125 @@ typedef enum {
     BUTTON_START
 } GGButton;
 
+/*
+    A button press or release, as sent through an input queue attached with
+    gamegear_attach_input_queue(). The time is when it happened, from
+    get_time_ns().
+*/
+typedef struct {
+    uint64_t time;
+    GGButton button;
+    bool state;
+} GGInputEvent;
+
+/*
+    How long events from the input queue waited before being applied, in
+    nanoseconds.
+*/
+typedef struct {
+    uint64_t events;
+    uint64_t total, max;
+} GGInputStats;
+
+/*
+    Wall time spent in each part of the emulator, in nanoseconds, while a
+    profile is attached with gamegear_attach_profile().
+*/
+typedef struct {
+    uint64_t frames;
+    uint64_t cpu, vdp, psg, callback;
+} GGProfile;
+
+/*
+    Running totals kept by the emulator at all times, cheap enough that they
+    need no profile attached.
+*/
+typedef struct {
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t halted_cycles;
+    uint64_t bank_switches;
+} GGCounters;
+
+/*
+    A snapshot of everything needed to resume emulation exactly where it was,
+    as taken by gamegear_save_state(), including how far into the frame it
+    was. The ROM, BIOS and attached displays and callbacks are not included.
+*/
+typedef struct {
+    Z80State cpu;
+    MMUState mmu;
+    VDPState vdp;
+    PSGState psg;
+    IOState io;
+    uint16_t line;
+    bool     mid_line;
+    double   line_left;
+} GGState;
+
+typedef struct GameGear {
+    Z80 cpu;
+    MMU mmu;
+    VDP vdp;
+    PSG psg;
+    IO io;
+    Pacer pacer;
+    bool powered;
+    GGFrameCallback callback;
+    GGProfile *profile;
+    Ring *input;
+    GGInputStats input_stats;
+    struct LinkEnd *link;
+    unsigned line;
+    bool mid_line;
+    double line_left;
+    GGPredicate until;
+    void *until_arg;
+    char exc_buffer[GG_EXC_BUFF_SIZE];
+} GameGear;
+
 /* Functions */
 
 GameGear* gamegear_create();
 void gamegear_destroy(GameGear*);
+void gamegear_reset(GameGear*);
+GameGear* gamegear_fork(const GameGear*);
 void gamegear_load_rom(GameGear*, const ROM*);
 void gamegear_load_bios(GameGear*, const BIOS*);
 void gamegear_load_save(GameGear*, Save*);
+void gamegear_set_render_mode(GameGear*, VDPRenderMode);
+void gamegear_set_pacing(GameGear*, PaceMode, double);
+void gamegear_set_speed(GameGear*, unsigned);
+void gamegear_get_pacing_stats(const GameGear*, PacerStats*);
+void gamegear_get_counters(const GameGear*, GGCounters*);
 void gamegear_simulate(GameGear*);
+bool gamegear_simulate_frame(GameGear*);
+GGRunReason gamegear_run_cycles(GameGear*, uint64_t);
+GGRunReason gamegear_run_lines(GameGear*, unsigned);
+GGRunReason gamegear_run_frame(GameGear*);
+GGRunReason gamegear_run_until(GameGear*, GGPredicate, void*);
+unsigned gamegear_get_line(const GameGear*);
+void gamegear_save_state(const GameGear*, GGState*);
+void gamegear_load_state(GameGear*, const GGState*);
 void gamegear_input(GameGear*, GGButton, bool);
+uint8_t gamegear_get_buttons(const GameGear*);
+void gamegear_set_buttons(GameGear*, uint8_t);
+void gamegear_copy_input(GameGear*, const GameGear*);
+void gamegear_get_input_stats(const GameGear*, GGInputStats*);
+void gamegear_power_on(GameGear*);
 void gamegear_power_off(GameGear*);
 
 void gamegear_attach_callback(GameGear*, GGFrameCallback);
-void gamegear_attach_display(GameGear*, uint32_t*);
+void gamegear_attach_profile(GameGear*, GGProfile*);
+void gamegear_attach_input_queue(GameGear*, Ring*);
+void gamegear_attach_link(GameGear*, struct LinkEnd*);
+void gamegear_attach_display(GameGear*, uint32_t*, size_t);
+void gamegear_attach_indexed_display(GameGear*, uint8_t*, uint16_t*);
+void gamegear_expand_line(const uint8_t*, const uint16_t*, uint8_t, uint32_t*);
 void gamegear_detach(GameGear*);
+const bool* gamegear_get_dirty_lines(const GameGear*);
+void gamegear_set_audio_rate(GameGear*, double);
+size_t gamegear_read_audio(GameGear*, int16_t*, size_t);
 
 const char* gamegear_get_exception(GameGear*);
 void gamegear_print_state(const GameGear*);
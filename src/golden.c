@@ -0,0 +1,453 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "golden.h"
+#include "gamegear.h"
+#include "logging.h"
+#include "movie.h"
+#include "util.h"
+
+static const char *MAGIC = "CRFHASH\x1A";
+#define MAGIC_LEN 8
+#define STREAM_HEADER_SIZE 24
+#define FLAG_AUDIO 0x0001
+#define FLAG_RAM   0x0002
+
+#define BANDS (GG_SCREEN_HEIGHT / GOLDEN_BAND_LINES)
+#define BAND_PIXELS (GOLDEN_BAND_LINES * GG_SCREEN_WIDTH)
+#define AUDIO_CHUNK 1024
+
+/*
+    Hashes of one frame. Each band of the screen also gets a short hash of its
+    own, so that a frame that differs can be narrowed down to the lines that
+    do.
+*/
+typedef struct {
+    uint64_t video;
+    uint16_t bands[BANDS];
+    uint64_t audio;
+    uint64_t ram;
+} FrameHashes;
+
+/*
+    State shared with the frame callback during a run. Frames are either
+    written to out as they finish, or compared against expected, stopping at
+    the first one that differs.
+*/
+static struct {
+    unsigned long frame, frames;
+    unsigned flags;
+    uint32_t *pixels;
+    uint64_t band_hashes[BANDS];
+    FrameHashes current;
+    const FrameHashes *expected;
+    bool diverged;
+    FILE *out;
+    Movie *movie;
+    int16_t audio[2 * AUDIO_CHUNK];
+} golden;
+
+/*
+    Return the size of each frame's record in a stream with the given flags.
+*/
+static size_t record_size(unsigned flags)
+{
+    return 8 + 2 * BANDS + (flags & FLAG_AUDIO ? 8 : 0) +
+           (flags & FLAG_RAM ? 8 : 0);
+}
+
+/*
+    Hash the frame the GameGear just finished.
+
+    Only bands with a line that was redrawn are hashed again; the rest of the
+    screen is the same as in the frame before. Audio is read out and hashed
+    whether or not it is kept, so that the PSG never fills up.
+*/
+static void hash_frame(GameGear *gg, FrameHashes *hashes)
+{
+    const bool *dirty = gamegear_get_dirty_lines(gg);
+
+    for (int band = 0; band < BANDS; band++) {
+        for (int line = 0; line < GOLDEN_BAND_LINES; line++) {
+            if (dirty[band * GOLDEN_BAND_LINES + line]) {
+                golden.band_hashes[band] = hash64(
+                    golden.pixels + band * BAND_PIXELS,
+                    BAND_PIXELS * sizeof(uint32_t), 0);
+                break;
+            }
+        }
+        hashes->bands[band] = golden.band_hashes[band];
+    }
+    hashes->video = hash64(golden.band_hashes, sizeof(golden.band_hashes), 0);
+
+    size_t count;
+    hashes->audio = 0;
+    while ((count = gamegear_read_audio(gg, golden.audio, AUDIO_CHUNK))) {
+        if (golden.flags & FLAG_AUDIO)
+            hashes->audio = hash64(golden.audio,
+                2 * count * sizeof(int16_t), hashes->audio);
+    }
+
+    hashes->ram = 0;
+    if (golden.flags & FLAG_RAM) {
+        hashes->ram = hash64(gg->mmu.system_ram, MMU_SYSTEM_RAM_SIZE, 0);
+        if (gg->mmu.cart_ram)
+            hashes->ram = hash64(gg->mmu.cart_ram, MMU_CART_RAM_SIZE,
+                                 hashes->ram);
+    }
+}
+
+/*
+    Write a frame's hashes to the stream.
+*/
+static void write_record(FILE *fp, const FrameHashes *hashes)
+{
+    write_le(fp, hashes->video, 8);
+    for (int band = 0; band < BANDS; band++)
+        write_le(fp, hashes->bands[band], 2);
+    if (golden.flags & FLAG_AUDIO)
+        write_le(fp, hashes->audio, 8);
+    if (golden.flags & FLAG_RAM)
+        write_le(fp, hashes->ram, 8);
+}
+
+/*
+    Read a frame's hashes from a stream, in the same layout as write_record().
+*/
+static void read_record(const uint8_t *buf, FrameHashes *hashes)
+{
+    hashes->video = read_le(buf, 8);
+    buf += 8;
+    for (int band = 0; band < BANDS; band++, buf += 2)
+        hashes->bands[band] = read_le(buf, 2);
+    hashes->audio = hashes->ram = 0;
+    if (golden.flags & FLAG_AUDIO) {
+        hashes->audio = read_le(buf, 8);
+        buf += 8;
+    }
+    if (golden.flags & FLAG_RAM)
+        hashes->ram = read_le(buf, 8);
+}
+
+/*
+    GameGear callback for hashing runs.
+*/
+static void golden_callback(GameGear *gg)
+{
+    FrameHashes *hashes = &golden.current;
+
+    hash_frame(gg, hashes);
+    if (golden.out) {
+        write_record(golden.out, hashes);
+    } else {
+        const FrameHashes *expected = &golden.expected[golden.frame];
+        if (hashes->video != expected->video ||
+                hashes->audio != expected->audio ||
+                hashes->ram != expected->ram) {
+            golden.diverged = true;
+            gamegear_power_off(gg);
+            return;
+        }
+    }
+
+    golden.frame++;
+    if (golden.movie)
+        movie_play(golden.movie, gg);
+    if (golden.frame >= golden.frames)
+        gamegear_power_off(gg);
+}
+
+/*
+    Emulate the ROM from power-on, or from the start of the movie being
+    played, as fast as possible, hashing each frame until golden.frames have
+    run or one differs from what was expected.
+
+    Return whether the run finished without an exception.
+*/
+static bool run_emulator(const ROM *rom, const Config *config)
+{
+    GameGear *gg = gamegear_create();
+    BIOS *bios = NULL;
+    bool ok = true;
+
+    if (config->bios_path && !(bios = bios_open(config->bios_path))) {
+        gamegear_destroy(gg);
+        return false;
+    }
+
+    golden.frame = 0;
+    golden.diverged = false;
+    golden.pixels = cr_calloc(GG_SCREEN_WIDTH * GG_SCREEN_HEIGHT,
+                              sizeof(uint32_t));
+    for (int band = 0; band < BANDS; band++)
+        golden.band_hashes[band] = hash64(golden.pixels + band * BAND_PIXELS,
+            BAND_PIXELS * sizeof(uint32_t), 0);
+
+    gamegear_set_render_mode(gg, config->render_mode);
+    gamegear_set_speed(gg, PACER_UNTHROTTLED);
+    gamegear_attach_callback(gg, golden_callback);
+    gamegear_attach_display(gg, golden.pixels,
+                            GG_SCREEN_WIDTH * sizeof(uint32_t));
+    gamegear_load_rom(gg, rom);
+    if (bios)
+        gamegear_load_bios(gg, bios);
+    if (golden.movie)
+        movie_begin(golden.movie, gg);
+    gamegear_simulate(gg);
+
+    if (gamegear_get_exception(gg)) {
+        ERROR("caught exception: %s", gamegear_get_exception(gg))
+        ok = false;
+    }
+    gamegear_destroy(gg);
+    if (bios)
+        bios_close(bios);
+    return ok;
+}
+
+/*
+    Load the movie to play during the run, if there is one. Return whether it
+    worked.
+*/
+static bool load_movie(const ROM *rom, const Config *config, Movie *movie)
+{
+    golden.movie = NULL;
+    if (!config->play_path)
+        return true;
+    golden.movie = movie;
+    return movie_load(movie, config->play_path, rom);
+}
+
+/*
+    Free the movie and the screen used during the run.
+*/
+static void free_run()
+{
+    if (golden.movie)
+        movie_free(golden.movie);
+    free(golden.pixels);
+    golden.movie = NULL;
+    golden.pixels = NULL;
+}
+
+/*
+    Emulate a ROM without a frontend and write a hash of each frame to the
+    file at config->hashes_path, for checking later runs against with
+    golden_check().
+
+    The screen is always hashed; each frame's audio and RAM are too, if asked
+    for. The run lasts for config->frames, or else as long as the movie at
+    config->play_path. Return whether it worked.
+*/
+bool golden_write(const ROM *rom, const Config *config)
+{
+    Movie movie;
+    bool ok = false;
+
+    golden.out = NULL;
+    golden.expected = NULL;
+    golden.flags = (config->hash_audio ? FLAG_AUDIO : 0) |
+                   (config->hash_ram ? FLAG_RAM : 0);
+    if (!load_movie(rom, config, &movie))
+        goto cleanup;
+    golden.frames = config->frames ? config->frames : movie.frames;
+
+    if (!(golden.out = fopen(config->hashes_path, "wb"))) {
+        ERROR_ERRNO("couldn't write frame hashes to '%s'", config->hashes_path)
+        goto cleanup;
+    }
+    fwrite(MAGIC, 1, MAGIC_LEN, golden.out);
+    write_le(golden.out, GOLDEN_VERSION, 2);
+    write_le(golden.out, golden.flags, 2);
+    write_le(golden.out, rom->product_code, 4);
+    write_le(golden.out, rom->expected_checksum, 2);
+    write_le(golden.out, 0, 2);
+    write_le(golden.out, rom->size, 4);
+
+    ok = run_emulator(rom, config);
+    bool written = !ferror(golden.out);
+    if (fclose(golden.out) || !written) {
+        ERROR_ERRNO("couldn't write frame hashes to '%s'", config->hashes_path)
+        ok = false;
+    }
+    golden.out = NULL;
+    if (ok)
+        printf("crater: wrote hashes of %lu frames to %s\n", golden.frame,
+               config->hashes_path);
+
+    cleanup:
+    free_run();
+    return ok;
+}
+
+/*
+    Load a stream written by golden_write() into golden.expected, setting
+    golden.flags and golden.frames to match.
+
+    NULL will be returned if the stream is valid. Otherwise, an error string
+    will be returned.
+*/
+static const char* load_stream(const char *path, const ROM *rom)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp)
+        return "couldn't open the file";
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+    if (size < STREAM_HEADER_SIZE) {
+        fclose(fp);
+        return "too short";
+    }
+
+    uint8_t *buf = cr_malloc(size);
+    bool read = fread(buf, 1, size, fp) == (size_t) size;
+    fclose(fp);
+
+    const char *error = NULL;
+    if (!read)
+        error = "couldn't read the entire file";
+    else if (memcmp(buf, MAGIC, MAGIC_LEN))
+        error = "invalid header (was this file created by crater?)";
+    else if (read_le(buf + 8, 2) != GOLDEN_VERSION)
+        error = "unknown or unsupported version";
+    else if (read_le(buf + 12, 4) != rom->product_code ||
+             read_le(buf + 16, 2) != rom->expected_checksum ||
+             read_le(buf + 20, 4) != rom->size)
+        error = "hashes were written for a different ROM";
+    if (error) {
+        free(buf);
+        return error;
+    }
+
+    golden.flags = read_le(buf + 10, 2);
+    size_t rsize = record_size(golden.flags);
+    golden.frames = (size - STREAM_HEADER_SIZE) / rsize;
+    if ((size - STREAM_HEADER_SIZE) % rsize || !golden.frames) {
+        free(buf);
+        return "file is truncated";
+    }
+
+    FrameHashes *expected;
+    golden.expected = expected = cr_malloc(
+        sizeof(FrameHashes) * golden.frames);
+    for (unsigned long i = 0; i < golden.frames; i++)
+        read_record(buf + STREAM_HEADER_SIZE + i * rsize, &expected[i]);
+    free(buf);
+    return NULL;
+}
+
+/*
+    Save the frame that differed as a PPM image. Bands of the screen that
+    match the expected frame are dimmed, leaving the ones that differ as they
+    were drawn.
+*/
+static void write_diff_image(const char *path, const bool *differs)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        ERROR_ERRNO("couldn't write diff image to '%s'", path)
+        return;
+    }
+
+    fprintf(fp, "P6\n%d %d\n255\n", GG_SCREEN_WIDTH, GG_SCREEN_HEIGHT);
+    for (int i = 0; i < GG_SCREEN_WIDTH * GG_SCREEN_HEIGHT; i++) {
+        uint32_t pixel = golden.pixels[i];
+        int shift = differs[i / BAND_PIXELS] ? 0 : 2;
+        fputc(((pixel >> 16) & 0xFF) >> shift, fp);
+        fputc(((pixel >> 8) & 0xFF) >> shift, fp);
+        fputc((pixel & 0xFF) >> shift, fp);
+    }
+    bool written = !ferror(fp);
+    if (fclose(fp) || !written)
+        ERROR_ERRNO("couldn't write diff image to '%s'", path)
+    else
+        printf("crater: saved frame as %s\n", path);
+}
+
+/*
+    Describe how the frame that diverged differs from the expected one, and
+    save it as an image next to the stream.
+*/
+static void report_divergence(const char *path)
+{
+    const FrameHashes *hashes = &golden.current,
+                      *expected = &golden.expected[golden.frame];
+    bool differs[BANDS];
+
+    printf("crater: frame %lu differs:", golden.frame + 1);
+    if (hashes->video != expected->video) {
+        printf(" video (lines");
+        for (int band = 0; band < BANDS; band++) {
+            differs[band] = hashes->bands[band] != expected->bands[band];
+            if (differs[band])
+                printf(" %d-%d", band * GOLDEN_BAND_LINES,
+                       (band + 1) * GOLDEN_BAND_LINES - 1);
+        }
+        printf(")");
+    } else {
+        memset(differs, 0, sizeof(differs));
+    }
+    if (hashes->audio != expected->audio)
+        printf(" audio");
+    if (hashes->ram != expected->ram)
+        printf(" RAM");
+    printf("\n");
+
+    char *image = cr_malloc(sizeof(char) *
+        (strlen(path) + strlen(".diff.ppm") + 1));
+    strcpy(image, path);
+    strcat(image, ".diff.ppm");
+    write_diff_image(image, differs);
+    free(image);
+}
+
+/*
+    Emulate a ROM without a frontend, checking each frame against the stream
+    at config->check_path written by golden_write(). Playing the same movie
+    (if any) as when it was written, the run should match it exactly.
+
+    The run stops at the first frame that differs, saving it as an image with
+    the parts of the screen that differ highlighted. It lasts for the length
+    of the stream, or config->frames if that is shorter. Return whether every
+    frame matched.
+*/
+bool golden_check(const ROM *rom, const Config *config)
+{
+    Movie movie;
+    bool ok = false;
+
+    golden.out = NULL;
+    const char *error = load_stream(config->check_path, rom);
+    if (error) {
+        ERROR("couldn't load frame hashes from '%s': %s", config->check_path,
+              error)
+        return false;
+    }
+    if (config->frames && config->frames < golden.frames)
+        golden.frames = config->frames;
+    if (!load_movie(rom, config, &movie))
+        goto cleanup;
+
+    if (run_emulator(rom, config)) {
+        if (golden.diverged) {
+            report_divergence(config->check_path);
+        } else if (golden.frame < golden.frames) {
+            ERROR("stopped after %lu of %lu frames", golden.frame,
+                  golden.frames)
+        } else {
+            printf("crater: all %lu frames match\n", golden.frames);
+            ok = true;
+        }
+    }
+
+    cleanup:
+    free_run();
+    free((FrameHashes*) golden.expected);
+    golden.expected = NULL;
+    return ok;
+}
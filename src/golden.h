@@ -0,0 +1,17 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdbool.h>
+
+#include "config.h"
+#include "rom.h"
+
+#define GOLDEN_VERSION 1
+#define GOLDEN_BAND_LINES 16  // Scanlines per band of the screen
+
+/* Functions */
+
+bool golden_write(const ROM*, const Config*);
+bool golden_check(const ROM*, const Config*);
@@ -0,0 +1,174 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "hud.h"
+#include "util.h"
+
+#define NS_PER_SEC 1000000000
+#define NS_PER_MS 1e6
+
+#define HUD_LEFT 1
+#define GLYPH_WIDTH 3
+#define GLYPH_HEIGHT 5
+#define ROW_HEIGHT (GLYPH_HEIGHT + 1)
+#define TEXT_COLOR 0xFFFFFFFF
+
+/*
+    A tiny 3x5 font. Each octal digit is one row of a glyph, top to bottom,
+    with the leftmost pixel in the highest bit. Lowercase letters are drawn in
+    uppercase, and anything missing is left blank.
+*/
+static const uint16_t glyphs[128] = {
+    ['0'] = 075557, ['1'] = 026227, ['2'] = 071747, ['3'] = 071317,
+    ['4'] = 055711, ['5'] = 074717, ['6'] = 074757, ['7'] = 071222,
+    ['8'] = 075757, ['9'] = 075717, ['.'] = 000002, ['%'] = 051245,
+    ['/'] = 011244, [':'] = 002020, ['-'] = 000700,
+    ['A'] = 025755, ['B'] = 065656, ['C'] = 034443, ['D'] = 065556,
+    ['E'] = 074647, ['F'] = 074644, ['G'] = 034553, ['H'] = 055755,
+    ['I'] = 072227, ['J'] = 011152, ['K'] = 055655, ['L'] = 044447,
+    ['M'] = 057755, ['N'] = 065555, ['O'] = 025552, ['P'] = 065644,
+    ['Q'] = 025563, ['R'] = 065655, ['S'] = 034216, ['T'] = 072222,
+    ['U'] = 055557, ['V'] = 055552, ['W'] = 055775, ['X'] = 055255,
+    ['Y'] = 055222, ['Z'] = 071247
+};
+
+/*
+    Initialize the overlay. draw_in_callback says whether the frontend draws
+    from within the frame callback, in which case drawing is subtracted from
+    the callback's time rather than counted twice.
+*/
+void hud_init(Hud *hud, bool draw_in_callback)
+{
+    memset(hud, 0, sizeof(Hud));
+    hud->draw_in_callback = draw_in_callback;
+}
+
+/*
+    Return the time spent emulating, including the frame callback.
+*/
+static uint64_t busy_time(const GGProfile *profile)
+{
+    return profile->cpu + profile->vdp + profile->psg + profile->callback;
+}
+
+/*
+    Work out averages over the window that just ended, from its start to now.
+*/
+static void close_window(Hud *hud, const HudSample *now)
+{
+    const HudSample *start = &hud->window;
+    const GGProfile *a = &now->profile, *b = &start->profile;
+    double frames = a->frames - b->frames;
+    uint64_t draws = now->draws - start->draws;
+    uint64_t cycles = now->counters.cycles - start->counters.cycles;
+    double draw_time = (now->draw_time - start->draw_time) / NS_PER_MS;
+
+    hud->avg_frame = (busy_time(a) - busy_time(b)) / NS_PER_MS / frames;
+    hud->avg_cpu = (a->cpu - b->cpu) / NS_PER_MS / frames;
+    hud->avg_vdp = (a->vdp - b->vdp) / NS_PER_MS / frames;
+    hud->avg_psg = (a->psg - b->psg) / NS_PER_MS / frames;
+    hud->avg_host = (a->callback - b->callback) / NS_PER_MS / frames;
+    if (hud->draw_in_callback)
+        hud->avg_host -= draw_time / frames;
+    if (hud->avg_host < 0)
+        hud->avg_host = 0;
+    hud->avg_draw = draws ? draw_time / draws : 0;
+
+    hud->speed = 100.0 * frames * NS_PER_SEC / (now->time - start->time) /
+        GG_FPS;
+    hud->halted = cycles ? 100.0 * (now->counters.halted_cycles -
+        start->counters.halted_cycles) / cycles : 0;
+    hud->banks = (now->counters.bank_switches -
+        start->counters.bank_switches) / frames;
+    hud->window = *now;
+}
+
+/*
+    Update the overlay after a frame, while its profile is attached to the
+    GameGear.
+
+    draw_time and draws are running totals of the time spent drawing frames
+    and the number drawn, and audio_fill is how full the audio buffer is, from
+    0 to 1. Return whether the overlay's text changed.
+*/
+bool hud_update(Hud *hud, const GameGear *gg, uint64_t draw_time,
+                uint64_t draws, double audio_fill)
+{
+    HudSample now;
+    HudText text;
+
+    now.time = get_time_ns();
+    now.profile = hud->profile;
+    gamegear_get_counters(gg, &now.counters);
+    now.draw_time = draw_time;
+    now.draws = draws;
+
+    if (!hud->started) {
+        hud->last = hud->window = now;
+        hud->started = true;
+    }
+    hud->frame_time = (busy_time(&now.profile) -
+        busy_time(&hud->last.profile)) / NS_PER_MS;
+    hud->last = now;
+    if (now.time - hud->window.time >= NS_PER_SEC &&
+            now.profile.frames > hud->window.profile.frames)
+        close_window(hud, &now);
+
+    memset(&text, 0, sizeof(HudText));
+    snprintf(text.rows[0], sizeof(text.rows[0]),
+             "FRAME %.2f MS  AVG %.2f MS", hud->frame_time, hud->avg_frame);
+    snprintf(text.rows[1], sizeof(text.rows[1]),
+             "CPU %.2f  VDP %.2f  PSG %.2f",
+             hud->avg_cpu, hud->avg_vdp, hud->avg_psg);
+    snprintf(text.rows[2], sizeof(text.rows[2]),
+             "HOST %.2f  DRAW %.2f  HALT %.0f%%",
+             hud->avg_host, hud->avg_draw, hud->halted);
+    snprintf(text.rows[3], sizeof(text.rows[3]),
+             "SPEED %.0f%%  BANKS %.1f  AUDIO %.0f%%",
+             hud->speed, hud->banks, 100 * audio_fill);
+
+    if (!memcmp(&text, &hud->text, sizeof(HudText)))
+        return false;
+    hud->text = text;
+    return true;
+}
+
+/*
+    Draw the overlay over one line of the screen, in ARGB pixels.
+
+    The text sits on a darkened box in the top-left corner; lines outside of
+    it are left alone.
+*/
+void hud_draw_line(const HudText *text, int line, uint32_t *row)
+{
+    int y = line - HUD_TOP, width = 0, len;
+    if (y < 0 || y >= HUD_HEIGHT)
+        return;
+
+    for (int r = 0; r < HUD_ROWS; r++) {
+        len = strlen(text->rows[r]);
+        if (len > width)
+            width = len;
+    }
+    for (int x = HUD_LEFT; x <= HUD_LEFT + width * (GLYPH_WIDTH + 1); x++)
+        row[x] = 0xFF000000 | ((row[x] >> 2) & 0x3F3F3F);
+
+    int gy = y % ROW_HEIGHT - 1;
+    if (y / ROW_HEIGHT >= HUD_ROWS || gy < 0)
+        return;
+
+    const char *str = text->rows[y / ROW_HEIGHT];
+    for (int i = 0; str[i]; i++) {
+        unsigned char c = toupper((unsigned char) str[i]);
+        unsigned bits = c < 128 ? (glyphs[c] >> (3 * (4 - gy))) & 7 : 0;
+        int x = HUD_LEFT + 1 + i * (GLYPH_WIDTH + 1);
+        for (int gx = 0; gx < GLYPH_WIDTH; gx++) {
+            if (bits & (4 >> gx))
+                row[x + gx] = TEXT_COLOR;
+        }
+    }
+}
@@ -0,0 +1,57 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gamegear.h"
+
+#define HUD_ROWS 4
+#define HUD_COLUMNS 39
+#define HUD_TOP 1
+#define HUD_HEIGHT (HUD_ROWS * 6 + 1)
+
+/* Structs */
+
+typedef struct {
+    char rows[HUD_ROWS][HUD_COLUMNS + 1];
+} HudText;
+
+/*
+    Totals at some point in time, for working out what happened since.
+*/
+typedef struct {
+    uint64_t time;
+    uint64_t frames;
+    GGProfile profile;
+    GGCounters counters;
+    uint64_t draw_time, draws;
+} HudSample;
+
+/*
+    On-screen performance overlay state.
+
+    The profile is attached to the GameGear while the overlay is shown; each
+    frame, it is compared against the last frame for instantaneous figures,
+    and against the start of a one-second window for averages. Time spent
+    drawing is measured by the frontend, which may or may not do it from the
+    frame callback.
+*/
+typedef struct {
+    GGProfile profile;
+    HudSample last, window;
+    bool started;
+    bool draw_in_callback;
+    double frame_time;
+    double avg_frame, avg_cpu, avg_vdp, avg_psg, avg_host, avg_draw;
+    double speed, halted, banks;
+    HudText text;
+} Hud;
+
+/* Functions */
+
+void hud_init(Hud*, bool);
+bool hud_update(Hud*, const GameGear*, uint64_t, uint64_t, double);
+void hud_draw_line(const HudText*, int, uint32_t*);
@@ -1,17 +1,29 @@
 /* Copyright (C) 2014-2017 Ben Kurtovic <ben.kurtovic@gmail.com>
    Released under the terms of the MIT License. See LICENSE for details. */
 
+#include <string.h>
+
 #include "io.h"
+#include "link.h"
 #include "logging.h"
 
 /*
     Initialize an IO object.
+
+    No buttons are held to begin with, in case a state is loaded before the
+    first power-on.
 */
 void io_init(IO *io, MMU *mmu, VDP *vdp, PSG *psg)
 {
     io->vdp = vdp;
     io->mmu = mmu;
     io->psg = psg;
+    io->buttons = 0xFF;
+    io->start = true;
+    io->polls = 0;
+    io->link = NULL;
+    io->pins = 0x7F;
+    io->nmi = false;
 }
 
 /*
@@ -30,6 +42,23 @@ void io_power(IO *io)
     io->start = true;
 }
 
+/*
+    Save the IO object's state so that it can be restored with
+    io_load_state().
+*/
+void io_save_state(const IO *io, IOState *state)
+{
+    memcpy(state->ports, io->ports, sizeof(state->ports));
+}
+
+/*
+    Restore the IO object's state from a copy made by io_save_state().
+*/
+void io_load_state(IO *io, const IOState *state)
+{
+    memcpy(io->ports, state->ports, sizeof(io->ports));
+}
+
 /*
     Return whether the IRQ line is currently active.
 */
@@ -61,17 +90,47 @@ static uint8_t read_system_port(IO *io, uint8_t port)
 {
     switch (port) {
         case 0x00:
+            io->polls++;
             return (io->ports[port] & 0x7F) | (io->start << 7);
         case 0x01:
+            if (io->link)  // Lines set as inputs read the other end's
+                return (io->ports[port] & (~io->ports[0x02] | 0x80)) |
+                       (io->pins & io->ports[0x02] & 0x7F);
+            return io->ports[port];
+        case 0x04:
+            io->ports[0x05] &= ~(IO_SERIAL_RX_READY | IO_SERIAL_ERROR);
+            return io->ports[port];
         case 0x02:
         case 0x03:
-        case 0x04:
         case 0x05:
             return io->ports[port];
     }
     return 0xFF;
 }
 
+/*
+    Let a linked Game Gear know which parallel lines we are driving: those
+    set as outputs in port $02, with the rest left high.
+*/
+static void send_parallel(IO *io)
+{
+    if (io->link)
+        link_send_parallel(io->link, (io->ports[0x01] | io->ports[0x02]) &
+                                     0x7F);
+}
+
+/*
+    Send a byte to a linked Game Gear if transmitting is on and the last one
+    has gone out.
+*/
+static void send_serial(IO *io, uint8_t value)
+{
+    uint8_t control = io->ports[0x05];
+    if (io->link && (control & IO_SERIAL_TX_ON) &&
+            !(control & IO_SERIAL_TX_FULL))
+        link_send_serial(io->link, value);
+}
+
 /*
     Write to one of the system ports, which are numbered from 0x00 to 0x06.
 */
@@ -80,11 +139,15 @@ static void write_system_port(IO *io, uint8_t port, uint8_t value)
     switch (port) {
         case 0x01:
         case 0x02:
+            io->ports[port] = value;
+            send_parallel(io);
+            break;
         case 0x03:
             io->ports[port] = value;
+            send_serial(io, value);
             break;
         case 0x05:
-            io->ports[port] = value & 0xF8;
+            io->ports[port] = (value & 0xF8) | (io->ports[port] & 0x07);
             break;
         case 0x06:
             psg_stereo(io->psg, value);
@@ -112,13 +175,13 @@ uint8_t io_port_read(IO *io, uint8_t port)
     else if (port <= 0x7F && !(port % 2))
         return io->vdp->v_counter;
     else if (port <= 0x7F)
-        return io->vdp->h_counter;
+        return vdp_read_h_counter(io->vdp);
     else if (port <= 0xBF && !(port % 2))
         return vdp_read_data(io->vdp);
     else if (port <= 0xBF)
         return vdp_read_control(io->vdp);
     else if (port == 0xCD || port == 0xDC)
-        return io->buttons;
+        return io->polls++, io->buttons;
     else if (port == 0xC1 || port == 0xDD)
         return 0xFF;  // B/Misc port, always set (unless in SMS mode?)
     else
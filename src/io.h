@@ -10,8 +10,23 @@
 #include "psg.h"
 #include "vdp.h"
 
+/* Bits of the serial control port, $05 */
+#define IO_SERIAL_TX_FULL  0x01
+#define IO_SERIAL_RX_READY 0x02
+#define IO_SERIAL_ERROR    0x04
+#define IO_SERIAL_NMI      0x08
+#define IO_SERIAL_TX_ON    0x10
+#define IO_SERIAL_RX_ON    0x20
+
 /* Structs */
 
+struct LinkEnd;
+
+/*
+    The link port is only connected to anything while a cable is plugged in
+    (see link.h); pins then holds the parallel lines as driven by the other
+    end, and nmi is raised when a serial byte arrives and asks for one.
+*/
 typedef struct {
     MMU *mmu;
     VDP *vdp;
@@ -19,12 +34,26 @@ typedef struct {
     uint8_t ports[6];
     uint8_t buttons;
     bool start;
+    uint64_t polls;
+    struct LinkEnd *link;
+    uint8_t pins;
+    bool nmi;
 } IO;
 
+/*
+    The buttons are left out, as they belong to whoever is holding the Game
+    Gear rather than the Game Gear itself.
+*/
+typedef struct {
+    uint8_t ports[6];
+} IOState;
+
 /* Functions */
 
 void io_init(IO*, MMU*, VDP*, PSG*);
 void io_power(IO*);
+void io_save_state(const IO*, IOState*);
+void io_load_state(IO*, const IOState*);
 bool io_check_irq(IO*);
 void io_set_button(IO*, uint8_t, bool);
 void io_set_start(IO*, bool);
@@ -0,0 +1,203 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <stdlib.h>
+
+#include "lanes.h"
+#include "state.h"
+#include "util.h"
+
+/*
+    Create lanes from a GameGear that is powered on, all starting out merged
+    in its state, holding its buttons. The count is capped at LANES_MAX.
+
+    The ROM must be the one the GameGear is running; like its BIOS, it is
+    shared by every lane and must outlive them.
+*/
+Lanes* lanes_create(const GameGear *gg, const ROM *rom, unsigned count)
+{
+    Lanes *lanes = cr_malloc(sizeof(Lanes));
+    if (count < 1)
+        count = 1;
+    if (count > LANES_MAX)
+        count = LANES_MAX;
+
+    lanes->count = count;
+    lanes->rom = rom;
+    for (unsigned lane = 0; lane < count; lane++) {
+        lanes->machines[lane] = gamegear_fork(gg);
+        lanes->leaders[lane] = 0;
+        lanes->buttons[lane] = gamegear_get_buttons(gg);
+        lanes->prints[lane] = 0;
+    }
+    lanes->state = cr_malloc(sizeof(GGState));
+    lanes->frames = lanes->emulated = 0;
+    return lanes;
+}
+
+/*
+    Destroy lanes previously created with lanes_create().
+*/
+void lanes_destroy(Lanes *lanes)
+{
+    for (unsigned lane = 0; lane < lanes->count; lane++)
+        gamegear_destroy(lanes->machines[lane]);
+    free(lanes->state);
+    free(lanes);
+}
+
+/*
+    Hold exactly the given buttons (a mask from gamegear_get_buttons()) in a
+    lane from the next frame on.
+*/
+void lanes_set_buttons(Lanes *lanes, unsigned lane, uint8_t buttons)
+{
+    lanes->buttons[lane] = buttons;
+}
+
+/*
+    Return a hash of a leader's full state.
+*/
+static uint64_t full_hash(Lanes *lanes, unsigned lane)
+{
+    gamegear_save_state(lanes->machines[lane], lanes->state);
+    return state_hash(lanes->state, lanes->rom);
+}
+
+/*
+    Merge leaders that ended the frame in the same state into the first of
+    them. A cheap fingerprint of each (its system RAM and program counter)
+    is compared first, so that full states are only hashed for likely
+    matches.
+*/
+static void join(Lanes *lanes)
+{
+    for (unsigned lane = 0; lane < lanes->count; lane++) {
+        if (lanes->leaders[lane] != lane)
+            continue;
+        const GameGear *gg = lanes->machines[lane];
+        lanes->prints[lane] = hash64(gg->mmu.system_ram, MMU_SYSTEM_RAM_SIZE,
+                                     gg->cpu.regs.pc);
+    }
+
+    for (unsigned lane = 1; lane < lanes->count; lane++) {
+        if (lanes->leaders[lane] != lane)
+            continue;
+        for (unsigned other = 0; other < lane; other++) {
+            if (lanes->leaders[other] != other ||
+                    lanes->prints[other] != lanes->prints[lane] ||
+                    full_hash(lanes, other) != full_hash(lanes, lane))
+                continue;
+            for (unsigned x = lane; x < lanes->count; x++) {
+                if (lanes->leaders[x] == lane)
+                    lanes->leaders[x] = other;
+            }
+            break;
+        }
+    }
+}
+
+/*
+    Run one frame on a lane's machine with its own buttons, throwing away the
+    audio. Return false if it raised an exception.
+*/
+static bool run_lane(Lanes *lanes, unsigned lane)
+{
+    GameGear *gg = lanes->machines[lane];
+    bool ok;
+
+    gamegear_set_buttons(gg, lanes->buttons[lane]);
+    ok = gamegear_simulate_frame(gg);
+    gamegear_read_audio(gg, NULL, SIZE_MAX);
+    lanes->emulated++;
+    return ok;
+}
+
+/*
+    Run one frame for a leader and every lane following it.
+
+    The leader runs with its own buttons. Followers holding other buttons
+    can share its frame as long as the game never read the buttons during
+    it; otherwise they split off onto their own machines, starting again
+    from the leader's state before the frame, and those that hold the same
+    buttons as each other stay together.
+*/
+static bool run_group(Lanes *lanes, unsigned leader, bool *ran)
+{
+    GameGear *gg = lanes->machines[leader];
+    unsigned from[LANES_MAX];
+    bool mixed = false, ok;
+
+    for (unsigned lane = leader + 1; lane < lanes->count; lane++) {
+        from[lane] = LANES_MAX;
+        if (lanes->leaders[lane] == leader &&
+                lanes->buttons[lane] != lanes->buttons[leader])
+            mixed = true;
+    }
+    if (mixed)
+        gamegear_save_state(gg, lanes->state);
+
+    uint64_t polls = gg->io.polls;
+    ok = run_lane(lanes, leader);
+    ran[leader] = true;
+    if (!mixed || gg->io.polls == polls)
+        return ok;
+
+    for (unsigned lane = leader + 1; lane < lanes->count; lane++) {
+        unsigned other;
+
+        if (lanes->leaders[lane] != leader ||
+                lanes->buttons[lane] == lanes->buttons[leader])
+            continue;
+
+        for (other = leader + 1; other < lane; other++) {
+            if (from[other] == leader &&
+                    lanes->buttons[other] == lanes->buttons[lane])
+                break;
+        }
+        if (other < lane) {
+            lanes->leaders[lane] = other;
+            continue;
+        }
+
+        gamegear_load_state(lanes->machines[lane], lanes->state);
+        lanes->leaders[lane] = lane;
+        from[lane] = leader;
+        if (!run_lane(lanes, lane))
+            ok = false;
+        ran[lane] = true;
+    }
+    return ok;
+}
+
+/*
+    Run one frame on every lane: emulate each leader once (splitting off
+    followers whose buttons turned out to matter), then join leaders that
+    ended up the same.
+
+    Return false if any lane raised an exception.
+*/
+bool lanes_run_frame(Lanes *lanes)
+{
+    bool ran[LANES_MAX] = {false};
+    bool ok = true;
+
+    for (unsigned lane = 0; lane < lanes->count; lane++) {
+        if (lanes->leaders[lane] == lane && !ran[lane] &&
+                !run_group(lanes, lane, ran))
+            ok = false;
+    }
+    lanes->frames += lanes->count;
+    if (ok)
+        join(lanes);
+    return ok;
+}
+
+/*
+    Return the GameGear holding a lane's current state. It may be shared with
+    other lanes, and is only valid until the next frame.
+*/
+const GameGear* lanes_get(const Lanes *lanes, unsigned lane)
+{
+    return lanes->machines[lanes->leaders[lane]];
+}
@@ -0,0 +1,45 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gamegear.h"
+#include "rom.h"
+
+#define LANES_MAX 64
+
+/* Structs */
+
+/*
+    Many GameGears ("lanes") running the same ROM in lock-step, one frame at a
+    time, each with its own buttons.
+
+    Lanes that are in exactly the same state are emulated once, by the
+    lowest-numbered of them (its leader), even when they hold different
+    buttons, as long as the game doesn't read the buttons that frame. When it
+    does, lanes whose buttons differ from their leader's split off onto
+    machines of their own, and lanes that end a frame in the same state join
+    up again. This pays off when most lanes spend most frames doing the same
+    thing, e.g. while a game ignores input.
+*/
+typedef struct {
+    unsigned count;
+    const ROM *rom;
+    GameGear *machines[LANES_MAX];
+    unsigned leaders[LANES_MAX];
+    uint8_t buttons[LANES_MAX];
+    uint64_t prints[LANES_MAX];
+    GGState *state;
+    uint64_t frames, emulated;
+} Lanes;
+
+/* Functions */
+
+Lanes* lanes_create(const GameGear*, const ROM*, unsigned);
+void lanes_destroy(Lanes*);
+void lanes_set_buttons(Lanes*, unsigned, uint8_t);
+bool lanes_run_frame(Lanes*);
+const GameGear* lanes_get(const Lanes*, unsigned);
@@ -0,0 +1,37 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+/*
+    The emulator core as a library (libcrater.a or libcrater.so, built with
+    `make lib`), for programs that want to run Game Gears themselves rather
+    than through the crater binary. It has no global state and doesn't use
+    SDL, so any number of GameGears can be run at once, each on a thread of
+    its own; only one thread may use a GameGear at a time.
+
+    - Machines: gamegear_create(), gamegear_destroy(), gamegear_reset(),
+      gamegear_fork()
+    - ROMs: rom_load() or rom_open(), then gamegear_load_rom(); likewise
+      bios_load() or bios_open() and gamegear_load_bios()
+    - Running: gamegear_power_on(), then gamegear_simulate_frame() for each
+      frame (or gamegear_simulate() with a callback attached); for finer
+      steps, gamegear_run_cycles(), gamegear_run_lines(), and
+      gamegear_run_until() with a predicate, e.g. for breakpoints
+    - Input: gamegear_set_buttons() or gamegear_input()
+    - Video: gamegear_attach_display() or gamegear_attach_indexed_display(),
+      written to as each scanline is drawn
+    - Audio: gamegear_set_audio_rate() and gamegear_read_audio()
+    - Snapshots: gamegear_save_state() and gamegear_load_state(), with
+      state_serialize() and state_deserialize() to turn them into bytes
+    - Linking two machines: see link.h
+
+    Errors are printed to stderr; running out of memory exits.
+*/
+
+#include "gamegear.h"
+#include "link.h"
+#include "movie.h"
+#include "rom.h"
+#include "state.h"
+#include "version.h"
@@ -0,0 +1,332 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#if defined __linux__
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "link.h"
+#include "gamegear.h"
+#include "logging.h"
+#include "pool.h"
+#include "state.h"
+#include "util.h"
+
+#define LINES_PER_SECOND (VDP_LINES_PER_FRAME * GG_FPS)
+#define BITS_PER_BYTE 10  // Start and stop bits included
+#define MESSAGES_PER_LINE 32
+
+static const unsigned baud_rates[] = {4800, 2400, 1200, 300};
+
+/*
+    Create a cable whose ends wait for each other every quantum scanlines
+    (between 1 and LINK_MAX_QUANTUM).
+*/
+Link* link_create(unsigned quantum)
+{
+    Link *link = cr_malloc(sizeof(Link));
+    if (quantum < 1)
+        quantum = 1;
+    if (quantum > LINK_MAX_QUANTUM)
+        quantum = LINK_MAX_QUANTUM;
+    link->quantum = quantum;
+
+    for (unsigned i = 0; i < 2; i++) {
+        LinkEnd *end = &link->ends[i];
+        end->link = link;
+        end->peer = &link->ends[!i];
+        end->io = NULL;
+        // A sender is never more than two quanta ahead of its receiver:
+        ring_init(&end->queue, (2 * quantum + 2) * MESSAGES_PER_LINE,
+                  sizeof(LinkMessage));
+        end->line = end->last = end->tx_done = 0;
+        end->pins = 0x7F;
+        end->sent = end->received = end->waits = 0;
+        atomic_init(&end->reached, 0);
+        atomic_init(&end->unplugged, false);
+    }
+    return link;
+}
+
+/*
+    Destroy a cable previously created with link_create(). Both ends must be
+    unplugged first.
+*/
+void link_destroy(Link *link)
+{
+    ring_free(&link->ends[0].queue);
+    ring_free(&link->ends[1].queue);
+    free(link);
+}
+
+/*
+    Plug one end of a cable into a GameGear's IO. This is normally done with
+    gamegear_attach_link().
+*/
+void link_plug(LinkEnd *end, IO *io)
+{
+    end->io = io;
+    io->link = end;
+    io->pins = end->peer->pins;
+}
+
+/*
+    Unplug one end of a cable, e.g. once its GameGear has stopped running;
+    the other end carries on alone rather than waiting for it. An end can't
+    be plugged in again.
+*/
+void link_unplug(LinkEnd *end)
+{
+    if (end->io)
+        end->io->link = NULL;
+    end->io = NULL;
+    atomic_store_explicit(&end->unplugged, true, memory_order_release);
+}
+
+/*
+    Return the first line at the start of a quantum that is at least the
+    given one.
+*/
+static uint64_t align_line(const LinkEnd *end, uint64_t line)
+{
+    unsigned quantum = end->link->quantum;
+    return (line + quantum - 1) / quantum * quantum;
+}
+
+/*
+    Return whether the other end of the cable has been unplugged.
+*/
+static bool is_peer_unplugged(const LinkEnd *end)
+{
+    return atomic_load_explicit(&end->peer->unplugged, memory_order_acquire);
+}
+
+/*
+    Send a message that lands on the other end at the start of the first
+    quantum after the given line, and never before anything sent earlier.
+
+    If the other end has been unplugged, the message is dropped, rather than
+    waiting forever for room in a queue that nobody reads.
+*/
+static void send(LinkEnd *end, LinkType type, uint8_t value, uint64_t line)
+{
+    LinkMessage message;
+
+    message.line = align_line(end, line + 1);
+    if (message.line < end->last)
+        message.line = end->last;
+    message.type = type;
+    message.value = value;
+    end->last = message.line;
+
+    while (!is_peer_unplugged(end)) {
+        if (ring_write(&end->peer->queue, &message, 1))
+            return;
+        sched_yield();
+    }
+}
+
+/*
+    Apply a message from the other end to this end's IO.
+*/
+static void receive(LinkEnd *end, const LinkMessage *message)
+{
+    IO *io = end->io;
+
+    if (message->type == LINK_PARALLEL) {
+        io->pins = message->value;
+        return;
+    }
+    if (!(io->ports[0x05] & IO_SERIAL_RX_ON))
+        return;
+
+    if (io->ports[0x05] & IO_SERIAL_RX_READY)
+        io->ports[0x05] |= IO_SERIAL_ERROR;  // Overrun
+    io->ports[0x04] = message->value;
+    io->ports[0x05] |= IO_SERIAL_RX_READY;
+    if (io->ports[0x05] & IO_SERIAL_NMI)
+        io->nmi = true;
+    end->received++;
+}
+
+/*
+    Wait for the other end to reach the given line, unless it was unplugged.
+*/
+static void wait_for_peer(LinkEnd *end, uint64_t line)
+{
+    const LinkEnd *peer = end->peer;
+    bool waited = false;
+
+    while (atomic_load_explicit(&peer->reached, memory_order_acquire) < line &&
+           !is_peer_unplugged(end)) {
+        waited = true;
+        sched_yield();
+    }
+    if (waited)
+        end->waits++;
+}
+
+/*
+    Bring an end of the cable up to date at the end of a scanline.
+
+    This finishes sending a serial byte once its time is up, and at the start
+    of each quantum, lets the other end know how far this one has got, waits
+    for it to get as far, and takes whatever it sent that lands now.
+*/
+void link_sync(LinkEnd *end)
+{
+    IO *io = end->io;
+    uint64_t line = ++end->line;
+    LinkMessage message;
+
+    if ((io->ports[0x05] & IO_SERIAL_TX_FULL) && line >= end->tx_done)
+        io->ports[0x05] &= ~IO_SERIAL_TX_FULL;
+    if (line % end->link->quantum)
+        return;
+
+    atomic_store_explicit(&end->reached, line, memory_order_release);
+    wait_for_peer(end, line);
+    while (ring_peek(&end->queue, &message, 1) && message.line <= line) {
+        receive(end, &message);
+        ring_skip(&end->queue, 1);
+    }
+}
+
+/*
+    Drive the given parallel lines (bit n for line n, with undriven ones
+    high), letting the other end know if they changed.
+*/
+void link_send_parallel(LinkEnd *end, uint8_t pins)
+{
+    if (pins == end->pins)
+        return;
+    end->pins = pins;
+    send(end, LINK_PARALLEL, pins, end->line);
+}
+
+/*
+    Start sending a byte over the serial line, at the baud rate set in the
+    serial control port. It is marked as sending until it is done.
+*/
+void link_send_serial(LinkEnd *end, uint8_t value)
+{
+    IO *io = end->io;
+    unsigned baud = baud_rates[io->ports[0x05] >> 6];
+    uint64_t lines = (LINES_PER_SECOND * BITS_PER_BYTE + baud - 1) / baud;
+
+    end->tx_done = end->line + lines;
+    io->ports[0x05] |= IO_SERIAL_TX_FULL;
+    send(end, LINK_SERIAL, value, end->tx_done - 1);
+    end->sent++;
+}
+
+/*
+    Two GameGears to run on their own threads while linked.
+*/
+typedef struct {
+    GameGear *machines[2];
+    unsigned long frames;
+    unsigned long done[2];
+} LinkRun;
+
+/*
+    Pool task: run one of the GameGears, unplugging it when it stops so that
+    the other can carry on.
+*/
+static void run_task(void *context, unsigned index, unsigned count)
+{
+    LinkRun *run = context;
+    GameGear *gg = run->machines[index];
+    unsigned long frame;
+
+    (void) count;
+    for (frame = 0; frame < run->frames; frame++) {
+        if (!gamegear_simulate_frame(gg))
+            break;
+        gamegear_read_audio(gg, NULL, SIZE_MAX);
+    }
+    run->done[index] = frame;
+    gamegear_attach_link(gg, NULL);
+}
+
+/*
+    Link a GameGear running the given ROM to another running the ROM at
+    config->link_path, and run both with no window or sound for
+    config->frames, each on its own thread. Print what each sent and the
+    state it ended in. Return whether both ran without an exception.
+*/
+bool link_roms(const ROM *rom, const Config *config)
+{
+    const ROM *roms[2] = {rom, NULL};
+    ROM other;
+    BIOS *bios = NULL;
+    Link *link = NULL;
+    LinkRun run;
+    ThreadPool *pool;
+    const char *errmsg;
+    bool ok = true;
+
+    if ((errmsg = rom_open(&other, config->link_path))) {
+        ERROR("couldn't load ROM image '%s': %s", config->link_path, errmsg)
+        return false;
+    }
+    roms[1] = &other;
+    if (config->bios_path && !(bios = bios_open(config->bios_path))) {
+        rom_close(&other);
+        return false;
+    }
+
+    link = link_create(config->link_quantum);
+    run.frames = config->frames;
+    for (unsigned i = 0; i < 2; i++) {
+        GameGear *gg = run.machines[i] = gamegear_create();
+        gamegear_load_rom(gg, roms[i]);
+        if (bios)
+            gamegear_load_bios(gg, bios);
+        gamegear_power_on(gg);
+        gamegear_attach_link(gg, &link->ends[i]);
+    }
+
+    printf("crater: linking %s and %s for %lu frames, syncing every %u "
+           "line(s)\n", rom->name, other.name, run.frames, link->quantum);
+    pool = pool_create(2);
+    uint64_t start = get_time_ns();
+    pool_run(pool, run_task, &run);
+    double elapsed = (get_time_ns() - start) / 1e9;
+    pool_destroy(pool);
+
+    GGState *state = cr_malloc(sizeof(GGState));
+    for (unsigned i = 0; i < 2; i++) {
+        GameGear *gg = run.machines[i];
+        const LinkEnd *end = &link->ends[i];
+
+        if (run.done[i] < run.frames) {
+            ERROR("Game Gear %u caught exception after %lu frames: %s",
+                  i + 1, run.done[i], gamegear_get_exception(gg))
+            ok = false;
+        }
+        printf("Game Gear %u: sent %llu bytes, received %llu, waited %llu "
+               "times\n", i + 1, (unsigned long long) end->sent,
+               (unsigned long long) end->received,
+               (unsigned long long) end->waits);
+        gamegear_save_state(gg, state);
+        printf("State hash: %016llx\n",
+               (unsigned long long) state_hash(state, roms[i]));
+        gamegear_power_off(gg);
+        gamegear_destroy(gg);
+    }
+    printf("crater: %lu frames in %.2f seconds (%.1f fps each)\n",
+           run.done[0] + run.done[1], elapsed,
+           elapsed > 0 ? (run.done[0] + run.done[1]) / 2.0 / elapsed : 0);
+
+    free(state);
+    link_destroy(link);
+    if (bios)
+        bios_close(bios);
+    rom_close(&other);
+    return ok;
+}
@@ -0,0 +1,83 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "io.h"
+#include "ring.h"
+#include "rom.h"
+
+#define LINK_DEFAULT_QUANTUM 1
+#define LINK_MAX_QUANTUM 32
+
+/* Structs */
+
+/*
+    A change on the cable, as sent from one end to the other: either the
+    parallel lines driven by the sender (LINK_PARALLEL) or a serial byte
+    (LINK_SERIAL). It takes effect at the start of the given line of the
+    receiver's.
+*/
+typedef enum {
+    LINK_PARALLEL,
+    LINK_SERIAL
+} LinkType;
+
+typedef struct {
+    uint64_t line;
+    LinkType type;
+    uint8_t value;
+} LinkMessage;
+
+/*
+    One end of a Gear-to-Gear cable, plugged into a GameGear's link port.
+
+    Everything here belongs to the thread running that GameGear, except for
+    the queue of messages from the other end, which that end writes to, and
+    the number of lines this end has reached, which it reads.
+*/
+typedef struct LinkEnd {
+    struct Link *link;
+    struct LinkEnd *peer;
+    IO *io;
+    Ring queue;
+    uint64_t line, last;
+    uint64_t tx_done;
+    uint8_t pins;
+    uint64_t sent, received, waits;
+    alignas(RING_CACHE_LINE) atomic_uint_fast64_t reached;
+    atomic_bool unplugged;
+} LinkEnd;
+
+/*
+    A Gear-to-Gear cable between two GameGears, each run on its own thread.
+
+    The two only wait for each other once every quantum (in scanlines), and
+    anything one sends lands on the other at the start of the quantum after
+    the one it was sent in (serial bytes may take longer, at their baud
+    rate), so neither can ever see something the other hasn't done yet.
+    This keeps linked runs exactly reproducible, however the threads are
+    scheduled; smaller quanta mean less latency on the cable but more time
+    spent waiting.
+*/
+typedef struct Link {
+    LinkEnd ends[2];
+    unsigned quantum;
+} Link;
+
+/* Functions */
+
+Link* link_create(unsigned);
+void link_destroy(Link*);
+void link_plug(LinkEnd*, IO*);
+void link_unplug(LinkEnd*);
+void link_sync(LinkEnd*);
+void link_send_parallel(LinkEnd*, uint8_t);
+void link_send_serial(LinkEnd*, uint8_t);
+bool link_roms(const ROM*, const Config*);
@@ -34,7 +34,11 @@
 #define DEBUG_TEXT_ "\x1b[0m\x1b[37m" "[DEBUG]"  "\x1b[0m"
 #define TRACE_TEXT_ "\x1b[1m\x1b[30m" "[TRACE]"  "\x1b[0m"
 
+#ifdef CRATER_LIBRARY
+#define logging_level_ 0u  // No global level to set; only errors are shown
+#else
 unsigned logging_level_;
+#endif
 
 /* Public logging macros */
 
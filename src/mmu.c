@@ -16,15 +16,31 @@ void mmu_init(MMU *mmu)
 {
     mmu->system_ram = cr_malloc(sizeof(uint8_t) * MMU_SYSTEM_RAM_SIZE);
     mmu->cart_ram = NULL;
+    mmu->cart_ram_external = false;
+    mmu_reset(mmu);
+}
+
+/*
+    Return a MMU to how mmu_init() left it, forgetting its ROM, BIOS, save,
+    and any cartridge RAM, but keeping its system RAM allocated.
+*/
+void mmu_reset(MMU *mmu)
+{
+    if (!mmu->cart_ram_external)
+        free(mmu->cart_ram);
+    mmu->cart_ram = NULL;
     mmu->cart_ram_slot = NULL;
     mmu->bios_rom = NULL;
     mmu->cart_ram_mapped = false;
     mmu->cart_ram_external = false;
     mmu->bios_enabled = false;
+    mmu->bank_switches = 0;
     mmu->save = NULL;
 
-    for (size_t slot = 0; slot < MMU_NUM_SLOTS; slot++)
+    for (size_t slot = 0; slot < MMU_NUM_SLOTS; slot++) {
         mmu->rom_slots[slot] = NULL;
+        mmu->slot_banks[slot] = slot;
+    }
 
     for (size_t bank = 0; bank < MMU_NUM_ROM_BANKS; bank++)
         mmu->rom_banks[bank] = NULL;
@@ -135,6 +151,22 @@ static inline void map_rom_slot(MMU *mmu, size_t slot, size_t bank)
 {
     TRACE("MMU mapping memory slot %zu to ROM bank 0x%02zX", slot, bank)
     mmu->rom_slots[slot] = mmu->rom_banks[bank];
+    mmu->slot_banks[slot] = bank;
+}
+
+/*
+    Create fresh cartridge RAM, backed by the save file if there is one.
+*/
+static void create_cart_ram(MMU *mmu)
+{
+    if (mmu->save && save_init_cart_ram(mmu->save)) {
+        mmu->cart_ram = save_get_cart_ram(mmu->save);
+        mmu->cart_ram_external = true;
+    } else {
+        mmu->cart_ram = cr_malloc(sizeof(uint8_t) * MMU_CART_RAM_SIZE);
+        mmu->cart_ram_external = false;
+    }
+    memset(mmu->cart_ram, 0xFF, MMU_CART_RAM_SIZE);
 }
 
 /*
@@ -226,14 +258,7 @@ static void write_ram_control_register(MMU *mmu, uint8_t value)
 
     if (slot2_enable && !mmu->cart_ram) {
         DEBUG("MMU initializing cartridge RAM (fresh battery save)")
-        if (mmu->save && save_init_cart_ram(mmu->save)) {
-            mmu->cart_ram = save_get_cart_ram(mmu->save);
-            mmu->cart_ram_external = true;
-        } else {
-            mmu->cart_ram = cr_malloc(sizeof(uint8_t) * MMU_CART_RAM_SIZE);
-            mmu->cart_ram_external = false;
-        }
-        memset(mmu->cart_ram, 0xFF, MMU_CART_RAM_SIZE);
+        create_cart_ram(mmu);
     }
 
     mmu->cart_ram_slot =
@@ -261,12 +286,10 @@ bool mmu_write_byte(MMU *mmu, uint16_t addr, uint8_t value)
     } else {  // System RAM, mirrored (0xE000 - 0xFFFF)
         if (addr == 0xFFFC)
             write_ram_control_register(mmu, value);
-        else if (addr == 0xFFFD)
-            map_rom_slot(mmu, 0, value & 0x3F);
-        else if (addr == 0xFFFE)
-            map_rom_slot(mmu, 1, value & 0x3F);
-        else if (addr == 0xFFFF)
-            map_rom_slot(mmu, 2, value & 0x3F);
+        else if (addr >= 0xFFFD) {
+            map_rom_slot(mmu, addr - 0xFFFD, value & 0x3F);
+            mmu->bank_switches++;
+        }
         mmu->system_ram[addr - 0xE000] = value;
         return true;
     }
@@ -281,3 +304,49 @@ bool mmu_write_double(MMU *mmu, uint16_t addr, uint16_t value)
     bool b2 = mmu_write_byte(mmu, addr + 1, value >> 8);
     return b1 && b2;
 }
+
+/*
+    Save the MMU's state so that it can be restored with mmu_load_state().
+
+    The ROM and BIOS themselves are not included; the MMU they are restored
+    into must have the same ones loaded.
+*/
+void mmu_save_state(const MMU *mmu, MMUState *state)
+{
+    memcpy(state->system_ram, mmu->system_ram, MMU_SYSTEM_RAM_SIZE);
+    state->has_cart_ram = mmu->cart_ram != NULL;
+    if (mmu->cart_ram)
+        memcpy(state->cart_ram, mmu->cart_ram, MMU_CART_RAM_SIZE);
+    memcpy(state->slot_banks, mmu->slot_banks, MMU_NUM_SLOTS);
+    state->cart_ram_mapped = mmu->cart_ram_mapped;
+    state->cart_ram_bank =
+        mmu->cart_ram && mmu->cart_ram_slot != mmu->cart_ram;
+    state->bios_enabled = mmu->bios_enabled;
+    state->bank_switches = mmu->bank_switches;
+}
+
+/*
+    Restore the MMU's state from a copy made by mmu_save_state().
+
+    Cartridge RAM is created if the state has some and we don't. If we have
+    some and the state doesn't, it is reset to how fresh RAM would look, since
+    the game hadn't touched it yet.
+*/
+void mmu_load_state(MMU *mmu, const MMUState *state)
+{
+    memcpy(mmu->system_ram, state->system_ram, MMU_SYSTEM_RAM_SIZE);
+    if (state->has_cart_ram && !mmu->cart_ram)
+        create_cart_ram(mmu);
+    if (state->has_cart_ram)
+        memcpy(mmu->cart_ram, state->cart_ram, MMU_CART_RAM_SIZE);
+    else if (mmu->cart_ram)
+        memset(mmu->cart_ram, 0xFF, MMU_CART_RAM_SIZE);
+
+    for (size_t slot = 0; slot < MMU_NUM_SLOTS; slot++)
+        map_rom_slot(mmu, slot, state->slot_banks[slot]);
+    mmu->cart_ram_mapped = state->cart_ram_mapped && mmu->cart_ram;
+    mmu->cart_ram_slot = !mmu->cart_ram ? NULL :
+        state->cart_ram_bank ? (mmu->cart_ram + 0x4000) : mmu->cart_ram;
+    mmu->bios_enabled = state->bios_enabled && mmu->bios_rom;
+    mmu->bank_switches = state->bank_switches;
+}
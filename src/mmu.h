@@ -21,22 +21,40 @@ typedef struct {
     uint8_t *system_ram;
     uint8_t *cart_ram;
     const uint8_t *rom_slots[MMU_NUM_SLOTS];
+    uint8_t slot_banks[MMU_NUM_SLOTS];
     const uint8_t *rom_banks[MMU_NUM_ROM_BANKS];
     uint8_t *cart_ram_slot;
     const uint8_t *bios_rom;
     bool cart_ram_mapped, cart_ram_external;
     bool bios_enabled;
+    uint64_t bank_switches;
     Save *save;
 } MMU;
 
+/*
+    Cartridge RAM is only filled in if has_cart_ram is set.
+*/
+typedef struct {
+    uint8_t system_ram[MMU_SYSTEM_RAM_SIZE];
+    uint8_t cart_ram[MMU_CART_RAM_SIZE];
+    bool has_cart_ram;
+    uint8_t slot_banks[MMU_NUM_SLOTS];
+    bool cart_ram_mapped, cart_ram_bank;
+    bool bios_enabled;
+    uint64_t bank_switches;
+} MMUState;
+
 /* Functions */
 
 void mmu_init(MMU*);
 void mmu_free(MMU*);
+void mmu_reset(MMU*);
 void mmu_load_rom(MMU*, const uint8_t*, size_t);
 void mmu_load_bios(MMU*, const uint8_t*);
 void mmu_load_save(MMU*, Save*);
 void mmu_power(MMU*);
+void mmu_save_state(const MMU*, MMUState*);
+void mmu_load_state(MMU*, const MMUState*);
 
 uint8_t mmu_read_byte(const MMU*, uint16_t);
 uint16_t mmu_read_double(const MMU*, uint16_t);
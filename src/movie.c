@@ -0,0 +1,256 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "movie.h"
+#include "logging.h"
+#include "state.h"
+#include "util.h"
+
+static const char *MAGIC = "CRMOVIE\x1A";
+#define MAGIC_LEN 8
+#define MOVIE_HEADER_SIZE 32
+#define FLAG_FROM_STATE 0x0001
+
+/*
+    Log an error while trying to save or load a movie file.
+*/
+static void log_error(const char *action, const char *path, const char *reason)
+{
+    ERROR("couldn't %s movie file '%s': %s", action, path, reason)
+}
+
+/*
+    Initialize an empty movie, starting from power-on, to record into.
+*/
+void movie_init(Movie *movie)
+{
+    movie->inputs = NULL;
+    movie->frames = movie->capacity = 0;
+    movie->pos = 0;
+    movie->start = NULL;
+}
+
+/*
+    Free memory previously allocated by the movie.
+*/
+void movie_free(Movie *movie)
+{
+    free(movie->inputs);
+    free(movie->start);
+}
+
+/*
+    Start the movie from the given state instead of from power-on.
+*/
+void movie_set_start(Movie *movie, const GGState *state)
+{
+    if (!movie->start)
+        movie->start = cr_malloc(sizeof(GGState));
+    memcpy(movie->start, state, sizeof(GGState));
+}
+
+/*
+    Add a frame's buttons to the end of the movie.
+*/
+void movie_append(Movie *movie, uint8_t buttons)
+{
+    if (movie->frames == movie->capacity) {
+        movie->capacity = movie->capacity ? 2 * movie->capacity : 4096;
+        movie->inputs = cr_realloc(movie->inputs, movie->capacity);
+    }
+    movie->inputs[movie->frames++] = buttons;
+}
+
+/*
+    Parse the body of a movie file after its header: the starting state, if
+    any, then runs of frames with the same buttons, each stored as the
+    buttons and then the run's length as a variable-length integer.
+
+    NULL will be returned if the body is valid. Otherwise, an error string
+    will be returned.
+*/
+static const char* parse_body(Movie *movie, const ROM *rom, uint16_t flags,
+    uint32_t frames, const uint8_t *buf, size_t size)
+{
+    uint32_t state_size = read_le(buf + 28, 4);
+    size_t pos = MOVIE_HEADER_SIZE;
+
+    if (flags & FLAG_FROM_STATE) {
+        if (state_size > size - pos)
+            return "starting state is truncated";
+        movie->start = cr_malloc(sizeof(GGState));
+        const char *error = state_deserialize(movie->start, rom, buf + pos,
+                                              state_size);
+        if (error)
+            return error;
+        pos += state_size;
+    }
+
+    while (movie->frames < frames) {
+        if (pos >= size)
+            return "inputs are truncated";
+        uint8_t buttons = buf[pos++];
+        size_t count, len = get_varint(buf + pos, size - pos, &count);
+        if (!len)
+            return "inputs are truncated";
+        pos += len;
+
+        if (!count || count > frames - movie->frames)
+            return "inputs are corrupt";
+        while (count--)
+            movie_append(movie, buttons);
+    }
+    return NULL;
+}
+
+/*
+    Load a movie recorded for the given ROM from a file.
+
+    Return whether it worked. Either way, the movie should be freed with
+    movie_free() afterwards.
+*/
+bool movie_load(Movie *movie, const char *path, const ROM *rom)
+{
+    movie_init(movie);
+
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        ERROR_ERRNO("couldn't load movie file '%s'", path)
+        return false;
+    }
+    fseek(fp, 0, SEEK_END);
+    long size = ftell(fp);
+    rewind(fp);
+    if (size < MOVIE_HEADER_SIZE) {
+        fclose(fp);
+        log_error("load", path, "too short");
+        return false;
+    }
+
+    uint8_t *buf = cr_malloc(size);
+    bool ok = fread(buf, 1, size, fp) == (size_t) size;
+    fclose(fp);
+    if (!ok) {
+        log_error("load", path, "couldn't read the entire file");
+        free(buf);
+        return false;
+    }
+
+    const char *error = NULL;
+    if (memcmp(buf, MAGIC, MAGIC_LEN))
+        error = "invalid header (was this movie created by crater?)";
+    else if (read_le(buf + 8, 2) != MOVIE_VERSION)
+        error = "unknown or unsupported movie file version";
+    else if (read_le(buf + 12, 4) != rom->product_code ||
+             read_le(buf + 16, 2) != rom->expected_checksum ||
+             read_le(buf + 20, 4) != rom->size)
+        error = "movie was recorded with a different ROM";
+    else
+        error = parse_body(movie, rom, read_le(buf + 10, 2),
+                           read_le(buf + 24, 4), buf, size);
+    free(buf);
+
+    if (error) {
+        log_error("load", path, error);
+        return false;
+    }
+    return true;
+}
+
+/*
+    Save a movie recorded with the given ROM to a file. Return whether it
+    worked.
+*/
+bool movie_save(const Movie *movie, const char *path, const ROM *rom)
+{
+    size_t frames = movie->frames;
+    uint8_t *state = NULL, varint[VARINT_MAX_SIZE];
+    size_t state_size = 0;
+
+    if (movie->start) {
+        state = cr_malloc(STATE_MAX_SIZE);
+        state_size = state_serialize(movie->start, rom, state,
+                                     STATE_MAX_SIZE);
+    }
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        ERROR_ERRNO("couldn't save movie file '%s'", path)
+        free(state);
+        return false;
+    }
+
+    fwrite(MAGIC, 1, MAGIC_LEN, fp);
+    write_le(fp, MOVIE_VERSION, 2);
+    write_le(fp, movie->start ? FLAG_FROM_STATE : 0, 2);
+    write_le(fp, rom->product_code, 4);
+    write_le(fp, rom->expected_checksum, 2);
+    write_le(fp, 0, 2);
+    write_le(fp, rom->size, 4);
+    write_le(fp, frames, 4);
+    write_le(fp, state_size, 4);
+    if (state)
+        fwrite(state, 1, state_size, fp);
+
+    for (size_t i = 0; i < frames; ) {
+        size_t count = 1;
+        while (i + count < frames && movie->inputs[i + count] ==
+                                     movie->inputs[i])
+            count++;
+        fputc(movie->inputs[i], fp);
+        fwrite(varint, 1, put_varint(varint, count), fp);
+        i += count;
+    }
+
+    bool ok = !ferror(fp);
+    if (fclose(fp) || !ok) {
+        ERROR_ERRNO("couldn't save movie file '%s'", path)
+        ok = false;
+    }
+    free(state);
+    return ok;
+}
+
+/*
+    Record the buttons held for the next frame. Call this at the end of each
+    frame, after any changes to the buttons.
+
+    The first frame's buttons come from the start: none at power-on, or the
+    ones held when the starting state was saved.
+*/
+void movie_record(Movie *movie, const GameGear *gg)
+{
+    movie_append(movie, gamegear_get_buttons(gg));
+}
+
+/*
+    Get a GameGear ready to play the movie from the start, restoring its
+    starting state if it has one.
+*/
+void movie_begin(Movie *movie, GameGear *gg)
+{
+    movie->pos = 0;
+    if (movie->start)
+        gamegear_load_state(gg, movie->start);
+}
+
+/*
+    Hold the buttons for the movie's next frame. Call this at the end of each
+    frame.
+
+    Return false once as many frames have run as were recorded, leaving the
+    buttons as they were.
+*/
+bool movie_play(Movie *movie, GameGear *gg)
+{
+    if (movie->pos < movie->frames)
+        movie->pos++;
+    if (movie->pos == movie->frames)
+        return false;
+    gamegear_set_buttons(gg, movie->inputs[movie->pos - 1]);
+    return true;
+}
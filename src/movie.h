@@ -0,0 +1,42 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gamegear.h"
+#include "rom.h"
+
+#define MOVIE_VERSION 1
+
+/* Structs */
+
+/*
+    An input movie: the buttons held during each frame of a run, from either
+    power-on or a saved state.
+
+    Buttons only change between frames while recording or playing one, so
+    replaying the same buttons from the same start reproduces the run
+    exactly.
+*/
+typedef struct {
+    uint8_t *inputs;
+    size_t frames, capacity;
+    size_t pos;
+    GGState *start;
+} Movie;
+
+/* Functions */
+
+void movie_init(Movie*);
+void movie_free(Movie*);
+void movie_set_start(Movie*, const GGState*);
+bool movie_load(Movie*, const char*, const ROM*);
+bool movie_save(const Movie*, const char*, const ROM*);
+void movie_append(Movie*, uint8_t);
+void movie_record(Movie*, const GameGear*);
+void movie_begin(Movie*, GameGear*);
+bool movie_play(Movie*, GameGear*);
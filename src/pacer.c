@@ -0,0 +1,181 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#if defined __linux__
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <math.h>
+#include <string.h>
+#include <time.h>
+
+#include "pacer.h"
+#include "util.h"
+
+#define NS_PER_SEC 1000000000
+
+/*
+    How long before a deadline to stop sleeping and start spinning. Sleeps can
+    overshoot by up to a scheduler tick, so the last stretch is busy-waited.
+*/
+#define SPIN_NS (1000 * 1000)
+
+/*
+    Initialize a pacer for the given mode and frame rate.
+*/
+void pacer_init(Pacer *pacer, PaceMode mode, double fps)
+{
+    pacer->mode = mode;
+    pacer->speed = 1;
+    pacer->base_period = pacer->period = NS_PER_SEC / fps;
+    pacer_reset(pacer);
+}
+
+/*
+    Run the given number of times faster than real time, or as fast as
+    possible if speed is PACER_UNTHROTTLED.
+
+    This only affects deadline mode; the deadline grid restarts at the next
+    frame so the change takes effect immediately.
+*/
+void pacer_set_speed(Pacer *pacer, unsigned speed)
+{
+    pacer->speed = speed;
+    pacer->period = speed ? pacer->base_period / speed : 0;
+    pacer->deadline = 0;
+}
+
+/*
+    Forget any previous deadline and clear the statistics.
+
+    The next call to pacer_wait() starts a new timeline from that moment.
+*/
+void pacer_reset(Pacer *pacer)
+{
+    pacer->deadline = 0;
+    pacer->last = 0;
+    pacer->frames = pacer->late = 0;
+    pacer->min = UINT64_MAX;
+    pacer->max = 0;
+    pacer->mean = pacer->m2 = 0;
+}
+
+/*
+    Block until the given time, as returned by get_time_ns().
+
+    The bulk of the wait is an absolute sleep, so that it never accumulates
+    drift; the rest is spent spinning.
+*/
+void pacer_sleep_until(uint64_t target)
+{
+    if (target > SPIN_NS && get_time_ns() < target - SPIN_NS) {
+#if defined __linux__
+        uint64_t wake = target - SPIN_NS;
+        struct timespec spec = {
+            .tv_sec = wake / NS_PER_SEC, .tv_nsec = wake % NS_PER_SEC};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, NULL));
+#else
+        uint64_t delta = target - SPIN_NS - get_time_ns();
+        struct timespec spec = {
+            .tv_sec = delta / NS_PER_SEC, .tv_nsec = delta % NS_PER_SEC};
+        nanosleep(&spec, NULL);
+#endif
+    }
+    while (get_time_ns() < target);
+}
+
+/*
+    Record the length of the frame that just ended.
+*/
+static void record_frame(Pacer *pacer, uint64_t now)
+{
+    if (pacer->last) {
+        uint64_t length = now - pacer->last;
+        if (length < pacer->min)
+            pacer->min = length;
+        if (length > pacer->max)
+            pacer->max = length;
+
+        // Welford's method, to avoid keeping every sample around:
+        pacer->frames++;
+        double delta = length - pacer->mean;
+        pacer->mean += delta / pacer->frames;
+        pacer->m2 += delta * (length - pacer->mean);
+    }
+    pacer->last = now;
+}
+
+/*
+    Wait for the end of the current frame.
+
+    In deadline mode, deadlines are kept on a fixed grid, so an early or late
+    frame doesn't shift the ones after it. If we fall more than a frame behind
+    (e.g. the process was suspended), the grid is restarted from now instead of
+    racing to catch up.
+*/
+void pacer_wait(Pacer *pacer)
+{
+    uint64_t now = get_time_ns();
+
+    if (pacer->mode == PACE_DEADLINE && pacer->speed != PACER_UNTHROTTLED) {
+        if (!pacer->deadline)
+            pacer->deadline = now + pacer->period;
+
+        if (now < pacer->deadline) {
+            pacer_sleep_until(pacer->deadline);
+            now = get_time_ns();
+        } else {
+            pacer->late++;
+        }
+
+        pacer->deadline += pacer->period;
+        if (pacer->deadline + pacer->period < now)
+            pacer->deadline = now + pacer->period;
+    }
+    record_frame(pacer, now);
+}
+
+/*
+    Fill in statistics about the frames seen so far, in milliseconds.
+
+    Jitter is the standard deviation of the frame length.
+*/
+void pacer_get_stats(const Pacer *pacer, PacerStats *stats)
+{
+    stats->frames = pacer->frames;
+    stats->late = pacer->late;
+    stats->mean = pacer->mean / 1e6;
+    stats->jitter = pacer->frames > 1 ?
+        sqrt(pacer->m2 / (pacer->frames - 1)) / 1e6 : 0;
+    stats->min = pacer->frames ? pacer->min / 1e6 : 0;
+    stats->max = pacer->max / 1e6;
+}
+
+/*
+    Return the name of the given pacing mode.
+*/
+const char* pacer_mode_name(PaceMode mode)
+{
+    switch (mode) {
+        case PACE_DEADLINE: return "deadline";
+        case PACE_AUDIO:    return "audio";
+        case PACE_VSYNC:    return "vsync";
+    }
+    return "unknown";
+}
+
+/*
+    Convert a pacing mode name into its enum value.
+
+    Return whether the name was recognized.
+*/
+bool pacer_parse_mode(const char *name, PaceMode *mode)
+{
+    for (PaceMode m = PACE_DEADLINE; m <= PACE_VSYNC; m++) {
+        if (!strcmp(name, pacer_mode_name(m))) {
+            *mode = m;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,58 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PACER_UNTHROTTLED 0
+
+/* Structs */
+
+typedef enum {
+    PACE_DEADLINE,
+    PACE_AUDIO,
+    PACE_VSYNC
+} PaceMode;
+
+/*
+    Frame pacing state.
+
+    In deadline mode the pacer sleeps until each frame's absolute start time,
+    with frames shortened by the speed multiplier (or not waited for at all
+    when unthrottled). In the other modes something else (the audio device or
+    the display) blocks the emulator, and the pacer only keeps statistics.
+*/
+typedef struct {
+    PaceMode mode;
+    unsigned speed;
+    uint64_t base_period;
+    uint64_t period;
+    uint64_t deadline;
+    uint64_t last;
+
+    uint64_t frames;
+    uint64_t late;
+    uint64_t min, max;
+    double mean, m2;
+} Pacer;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t late;
+    double mean;
+    double jitter;
+    double min, max;
+} PacerStats;
+
+/* Functions */
+
+void pacer_init(Pacer*, PaceMode, double);
+void pacer_reset(Pacer*);
+void pacer_set_speed(Pacer*, unsigned);
+void pacer_wait(Pacer*);
+void pacer_get_stats(const Pacer*, PacerStats*);
+const char* pacer_mode_name(PaceMode);
+bool pacer_parse_mode(const char*, PaceMode*);
+void pacer_sleep_until(uint64_t);
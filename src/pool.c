@@ -0,0 +1,147 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <unistd.h>
+
+#include "pool.h"
+#include "logging.h"
+#include "util.h"
+
+/*
+    Main loop of a pool thread: run each new task until told to stop.
+*/
+static void* run_worker(void *arg)
+{
+    PoolWorker *worker = arg;
+    ThreadPool *pool = worker->pool;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while (true) {
+        while (pool->generation == seen && !pool->stopping)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stopping)
+            break;
+        seen = pool->generation;
+
+        pthread_mutex_unlock(&pool->lock);
+        pool->task(pool->context, worker->index, pool->count);
+        pthread_mutex_lock(&pool->lock);
+
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->done);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/*
+    Create a pool that runs tasks on the given number of threads.
+
+    The calling thread counts as one of them, so a pool of size one starts no
+    threads at all and simply runs tasks in place. The size is capped at
+    POOL_MAX_THREADS.
+*/
+ThreadPool* pool_create(unsigned count)
+{
+    ThreadPool *pool = cr_malloc(sizeof(ThreadPool));
+    if (count < 1)
+        count = 1;
+    if (count > POOL_MAX_THREADS)
+        count = POOL_MAX_THREADS;
+
+    pool->count = count;
+    pool->task = NULL;
+    pool->context = NULL;
+    pool->generation = 0;
+    pool->running = 0;
+    pool->stopping = false;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (unsigned i = 1; i < count; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if (pthread_create(&pool->threads[i], NULL, run_worker,
+                           &pool->workers[i]))
+            FATAL_ERRNO("couldn't start a pool thread")
+    }
+    return pool;
+}
+
+/*
+    Stop all of a pool's threads and free it.
+*/
+void pool_destroy(ThreadPool *pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (unsigned i = 1; i < pool->count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+/*
+    Return the number of threads tasks are split across.
+*/
+unsigned pool_size(const ThreadPool *pool)
+{
+    return pool->count;
+}
+
+/*
+    Run a task on every thread of the pool, and wait for all of them.
+
+    The task is called as task(context, index, count) with each index from 0
+    to count - 1 exactly once; index 0 runs on the calling thread. Tasks are
+    expected to split their work by index.
+*/
+void pool_run(ThreadPool *pool, PoolTask task, void *context)
+{
+    if (pool->count == 1) {
+        task(context, 0, 1);
+        return;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->task = task;
+    pool->context = context;
+    pool->running = pool->count - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    task(context, 0, pool->count);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+    Return the number of online CPUs on this machine, or one if it is unknown.
+*/
+unsigned pool_cpu_count()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    return cpus < 1 ? 1 : cpus;
+}
+
+/*
+    Return a reasonable pool size for this machine: one thread per online
+    CPU, up to four.
+*/
+unsigned pool_default_size()
+{
+    unsigned cpus = pool_cpu_count();
+    return cpus < 4 ? cpus : 4;
+}
@@ -0,0 +1,50 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+
+#define POOL_MAX_THREADS 64
+
+/* Structs */
+
+typedef void (*PoolTask)(void*, unsigned, unsigned);
+
+struct ThreadPool;
+
+typedef struct {
+    struct ThreadPool *pool;
+    unsigned index;
+} PoolWorker;
+
+/*
+    A fixed set of threads that run one task at a time, fork-join style.
+
+    Each call to pool_run() runs the task once on every thread, including the
+    caller's, and returns when all of them are done.
+*/
+typedef struct ThreadPool {
+    pthread_t threads[POOL_MAX_THREADS];
+    PoolWorker workers[POOL_MAX_THREADS];
+    unsigned count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    PoolTask task;
+    void *context;
+    unsigned generation;
+    unsigned running;
+    bool stopping;
+} ThreadPool;
+
+/* Functions */
+
+ThreadPool* pool_create(unsigned);
+void pool_destroy(ThreadPool*);
+unsigned pool_size(const ThreadPool*);
+void pool_run(ThreadPool*, PoolTask, void*);
+unsigned pool_cpu_count();
+unsigned pool_default_size();
@@ -1,16 +1,92 @@
-/* Copyright (C) 2014-2016 Ben Kurtovic <ben.kurtovic@gmail.com>
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
    Released under the terms of the MIT License. See LICENSE for details. */
 
+#include <math.h>
+#include <pthread.h>
+#include <string.h>
+
 #include "psg.h"
 #include "util.h"
 
+#define PSG_DIVIDER 16
+#define LFSR_RESET 0x8000
+#define LFSR_TAPS 0x0009
+
+#define FRAC_BITS 32
+#define PHASE_BITS 6
+#define PHASES (1 << PHASE_BITS)
+#define BLIP_WIDTH PSG_KERNEL_WIDTH
+#define KERNEL_BITS 15
+#define BASS_SHIFT 9
+#define DELTAS_SIZE PSG_DELTAS_SIZE
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+    Output level of each attenuation setting, in 2 dB steps. Four channels at
+    full volume sum to just under the int16_t limit.
+*/
+static const int32_t volume_table[16] = {
+    8191, 6506, 5168, 4105, 3261, 2590, 2057, 1634,
+    1298, 1031,  819,  651,  517,  411,  326,    0
+};
+
+static int16_t kernel[PHASES][BLIP_WIDTH];
+static pthread_once_t kernel_once = PTHREAD_ONCE_INIT;
+
+/*
+    Build the band-limited step table. This is done once, by whichever thread
+    creates the first PSG; the table never changes after that.
+
+    Each row is a windowed-sinc impulse, lowpassed just below the output
+    Nyquist frequency and delayed by a fraction of a sample given by its
+    phase. Adding a scaled row into the delta buffer and integrating later
+    yields a step with no aliasing, so edges can be placed at their exact
+    sub-sample time without oversampling the PSG's native clock.
+*/
+static void build_kernel()
+{
+    const double cutoff = 0.45;
+    double taps[BLIP_WIDTH];
+
+    for (unsigned phase = 0; phase < PHASES; phase++) {
+        double sum = 0;
+        for (unsigned i = 0; i < BLIP_WIDTH; i++) {
+            double x = (double) i - (BLIP_WIDTH / 2 - 1) -
+                       (double) phase / PHASES;
+            double w = 2 * M_PI * x / BLIP_WIDTH;
+            double window = 0.42 + 0.5 * cos(w) + 0.08 * cos(2 * w);
+            double sinc = x ? sin(2 * M_PI * cutoff * x) / (M_PI * x)
+                            : 2 * cutoff;
+            taps[i] = sinc * (fabs(x) < BLIP_WIDTH / 2 ? window : 0);
+            sum += taps[i];
+        }
+
+        // Normalize each row so that its integral is exactly one step:
+        int32_t total = 0;
+        for (unsigned i = 0; i < BLIP_WIDTH; i++) {
+            kernel[phase][i] = lround(taps[i] / sum * (1 << KERNEL_BITS));
+            total += kernel[phase][i];
+        }
+        kernel[phase][BLIP_WIDTH / 2] += (1 << KERNEL_BITS) - total;
+    }
+}
+
 /*
     Initialize the SN76489 Programmable Sound Generator (PSG).
 */
 void psg_init(PSG *psg)
 {
-    // TODO
-    (void) psg;
+    pthread_once(&kernel_once, build_kernel);
+
+    psg->deltas[0] = cr_calloc(DELTAS_SIZE, sizeof(int32_t));
+    psg->deltas[1] = cr_calloc(DELTAS_SIZE, sizeof(int32_t));
+    psg->clock = NULL;
+    psg->time = psg->base = psg->base_pos = 0;
+    psg->clock_rate = psg->rate = 0;
+    psg->factor = 0;
 }
 
 /*
@@ -18,8 +94,8 @@ void psg_init(PSG *psg)
 */
 void psg_free(PSG *psg)
 {
-    // TODO
-    (void) psg;
+    free(psg->deltas[0]);
+    free(psg->deltas[1]);
 }
 
 /*
@@ -27,27 +103,344 @@ void psg_free(PSG *psg)
 */
 void psg_power(PSG *psg)
 {
-    psg->tone1 = psg->tone2 = psg->tone3 = 0x0000;
-    psg->vol1 = psg->vol2 = psg->vol3 = 0x0F;
+    psg->time = psg->base = psg->clock ? *psg->clock : 0;
+    psg->base_pos = 0;
+
+    for (unsigned ch = 0; ch < PSG_CHANNELS; ch++) {
+        PSGChannel *chan = &psg->channels[ch];
+        chan->period = 0x000;
+        chan->volume = 0x0F;
+        chan->output = false;
+        chan->next = psg->time + PSG_DIVIDER;
+        chan->left = chan->right = 0;
+    }
+    psg->latch = 0x00;
     psg->noise = 0x00;
+    psg->lfsr = LFSR_RESET;
+    psg->noise_flip = false;
+    psg->stereo = 0xFF;
+
+    memset(psg->deltas[0], 0x00, DELTAS_SIZE * sizeof(int32_t));
+    memset(psg->deltas[1], 0x00, DELTAS_SIZE * sizeof(int32_t));
+    psg->sums[0] = psg->sums[1] = 0;
+}
+
+/*
+    Return the output sample position of the given CPU cycle, as a fixed-point
+    index into the delta buffers.
+*/
+static inline uint64_t sample_position(const PSG *psg, uint64_t time)
+{
+    return psg->base_pos + (time - psg->base) * psg->factor;
+}
+
+/*
+    Add a band-limited step to both output sides at the given CPU cycle.
+*/
+static void add_delta(PSG *psg, uint64_t time, int32_t left, int32_t right)
+{
+    uint64_t pos = sample_position(psg, time);
+    size_t index = pos >> FRAC_BITS;
+    if (index >= PSG_BUFFER_SIZE)
+        return;
+
+    const int16_t *step = kernel[(pos >> (FRAC_BITS - PHASE_BITS)) % PHASES];
+    int32_t *ldeltas = psg->deltas[0] + index;
+    int32_t *rdeltas = psg->deltas[1] + index;
+
+    for (unsigned i = 0; i < BLIP_WIDTH; i++) {
+        ldeltas[i] += left * step[i];
+        rdeltas[i] += right * step[i];
+    }
+}
+
+/*
+    Recompute a channel's contribution to each side at the given CPU cycle,
+    emitting a step if it changed.
+*/
+static void update_channel(PSG *psg, unsigned ch, uint64_t time)
+{
+    PSGChannel *chan = &psg->channels[ch];
+    int32_t level = chan->output ? volume_table[chan->volume] : 0;
+    int32_t left  = (psg->stereo & (0x10 << ch)) ? level : 0;
+    int32_t right = (psg->stereo & (0x01 << ch)) ? level : 0;
+
+    if (left != chan->left || right != chan->right) {
+        add_delta(psg, time, left - chan->left, right - chan->right);
+        chan->left = left;
+        chan->right = right;
+    }
+}
+
+/*
+    Advance a tone channel up to the given CPU cycle.
+
+    Periods of zero and one toggle far above the audible range; the real chip
+    holds its output high instead, which games use to play samples by writing
+    the volume register directly.
+*/
+static void run_tone(PSG *psg, unsigned ch, uint64_t end)
+{
+    PSGChannel *chan = &psg->channels[ch];
+
+    if (chan->period <= 1) {
+        if (chan->next <= end) {
+            chan->output = true;
+            update_channel(psg, ch, chan->next);
+            chan->next += ((end - chan->next) / PSG_DIVIDER + 1) * PSG_DIVIDER;
+        }
+        return;
+    }
+
+    uint64_t step = chan->period * PSG_DIVIDER;
+    while (chan->next <= end) {
+        chan->output = !chan->output;
+        update_channel(psg, ch, chan->next);
+        chan->next += step;
+    }
+}
+
+/*
+    Advance the noise channel up to the given CPU cycle.
+
+    The shift register is clocked on every other counter expiry. In white noise
+    mode, its input is the parity of the tapped bits; in periodic mode, it
+    simply rotates.
+*/
+static void run_noise(PSG *psg, uint64_t end)
+{
+    PSGChannel *chan = &psg->channels[3];
+    uint16_t period = (psg->noise & 0x03) == 0x03 ?
+        psg->channels[2].period : 0x10 << (psg->noise & 0x03);
+    uint64_t step = (period ? period : 1) * PSG_DIVIDER;
+
+    while (chan->next <= end) {
+        psg->noise_flip = !psg->noise_flip;
+        if (psg->noise_flip) {
+            uint16_t input = (psg->noise & 0x04) ?
+                __builtin_parity(psg->lfsr & LFSR_TAPS) : (psg->lfsr & 1);
+            psg->lfsr = (psg->lfsr >> 1) | (input << 15);
+            chan->output = psg->lfsr & 1;
+            update_channel(psg, 3, chan->next);
+        }
+        chan->next += step;
+    }
+}
+
+/*
+    Synthesize everything between the last catch-up and the given CPU cycle.
+*/
+static void run_until(PSG *psg, uint64_t end)
+{
+    if (end <= psg->time)
+        return;
+    for (unsigned ch = 0; ch < 3; ch++)
+        run_tone(psg, ch, end);
+    run_noise(psg, end);
+    psg->time = end;
+}
+
+/*
+    Return the CPU cycle that the PSG should catch up to before a write.
+*/
+static inline uint64_t current_time(const PSG *psg)
+{
+    return psg->clock ? *psg->clock : psg->time;
 }
 
 /*
     Write a byte of input to the PSG.
+
+    Bytes with the top bit set select ("latch") a register and write its low
+    bits; other bytes write the high bits of the latched register.
 */
 void psg_write(PSG *psg, uint8_t byte)
 {
-    // TODO
-    (void) psg;
-    TRACE("PSG ignoring write: 0x%02X", byte)
+    uint64_t now = current_time(psg);
+    run_until(psg, now);
+
+    if (byte & 0x80)
+        psg->latch = (byte >> 4) & 0x07;
+
+    unsigned ch = psg->latch >> 1;
+    PSGChannel *chan = &psg->channels[ch];
+
+    if (psg->latch & 0x01) {
+        chan->volume = byte & 0x0F;
+        update_channel(psg, ch, now);
+    } else if (ch == 3) {
+        psg->noise = byte & 0x07;
+        psg->lfsr = LFSR_RESET;
+        chan->output = psg->lfsr & 1;
+        update_channel(psg, ch, now);
+    } else if (byte & 0x80) {
+        chan->period = (chan->period & 0x3F0) | (byte & 0x0F);
+    } else {
+        chan->period = (chan->period & 0x00F) | ((byte & 0x3F) << 4);
+    }
 }
 
 /*
     Send a byte to the PSG's stereo control.
+
+    The high nibble enables each channel (noise in bit 7, down to tone 1 in
+    bit 4) on the left side; the low nibble does the same for the right side.
 */
 void psg_stereo(PSG *psg, uint8_t byte)
 {
-    // TODO
-    (void) psg;
-    TRACE("PSG ignoring stereo: 0x%02X", byte)
+    uint64_t now = current_time(psg);
+    run_until(psg, now);
+
+    psg->stereo = byte;
+    for (unsigned ch = 0; ch < PSG_CHANNELS; ch++)
+        update_channel(psg, ch, now);
+}
+
+/*
+    Set the PSG's input clock rate and output sample rate, both in Hz.
+
+    This can be called at any time; samples already synthesized are kept, and
+    small adjustments to the output rate can be used to track a host clock.
+*/
+void psg_set_rate(PSG *psg, double clock_rate, double rate)
+{
+    psg->base_pos = sample_position(psg, psg->time);
+    psg->base = psg->time;
+    psg->clock_rate = clock_rate;
+    psg->rate = rate;
+    psg->factor = (uint64_t) (rate / clock_rate * ((uint64_t) 1 << FRAC_BITS));
+}
+
+/*
+    Return the number of finished stereo samples waiting to be read.
+*/
+size_t psg_samples_available(const PSG *psg)
+{
+    size_t avail = sample_position(psg, psg->time) >> FRAC_BITS;
+    return avail < PSG_BUFFER_SIZE ? avail : PSG_BUFFER_SIZE;
+}
+
+/*
+    Catch the PSG up to the CPU.
+
+    This is called at the end of each frame, so that samples are synthesized
+    in one batch rather than after every CPU instruction. If nobody is reading
+    the output, the oldest samples are dropped to make room for the next frame.
+*/
+void psg_sync(PSG *psg)
+{
+    run_until(psg, current_time(psg));
+    psg->base_pos = sample_position(psg, psg->time);
+    psg->base = psg->time;
+
+    size_t avail = psg_samples_available(psg);
+    if (avail > PSG_BUFFER_SIZE / 2)
+        psg_read_samples(psg, NULL, avail - PSG_BUFFER_SIZE / 2);
+}
+
+/*
+    Read up to count stereo samples from the PSG, interleaved left-right.
+
+    The output array must hold (2 * count) values. If it is NULL, the samples
+    are discarded. The number of samples actually read is returned.
+*/
+size_t psg_read_samples(PSG *psg, int16_t *out, size_t count)
+{
+    size_t avail = psg_samples_available(psg);
+    if (count > avail)
+        count = avail;
+    if (!count)
+        return 0;
+
+    for (unsigned side = 0; side < 2; side++) {
+        const int32_t *deltas = psg->deltas[side];
+        int32_t sum = psg->sums[side];
+
+        for (size_t i = 0; i < count; i++) {
+            sum += deltas[i];
+            int32_t sample = sum >> KERNEL_BITS;
+            sum -= sample << (KERNEL_BITS - BASS_SHIFT);
+
+            if (out) {
+                if (sample > INT16_MAX)
+                    sample = INT16_MAX;
+                else if (sample < INT16_MIN)
+                    sample = INT16_MIN;
+                out[2 * i + side] = sample;
+            }
+        }
+        psg->sums[side] = sum;
+
+        size_t remain = avail - count + BLIP_WIDTH;
+        memmove(psg->deltas[side], psg->deltas[side] + count,
+                remain * sizeof(int32_t));
+        memset(psg->deltas[side] + remain, 0x00, count * sizeof(int32_t));
+    }
+
+    psg->base_pos -= (uint64_t) count << FRAC_BITS;
+    return count;
+}
+
+/*
+    Return how many entries at the start of each delta buffer may be nonzero.
+
+    Steps are only ever added up to the current time, so everything past it
+    (and the width of the kernel) is still zero. Snapshots copy just this part.
+*/
+static size_t deltas_used(const PSG *psg)
+{
+    size_t used = (sample_position(psg, psg->time) >> FRAC_BITS) + BLIP_WIDTH;
+    return used < DELTAS_SIZE ? used : DELTAS_SIZE;
+}
+
+/*
+    Save the PSG's state so that it can be restored with psg_load_state().
+*/
+void psg_save_state(const PSG *psg, PSGState *state)
+{
+    memcpy(state->channels, psg->channels, sizeof(state->channels));
+    state->latch = psg->latch;
+    state->noise = psg->noise;
+    state->lfsr = psg->lfsr;
+    state->noise_flip = psg->noise_flip;
+    state->stereo = psg->stereo;
+
+    state->time = psg->time;
+    state->base = psg->base;
+    state->base_pos = psg->base_pos;
+    state->deltas_used = deltas_used(psg);
+    for (unsigned side = 0; side < 2; side++) {
+        memcpy(state->deltas[side], psg->deltas[side],
+               state->deltas_used * sizeof(int32_t));
+        state->sums[side] = psg->sums[side];
+    }
+}
+
+/*
+    Restore the PSG's state from a copy made by psg_save_state().
+
+    The output rate is not part of the state, so the current one is kept.
+*/
+void psg_load_state(PSG *psg, const PSGState *state)
+{
+    size_t used = deltas_used(psg);
+    size_t restored = state->deltas_used;
+    memcpy(psg->channels, state->channels, sizeof(psg->channels));
+    psg->latch = state->latch;
+    psg->noise = state->noise;
+    psg->lfsr = state->lfsr;
+    psg->noise_flip = state->noise_flip;
+    psg->stereo = state->stereo;
+
+    psg->time = state->time;
+    psg->base = state->base;
+    psg->base_pos = state->base_pos;
+    for (unsigned side = 0; side < 2; side++) {
+        memcpy(psg->deltas[side], state->deltas[side],
+               restored * sizeof(int32_t));
+        if (used > restored)
+            memset(psg->deltas[side] + restored, 0x00,
+                   (used - restored) * sizeof(int32_t));
+        psg->sums[side] = state->sums[side];
+    }
 }
@@ -1,18 +1,67 @@
-/* Copyright (C) 2014-2016 Ben Kurtovic <ben.kurtovic@gmail.com>
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
    Released under the terms of the MIT License. See LICENSE for details. */
 
 #pragma once
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+#define PSG_CHANNELS 4
+#define PSG_DEFAULT_RATE 48000
+#define PSG_BUFFER_SIZE 8192
+#define PSG_KERNEL_WIDTH 16
+#define PSG_DELTAS_SIZE (PSG_BUFFER_SIZE + PSG_KERNEL_WIDTH)
+
 /* Structs */
 
 typedef struct {
-    uint16_t tone1, tone2, tone3;
-    uint8_t vol1, vol2, vol3;
+    uint16_t period;
+    uint8_t volume;
+    bool output;
+    uint64_t next;
+    int32_t left, right;
+} PSGChannel;
+
+typedef struct {
+    PSGChannel channels[PSG_CHANNELS];
+    uint8_t latch;
     uint8_t noise;
+    uint16_t lfsr;
+    bool noise_flip;
+    uint8_t stereo;
+
+    const uint64_t *clock;
+    uint64_t time;
+    uint64_t base;
+    uint64_t base_pos;
+    uint64_t factor;
+    double clock_rate, rate;
+    int32_t *deltas[2];
+    int32_t sums[2];
 } PSG;
 
+/*
+    Includes output that hasn't been read yet, so that restoring a state
+    doesn't leave a gap or a click in the audio. Only the first deltas_used
+    entries of each delta buffer are meaningful; the rest are zero.
+*/
+typedef struct {
+    PSGChannel channels[PSG_CHANNELS];
+    uint8_t latch;
+    uint8_t noise;
+    uint16_t lfsr;
+    bool noise_flip;
+    uint8_t stereo;
+
+    uint64_t time;
+    uint64_t base;
+    uint64_t base_pos;
+    size_t deltas_used;
+    int32_t deltas[2][PSG_DELTAS_SIZE];
+    int32_t sums[2];
+} PSGState;
+
 /* Functions */
 
 void psg_init(PSG*);
@@ -20,3 +69,9 @@ void psg_free(PSG*);
 void psg_power(PSG*);
 void psg_write(PSG*, uint8_t);
 void psg_stereo(PSG*, uint8_t);
+void psg_set_rate(PSG*, double, double);
+void psg_sync(PSG*);
+void psg_save_state(const PSG*, PSGState*);
+void psg_load_state(PSG*, const PSGState*);
+size_t psg_samples_available(const PSG*);
+size_t psg_read_samples(PSG*, int16_t*, size_t);
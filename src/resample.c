@@ -0,0 +1,280 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <math.h>
+#include <string.h>
+
+#if defined __AVX__
+#include <immintrin.h>
+#elif defined __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "resample.h"
+#include "util.h"
+
+#define FRAC_BITS 32
+#define INT16_SCALE 32768.f
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+    Filter length, number of phases (as a power of two), and Kaiser window
+    shape for each quality level. Tap counts are multiples of eight so the
+    vector loops never need a scalar tail.
+*/
+static const struct {
+    const char *name;
+    unsigned taps;
+    unsigned phase_bits;
+    double beta;
+    double cutoff;
+} qualities[] = {
+    [RESAMPLE_FAST]   = {"fast",    8,  6,  5.0, 0.80},
+    [RESAMPLE_MEDIUM] = {"medium", 16,  8,  7.0, 0.88},
+    [RESAMPLE_BEST]   = {"best",   32, 10, 10.0, 0.92}
+};
+
+/*
+    Zeroth-order modified Bessel function of the first kind, for the Kaiser
+    window.
+*/
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    for (unsigned k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+/*
+    Fill the filter table with one windowed-sinc row per phase.
+
+    The passband is narrowed when downsampling so that the output stays free
+    of aliasing. Each row is normalized to unity gain.
+*/
+static void build_filter(Resampler *rs, double ratio)
+{
+    unsigned taps = rs->taps, phases = 1 << rs->phase_bits;
+    double beta = qualities[rs->quality].beta;
+    double cutoff = qualities[rs->quality].cutoff * (ratio < 1 ? ratio : 1);
+    double norm = bessel_i0(beta);
+
+    for (unsigned phase = 0; phase < phases; phase++) {
+        float *row = rs->filter + phase * taps;
+        double sum = 0;
+
+        for (unsigned i = 0; i < taps; i++) {
+            double x = (double) i - (taps / 2 - 1) - (double) phase / phases;
+            double t = 2 * x / taps;
+            double window = fabs(t) < 1 ?
+                bessel_i0(beta * sqrt(1 - t * t)) / norm : 0;
+            double sinc = x ? sin(M_PI * cutoff * x) / (M_PI * x) : cutoff;
+            row[i] = sinc * window;
+            sum += row[i];
+        }
+        for (unsigned i = 0; i < taps; i++)
+            row[i] /= sum;
+    }
+}
+
+/*
+    Initialize a resampler converting between the given rates, in Hz.
+*/
+void resampler_init(Resampler *rs, ResampleQuality quality, double in_rate,
+    double out_rate)
+{
+    rs->quality = quality;
+    rs->taps = qualities[quality].taps;
+    rs->phase_bits = qualities[quality].phase_bits;
+    rs->filter = cr_malloc(sizeof(float) * rs->taps << rs->phase_bits);
+    build_filter(rs, out_rate / in_rate);
+
+    // Start with a filter's worth of silence, so output begins immediately:
+    rs->capacity = 4096;
+    rs->length = rs->taps;
+    for (unsigned side = 0; side < 2; side++)
+        rs->input[side] = cr_calloc(rs->capacity, sizeof(float));
+    rs->position = 0;
+    resampler_set_rates(rs, in_rate, out_rate);
+}
+
+/*
+    Free memory previously allocated by the resampler.
+*/
+void resampler_free(Resampler *rs)
+{
+    free(rs->filter);
+    free(rs->input[0]);
+    free(rs->input[1]);
+}
+
+/*
+    Change the conversion ratio without disturbing the output.
+
+    The filter is not rebuilt, so this is meant for small adjustments (e.g.
+    dynamic rate control), not for switching to a very different rate.
+*/
+void resampler_set_rates(Resampler *rs, double in_rate, double out_rate)
+{
+    rs->step = in_rate / out_rate * ((uint64_t) 1 << FRAC_BITS);
+}
+
+/*
+    Return the most output samples that resampler_run() can produce from the
+    given number of input samples.
+*/
+size_t resampler_max_output(const Resampler *rs, size_t count)
+{
+    uint64_t end = (uint64_t) (rs->length + count) << FRAC_BITS;
+    return (end - rs->position) / rs->step + 1;
+}
+
+/*
+    Run one output sample's filter over both sides of the input.
+*/
+static inline void convolve(const float *left, const float *right,
+    const float *filter, unsigned taps, float *out_left, float *out_right)
+{
+    unsigned i = 0;
+
+#if defined __AVX__
+    __m256 accl = _mm256_setzero_ps(), accr = _mm256_setzero_ps();
+    for (; i < taps; i += 8) {
+        __m256 h = _mm256_loadu_ps(filter + i);
+        accl = _mm256_add_ps(accl, _mm256_mul_ps(h, _mm256_loadu_ps(left + i)));
+        accr = _mm256_add_ps(accr, _mm256_mul_ps(h, _mm256_loadu_ps(right + i)));
+    }
+    __m128 suml = _mm_add_ps(_mm256_castps256_ps128(accl),
+                             _mm256_extractf128_ps(accl, 1));
+    __m128 sumr = _mm_add_ps(_mm256_castps256_ps128(accr),
+                             _mm256_extractf128_ps(accr, 1));
+#elif defined __SSE2__
+    __m128 suml = _mm_setzero_ps(), sumr = _mm_setzero_ps();
+    for (; i < taps; i += 4) {
+        __m128 h = _mm_loadu_ps(filter + i);
+        suml = _mm_add_ps(suml, _mm_mul_ps(h, _mm_loadu_ps(left + i)));
+        sumr = _mm_add_ps(sumr, _mm_mul_ps(h, _mm_loadu_ps(right + i)));
+    }
+#endif
+
+#if defined __AVX__ || defined __SSE2__
+    // Reduce both accumulators at once: (l0+l1, r0+r1, l2+l3, r2+r3), etc.
+    __m128 pairs = _mm_add_ps(_mm_unpacklo_ps(suml, sumr),
+                              _mm_unpackhi_ps(suml, sumr));
+    __m128 total = _mm_add_ps(pairs, _mm_movehl_ps(pairs, pairs));
+    float result[4];
+    _mm_storeu_ps(result, total);
+    *out_left = result[0];
+    *out_right = result[1];
+#else
+    float suml = 0, sumr = 0;
+    for (; i < taps; i++) {
+        suml += filter[i] * left[i];
+        sumr += filter[i] * right[i];
+    }
+    *out_left = suml;
+    *out_right = sumr;
+#endif
+}
+
+/*
+    Convert a float sample to a clamped int16_t.
+*/
+static inline int16_t to_int16(float sample)
+{
+    if (sample >= INT16_MAX)
+        return INT16_MAX;
+    if (sample <= INT16_MIN)
+        return INT16_MIN;
+    return lrintf(sample);
+}
+
+/*
+    Resample a block of interleaved stereo int16_t samples.
+
+    The output is interleaved stereo in the given format; floats are scaled to
+    [-1, 1]. out must have room for resampler_max_output() samples. Input that
+    can't be used yet is kept for the next call. Return the number of samples
+    written.
+*/
+size_t resampler_run(Resampler *rs, const int16_t *in, size_t count,
+    void *out, SampleFormat format)
+{
+    if (rs->length + count > rs->capacity) {
+        while (rs->length + count > rs->capacity)
+            rs->capacity *= 2;
+        for (unsigned side = 0; side < 2; side++)
+            rs->input[side] = cr_realloc(rs->input[side],
+                                         sizeof(float) * rs->capacity);
+    }
+
+    float *left = rs->input[0] + rs->length, *right = rs->input[1] + rs->length;
+    for (size_t i = 0; i < count; i++) {
+        left[i]  = in[2 * i];
+        right[i] = in[2 * i + 1];
+    }
+    rs->length += count;
+
+    uint64_t end = rs->length >= rs->taps ?
+        (uint64_t) (rs->length - rs->taps + 1) << FRAC_BITS : 0;
+    unsigned shift = FRAC_BITS - rs->phase_bits;
+    size_t written = 0;
+
+    while (rs->position < end) {
+        size_t index = rs->position >> FRAC_BITS;
+        const float *filter = rs->filter +
+            ((rs->position & 0xFFFFFFFF) >> shift) * rs->taps;
+        float l, r;
+
+        convolve(rs->input[0] + index, rs->input[1] + index, filter, rs->taps,
+                 &l, &r);
+        if (format == SAMPLE_FLOAT) {
+            ((float*) out)[2 * written]     = l / INT16_SCALE;
+            ((float*) out)[2 * written + 1] = r / INT16_SCALE;
+        } else {
+            ((int16_t*) out)[2 * written]     = to_int16(l);
+            ((int16_t*) out)[2 * written + 1] = to_int16(r);
+        }
+        written++;
+        rs->position += rs->step;
+    }
+
+    size_t consumed = rs->position >> FRAC_BITS;
+    if (consumed > rs->length)
+        consumed = rs->length;
+    for (unsigned side = 0; side < 2; side++)
+        memmove(rs->input[side], rs->input[side] + consumed,
+                sizeof(float) * (rs->length - consumed));
+    rs->length -= consumed;
+    rs->position -= (uint64_t) consumed << FRAC_BITS;
+    return written;
+}
+
+/*
+    Return the name of the given quality level.
+*/
+const char* resampler_quality_name(ResampleQuality quality)
+{
+    return qualities[quality].name;
+}
+
+/*
+    Convert a quality level name into its enum value.
+
+    Return whether the name was recognized.
+*/
+bool resampler_parse_quality(const char *name, ResampleQuality *quality)
+{
+    for (ResampleQuality q = RESAMPLE_FAST; q <= RESAMPLE_BEST; q++) {
+        if (!strcmp(name, resampler_quality_name(q))) {
+            *quality = q;
+            return true;
+        }
+    }
+    return false;
+}
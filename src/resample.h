@@ -0,0 +1,49 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Structs */
+
+typedef enum {
+    RESAMPLE_FAST,
+    RESAMPLE_MEDIUM,
+    RESAMPLE_BEST
+} ResampleQuality;
+
+typedef enum {
+    SAMPLE_INT16,
+    SAMPLE_FLOAT
+} SampleFormat;
+
+/*
+    A windowed-sinc polyphase resampler for interleaved stereo samples.
+
+    Input is kept as planar floats so the filter can be run over both sides
+    with wide vector loads. position is the fixed-point index of the next
+    output sample within the input buffers.
+*/
+typedef struct {
+    ResampleQuality quality;
+    unsigned taps;
+    unsigned phase_bits;
+    float *filter;
+    float *input[2];
+    size_t length, capacity;
+    uint64_t position;
+    uint64_t step;
+} Resampler;
+
+/* Functions */
+
+void resampler_init(Resampler*, ResampleQuality, double, double);
+void resampler_free(Resampler*);
+void resampler_set_rates(Resampler*, double, double);
+size_t resampler_max_output(const Resampler*, size_t);
+size_t resampler_run(Resampler*, const int16_t*, size_t, void*, SampleFormat);
+const char* resampler_quality_name(ResampleQuality);
+bool resampler_parse_quality(const char*, ResampleQuality*);
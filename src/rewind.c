@@ -0,0 +1,326 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rewind.h"
+#include "logging.h"
+#include "state.h"
+#include "util.h"
+
+#define PACKED_SIZE (2 * STATE_MAX_SIZE)
+#define MIN_RUN 4
+
+/*
+    Return the first position from i on where the two buffers differ, or n.
+*/
+static size_t skip_same(const uint8_t *a, const uint8_t *b, size_t i,
+    size_t n)
+{
+    uint64_t x, y;
+    while (i + sizeof(x) <= n) {
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+        if (x != y)
+            break;
+        i += sizeof(x);
+    }
+    while (i < n && a[i] == b[i])
+        i++;
+    return i;
+}
+
+/*
+    Encode the XOR of two buffers of length n as a list of runs: the number of
+    bytes that are the same, the number that differ, then the XOR of those.
+    Short stretches of equal bytes are kept within a run of different ones.
+
+    Return the length of the output, which is at most 2 * n bytes.
+*/
+static size_t pack_delta(const uint8_t *a, const uint8_t *b, size_t n,
+    uint8_t *out)
+{
+    size_t i = 0, len = 0;
+
+    while (i < n) {
+        size_t start = i;
+        i = skip_same(a, b, i, n);
+        if (i == n)
+            break;
+
+        size_t diff = i, same = 0;
+        while (i < n && same < MIN_RUN) {
+            same = a[i] == b[i] ? same + 1 : 0;
+            i++;
+        }
+        i -= same;
+
+        len += put_varint(out + len, diff - start);
+        len += put_varint(out + len, i - diff);
+        for (size_t j = diff; j < i; j++)
+            out[len++] = a[j] ^ b[j];
+    }
+    return len;
+}
+
+/*
+    Apply a delta made by pack_delta() to a buffer, turning either side of it
+    into the other.
+*/
+static void unpack_delta(const uint8_t *in, size_t length, uint8_t *buf)
+{
+    size_t pos = 0, skip, count;
+
+    for (size_t i = 0; i < length; ) {
+        i += get_varint(in + i, length - i, &skip);
+        i += get_varint(in + i, length - i, &count);
+        pos += skip;
+        for (size_t j = 0; j < count; j++)
+            buf[pos++] ^= in[i++];
+    }
+}
+
+/*
+    Forget the oldest delta in the history.
+*/
+static void drop_oldest(Rewind *rw)
+{
+    rw->first = (rw->first + 1) % rw->frames;
+    rw->count--;
+}
+
+/*
+    Find room in the history for a delta of the given length, dropping old
+    ones as needed, and return its offset.
+
+    Deltas are laid out one after another, wrapping around to the start when
+    they reach the end. A delta never starts where the oldest one does, so
+    it's always clear whether they have wrapped around.
+*/
+static size_t make_room(Rewind *rw, size_t length)
+{
+    if (rw->count == rw->frames)
+        drop_oldest(rw);
+
+    while (rw->count) {
+        const RewindEntry *oldest = &rw->entries[rw->first];
+        const RewindEntry *last =
+            &rw->entries[(rw->first + rw->count - 1) % rw->frames];
+        size_t end = last->offset + last->length;
+
+        if (last->offset >= oldest->offset) {
+            if (end + length <= REWIND_BUDGET)
+                return end;
+            if (length < oldest->offset)
+                return 0;
+        } else if (end + length < oldest->offset) {
+            return end;
+        }
+        drop_oldest(rw);
+    }
+    return 0;
+}
+
+/*
+    Add the delta in the packed buffer to the history.
+*/
+static void store_delta(Rewind *rw, size_t length, size_t prev_size)
+{
+    if (length > REWIND_BUDGET) {
+        rw->count = 0;  // Older deltas can't be reached without this one
+        return;
+    }
+
+    size_t offset = make_room(rw, length);
+    memcpy(rw->history + offset, rw->packed, length);
+    rw->entries[(rw->first + rw->count) % rw->frames] =
+        (RewindEntry) {offset, length, prev_size};
+    rw->count++;
+}
+
+/*
+    Serialize a snapshot and add it to the history.
+
+    Audio the PSG has buffered but not yet played is left out; it changes
+    completely every frame and isn't worth keeping, since rewinding doesn't
+    play it anyway.
+*/
+static void record(Rewind *rw, GGState *state)
+{
+    state->psg.deltas_used = 0;
+    size_t size = state_serialize(state, rw->rom, rw->scratch, STATE_MAX_SIZE);
+    if (size < rw->scratch_size)
+        memset(rw->scratch + size, 0x00, rw->scratch_size - size);
+
+    if (rw->newest_size) {
+        size_t n = size > rw->newest_size ? size : rw->newest_size;
+        size_t length = pack_delta(rw->newest, rw->scratch, n, rw->packed);
+        store_delta(rw, length, rw->newest_size);
+    }
+
+    uint8_t *newest = rw->newest;
+    rw->newest = rw->scratch;
+    rw->scratch = newest;
+    rw->scratch_size = rw->newest_size;
+    rw->newest_size = size;
+}
+
+/*
+    Main loop of the rewind thread: record each snapshot handed to it until
+    told to stop.
+*/
+static void* run_thread(void *arg)
+{
+    Rewind *rw = arg;
+
+    pthread_mutex_lock(&rw->lock);
+    while (true) {
+        while (!rw->queued && !rw->stopping)
+            pthread_cond_wait(&rw->start, &rw->lock);
+        if (rw->stopping)
+            break;
+
+        GGState *state = &rw->slots[rw->head];
+        pthread_mutex_unlock(&rw->lock);
+        record(rw, state);
+        pthread_mutex_lock(&rw->lock);
+
+        rw->head = (rw->head + 1) % REWIND_QUEUE_SIZE;
+        rw->queued--;
+        pthread_cond_signal(&rw->done);
+    }
+    pthread_mutex_unlock(&rw->lock);
+    return NULL;
+}
+
+/*
+    Initialize rewinding by up to the given number of frames, for a GameGear
+    running the given ROM, and start its thread.
+*/
+void rewind_init(Rewind *rw, unsigned frames, const ROM *rom)
+{
+    rw->frames = frames ? frames : 1;
+    rw->rom = rom;
+    rw->slots = cr_malloc(sizeof(GGState) * REWIND_QUEUE_SIZE);
+    rw->head = rw->queued = 0;
+    rw->dropped = 0;
+
+    rw->newest = cr_calloc(STATE_MAX_SIZE, sizeof(uint8_t));
+    rw->scratch = cr_calloc(STATE_MAX_SIZE, sizeof(uint8_t));
+    rw->packed = cr_malloc(PACKED_SIZE);
+    rw->newest_size = rw->scratch_size = 0;
+    rw->history = cr_malloc(REWIND_BUDGET);
+    rw->entries = cr_malloc(sizeof(RewindEntry) * rw->frames);
+    rw->first = rw->count = 0;
+    rw->restore = cr_malloc(sizeof(GGState));
+
+    rw->stopping = false;
+    pthread_mutex_init(&rw->lock, NULL);
+    pthread_cond_init(&rw->start, NULL);
+    pthread_cond_init(&rw->done, NULL);
+    if (pthread_create(&rw->thread, NULL, run_thread, rw))
+        FATAL("couldn't start the rewind thread")
+}
+
+/*
+    Stop the rewind thread and free memory allocated by rewind_init().
+*/
+void rewind_free(Rewind *rw)
+{
+    pthread_mutex_lock(&rw->lock);
+    rw->stopping = true;
+    pthread_cond_signal(&rw->start);
+    pthread_mutex_unlock(&rw->lock);
+    pthread_join(rw->thread, NULL);
+
+    if (rw->count) {
+        const RewindEntry *last =
+            &rw->entries[(rw->first + rw->count - 1) % rw->frames];
+        size_t used = last->offset + last->length;
+        if (last->offset < rw->entries[rw->first].offset)
+            used += REWIND_BUDGET - rw->entries[rw->first].offset;
+        else
+            used -= rw->entries[rw->first].offset;
+        DEBUG("Rewind history held %u frames in %zu KB", rw->count,
+              used >> 10)
+    }
+    if (rw->dropped)
+        DEBUG("Rewind skipped %llu frames while busy",
+              (unsigned long long) rw->dropped)
+
+    pthread_cond_destroy(&rw->done);
+    pthread_cond_destroy(&rw->start);
+    pthread_mutex_destroy(&rw->lock);
+    free(rw->restore);
+    free(rw->entries);
+    free(rw->history);
+    free(rw->packed);
+    free(rw->scratch);
+    free(rw->newest);
+    free(rw->slots);
+}
+
+/*
+    Record the GameGear's state at the end of a frame.
+
+    The snapshot is taken here, which is quick; the thread does the rest. If
+    it falls behind, this frame is left out of the history.
+*/
+void rewind_push(Rewind *rw, const GameGear *gg)
+{
+    pthread_mutex_lock(&rw->lock);
+    if (rw->queued == REWIND_QUEUE_SIZE) {
+        rw->dropped++;
+        pthread_mutex_unlock(&rw->lock);
+        return;
+    }
+    GGState *state = &rw->slots[(rw->head + rw->queued) % REWIND_QUEUE_SIZE];
+    pthread_mutex_unlock(&rw->lock);
+
+    gamegear_save_state(gg, state);
+
+    pthread_mutex_lock(&rw->lock);
+    rw->queued++;
+    pthread_cond_signal(&rw->start);
+    pthread_mutex_unlock(&rw->lock);
+}
+
+/*
+    Take the GameGear back one frame, in place of recording the frame just
+    emulated. Call this at the end of each frame for as long as rewinding
+    should go on; each one shows the frame before the last.
+
+    Once the history runs out, the GameGear is held at the oldest state. The
+    return value indicates whether it went back a frame.
+*/
+bool rewind_step(Rewind *rw, GameGear *gg)
+{
+    bool stepped = false;
+
+    pthread_mutex_lock(&rw->lock);
+    while (rw->queued)
+        pthread_cond_wait(&rw->done, &rw->lock);
+    if (rw->count) {
+        const RewindEntry *last =
+            &rw->entries[(rw->first + rw->count - 1) % rw->frames];
+        unpack_delta(rw->history + last->offset, last->length, rw->newest);
+        rw->newest_size = last->prev_size;
+        rw->count--;
+        stepped = true;
+    }
+    pthread_mutex_unlock(&rw->lock);
+
+    // The thread is idle now, since only we give it snapshots
+    if (!rw->newest_size)
+        return false;
+
+    const char *error = state_deserialize(rw->restore, rw->rom, rw->newest,
+                                          rw->newest_size);
+    if (error) {
+        ERROR("couldn't rewind: %s", error)
+        return false;
+    }
+    gamegear_load_state(gg, rw->restore);
+    return stepped;
+}
@@ -0,0 +1,69 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gamegear.h"
+#include "rom.h"
+
+#define REWIND_DEFAULT_SECONDS 60
+#define REWIND_MAX_SECONDS 3600
+#define REWIND_BUDGET (64 << 20)  // 64 MB
+#define REWIND_QUEUE_SIZE 4
+
+/* Structs */
+
+/*
+    Where a frame's delta lives in the history, and the serialized size of the
+    state before it.
+*/
+typedef struct {
+    size_t offset, length;
+    size_t prev_size;
+} RewindEntry;
+
+/*
+    Rewind state.
+
+    Snapshots are taken every frame and handed to a thread, which serializes
+    each one and stores it as the XOR of it and the one before, run-length
+    encoded. Since most of the Game Gear's memory doesn't change from one frame
+    to the next, these deltas are small.
+
+    Only the newest state is kept whole. XOR deltas work in both directions,
+    so stepping back undoes the newest delta to get the state before it, and
+    no keyframes are needed. The oldest deltas are dropped to stay within the
+    frame limit and the memory budget.
+*/
+typedef struct {
+    unsigned frames;
+    const ROM *rom;
+    GGState *slots;
+    unsigned head, queued;
+    uint64_t dropped;
+
+    uint8_t *newest, *scratch, *packed;
+    size_t newest_size, scratch_size;
+    uint8_t *history;
+    RewindEntry *entries;
+    unsigned first, count;
+    GGState *restore;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    bool stopping;
+} Rewind;
+
+/* Functions */
+
+void rewind_init(Rewind*, unsigned, const ROM*);
+void rewind_free(Rewind*);
+void rewind_push(Rewind*, const GameGear*);
+bool rewind_step(Rewind*, GameGear*);
@@ -0,0 +1,136 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <string.h>
+
+#include "ring.h"
+#include "util.h"
+
+/*
+    Initialize a ring buffer holding up to the given number of elements.
+
+    The capacity is rounded up to the next power of two.
+*/
+void ring_init(Ring *ring, size_t capacity, size_t elem_size)
+{
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+
+    ring->data = cr_malloc(size * elem_size);
+    ring->elem_size = elem_size;
+    ring->mask = size - 1;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+}
+
+/*
+    Free memory previously allocated by the ring buffer.
+*/
+void ring_free(Ring *ring)
+{
+    free(ring->data);
+    ring->data = NULL;
+}
+
+/*
+    Return the maximum number of elements the ring buffer can hold.
+*/
+size_t ring_capacity(const Ring *ring)
+{
+    return ring->mask + 1;
+}
+
+/*
+    Return the number of elements currently in the ring buffer.
+
+    This is exact when called by either the producer or the consumer; to
+    anyone else it is only a snapshot.
+*/
+size_t ring_used(const Ring *ring)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return head - tail;
+}
+
+/*
+    Copy count elements between the ring's storage and a flat buffer, starting
+    at the given (unmasked) ring position and handling wraparound.
+*/
+static void copy_elements(Ring *ring, size_t pos, void *buffer, size_t count,
+    bool into_ring)
+{
+    size_t start = pos & ring->mask, size = ring->elem_size;
+    size_t first = ring->mask + 1 - start;
+    if (first > count)
+        first = count;
+
+    unsigned char *flat = buffer, *data = ring->data;
+    if (into_ring) {
+        memcpy(data + start * size, flat, first * size);
+        memcpy(data, flat + first * size, (count - first) * size);
+    } else {
+        memcpy(flat, data + start * size, first * size);
+        memcpy(flat + first * size, data, (count - first) * size);
+    }
+}
+
+/*
+    Write up to count elements into the ring buffer. Producer only.
+
+    Return the number of elements actually written, which is less than count
+    if the buffer fills up.
+*/
+size_t ring_write(Ring *ring, const void *elems, size_t count)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    size_t space = ring->mask + 1 - (head - tail);
+    if (count > space)
+        count = space;
+    if (!count)
+        return 0;
+
+    copy_elements(ring, head, (void*) elems, count, true);
+    atomic_store_explicit(&ring->head, head + count, memory_order_release);
+    return count;
+}
+
+/*
+    Copy up to count elements out of the ring buffer without consuming them.
+    Consumer only.
+
+    Return the number of elements copied.
+*/
+size_t ring_peek(Ring *ring, void *elems, size_t count)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (count > head - tail)
+        count = head - tail;
+    if (count)
+        copy_elements(ring, tail, elems, count, false);
+    return count;
+}
+
+/*
+    Consume count elements previously returned by ring_peek(). Consumer only.
+*/
+void ring_skip(Ring *ring, size_t count)
+{
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + count, memory_order_release);
+}
+
+/*
+    Read and consume up to count elements from the ring buffer. Consumer only.
+
+    Return the number of elements actually read.
+*/
+size_t ring_read(Ring *ring, void *elems, size_t count)
+{
+    count = ring_peek(ring, elems, count);
+    ring_skip(ring, count);
+    return count;
+}
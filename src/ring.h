@@ -0,0 +1,38 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define RING_CACHE_LINE 64
+
+/* Structs */
+
+/*
+    A wait-free ring buffer for one producer thread and one consumer thread.
+
+    The head is only written by the producer and the tail only by the consumer,
+    so they are kept on separate cache lines.
+*/
+typedef struct {
+    unsigned char *data;
+    size_t elem_size;
+    size_t mask;
+    alignas(RING_CACHE_LINE) atomic_size_t head;
+    alignas(RING_CACHE_LINE) atomic_size_t tail;
+} Ring;
+
+/* Functions */
+
+void ring_init(Ring*, size_t, size_t);
+void ring_free(Ring*);
+size_t ring_capacity(const Ring*);
+size_t ring_used(const Ring*);
+size_t ring_write(Ring*, const void*, size_t);
+size_t ring_read(Ring*, void*, size_t);
+size_t ring_peek(Ring*, void*, size_t);
+void ring_skip(Ring*, size_t);
@@ -16,7 +16,7 @@
 #define NUM_LOCATIONS 3
 #define SIZE_CODE_BUF 8
 
-static size_t header_locations[NUM_LOCATIONS] = {0x7FF0, 0x3FF0, 0x1FF0};
+static const size_t header_locations[NUM_LOCATIONS] = {0x7FF0, 0x3FF0, 0x1FF0};
 
 /*
     @DEBUG_LEVEL
@@ -153,6 +153,45 @@ static bool find_and_read_header(ROM *rom)
     return false;
 }
 
+/*
+    Set up a ROM with no image yet, named after where it came from.
+*/
+static void init_rom(ROM *rom, const char *name)
+{
+    rom->name = cr_strdup(name);
+    rom->data = NULL;
+    rom->size = 0;
+    rom->header_location = 0;
+    rom->reported_checksum = 0;
+    rom->expected_checksum = 0;
+    rom->product_code = 0;
+    rom->version = 0;
+    rom->region_code = 0;
+    rom->declared_size = 0;
+}
+
+/*
+    Check a ROM whose image has been loaded, parsing its header.
+
+    NULL is returned if it is valid. Otherwise, the ROM is closed and an error
+    string is returned.
+*/
+static const char* check_rom(ROM *rom)
+{
+    if (!find_and_read_header(rom)) {
+        rom_close(rom);
+        return rom_err_badheader;
+    }
+
+    if (rom->region_code == 3 || rom->region_code == 4) {
+        // TODO: support SMS ROMs eventually?
+        rom_close(rom);
+        return rom_err_sms;
+    }
+
+    return NULL;
+}
+
 /*
     Load a ROM image located at the given path.
 
@@ -176,21 +215,7 @@ const char* rom_open(ROM *rom, const char *path)
         return (st.st_mode & S_IFDIR) ? rom_err_isdir : rom_err_notfile;
     }
 
-    // Set defaults:
-    rom->name = NULL;
-    rom->data = NULL;
-    rom->size = 0;
-    rom->header_location = 0;
-    rom->reported_checksum = 0;
-    rom->expected_checksum = 0;
-    rom->product_code = 0;
-    rom->version = 0;
-    rom->region_code = 0;
-    rom->declared_size = 0;
-
-    // Set rom->name:
-    rom->name = cr_malloc(sizeof(char) * (strlen(path) + 1));
-    strcpy(rom->name, path);
+    init_rom(rom, path);
     DEBUG("Loading ROM %s:", rom->name)
 
     // Set rom->size:
@@ -211,23 +236,36 @@ const char* rom_open(ROM *rom, const char *path)
     }
     fclose(fp);
 
-    // Parse the header:
-    if (!find_and_read_header(rom)) {
-        rom_close(rom);
-        return rom_err_badheader;
-    }
+    return check_rom(rom);
+}
 
-    if (rom->region_code == 3 || rom->region_code == 4) {
-        // TODO: support SMS ROMs eventually?
+/*
+    Load a ROM image from memory, e.g. one embedded in another program, giving
+    it the name for messages. The image is copied, so the caller keeps its own.
+
+    Return NULL or an error string, like rom_open().
+*/
+const char* rom_load(ROM *rom, const uint8_t *data, size_t size,
+                     const char *name)
+{
+    init_rom(rom, name);
+    DEBUG("Loading ROM %s from memory:", rom->name)
+
+    DEBUG("- size: %zu bytes (%s)", size, size_to_string(size))
+    if (size_bytes_to_code(size) == INVALID_SIZE_CODE) {
         rom_close(rom);
-        return rom_err_sms;
+        return rom_err_badsize;
     }
+    rom->size = size;
+    rom->data = cr_malloc(sizeof(uint8_t) * size);
+    memcpy(rom->data, data, size);
 
-    return NULL;
+    return check_rom(rom);
 }
 
 /*
-    Free memory previously allocated by the ROM during rom_open().
+    Free memory previously allocated by the ROM during rom_open() or
+    rom_load().
 */
 void rom_close(ROM *rom)
 {
@@ -308,7 +346,26 @@ BIOS* bios_open(const char *path)
 }
 
 /*
-    Deallocate a BIOS object previously returned by bios_open().
+    Load a BIOS ROM from memory, copying it.
+
+    Return a BIOS pointer, or NULL if it is the wrong size. The BIOS must be
+    deallocated with bios_close().
+*/
+BIOS* bios_load(const uint8_t *data, size_t size)
+{
+    if (size != BIOS_SIZE) {
+        ERROR("couldn't load BIOS: incorrect size")
+        return NULL;
+    }
+
+    BIOS *bios = cr_malloc(sizeof(BIOS));
+    memcpy(bios->data, data, BIOS_SIZE);
+    return bios;
+}
+
+/*
+    Deallocate a BIOS object previously returned by bios_open() or
+    bios_load().
 */
 void bios_close(BIOS *bios)
 {
@@ -49,8 +49,10 @@ typedef struct {
 /* Functions */
 
 const char* rom_open(ROM*, const char*);
+const char* rom_load(ROM*, const uint8_t*, size_t, const char*);
 void rom_close(ROM*);
 const char* rom_product(const ROM*);
 const char* rom_region(const ROM*);
 BIOS* bios_open(const char*);
+BIOS* bios_load(const uint8_t*, size_t);
 void bios_close(BIOS*);
@@ -0,0 +1,170 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "runahead.h"
+#include "logging.h"
+#include "util.h"
+
+/*
+    Add the lines the given GameGear changed in its last frame to a list.
+*/
+static void add_dirty_lines(const GameGear *gg, bool *dirty)
+{
+    const bool *lines = gamegear_get_dirty_lines(gg);
+    for (size_t line = 0; line < GG_SCREEN_HEIGHT; line++)
+        dirty[line] |= lines[line];
+}
+
+/*
+    Run the second GameGear ahead from the saved state.
+
+    It only sees a state once the frame after it is already underway, so it
+    runs one frame further than requested to make up for that.
+*/
+static void run_ahead(RunAhead *ra)
+{
+    gamegear_load_state(ra->ahead, ra->state);
+    for (unsigned i = 0; i <= ra->frames; i++) {
+        if (!gamegear_simulate_frame(ra->ahead))
+            break;
+        add_dirty_lines(ra->ahead, ra->dirty);
+    }
+}
+
+/*
+    Main loop of the run-ahead thread: run ahead from each new state until
+    told to stop.
+*/
+static void* run_thread(void *arg)
+{
+    RunAhead *ra = arg;
+
+    pthread_mutex_lock(&ra->lock);
+    while (true) {
+        while (!ra->pending && !ra->stopping)
+            pthread_cond_wait(&ra->start, &ra->lock);
+        if (ra->stopping)
+            break;
+
+        pthread_mutex_unlock(&ra->lock);
+        run_ahead(ra);
+        pthread_mutex_lock(&ra->lock);
+
+        ra->pending = false;
+        pthread_cond_signal(&ra->done);
+    }
+    pthread_mutex_unlock(&ra->lock);
+    return NULL;
+}
+
+/*
+    Initialize run-ahead by the given number of frames (at most
+    RUNAHEAD_MAX_FRAMES).
+
+    Frames to show end up in the given indexed display. Without a thread, the
+    caller should attach it to their GameGear as usual. With one, it is
+    attached to a second GameGear, which needs the same ROM and BIOS (which
+    may be NULL), and the caller's GameGear needs no display at all. The two
+    still run alike, as nothing a game can read (e.g. the sprite flags)
+    depends on whether a display is attached.
+*/
+void runahead_init(RunAhead *ra, unsigned frames, bool threaded,
+    const ROM *rom, const BIOS *bios, uint8_t *indices, uint16_t *palettes)
+{
+    ra->frames = frames < RUNAHEAD_MAX_FRAMES ? frames : RUNAHEAD_MAX_FRAMES;
+    ra->threaded = threaded;
+    ra->state = cr_malloc(sizeof(GGState));
+    ra->indices = indices;
+    ra->palettes = palettes;
+    memset(ra->dirty, false, sizeof(ra->dirty));
+    ra->ahead = NULL;
+    ra->pending = false;
+    ra->stopping = false;
+    if (!threaded)
+        return;
+
+    ra->ahead = gamegear_create();
+    gamegear_attach_indexed_display(ra->ahead, indices, palettes);
+    gamegear_load_rom(ra->ahead, rom);
+    if (bios)
+        gamegear_load_bios(ra->ahead, bios);
+
+    pthread_mutex_init(&ra->lock, NULL);
+    pthread_cond_init(&ra->start, NULL);
+    pthread_cond_init(&ra->done, NULL);
+    if (pthread_create(&ra->thread, NULL, run_thread, ra))
+        FATAL("couldn't start the run-ahead thread")
+}
+
+/*
+    Free memory and stop any thread started by runahead_init().
+*/
+void runahead_free(RunAhead *ra)
+{
+    if (ra->threaded) {
+        pthread_mutex_lock(&ra->lock);
+        ra->stopping = true;
+        pthread_cond_signal(&ra->start);
+        pthread_mutex_unlock(&ra->lock);
+        pthread_join(ra->thread, NULL);
+
+        pthread_cond_destroy(&ra->done);
+        pthread_cond_destroy(&ra->start);
+        pthread_mutex_destroy(&ra->lock);
+        gamegear_destroy(ra->ahead);
+    }
+    free(ra->state);
+}
+
+/*
+    Get the frame to show, ahead of where the GameGear is now.
+
+    Call this from the frame callback, after handling input. Afterwards, the
+    display holds the frame to show, and the lines of it that changed since
+    the last call are added to dirty. Call runahead_end() once done with it.
+*/
+void runahead_begin(RunAhead *ra, GameGear *gg, bool *dirty)
+{
+    if (ra->threaded) {
+        pthread_mutex_lock(&ra->lock);
+        while (ra->pending)
+            pthread_cond_wait(&ra->done, &ra->lock);
+        pthread_mutex_unlock(&ra->lock);
+    } else {
+        gamegear_save_state(gg, ra->state);
+        for (unsigned i = 0; i < ra->frames; i++) {
+            if (!gamegear_simulate_frame(gg))
+                break;
+            add_dirty_lines(gg, ra->dirty);
+        }
+    }
+
+    for (size_t line = 0; line < GG_SCREEN_HEIGHT; line++)
+        dirty[line] |= ra->dirty[line];
+    memset(ra->dirty, false, sizeof(ra->dirty));
+}
+
+/*
+    Finish with the frame from runahead_begin().
+
+    Without a thread, the GameGear goes back to where it was. With one, the
+    thread starts on the next frame to show, with the buttons held now (which
+    snapshots leave out).
+*/
+void runahead_end(RunAhead *ra, GameGear *gg)
+{
+    if (!ra->threaded) {
+        gamegear_load_state(gg, ra->state);
+        return;
+    }
+
+    gamegear_save_state(gg, ra->state);
+    gamegear_copy_input(ra->ahead, gg);
+    pthread_mutex_lock(&ra->lock);
+    ra->pending = true;
+    pthread_cond_signal(&ra->start);
+    pthread_mutex_unlock(&ra->lock);
+}
@@ -0,0 +1,52 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "gamegear.h"
+#include "rom.h"
+
+#define RUNAHEAD_MAX_FRAMES 3
+
+/* Structs */
+
+/*
+    Run-ahead state.
+
+    Games tend to react to input a frame or two after reading it. To hide that
+    delay, each shown frame is taken from a few frames in the future, emulated
+    with the current input and then thrown away.
+
+    Without a thread, this happens on the GameGear itself: its state is saved,
+    it runs ahead into its own display, and the state is restored. With a
+    thread, a second GameGear does the running ahead on another core, while
+    the first one (which needs no display) carries on with the next frame.
+*/
+typedef struct {
+    unsigned frames;
+    bool threaded;
+    GGState *state;
+    uint8_t *indices;
+    uint16_t *palettes;
+    bool dirty[GG_SCREEN_HEIGHT];
+
+    GameGear *ahead;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    bool pending;
+    bool stopping;
+} RunAhead;
+
+/* Functions */
+
+void runahead_init(RunAhead*, unsigned, bool, const ROM*, const BIOS*,
+                   uint8_t*, uint16_t*);
+void runahead_free(RunAhead*);
+void runahead_begin(RunAhead*, GameGear*, bool*);
+void runahead_end(RunAhead*, GameGear*);
@@ -15,7 +15,7 @@
 #include "util.h"
 
 static const char *MAGIC = "CRATER GAMEGEAR SAVE FILE\n";
-static size_t HEADER_LEN = 64;
+static const size_t HEADER_LEN = 64;
 
 /*
     Log an error while trying to load the save file.
@@ -0,0 +1,494 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "scale.h"
+#include "gamegear.h"
+#include "util.h"
+
+#define XBR_BORDER 2
+
+#define ROW(sc, y) ((uint32_t*) ((uint8_t*) (sc)->dst + (size_t) (y) * (sc)->pitch))
+
+/*
+    Initialize a scaler for the given filter and input size.
+
+    For SCALE_NEAREST, the output is the given integer factor times the input
+    size; if aspect is set, it is also widened to correct for the Game Gear's
+    8:7 pixel aspect ratio. The other filters have a fixed factor (2x for
+    SCALE_2X and SCALE_XBR, 3x for SCALE_3X) and ignore both. The output size
+    can be read from the width and height fields afterwards.
+
+    Work is split into bands of rows across the given pool, which may be
+    shared with other users; pass NULL to scale on the calling thread only.
+*/
+void scaler_init(Scaler *sc, ScaleFilter filter, unsigned src_width,
+    unsigned src_height, unsigned factor, bool aspect, ThreadPool *pool)
+{
+    sc->filter = filter;
+    sc->src_width = src_width;
+    sc->src_height = src_height;
+    sc->pool = pool;
+    sc->columns = NULL;
+    sc->yuv = NULL;
+
+    switch (filter) {
+        case SCALE_NEAREST:
+            if (factor < 1)
+                factor = 1;
+            if (factor > SCALE_MAX_FACTOR)
+                factor = SCALE_MAX_FACTOR;
+            break;
+        case SCALE_2X:
+        case SCALE_XBR:
+            factor = 2;
+            aspect = false;
+            break;
+        case SCALE_3X:
+            factor = 3;
+            aspect = false;
+            break;
+        default:
+            factor = 1;
+            aspect = false;
+            break;
+    }
+
+    sc->factor = factor;
+    sc->aspect = aspect;
+    sc->height = src_height * factor;
+    sc->width = src_width * factor;
+    if (aspect)
+        sc->width = (sc->width * GG_PIXEL_WIDTH + GG_PIXEL_HEIGHT / 2) /
+                    GG_PIXEL_HEIGHT;
+
+    if (filter == SCALE_NEAREST && aspect) {
+        sc->columns = cr_malloc(sizeof(unsigned) * sc->width);
+        for (unsigned x = 0; x < sc->width; x++)
+            sc->columns[x] = x * src_width / sc->width;
+    }
+    if (filter == SCALE_XBR)
+        sc->yuv = cr_malloc(sizeof(uint32_t) * (src_width  + 2 * XBR_BORDER) *
+                                               (src_height + 2 * XBR_BORDER));
+}
+
+/*
+    Free memory previously allocated by the scaler.
+*/
+void scaler_free(Scaler *sc)
+{
+    free(sc->columns);
+    free(sc->yuv);
+    sc->columns = NULL;
+    sc->yuv = NULL;
+}
+
+/*
+    Return the range of input rows [start, end) handled by the given band.
+*/
+static void get_band(const Scaler *sc, unsigned index, unsigned count,
+    unsigned *start, unsigned *end)
+{
+    *start = sc->src_height * index / count;
+    *end = sc->src_height * (index + 1) / count;
+}
+
+/*
+    Return the input pixel at the given coordinates, clamped to the edges.
+*/
+static inline uint32_t get_pixel(const Scaler *sc, int x, int y)
+{
+    if (x < 0)
+        x = 0;
+    else if (x >= (int) sc->src_width)
+        x = sc->src_width - 1;
+    if (y < 0)
+        y = 0;
+    else if (y >= (int) sc->src_height)
+        y = sc->src_height - 1;
+    return sc->src[y * sc->src_width + x];
+}
+
+/*
+    Widen one input row by an integer factor into an output row.
+*/
+static void widen_row(const uint32_t *src, uint32_t *dst, unsigned width,
+    unsigned factor)
+{
+    unsigned x = 0, i;
+
+#ifdef __SSE2__
+    if (factor == 2 || factor == 4) {
+        for (; x + 4 <= width; x += 4) {
+            __m128i p = _mm_loadu_si128((const __m128i*) (src + x));
+            __m128i *out = (__m128i*) (dst + x * factor);
+            if (factor == 2) {
+                _mm_storeu_si128(out,     _mm_unpacklo_epi32(p, p));
+                _mm_storeu_si128(out + 1, _mm_unpackhi_epi32(p, p));
+            } else {
+                _mm_storeu_si128(out,     _mm_shuffle_epi32(p, 0x00));
+                _mm_storeu_si128(out + 1, _mm_shuffle_epi32(p, 0x55));
+                _mm_storeu_si128(out + 2, _mm_shuffle_epi32(p, 0xAA));
+                _mm_storeu_si128(out + 3, _mm_shuffle_epi32(p, 0xFF));
+            }
+        }
+    }
+#endif
+
+    for (; x < width; x++) {
+        for (i = 0; i < factor; i++)
+            dst[x * factor + i] = src[x];
+    }
+}
+
+/*
+    Nearest neighbor scaling of one band, with optional aspect correction.
+
+    Each output row is built once and then copied down.
+*/
+static void scale_nearest(void *context, unsigned index, unsigned count)
+{
+    Scaler *sc = context;
+    unsigned start, end, y, x, i;
+    get_band(sc, index, count, &start, &end);
+
+    for (y = start; y < end; y++) {
+        const uint32_t *src = sc->src + y * sc->src_width;
+        uint32_t *first = ROW(sc, y * sc->factor);
+
+        if (sc->columns) {
+            for (x = 0; x < sc->width; x++)
+                first[x] = src[sc->columns[x]];
+        } else {
+            widen_row(src, first, sc->src_width, sc->factor);
+        }
+        for (i = 1; i < sc->factor; i++)
+            memcpy(ROW(sc, y * sc->factor + i), first,
+                   sizeof(uint32_t) * sc->width);
+    }
+}
+
+#ifdef __SSE2__
+/*
+    Return a where mask is set, and b elsewhere.
+*/
+static inline __m128i select_si128(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/*
+    Return a mask of the lanes where a != b.
+*/
+static inline __m128i cmpne_epi32(__m128i a, __m128i b)
+{
+    return _mm_xor_si128(_mm_cmpeq_epi32(a, b), _mm_set1_epi32(-1));
+}
+#endif
+
+/*
+    Copy an input row into a buffer with one pixel of padding on each side,
+    repeating the edge pixels.
+*/
+static void pad_row(const Scaler *sc, int y, uint32_t *buf)
+{
+    unsigned width = sc->src_width;
+    const uint32_t *src = sc->src + (y < 0 ? 0 : y >= (int) sc->src_height ?
+                                     sc->src_height - 1 : (unsigned) y) * width;
+    memcpy(buf + 1, src, sizeof(uint32_t) * width);
+    buf[0] = src[0];
+    buf[width + 1] = src[width - 1];
+}
+
+/*
+    Scale2x (also known as EPX) of one band.
+
+    For each pixel P with neighbors A (up), B (right), C (left) and D (down),
+    the four output pixels are:
+        E0 = C == A && C != D && A != B ? A : P
+        E1 = A == B && A != C && B != D ? B : P
+        E2 = D == C && D != B && C != A ? C : P
+        E3 = B == D && B != A && D != C ? D : P
+*/
+static void scale_2x(void *context, unsigned index, unsigned count)
+{
+    Scaler *sc = context;
+    unsigned width = sc->src_width, start, end, y, x;
+    uint32_t *up   = cr_malloc(sizeof(uint32_t) * (width + 2));
+    uint32_t *mid  = cr_malloc(sizeof(uint32_t) * (width + 2));
+    uint32_t *down = cr_malloc(sizeof(uint32_t) * (width + 2));
+    get_band(sc, index, count, &start, &end);
+
+    for (y = start; y < end; y++) {
+        pad_row(sc, (int) y - 1, up);
+        pad_row(sc, y, mid);
+        pad_row(sc, (int) y + 1, down);
+        uint32_t *out0 = ROW(sc, 2 * y), *out1 = ROW(sc, 2 * y + 1);
+        x = 0;
+
+#ifdef __SSE2__
+        for (; x + 4 <= width; x += 4) {
+            __m128i p = _mm_loadu_si128((const __m128i*) (mid  + x + 1));
+            __m128i a = _mm_loadu_si128((const __m128i*) (up   + x + 1));
+            __m128i d = _mm_loadu_si128((const __m128i*) (down + x + 1));
+            __m128i c = _mm_loadu_si128((const __m128i*) (mid  + x));
+            __m128i b = _mm_loadu_si128((const __m128i*) (mid  + x + 2));
+
+            __m128i ca = _mm_cmpeq_epi32(c, a), ab = _mm_cmpeq_epi32(a, b);
+            __m128i dc = _mm_cmpeq_epi32(d, c), bd = _mm_cmpeq_epi32(b, d);
+            __m128i cd = cmpne_epi32(c, d), ab_ne = cmpne_epi32(a, b);
+            __m128i ac = cmpne_epi32(a, c), bd_ne = cmpne_epi32(b, d);
+
+            __m128i e0 = select_si128(
+                _mm_and_si128(ca, _mm_and_si128(cd, ab_ne)), a, p);
+            __m128i e1 = select_si128(
+                _mm_and_si128(ab, _mm_and_si128(ac, bd_ne)), b, p);
+            __m128i e2 = select_si128(
+                _mm_and_si128(dc, _mm_and_si128(bd_ne, ac)), c, p);
+            __m128i e3 = select_si128(
+                _mm_and_si128(bd, _mm_and_si128(ab_ne, cd)), d, p);
+
+            _mm_storeu_si128((__m128i*) (out0 + 2 * x),
+                             _mm_unpacklo_epi32(e0, e1));
+            _mm_storeu_si128((__m128i*) (out0 + 2 * x + 4),
+                             _mm_unpackhi_epi32(e0, e1));
+            _mm_storeu_si128((__m128i*) (out1 + 2 * x),
+                             _mm_unpacklo_epi32(e2, e3));
+            _mm_storeu_si128((__m128i*) (out1 + 2 * x + 4),
+                             _mm_unpackhi_epi32(e2, e3));
+        }
+#endif
+
+        for (; x < width; x++) {
+            uint32_t p = mid[x + 1], a = up[x + 1], d = down[x + 1];
+            uint32_t c = mid[x], b = mid[x + 2];
+
+            out0[2 * x]     = (c == a && c != d && a != b) ? a : p;
+            out0[2 * x + 1] = (a == b && a != c && b != d) ? b : p;
+            out1[2 * x]     = (d == c && d != b && c != a) ? c : p;
+            out1[2 * x + 1] = (b == d && b != a && d != c) ? d : p;
+        }
+    }
+
+    free(up);
+    free(mid);
+    free(down);
+}
+
+/*
+    Scale3x of one band.
+
+    Using the 3x3 neighborhood A B C / D E F / G H I around each pixel E, this
+    extends the Scale2x rules to the nine output pixels (the center is always
+    E).
+*/
+static void scale_3x(void *context, unsigned index, unsigned count)
+{
+    Scaler *sc = context;
+    unsigned start, end, y, x;
+    get_band(sc, index, count, &start, &end);
+
+    for (y = start; y < end; y++) {
+        uint32_t *out0 = ROW(sc, 3 * y), *out1 = ROW(sc, 3 * y + 1),
+                 *out2 = ROW(sc, 3 * y + 2);
+
+        for (x = 0; x < sc->src_width; x++) {
+            int i = x, j = y;
+            uint32_t a = get_pixel(sc, i - 1, j - 1), b = get_pixel(sc, i, j - 1),
+                     c = get_pixel(sc, i + 1, j - 1), d = get_pixel(sc, i - 1, j),
+                     e = get_pixel(sc, i, j),         f = get_pixel(sc, i + 1, j),
+                     g = get_pixel(sc, i - 1, j + 1), h = get_pixel(sc, i, j + 1),
+                     k = get_pixel(sc, i + 1, j + 1);
+
+            bool db = d == b && d != h && b != f, bf = b == f && b != d && f != h;
+            bool dh = d == h && d != b && h != f, hf = h == f && h != d && f != b;
+
+            out0[3 * x]     = db ? d : e;
+            out0[3 * x + 1] = (db && e != c) || (bf && e != a) ? b : e;
+            out0[3 * x + 2] = bf ? f : e;
+            out1[3 * x]     = (db && e != g) || (dh && e != a) ? d : e;
+            out1[3 * x + 1] = e;
+            out1[3 * x + 2] = (bf && e != k) || (hf && e != c) ? f : e;
+            out2[3 * x]     = dh ? d : e;
+            out2[3 * x + 1] = (dh && e != k) || (hf && e != g) ? h : e;
+            out2[3 * x + 2] = hf ? f : e;
+        }
+    }
+}
+
+/*
+    Convert ARGB pixels in one band into packed YUV, for the xBR filter.
+
+    Y is stored in bits 16-23, and U and V (offset by 128) in bits 8-15 and
+    0-7. The YUV buffer has a border of XBR_BORDER pixels on each side,
+    repeating the edges, so neighborhoods never need to be clamped.
+*/
+static void convert_yuv(void *context, unsigned index, unsigned count)
+{
+    Scaler *sc = context;
+    unsigned start, end;
+    int stride = sc->src_width + 2 * XBR_BORDER, x, y, first, last;
+    get_band(sc, index, count, &start, &end);
+
+    first = index == 0 ? -XBR_BORDER : (int) start;
+    last = index == count - 1 ? (int) end + XBR_BORDER : (int) end;
+
+    for (y = first; y < last; y++) {
+        uint32_t *row = sc->yuv + (y + XBR_BORDER) * stride + XBR_BORDER;
+        for (x = -XBR_BORDER; x < (int) sc->src_width + XBR_BORDER; x++) {
+            uint32_t pixel = get_pixel(sc, x, y);
+            int r = (pixel >> 16) & 0xFF, g = (pixel >> 8) & 0xFF,
+                b = pixel & 0xFF;
+            int luma = ( 77 * r + 150 * g +  29 * b) >> 8;
+            int u    = ((-43 * r -  85 * g + 128 * b) >> 8) + 128;
+            int v    = ((128 * r - 107 * g -  21 * b) >> 8) + 128;
+            row[x] = (luma << 16) | (u << 8) | v;
+        }
+    }
+}
+
+/*
+    Return the weighted YUV distance between two packed YUV pixels.
+*/
+static inline int yuv_distance(uint32_t a, uint32_t b)
+{
+    return 48 * abs((int) ((a >> 16) & 0xFF) - (int) ((b >> 16) & 0xFF)) +
+            7 * abs((int) ((a >>  8) & 0xFF) - (int) ((b >>  8) & 0xFF)) +
+            6 * abs((int) ( a        & 0xFF) - (int) ( b        & 0xFF));
+}
+
+/*
+    Return the average of two ARGB pixels.
+*/
+static inline uint32_t blend(uint32_t a, uint32_t b)
+{
+    return (((a ^ b) & 0xFEFEFEFE) >> 1) + (a & b);
+}
+
+/*
+    Return one corner of the 2x xBR output for the pixel at (x, y).
+
+    The corner is given by (sx, sy), each 1 or -1; sx = sy = 1 is the bottom
+    right. The neighborhood is mirrored accordingly, so the rule is written
+    for the bottom-right corner only: if the edge through F and H is a better
+    fit than the one through E and I, the corner is blended towards whichever
+    of F and H is closer to E.
+*/
+static uint32_t xbr_corner(const Scaler *sc, int x, int y, int sx, int sy)
+{
+    int stride = sc->src_width + 2 * XBR_BORDER;
+    const uint32_t *yuv = sc->yuv + (y + XBR_BORDER) * stride + x + XBR_BORDER;
+
+#define P(c, r) yuv[sy * (r) * stride + sx * (c)]
+#define D(c1, r1, c2, r2) yuv_distance(P(c1, r1), P(c2, r2))
+    int anti = D(0, 0, 1, -1) + D(0, 0, -1, 1) + D(1, 1, 2, 0) +
+               D(1, 1, 0, 2) + 4 * D(0, 1, 1, 0);
+    int diag = D(0, 1, -1, 0) + D(0, 1, 1, 2) + D(1, 0, 2, 1) +
+               D(1, 0, 0, -1) + 4 * D(0, 0, 1, 1);
+    bool closer_f = D(0, 0, 1, 0) <= D(0, 0, 0, 1);
+#undef D
+#undef P
+
+    uint32_t e = get_pixel(sc, x, y);
+    uint32_t f = get_pixel(sc, x + sx, y), h = get_pixel(sc, x, y + sy);
+    if (anti >= diag || e == f || e == h)
+        return e;
+    return blend(e, closer_f ? f : h);
+}
+
+/*
+    A simplified 2x xBR filter (level 1) for one band.
+
+    Edges are detected from weighted YUV distances in a 5x5 neighborhood and
+    smoothed by blending, which rounds off diagonal lines without blurring
+    flat areas.
+*/
+static void scale_xbr(void *context, unsigned index, unsigned count)
+{
+    Scaler *sc = context;
+    unsigned start, end, y, x;
+    get_band(sc, index, count, &start, &end);
+
+    for (y = start; y < end; y++) {
+        uint32_t *out0 = ROW(sc, 2 * y), *out1 = ROW(sc, 2 * y + 1);
+        for (x = 0; x < sc->src_width; x++) {
+            out0[2 * x]     = xbr_corner(sc, x, y, -1, -1);
+            out0[2 * x + 1] = xbr_corner(sc, x, y,  1, -1);
+            out1[2 * x]     = xbr_corner(sc, x, y, -1,  1);
+            out1[2 * x + 1] = xbr_corner(sc, x, y,  1,  1);
+        }
+    }
+}
+
+/*
+    Scale a frame of ARGB pixels.
+
+    src must hold (src_width * src_height) pixels. dst receives (width *
+    height) pixels, with rows pitch bytes apart, so it can point straight into
+    a locked texture.
+*/
+void scaler_run(Scaler *sc, const uint32_t *src, uint32_t *dst, size_t pitch)
+{
+    PoolTask task;
+    sc->src = src;
+    sc->dst = dst;
+    sc->pitch = pitch;
+
+    switch (sc->filter) {
+        case SCALE_2X:
+            task = scale_2x;
+            break;
+        case SCALE_3X:
+            task = scale_3x;
+            break;
+        case SCALE_XBR:
+            if (sc->pool)
+                pool_run(sc->pool, convert_yuv, sc);
+            else
+                convert_yuv(sc, 0, 1);
+            task = scale_xbr;
+            break;
+        default:
+            task = scale_nearest;
+            break;
+    }
+
+    if (sc->pool)
+        pool_run(sc->pool, task, sc);
+    else
+        task(sc, 0, 1);
+}
+
+/*
+    Return the command-line name of the given filter.
+*/
+const char* scaler_filter_name(ScaleFilter filter)
+{
+    switch (filter) {
+        case SCALE_NEAREST: return "nearest";
+        case SCALE_2X:      return "scale2x";
+        case SCALE_3X:      return "scale3x";
+        case SCALE_XBR:     return "xbr";
+        default:            return "none";
+    }
+}
+
+/*
+    Look up a filter by its command-line name. Return whether it was found.
+*/
+bool scaler_parse_filter(const char *name, ScaleFilter *filter)
+{
+    for (ScaleFilter f = SCALE_NONE; f <= SCALE_XBR; f++) {
+        if (!strcmp(name, scaler_filter_name(f))) {
+            *filter = f;
+            return true;
+        }
+    }
+    return false;
+}
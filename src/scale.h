@@ -0,0 +1,50 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pool.h"
+
+/*
+    Largest output size supported by the nearest neighbor filter, in multiples
+    of the input size (after aspect ratio correction).
+*/
+#define SCALE_MAX_FACTOR 16
+
+/* Structs */
+
+typedef enum {
+    SCALE_NONE,
+    SCALE_NEAREST,
+    SCALE_2X,
+    SCALE_3X,
+    SCALE_XBR
+} ScaleFilter;
+
+typedef struct {
+    ScaleFilter filter;
+    unsigned src_width, src_height;
+    unsigned width, height;
+    unsigned factor;
+    bool aspect;
+    unsigned *columns;
+    uint32_t *yuv;
+    ThreadPool *pool;
+
+    const uint32_t *src;
+    uint32_t *dst;
+    size_t pitch;
+} Scaler;
+
+/* Functions */
+
+void scaler_init(Scaler*, ScaleFilter, unsigned, unsigned, unsigned, bool,
+                 ThreadPool*);
+void scaler_free(Scaler*);
+void scaler_run(Scaler*, const uint32_t*, uint32_t*, size_t);
+const char* scaler_filter_name(ScaleFilter);
+bool scaler_parse_filter(const char*, ScaleFilter*);
@@ -0,0 +1,349 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "search.h"
+#include "logging.h"
+#include "movie.h"
+#include "pool.h"
+#include "state.h"
+#include "util.h"
+
+/*
+    A state kept after a step, with the buttons held in each step to get to
+    it and the score it got.
+*/
+typedef struct {
+    GGState *state;
+    uint8_t *path;
+    double score;
+} Node;
+
+/*
+    The outcome of one try: the buttons given by index % SEARCH_INPUTS held
+    from node (index / SEARCH_INPUTS). The hash covers the RAM and VRAM it
+    ended with, to tell tries that went the same way apart from ones that
+    didn't.
+*/
+typedef struct {
+    size_t index;
+    double score;
+    uint64_t hash;
+} Branch;
+
+typedef struct {
+    const SearchParams *params;
+    GameGear **machines;
+    unsigned beam, step;
+
+    Node *nodes, *next;
+    size_t count;
+    Branch *branches;
+    size_t tries;
+    const Branch **chosen;
+    size_t kept;
+} Search;
+
+/*
+    Run one try on a GameGear, returning false if it raised an exception.
+*/
+static bool run_branch(GameGear *gg, const Search *search, size_t index)
+{
+    gamegear_load_state(gg, search->nodes[index / SEARCH_INPUTS].state);
+    gamegear_set_buttons(gg, index % SEARCH_INPUTS);
+    for (unsigned frame = 0; frame < search->params->frames; frame++) {
+        if (!gamegear_simulate_frame(gg))
+            return false;
+        gamegear_read_audio(gg, NULL, SIZE_MAX);
+    }
+    return true;
+}
+
+/*
+    Pool task: run and score every try, split between threads by index.
+*/
+static void score_task(void *context, unsigned index, unsigned count)
+{
+    Search *search = context;
+    GameGear *gg = search->machines[index];
+    const SearchParams *params = search->params;
+
+    for (size_t i = index; i < search->tries; i += count) {
+        Branch *branch = &search->branches[i];
+        branch->index = i;
+        branch->score = -INFINITY;
+        branch->hash = 0;
+        if (!run_branch(gg, search, i))
+            continue;
+
+        branch->score = params->score(gg, params->arg);
+        branch->hash = hash64(gg->mmu.system_ram, MMU_SYSTEM_RAM_SIZE, 0);
+        branch->hash = hash64(gg->vdp.vram, VDP_VRAM_SIZE, branch->hash);
+        if (gg->mmu.cart_ram)
+            branch->hash = hash64(gg->mmu.cart_ram, MMU_CART_RAM_SIZE,
+                                  branch->hash);
+    }
+}
+
+/*
+    Pool task: run the chosen tries again to keep the states they end in.
+*/
+static void keep_task(void *context, unsigned index, unsigned count)
+{
+    Search *search = context;
+    GameGear *gg = search->machines[index];
+
+    for (size_t i = index; i < search->kept; i += count) {
+        const Branch *branch = search->chosen[i];
+        const Node *parent = &search->nodes[branch->index / SEARCH_INPUTS];
+        Node *node = &search->next[i];
+
+        run_branch(gg, search, branch->index);
+        gamegear_save_state(gg, node->state);
+        memcpy(node->path, parent->path, search->step);
+        node->path[search->step] = branch->index % SEARCH_INPUTS;
+        node->score = branch->score;
+    }
+}
+
+/*
+    Order tries from best to worst, then by index so that the result never
+    depends on how they were split between threads.
+*/
+static int compare_branches(const void *a, const void *b)
+{
+    const Branch *x = a, *y = b;
+    if (x->score != y->score)
+        return x->score > y->score ? -1 : 1;
+    return x->index < y->index ? -1 : x->index > y->index;
+}
+
+/*
+    Choose the best tries to keep, skipping ones that raised an exception or
+    ended the same as a better one. Return how many there are.
+*/
+static size_t choose_branches(Search *search)
+{
+    size_t kept = 0;
+
+    qsort(search->branches, search->tries, sizeof(Branch), compare_branches);
+    for (size_t i = 0; i < search->tries && kept < search->beam; i++) {
+        const Branch *branch = &search->branches[i];
+        if (branch->score == -INFINITY)
+            break;
+
+        bool seen = false;
+        for (size_t j = 0; j < kept && !seen; j++)
+            seen = search->chosen[j]->hash == branch->hash;
+        if (!seen)
+            search->chosen[kept++] = branch;
+    }
+    return kept;
+}
+
+/*
+    Allocate a list of nodes with room for the given number of steps.
+*/
+static Node* create_nodes(size_t count, unsigned steps)
+{
+    Node *nodes = cr_malloc(count * sizeof(Node));
+    for (size_t i = 0; i < count; i++) {
+        nodes[i].state = cr_malloc(sizeof(GGState));
+        nodes[i].path = cr_malloc(steps);
+        nodes[i].score = -INFINITY;
+    }
+    return nodes;
+}
+
+/*
+    Free a list of nodes.
+*/
+static void free_nodes(Node *nodes, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        free(nodes[i].state);
+        free(nodes[i].path);
+    }
+    free(nodes);
+}
+
+/*
+    Search for the buttons to hold from the GameGear's current state that
+    lead to the best score, as a beam search across a thread pool.
+
+    The GameGear must have run at least one frame; the search runs on copies
+    of it. On success, it is left in the best state found, the buttons held
+    in each step to get there are written to inputs (which must have room for
+    params->steps of them), and the score is written to score. Return false
+    if every try raised an exception at some step.
+*/
+bool search_run(GameGear *gg, const SearchParams *params, uint8_t *inputs,
+                double *score)
+{
+    unsigned beam = params->beam ? params->beam : 1;
+    unsigned threads = params->threads ? params->threads : pool_cpu_count();
+    ThreadPool *pool = pool_create(threads);
+    Search search;
+    bool ok = true;
+
+    search.params = params;
+    search.beam = beam;
+    search.machines = cr_malloc(pool_size(pool) * sizeof(GameGear*));
+    for (unsigned i = 0; i < pool_size(pool); i++)
+        search.machines[i] = gamegear_fork(gg);
+    search.nodes = create_nodes(beam, params->steps);
+    search.next = create_nodes(beam, params->steps);
+    search.branches = cr_malloc(beam * SEARCH_INPUTS * sizeof(Branch));
+    search.chosen = cr_malloc(beam * sizeof(Branch*));
+
+    gamegear_save_state(gg, search.nodes[0].state);
+    search.count = 1;
+
+    for (search.step = 0; search.step < params->steps; search.step++) {
+        search.tries = search.count * SEARCH_INPUTS;
+        pool_run(pool, score_task, &search);
+        if (!(search.kept = choose_branches(&search))) {
+            ok = false;
+            break;
+        }
+        pool_run(pool, keep_task, &search);
+
+        Node *swap = search.nodes;
+        search.nodes = search.next;
+        search.next = swap;
+        search.count = search.kept;
+        DEBUG("Search step %u/%u: kept %zu states, best score %g",
+              search.step + 1, params->steps, search.count,
+              search.nodes[0].score)
+    }
+
+    if (ok) {
+        gamegear_load_state(gg, search.nodes[0].state);
+        memcpy(inputs, search.nodes[0].path, params->steps);
+        *score = search.nodes[0].score;
+    }
+
+    for (unsigned i = 0; i < pool_size(pool); i++)
+        gamegear_destroy(search.machines[i]);
+    pool_destroy(pool);
+    free(search.machines);
+    free_nodes(search.nodes, beam);
+    free_nodes(search.next, beam);
+    free(search.branches);
+    free(search.chosen);
+    return ok;
+}
+
+/*
+    Score a state by the little-endian value in memory at config->goal_addr,
+    config->goal_bytes long.
+*/
+static double goal_score(const GameGear *gg, void *arg)
+{
+    const Config *config = arg;
+    uint32_t value = 0;
+
+    for (unsigned i = 0; i < config->goal_bytes; i++)
+        value |= (uint32_t) mmu_read_byte(&gg->mmu,
+            config->goal_addr + i) << (8 * i);
+    return value;
+}
+
+/*
+    GameGear callback to stop after the first frame, throwing away its audio.
+*/
+static void stop_callback(GameGear *gg)
+{
+    gamegear_read_audio(gg, NULL, SIZE_MAX);
+    gamegear_power_off(gg);
+}
+
+/*
+    Search for the buttons that get the ROM to the highest value at
+    config->goal_addr within config->frames (rounded up to a whole number of
+    steps), and save them as a movie to config->search_path.
+
+    The search starts one frame after power-on, or after the state at
+    config->load_state_path, and the movie includes that frame. Return
+    whether it worked.
+*/
+bool search_rom(const ROM *rom, const Config *config)
+{
+    GameGear *gg = gamegear_create();
+    GGState *start = NULL;
+    BIOS *bios = NULL;
+    Movie movie;
+    double score;
+    bool ok = false;
+
+    SearchParams params = {
+        .steps = (config->frames + config->search_step - 1) /
+                 config->search_step,
+        .frames = config->search_step,
+        .beam = config->search_beam,
+        .threads = config->threads,
+        .score = goal_score,
+        .arg = (void*) config
+    };
+    uint8_t *inputs = cr_malloc(params.steps);
+    movie_init(&movie);
+
+    if (config->bios_path && !(bios = bios_open(config->bios_path)))
+        goto cleanup;
+    gamegear_set_speed(gg, PACER_UNTHROTTLED);
+    gamegear_attach_callback(gg, stop_callback);
+    gamegear_load_rom(gg, rom);
+    if (bios)
+        gamegear_load_bios(gg, bios);
+    if (config->load_state_path) {
+        start = cr_malloc(sizeof(GGState));
+        if (!state_load(config->load_state_path, start, rom))
+            goto cleanup;
+        gamegear_load_state(gg, start);
+        movie_set_start(&movie, start);
+    }
+    gamegear_simulate(gg);
+    if (gamegear_get_exception(gg)) {
+        ERROR("caught exception: %s", gamegear_get_exception(gg))
+        goto cleanup;
+    }
+    gamegear_detach(gg);
+
+    printf("crater: searching %u steps of %u frames, keeping %u states\n",
+           params.steps, params.frames, params.beam);
+    if (!search_run(gg, &params, inputs, &score)) {
+        ERROR("every try raised an exception; nothing to keep")
+        goto cleanup;
+    }
+
+    for (unsigned step = 0; step < params.steps; step++) {
+        for (unsigned frame = 0; frame < params.frames; frame++)
+            movie_append(&movie, inputs[step]);
+    }
+    movie_append(&movie, inputs[params.steps - 1]);
+    if (!movie_save(&movie, config->search_path, rom))
+        goto cleanup;
+
+    GGState *state = cr_malloc(sizeof(GGState));
+    gamegear_save_state(gg, state);
+    printf("crater: best score %g after %zu frames; saved movie to %s\n",
+           score, movie.frames, config->search_path);
+    printf("State hash: %016llx\n",
+           (unsigned long long) state_hash(state, rom));
+    free(state);
+    ok = true;
+
+    cleanup:
+    gamegear_power_off(gg);
+    gamegear_destroy(gg);
+    if (bios)
+        bios_close(bios);
+    movie_free(&movie);
+    free(start);
+    free(inputs);
+    return ok;
+}
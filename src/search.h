@@ -0,0 +1,43 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "gamegear.h"
+#include "rom.h"
+
+#define SEARCH_INPUTS 128  // Every combination of the seven buttons
+#define SEARCH_DEFAULT_STEP 15
+#define SEARCH_DEFAULT_BEAM 8
+#define SEARCH_MAX_BEAM 1024
+
+/* Structs */
+
+typedef double (*SearchScore)(const GameGear*, void*);
+
+/*
+    How to search for the inputs that lead to the best score.
+
+    Each step tries every combination of buttons, held for the given number
+    of frames, from each of the states kept after the step before; the beam
+    is how many of the best (and different) states are kept. The score
+    callback is called with arg at the end of each try, on whichever thread
+    ran it, and should only look at the GameGear it is given.
+*/
+typedef struct {
+    unsigned steps;
+    unsigned frames;
+    unsigned beam;
+    unsigned threads;
+    SearchScore score;
+    void *arg;
+} SearchParams;
+
+/* Functions */
+
+bool search_run(GameGear*, const SearchParams*, uint8_t*, double*);
+bool search_rom(const ROM*, const Config*);
@@ -0,0 +1,635 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "state.h"
+#include "logging.h"
+#include "util.h"
+
+static const char *MAGIC = "CRSTATE\x1A";
+#define MAGIC_LEN 8
+#define TABLE_OFFSET 24
+#define SECTION_ENTRY_SIZE 12
+
+/*
+    Every field is written out on its own in little-endian order, so that
+    files don't depend on the host or on how the compiler lays out structs.
+*/
+typedef struct {
+    uint8_t *data;
+    size_t size, pos;
+    bool overflow;
+} Writer;
+
+typedef struct {
+    const uint8_t *data;
+    size_t size, pos;
+    bool overflow;
+} Reader;
+
+/*
+    Write a little-endian integer of the given width.
+*/
+static void put(Writer *w, uint64_t value, unsigned bytes)
+{
+    if (w->pos + bytes > w->size) {
+        w->overflow = true;
+        return;
+    }
+    for (unsigned i = 0; i < bytes; i++)
+        w->data[w->pos++] = (value >> (8 * i)) & 0xFF;
+}
+
+/*
+    Write a run of raw bytes.
+*/
+static void put_bytes(Writer *w, const void *src, size_t size)
+{
+    if (w->pos + size > w->size) {
+        w->overflow = true;
+        return;
+    }
+    memcpy(w->data + w->pos, src, size);
+    w->pos += size;
+}
+
+/*
+    Read a little-endian integer of the given width; zero past the end.
+*/
+static uint64_t get(Reader *r, unsigned bytes)
+{
+    if (r->pos + bytes > r->size) {
+        r->overflow = true;
+        return 0;
+    }
+    uint64_t value = 0;
+    for (unsigned i = 0; i < bytes; i++)
+        value |= (uint64_t) r->data[r->pos++] << (8 * i);
+    return value;
+}
+
+/*
+    Read a run of raw bytes; zeros past the end.
+*/
+static void get_bytes(Reader *r, void *dst, size_t size)
+{
+    if (r->pos + size > r->size) {
+        r->overflow = true;
+        memset(dst, 0x00, size);
+        return;
+    }
+    memcpy(dst, r->data + r->pos, size);
+    r->pos += size;
+}
+
+/*
+    Doubles are stored as their IEEE 754 bit pattern.
+*/
+static void put_double(Writer *w, double value)
+{
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    put(w, bits, 8);
+}
+
+static double get_double(Reader *r)
+{
+    uint64_t bits = get(r, 8);
+    double value;
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/*
+    Write the Z80's registers and cycle counts.
+*/
+static void write_z80(Writer *w, const Z80State *state)
+{
+    const Z80RegFile *rf = &state->regs;
+
+    put(w, rf->af, 2);
+    put(w, rf->bc, 2);
+    put(w, rf->de, 2);
+    put(w, rf->hl, 2);
+    put(w, rf->af_, 2);
+    put(w, rf->bc_, 2);
+    put(w, rf->de_, 2);
+    put(w, rf->hl_, 2);
+    put(w, rf->ix, 2);
+    put(w, rf->iy, 2);
+    put(w, rf->sp, 2);
+    put(w, rf->pc, 2);
+    put(w, rf->i, 1);
+    put(w, rf->r, 1);
+    put(w, rf->im_a, 1);
+    put(w, rf->im_b, 1);
+    put(w, rf->iff1, 1);
+    put(w, rf->iff2, 1);
+
+    put(w, state->except, 1);
+    put(w, state->exc_code, 1);
+    put(w, state->exc_data, 1);
+    put_double(w, state->pending_cycles);
+    put(w, state->cycles, 8);
+    put(w, state->instructions, 8);
+    put(w, state->halted_cycles, 8);
+    put(w, state->irq_wait, 1);
+}
+
+/*
+    Read the Z80's registers and cycle counts.
+*/
+static const char* read_z80(Reader *r, Z80State *state)
+{
+    Z80RegFile *rf = &state->regs;
+
+    memset(rf, 0x00, sizeof(*rf));
+    rf->af  = get(r, 2);
+    rf->bc  = get(r, 2);
+    rf->de  = get(r, 2);
+    rf->hl  = get(r, 2);
+    rf->af_ = get(r, 2);
+    rf->bc_ = get(r, 2);
+    rf->de_ = get(r, 2);
+    rf->hl_ = get(r, 2);
+    rf->ix  = get(r, 2);
+    rf->iy  = get(r, 2);
+    rf->sp  = get(r, 2);
+    rf->pc  = get(r, 2);
+    rf->i   = get(r, 1);
+    rf->r   = get(r, 1);
+    rf->im_a = get(r, 1);
+    rf->im_b = get(r, 1);
+    rf->iff1 = get(r, 1);
+    rf->iff2 = get(r, 1);
+
+    state->except = get(r, 1);
+    state->exc_code = get(r, 1);
+    state->exc_data = get(r, 1);
+    state->pending_cycles = get_double(r);
+    state->cycles = get(r, 8);
+    state->instructions = get(r, 8);
+    state->halted_cycles = get(r, 8);
+    state->irq_wait = get(r, 1);
+    return NULL;
+}
+
+/*
+    Write the MMU's RAM and mapping. ROM slots are stored as bank numbers and
+    cartridge RAM only if the game has any.
+*/
+static void write_mmu(Writer *w, const MMUState *state)
+{
+    put_bytes(w, state->system_ram, MMU_SYSTEM_RAM_SIZE);
+    put(w, state->has_cart_ram, 1);
+    if (state->has_cart_ram)
+        put_bytes(w, state->cart_ram, MMU_CART_RAM_SIZE);
+    put_bytes(w, state->slot_banks, MMU_NUM_SLOTS);
+    put(w, state->cart_ram_mapped, 1);
+    put(w, state->cart_ram_bank, 1);
+    put(w, state->bios_enabled, 1);
+    put(w, state->bank_switches, 8);
+}
+
+/*
+    Read the MMU's RAM and mapping.
+*/
+static const char* read_mmu(Reader *r, MMUState *state)
+{
+    get_bytes(r, state->system_ram, MMU_SYSTEM_RAM_SIZE);
+    state->has_cart_ram = get(r, 1);
+    if (state->has_cart_ram)
+        get_bytes(r, state->cart_ram, MMU_CART_RAM_SIZE);
+    get_bytes(r, state->slot_banks, MMU_NUM_SLOTS);
+    state->cart_ram_mapped = get(r, 1);
+    state->cart_ram_bank = get(r, 1);
+    state->bios_enabled = get(r, 1);
+    state->bank_switches = get(r, 8);
+
+    for (size_t slot = 0; slot < MMU_NUM_SLOTS; slot++) {
+        if (state->slot_banks[slot] >= MMU_NUM_ROM_BANKS)
+            return "invalid ROM bank";
+    }
+    return NULL;
+}
+
+/*
+    Write the VDP's memory, registers and counters, along with the scanline
+    being drawn.
+*/
+static void write_vdp(Writer *w, const VDPState *state)
+{
+    const VDPLine *line = &state->render_line;
+
+    put_bytes(w, state->vram, VDP_VRAM_SIZE);
+    put_bytes(w, state->cram, VDP_CRAM_SIZE);
+    put_bytes(w, state->regs, VDP_REGS);
+
+    put(w, state->line_start, 8);
+    put(w, state->render_row, 1);
+    put(w, state->render_col, 1);
+    put_bytes(w, line->regs, VDP_REGS);
+    put(w, line->nsprites, 1);
+    put_bytes(w, line->sprite_y, VDP_SPRITES_PER_LINE);
+    put_bytes(w, line->sprite_x, VDP_SPRITES_PER_LINE);
+    put_bytes(w, line->sprite_name, VDP_SPRITES_PER_LINE);
+    put_bytes(w, state->colbuf, VDP_SCREEN_WIDTH);
+
+    put(w, state->v_counter, 1);
+    put(w, state->v_count_jump, 1);
+    put(w, state->flags, 1);
+    put(w, state->control_code, 1);
+    put(w, state->control_addr, 2);
+    put(w, state->line_count, 1);
+    put(w, state->read_buf, 1);
+    put(w, state->cram_latch, 1);
+}
+
+/*
+    Read the VDP's memory, registers and counters. The scanline being drawn
+    comes back without a cache stamp, since it's only given one once done.
+*/
+static const char* read_vdp(Reader *r, VDPState *state)
+{
+    VDPLine *line = &state->render_line;
+
+    get_bytes(r, state->vram, VDP_VRAM_SIZE);
+    get_bytes(r, state->cram, VDP_CRAM_SIZE);
+    get_bytes(r, state->regs, VDP_REGS);
+
+    state->line_start = get(r, 8);
+    state->render_row = get(r, 1);
+    state->render_col = get(r, 1);
+    memset(line, 0x00, sizeof(*line));
+    get_bytes(r, line->regs, VDP_REGS);
+    line->nsprites = get(r, 1);
+    get_bytes(r, line->sprite_y, VDP_SPRITES_PER_LINE);
+    get_bytes(r, line->sprite_x, VDP_SPRITES_PER_LINE);
+    get_bytes(r, line->sprite_name, VDP_SPRITES_PER_LINE);
+    get_bytes(r, state->colbuf, VDP_SCREEN_WIDTH);
+
+    state->v_counter = get(r, 1);
+    state->v_count_jump = get(r, 1);
+    state->flags = get(r, 1);
+    state->control_code = get(r, 1);
+    state->control_addr = get(r, 2);
+    state->line_count = get(r, 1);
+    state->read_buf = get(r, 1);
+    state->cram_latch = get(r, 1);
+
+    if (line->nsprites > VDP_SPRITES_PER_LINE)
+        return "too many sprites on a line";
+    if (state->render_row >= VDP_SCREEN_HEIGHT ||
+            state->render_col > VDP_SCREEN_WIDTH)
+        return "invalid render position";
+    return NULL;
+}
+
+/*
+    Write the PSG's registers, channels and audio not yet read.
+*/
+static void write_psg(Writer *w, const PSGState *state)
+{
+    for (unsigned ch = 0; ch < PSG_CHANNELS; ch++) {
+        const PSGChannel *chan = &state->channels[ch];
+        put(w, chan->period, 2);
+        put(w, chan->volume, 1);
+        put(w, chan->output, 1);
+        put(w, chan->next, 8);
+        put(w, (uint32_t) chan->left, 4);
+        put(w, (uint32_t) chan->right, 4);
+    }
+    put(w, state->latch, 1);
+    put(w, state->noise, 1);
+    put(w, state->lfsr, 2);
+    put(w, state->noise_flip, 1);
+    put(w, state->stereo, 1);
+
+    put(w, state->time, 8);
+    put(w, state->base, 8);
+    put(w, state->base_pos, 8);
+    put(w, state->deltas_used, 4);
+    for (unsigned side = 0; side < 2; side++) {
+        for (size_t i = 0; i < state->deltas_used; i++)
+            put(w, (uint32_t) state->deltas[side][i], 4);
+        put(w, (uint32_t) state->sums[side], 4);
+    }
+}
+
+/*
+    Read the PSG's registers, channels and audio not yet read.
+*/
+static const char* read_psg(Reader *r, PSGState *state)
+{
+    for (unsigned ch = 0; ch < PSG_CHANNELS; ch++) {
+        PSGChannel *chan = &state->channels[ch];
+        chan->period = get(r, 2);
+        chan->volume = get(r, 1);
+        chan->output = get(r, 1);
+        chan->next = get(r, 8);
+        chan->left = (int32_t) get(r, 4);
+        chan->right = (int32_t) get(r, 4);
+    }
+    state->latch = get(r, 1);
+    state->noise = get(r, 1);
+    state->lfsr = get(r, 2);
+    state->noise_flip = get(r, 1);
+    state->stereo = get(r, 1);
+
+    state->time = get(r, 8);
+    state->base = get(r, 8);
+    state->base_pos = get(r, 8);
+    state->deltas_used = get(r, 4);
+    if (state->deltas_used > PSG_DELTAS_SIZE)
+        return "too much buffered audio";
+    for (unsigned side = 0; side < 2; side++) {
+        for (size_t i = 0; i < state->deltas_used; i++)
+            state->deltas[side][i] = (int32_t) get(r, 4);
+        state->sums[side] = (int32_t) get(r, 4);
+    }
+    return NULL;
+}
+
+/*
+    Write the I/O ports.
+*/
+static void write_io(Writer *w, const IOState *state)
+{
+    put_bytes(w, state->ports, sizeof(state->ports));
+}
+
+/*
+    Read the I/O ports.
+*/
+static const char* read_io(Reader *r, IOState *state)
+{
+    get_bytes(r, state->ports, sizeof(state->ports));
+    return NULL;
+}
+
+/*
+    Write how far into the frame the GameGear was.
+*/
+static void write_run(Writer *w, const GGState *state)
+{
+    put(w, state->line, 2);
+    put(w, state->mid_line, 1);
+    put_double(w, state->line_left);
+}
+
+/*
+    Read how far into the frame the GameGear was.
+*/
+static const char* read_run(Reader *r, GGState *state)
+{
+    state->line = get(r, 2);
+    state->mid_line = get(r, 1);
+    state->line_left = get_double(r);
+
+    if (state->line >= VDP_LINES_PER_FRAME)
+        return "invalid scanline";
+    return NULL;
+}
+
+/*
+    Write the ID of a section into the table, and its offset and size once
+    written. The data itself goes at the writer's current position.
+*/
+static void write_section(Writer *w, unsigned index, const char *id,
+    size_t start)
+{
+    size_t pos = w->pos;
+    w->pos = TABLE_OFFSET + index * SECTION_ENTRY_SIZE;
+    put_bytes(w, id, 4);
+    put(w, start, 4);
+    put(w, pos - start, 4);
+    w->pos = pos;
+}
+
+/*
+    Serialize a snapshot taken from a GameGear running the given ROM into a
+    buffer, for state_deserialize() to read back.
+
+    This allocates nothing. Return the number of bytes used, or zero if the
+    buffer is too small; STATE_MAX_SIZE bytes are always enough.
+*/
+size_t state_serialize(const GGState *state, const ROM *rom, uint8_t *buf,
+    size_t size)
+{
+    Writer w = {buf, size, 0, false};
+    size_t start;
+
+    put_bytes(&w, MAGIC, MAGIC_LEN);
+    put(&w, STATE_VERSION, 2);
+    put(&w, STATE_SECTIONS, 2);
+    put(&w, rom->product_code, 4);
+    put(&w, rom->expected_checksum, 2);
+    put(&w, 0, 2);
+    put(&w, rom->size, 4);
+    w.pos = STATE_HEADER_SIZE;
+    if (w.pos > w.size)
+        return 0;
+
+    start = w.pos;
+    write_z80(&w, &state->cpu);
+    write_section(&w, 0, "Z80 ", start);
+    start = w.pos;
+    write_mmu(&w, &state->mmu);
+    write_section(&w, 1, "MMU ", start);
+    start = w.pos;
+    write_vdp(&w, &state->vdp);
+    write_section(&w, 2, "VDP ", start);
+    start = w.pos;
+    write_psg(&w, &state->psg);
+    write_section(&w, 3, "PSG ", start);
+    start = w.pos;
+    write_io(&w, &state->io);
+    write_section(&w, 4, "IO  ", start);
+    start = w.pos;
+    write_run(&w, state);
+    write_section(&w, 5, "RUN ", start);
+
+    return w.overflow ? 0 : w.pos;
+}
+
+/*
+    Find a section in the table by its ID, and point a reader at it.
+*/
+static bool find_section(const uint8_t *buf, size_t size, unsigned count,
+    const char *id, Reader *section)
+{
+    for (unsigned i = 0; i < count; i++) {
+        Reader r = {buf, size, TABLE_OFFSET + i * SECTION_ENTRY_SIZE, false};
+        char entry[4];
+        get_bytes(&r, entry, 4);
+        uint32_t offset = get(&r, 4), length = get(&r, 4);
+
+        if (memcmp(entry, id, 4))
+            continue;
+        if (offset > size || length > size - offset)
+            return false;
+        *section = (Reader) {buf + offset, length, 0, false};
+        return true;
+    }
+    return false;
+}
+
+/*
+    Read a state serialized by state_serialize() back into a snapshot, which
+    can then be restored with gamegear_load_state().
+
+    The state must have been saved while running the given ROM. NULL will be
+    returned if it loads successfully. Otherwise, an error string will be
+    returned, and the snapshot may be partly overwritten. States saved before
+    the run section was added were all taken between frames, and still load.
+*/
+const char* state_deserialize(GGState *state, const ROM *rom,
+    const uint8_t *buf, size_t size)
+{
+    Reader r = {buf, size, 0, false};
+    Reader section;
+    const char *error;
+
+    if (size < TABLE_OFFSET || memcmp(buf, MAGIC, MAGIC_LEN))
+        return "invalid header (was this state created by crater?)";
+    r.pos = MAGIC_LEN;
+    if (get(&r, 2) != STATE_VERSION)
+        return "unknown or unsupported state file version";
+
+    unsigned count = get(&r, 2);
+    uint32_t prodcode = get(&r, 4);
+    uint16_t checksum = get(&r, 2);
+    get(&r, 2);
+    uint32_t romsize = get(&r, 4);
+    if (prodcode != rom->product_code || checksum != rom->expected_checksum ||
+            romsize != rom->size)
+        return "state was created for a different ROM";
+    if (TABLE_OFFSET + count * SECTION_ENTRY_SIZE > size)
+        return "section table is truncated";
+
+#define READ_SECTION(id, name, func, member)                          \
+    if (!find_section(buf, size, count, id, &section))                \
+        return "missing or invalid " name " section";                 \
+    if ((error = func(&section, &state->member)))                     \
+        return error;                                                 \
+    if (section.overflow)                                             \
+        return name " section is truncated";
+
+    READ_SECTION("Z80 ", "Z80", read_z80, cpu)
+    READ_SECTION("MMU ", "MMU", read_mmu, mmu)
+    READ_SECTION("VDP ", "VDP", read_vdp, vdp)
+    READ_SECTION("PSG ", "PSG", read_psg, psg)
+    READ_SECTION("IO  ", "I/O", read_io, io)
+#undef READ_SECTION
+
+    state->line = 0;
+    state->mid_line = false;
+    state->line_left = 0;
+    if (!find_section(buf, size, count, "RUN ", &section))
+        return NULL;
+    if ((error = read_run(&section, state)))
+        return error;
+    if (section.overflow)
+        return "run section is truncated";
+    return NULL;
+}
+
+/*
+    Return a 64-bit hash of a snapshot, for telling whether two runs ended up
+    in the same place.
+
+    Audio the PSG has buffered but not yet played is left out, since that
+    depends on how often the frontend reads it rather than on the game. So is
+    the VDP's scanline being drawn, whose column buffer depends on which lines
+    had to be redrawn. The snapshot is left as it was.
+*/
+uint64_t state_hash(GGState *state, const ROM *rom)
+{
+    size_t deltas_used = state->psg.deltas_used;
+    VDPLine line = state->vdp.render_line;
+    uint8_t colbuf[VDP_SCREEN_WIDTH];
+    uint8_t *buf = cr_malloc(STATE_MAX_SIZE);
+
+    memcpy(colbuf, state->vdp.colbuf, VDP_SCREEN_WIDTH);
+    state->psg.deltas_used = 0;
+    memset(&state->vdp.render_line, 0x00, sizeof(VDPLine));
+    memset(state->vdp.colbuf, 0x00, VDP_SCREEN_WIDTH);
+    size_t size = state_serialize(state, rom, buf, STATE_MAX_SIZE);
+    state->psg.deltas_used = deltas_used;
+    state->vdp.render_line = line;
+    memcpy(state->vdp.colbuf, colbuf, VDP_SCREEN_WIDTH);
+
+    uint64_t hash = hash64(buf, size, 0);
+    free(buf);
+    return hash;
+}
+
+/*
+    Log an error while trying to save or load a state file.
+*/
+static void log_error(const char *action, const char *path, const char *reason)
+{
+    ERROR("couldn't %s state file '%s': %s", action, path, reason)
+}
+
+/*
+    Save a snapshot taken from a GameGear running the given ROM to a file.
+
+    Return whether it worked.
+*/
+bool state_save(const char *path, const GGState *state, const ROM *rom)
+{
+    uint8_t *buf = cr_malloc(STATE_MAX_SIZE);
+    size_t size = state_serialize(state, rom, buf, STATE_MAX_SIZE);
+    if (!size) {
+        log_error("save", path, "state is unexpectedly large");
+        free(buf);
+        return false;
+    }
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp) {
+        ERROR_ERRNO("couldn't save state file '%s'", path)
+        free(buf);
+        return false;
+    }
+    bool ok = fwrite(buf, 1, size, fp) == size;
+    if (fclose(fp) || !ok) {
+        ERROR_ERRNO("couldn't save state file '%s'", path)
+        ok = false;
+    }
+    free(buf);
+    return ok;
+}
+
+/*
+    Load a snapshot from a state file saved by state_save() for the given ROM.
+
+    Return whether it worked. If not, the snapshot may be partly overwritten.
+*/
+bool state_load(const char *path, GGState *state, const ROM *rom)
+{
+    FILE *fp = fopen(path, "rb");
+    if (!fp) {
+        ERROR_ERRNO("couldn't load state file '%s'", path)
+        return false;
+    }
+
+    uint8_t *buf = cr_malloc(STATE_MAX_SIZE);
+    size_t size = fread(buf, 1, STATE_MAX_SIZE, fp);
+    bool ok = !ferror(fp);
+    fclose(fp);
+
+    const char *error = NULL;
+    if (!ok)
+        error = "read failed";
+    else if ((error = state_deserialize(state, rom, buf, size)))
+        ok = false;
+    if (error)
+        log_error("load", path, error);
+    free(buf);
+    return ok;
+}
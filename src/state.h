@@ -0,0 +1,29 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "gamegear.h"
+#include "rom.h"
+
+#define STATE_VERSION 1
+#define STATE_SECTIONS 6
+#define STATE_HEADER_SIZE (24 + 12 * STATE_SECTIONS)  // Fixed part + table
+
+/*
+    No serialized state is ever larger than this, since every field takes no
+    more room than it does in memory.
+*/
+#define STATE_MAX_SIZE (STATE_HEADER_SIZE + sizeof(GGState))
+
+/* Functions */
+
+size_t state_serialize(const GGState*, const ROM*, uint8_t*, size_t);
+const char* state_deserialize(GGState*, const ROM*, const uint8_t*, size_t);
+bool state_save(const char*, const GGState*, const ROM*);
+bool state_load(const char*, GGState*, const ROM*);
+uint64_t state_hash(GGState*, const ROM*);
@@ -0,0 +1,83 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <stdlib.h>
+
+#include "triple.h"
+#include "util.h"
+
+/* The middle slot's index is kept with a flag for whether it is new: */
+#define FRESH 4
+#define SLOT(value) ((value) & 3)
+
+/*
+    Initialize a triple buffer whose slots are each the given size in bytes.
+
+    All slots start out zeroed, and the consumer sees nothing new until the
+    first call to triple_publish().
+*/
+void triple_init(TripleBuffer *buf, size_t size)
+{
+    buf->data = cr_calloc(3, size);
+    buf->size = size;
+    buf->back = 0;
+    buf->front = 1;
+    atomic_init(&buf->middle, 2);
+}
+
+/*
+    Free memory previously allocated by the triple buffer.
+*/
+void triple_free(TripleBuffer *buf)
+{
+    free(buf->data);
+    buf->data = NULL;
+}
+
+/*
+    Return the slot for the producer to fill in. Producer only.
+
+    This holds a stale value, not necessarily the last one published.
+*/
+void* triple_back(TripleBuffer *buf)
+{
+    return buf->data + buf->back * buf->size;
+}
+
+/*
+    Make the back slot available to the consumer. Producer only.
+
+    Return whether this replaced a value that the consumer never took.
+*/
+bool triple_publish(TripleBuffer *buf)
+{
+    unsigned old = atomic_exchange_explicit(&buf->middle, buf->back | FRESH,
+                                            memory_order_acq_rel);
+    buf->back = SLOT(old);
+    return old & FRESH;
+}
+
+/*
+    Take the latest published value, if there is one we haven't taken yet.
+    Consumer only.
+
+    Return whether the front slot changed.
+*/
+bool triple_acquire(TripleBuffer *buf)
+{
+    if (!(atomic_load_explicit(&buf->middle, memory_order_relaxed) & FRESH))
+        return false;
+
+    unsigned old = atomic_exchange_explicit(&buf->middle, buf->front,
+                                            memory_order_acq_rel);
+    buf->front = SLOT(old);
+    return true;
+}
+
+/*
+    Return the slot most recently taken by triple_acquire(). Consumer only.
+*/
+const void* triple_front(const TripleBuffer *buf)
+{
+    return buf->data + buf->front * buf->size;
+}
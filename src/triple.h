@@ -0,0 +1,39 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "ring.h"
+
+/* Structs */
+
+/*
+    A lock-free triple buffer for handing the latest of a series of values
+    (e.g. frames) from one producer thread to one consumer thread.
+
+    The producer fills the back slot and swaps it with the middle one; the
+    consumer swaps the middle slot with its front one when there is something
+    new in it. Neither side ever waits for the other, and values the consumer
+    is too slow to take are simply replaced.
+*/
+typedef struct {
+    unsigned char *data;
+    size_t size;
+    unsigned back;
+    alignas(RING_CACHE_LINE) unsigned front;
+    alignas(RING_CACHE_LINE) atomic_uint middle;
+} TripleBuffer;
+
+/* Functions */
+
+void triple_init(TripleBuffer*, size_t);
+void triple_free(TripleBuffer*);
+void* triple_back(TripleBuffer*);
+bool triple_publish(TripleBuffer*);
+bool triple_acquire(TripleBuffer*);
+const void* triple_front(const TripleBuffer*);
@@ -4,11 +4,14 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 
 #include "util_alloc.h"
 
 #define INVALID_SIZE_CODE 0x8
+#define VARINT_MAX_SIZE 10  // Enough for any 64-bit value
 
 #define BINARY_FMT "0b%u%u%u%u%u%u%u%u"  // Used by register dumpers
 #define BINARY_VAL(data)       \
@@ -32,4 +35,9 @@ uint8_t region_string_to_code(const char*);
 size_t size_code_to_bytes(uint8_t);
 uint8_t size_bytes_to_code(size_t);
 uint16_t compute_checksum(const uint8_t*, size_t, uint8_t);
+uint64_t read_le(const uint8_t*, unsigned);
+void write_le(FILE*, uint64_t, unsigned);
+size_t put_varint(uint8_t*, size_t);
+size_t get_varint(const uint8_t*, size_t, size_t*);
+uint64_t hash64(const void*, size_t, uint64_t);
 const char* get_third_party_developer(uint8_t);
@@ -2,9 +2,9 @@
    Released under the terms of the MIT License. See LICENSE for details. */
 
 #include <string.h>
-#include <SDL.h>
 
 #include "vdp.h"
+#include "vdp/thread.h"
 #include "util.h"
 
 #define FLAG_CONTROL   0x01
@@ -21,18 +21,37 @@
 #define COLBUF_BG_PRIORITY   0x10
 #define COLBUF_OPAQUE_SPRITE 0x20
 
+#define CMD_VRAM_WRITE 0
+#define CMD_CRAM_WRITE 1
+#define CMD_REG_WRITE  2
+#define CMD_RENDER     3
+
+#define CYCLES_PER_LINE 228
+#define PIXELS_PER_LINE 342
+#define DISPLAY_START_CYCLE (CYCLES_PER_LINE - VDP_SCREEN_WIDTH * 2 / 3)
+#define H_COUNTER_START (DISPLAY_START_CYCLE * 3 / 2 - 48)
+
 /*
     Initialize the Video Display Processor (VDP).
 
-    The VDP will write to its pixels array whenever it draws a scanline. It
-    defaults to NULL, but you should set it to something if you want to see its
-    output.
+    The VDP will write to its pixels array whenever it draws a scanline, with
+    rows pitch pixels apart. It defaults to NULL, but you should set it (or the
+    indexed output arrays, see vdp_draw_indexed()) to something if you want to
+    see its output.
 */
 void vdp_init(VDP *vdp)
 {
     vdp->pixels = NULL;
+    vdp->pitch = VDP_SCREEN_WIDTH;
+    vdp->indices = NULL;
+    vdp->palettes = NULL;
+    vdp->render_mode = VDP_RENDER_SYNC;
+    vdp->mirror = NULL;
+    vdp->thread = NULL;
+    vdp->clock = NULL;
     vdp->vram = cr_malloc(sizeof(uint8_t) * VDP_VRAM_SIZE);
     vdp->cram = cr_malloc(sizeof(uint8_t) * VDP_CRAM_SIZE);
+    vdp->vram_stamps = cr_malloc(sizeof(uint64_t) * VDP_PATTERNS);
 }
 
 /*
@@ -40,8 +59,35 @@ void vdp_init(VDP *vdp)
 */
 void vdp_free(VDP *vdp)
 {
+    vdp_set_render_mode(vdp, VDP_RENDER_SYNC);
     free(vdp->vram);
     free(vdp->cram);
+    free(vdp->vram_stamps);
+}
+
+/*
+    Bring the render thread's copy of the VDP fully up to date.
+
+    This waits for the render thread to go idle, so it should only be used for
+    rare events (power on, attaching a display), not for regular writes.
+*/
+static void update_mirror(VDP *vdp)
+{
+    VDP *mirror = vdp->mirror;
+
+    vdp_thread_sync(vdp->thread);
+    memcpy(mirror->vram, vdp->vram, VDP_VRAM_SIZE);
+    memcpy(mirror->cram, vdp->cram, VDP_CRAM_SIZE);
+    memcpy(mirror->regs, vdp->regs, VDP_REGS);
+    mirror->pixels = vdp->pixels;
+    mirror->pitch = vdp->pitch;
+    mirror->indices = vdp->indices;
+    mirror->palettes = vdp->palettes;
+    mirror->render_row = vdp->render_row;
+    mirror->render_col = vdp->render_col;
+    mirror->render_line = vdp->render_line;
+    memcpy(mirror->colbuf, vdp->colbuf, sizeof(vdp->colbuf));
+    vdp_invalidate_lines(mirror);
 }
 
 /*
@@ -64,9 +110,11 @@ void vdp_power(VDP *vdp)
     vdp->regs[0x09] = 0x00;
     vdp->regs[0x0A] = 0x01;
 
-    vdp->h_counter = 0;
     vdp->v_counter = 0;
     vdp->v_count_jump = false;
+    vdp->line_start = vdp->clock ? *vdp->clock : 0;
+    vdp->render_row = 0;
+    vdp->render_col = 0;
 
     vdp->flags = 0;
     vdp->control_code = 0;
@@ -74,6 +122,99 @@ void vdp_power(VDP *vdp)
     vdp->line_count = 0x01;
     vdp->read_buf = 0;
     vdp->cram_latch = 0;
+
+    vdp->stamp = 1;
+    memset(vdp->vram_stamps, 0x00, sizeof(uint64_t) * VDP_PATTERNS);
+    vdp->cram_stamp = 0;
+    vdp_invalidate_lines(vdp);
+}
+
+/*
+    Forget the contents of every cached scanline.
+
+    The VDP skips redrawing lines whose inputs have not changed since the last
+    frame, trusting the pixel array to still hold the previous output. This
+    must be called whenever that stops being true (e.g. a new display was
+    attached, or someone else drew over the frame).
+*/
+void vdp_invalidate_lines(VDP *vdp)
+{
+    if (vdp->mirror)
+        update_mirror(vdp);
+    for (size_t line = 0; line < VDP_SCREEN_HEIGHT; line++) {
+        vdp->lines[line].valid = false;
+        vdp->dirty_lines[line] = true;
+    }
+}
+
+/*
+    Save the VDP's state so that it can be restored with vdp_load_state().
+*/
+void vdp_save_state(const VDP *vdp, VDPState *state)
+{
+    memcpy(state->vram, vdp->vram, VDP_VRAM_SIZE);
+    memcpy(state->cram, vdp->cram, VDP_CRAM_SIZE);
+    memcpy(state->regs, vdp->regs, VDP_REGS);
+
+    state->line_start = vdp->line_start;
+    state->render_row = vdp->render_row;
+    state->render_col = vdp->render_col;
+    state->render_line = vdp->render_line;
+    memcpy(state->colbuf, vdp->colbuf, sizeof(state->colbuf));
+
+    state->v_counter = vdp->v_counter;
+    state->v_count_jump = vdp->v_count_jump;
+    state->flags = vdp->flags;
+    state->control_code = vdp->control_code;
+    state->control_addr = vdp->control_addr;
+    state->line_count = vdp->line_count;
+    state->read_buf = vdp->read_buf;
+    state->cram_latch = vdp->cram_latch;
+}
+
+/*
+    Restore the VDP's state from a copy made by vdp_save_state().
+
+    The display still holds whatever was drawn last, and cached lines still
+    describe it, so only patterns (and CRAM) that differ from the restored
+    state are marked as written. Restoring a state close to the current one,
+    as run-ahead and rewinding do, then redraws only the lines that differ.
+    The render thread's copy is simply brought up to date and redraws
+    everything.
+*/
+void vdp_load_state(VDP *vdp, const VDPState *state)
+{
+    for (size_t pattern = 0; pattern < VDP_PATTERNS; pattern++) {
+        size_t offset = pattern * VDP_PATTERN_SIZE;
+        if (memcmp(vdp->vram + offset, state->vram + offset,
+                   VDP_PATTERN_SIZE))
+            vdp->vram_stamps[pattern] = vdp->stamp;
+    }
+    if (memcmp(vdp->cram, state->cram, VDP_CRAM_SIZE))
+        vdp->cram_stamp = vdp->stamp;
+    vdp->stamp++;
+
+    memcpy(vdp->vram, state->vram, VDP_VRAM_SIZE);
+    memcpy(vdp->cram, state->cram, VDP_CRAM_SIZE);
+    memcpy(vdp->regs, state->regs, VDP_REGS);
+
+    vdp->line_start = state->line_start;
+    vdp->render_row = state->render_row;
+    vdp->render_col = state->render_col;
+    vdp->render_line = state->render_line;
+    memcpy(vdp->colbuf, state->colbuf, sizeof(vdp->colbuf));
+
+    vdp->v_counter = state->v_counter;
+    vdp->v_count_jump = state->v_count_jump;
+    vdp->flags = state->flags;
+    vdp->control_code = state->control_code;
+    vdp->control_addr = state->control_addr;
+    vdp->line_count = state->line_count;
+    vdp->read_buf = state->read_buf;
+    vdp->cram_latch = state->cram_latch;
+
+    if (vdp->mirror)
+        update_mirror(vdp);
 }
 
 /*
@@ -141,19 +282,19 @@ static uint8_t get_backdrop_color(const VDP *vdp)
 }
 
 /*
-    Return the horizontal background scroll value.
+    Return the horizontal background scroll value latched for the given line.
 */
-static uint8_t get_bg_hscroll(const VDP *vdp)
+static uint8_t get_bg_hscroll(const VDPLine *line)
 {
-    return vdp->regs[0x08];
+    return line->regs[0x08];
 }
 
 /*
-    Return the vertical background scroll value.
+    Return the vertical background scroll value latched for the given line.
 */
-static uint8_t get_bg_vscroll(const VDP *vdp)
+static uint8_t get_bg_vscroll(const VDPLine *line)
 {
-    return vdp->regs[0x09];
+    return line->regs[0x09];
 }
 
 /*
@@ -191,34 +332,83 @@ static uint16_t get_color(const VDP *vdp, uint8_t index, bool palette)
 }
 
 /*
-    Draw a pixel onto our pixel array at the given coordinates.
-
-    The color should be in BGR444 format, as returned by get_color().
+    Convert a BGR444 color, as returned by get_color(), into ARGB8888.
 */
-static void draw_pixel(VDP *vdp, uint8_t y, uint8_t x, uint16_t color)
+static inline uint32_t bgr444_to_argb(uint16_t color)
 {
     uint8_t r = 0x11 *  (color & 0x000F);
     uint8_t g = 0x11 * ((color & 0x00F0) >> 4);
     uint8_t b = 0x11 * ((color & 0x0F00) >> 8);
 
-    uint32_t argb = (0xFF << 24) + (r << 16) + (g << 8) + b;
-    vdp->pixels[y * 160 + x] = argb;
+    return (0xFF << 24) + (r << 16) + (g << 8) + b;
+}
+
+/*
+    Return whether the VDP has anywhere to draw its output.
+*/
+static inline bool has_display(const VDP *vdp)
+{
+    return vdp->pixels || vdp->indices;
+}
+
+/*
+    Return whether this VDP draws pixels itself, rather than only raising the
+    sprite flags (when it has no display, or the render thread draws them).
+*/
+static inline bool draws_pixels(const VDP *vdp)
+{
+    return has_display(vdp) && !vdp->thread;
+}
+
+/*
+    Draw a pixel onto our display at the given coordinates.
+
+    The color is given as a CRAM entry (0-31, i.e. 16 * palette + index). In
+    indexed mode, the entry itself is stored; otherwise, it is looked up.
+*/
+static void draw_pixel(VDP *vdp, uint8_t y, uint8_t x, uint8_t entry)
+{
+    if (vdp->indices) {
+        vdp->indices[y * 160 + x] = entry;
+        return;
+    }
+    uint16_t color = get_color(vdp, entry & 0x0F, entry & 0x10);
+    vdp->pixels[y * vdp->pitch + x] = bgr444_to_argb(color);
 }
 
 /*
-    Draw the background of the current scanline.
+    Store the current contents of CRAM as the given line's palette.
+
+    Only used in indexed mode. A line's palette is taken from CRAM as it was
+    when the line was last drawn to, so a palette change in the middle of a
+    line applies to the whole line there.
 */
-static void draw_background(VDP *vdp, uint8_t *colbuf)
+static void save_line_palette(VDP *vdp, uint8_t row)
 {
-    uint8_t src_row = (vdp->v_counter + get_bg_vscroll(vdp)) % (28 << 3);
+    uint16_t *palette = vdp->palettes + row * VDP_PALETTE_SIZE;
+    for (uint8_t entry = 0; entry < VDP_PALETTE_SIZE; entry++)
+        palette[entry] = get_color(vdp, entry & 0x0F, entry & 0x10);
+}
+
+/*
+    Draw the background of the current scanline, between the given columns.
+*/
+static void draw_background(VDP *vdp, uint8_t start, uint8_t end)
+{
+    const VDPLine *line = &vdp->render_line;
+    uint8_t src_row = (vdp->v_counter + get_bg_vscroll(line)) % (28 << 3);
     uint8_t dst_row = vdp->v_counter - 0x18;
     uint8_t vcell = src_row >> 3;
     uint8_t hcell, col;
 
-    uint8_t start_col   = get_bg_hscroll(vdp) >> 3;
-    uint8_t fine_scroll = get_bg_hscroll(vdp) % 8;
+    uint8_t start_col   = get_bg_hscroll(line) >> 3;
+    uint8_t fine_scroll = get_bg_hscroll(line) % 8;
 
     for (col = 5; col < 20 + 6; col++) {
+        int16_t left = ((col - 6) << 3) + fine_scroll;
+        if (left + 8 <= start || left >= end)
+            continue;
+
         hcell = (32 - start_col + col) % 32;
         uint16_t tile = get_background_tile(vdp, vcell, hcell);
         uint16_t pattern  = tile & 0x01FF;
@@ -228,80 +418,139 @@ static void draw_background(VDP *vdp, uint8_t *colbuf)
         bool     hflip    = tile & 0x0200;
 
         uint8_t vshift = vflip ? (7 - src_row % 8) : (src_row % 8), hshift;
-        uint8_t pixel, index;
+        uint8_t pixel, index, entry;
         int16_t dst_col;
-        uint16_t color;
 
         for (pixel = 0; pixel < 8; pixel++) {
-            dst_col = ((col - 6) << 3) + pixel + fine_scroll;
-            if (dst_col < 0 || dst_col >= 160)
+            dst_col = left + pixel;
+            if (dst_col < start || dst_col >= end)
                 continue;
 
             hshift = hflip ? (7 - pixel) : pixel;
             index = read_pattern(vdp, pattern, vshift, hshift);
             if (is_display_visible(vdp))
-                color = get_color(vdp, index, palette);
+                entry = index + 16 * palette;
             else
-                color = get_color(vdp, get_backdrop_color(vdp), 1);
-            draw_pixel(vdp, dst_row, dst_col, color);
+                entry = get_backdrop_color(vdp) + 16;
+            draw_pixel(vdp, dst_row, dst_col, entry);
 
             if (priority && index != 0)
-                colbuf[dst_col] |= COLBUF_BG_PRIORITY;
+                vdp->colbuf[dst_col] |= COLBUF_BG_PRIORITY;
         }
     }
 }
 
 /*
-    Draw sprites in the current scanline.
+    Find the sprites visible on the current scanline, in SAT order.
+
+    Up to eight sprites are stored in the given line object; a ninth sets the
+    sprite overflow flag.
 */
-static void draw_sprites(VDP *vdp, uint8_t *colbuf)
+static void evaluate_sprites(VDP *vdp, VDPLine *line)
 {
     uint8_t *sat = vdp->vram + get_sat_base(vdp);
-    uint8_t spritebuf[8], nsprites = 0, i;
-    uint8_t height = get_sprite_height(vdp);
+    uint8_t height = get_sprite_height(vdp), i;
 
+    line->nsprites = 0;
     for (i = 0; i < 64; i++) {
         uint8_t y = sat[i] + 1;
         if (y == 0xD0 + 1)
             break;
         if (vdp->v_counter >= y && vdp->v_counter < y + (height * 8)) {
-            if (nsprites >= 8) {
+            if (line->nsprites >= VDP_SPRITES_PER_LINE) {
                 vdp->flags |= FLAG_SPR_OVF;
                 break;
             }
-            spritebuf[nsprites++] = i;
+            line->sprite_y[line->nsprites] = y;
+            line->sprite_x[line->nsprites] = sat[0x80 + 2 * i];
+            line->sprite_name[line->nsprites] = sat[0x80 + 2 * i + 1];
+            line->nsprites++;
         }
     }
+}
+
+/*
+    Return the pattern used by the given sprite on the current scanline.
+
+    The row within that pattern is stored in vshift. The sprite height and
+    generator table are taken from the line's latched registers, since they
+    were used to find its sprites in the first place.
+*/
+static uint16_t get_sprite_pattern(const VDP *vdp, const VDPLine *line,
+    uint8_t sprite, uint8_t *vshift)
+{
+    uint8_t y = line->sprite_y[sprite];
+    uint16_t pattern = ((line->regs[0x06] & 0x04) << 6) +
+                       line->sprite_name[sprite];
+
+    if (line->regs[0x01] & 0x02) {
+        pattern  = (pattern & 0x1FE) | ((vdp->v_counter - y) >> 3);
+        *vshift  = (vdp->v_counter - y) % 8;
+    } else {
+        // TODO: sprite doubling
+        *vshift = vdp->v_counter - y;
+    }
+    return pattern;
+}
 
+/*
+    Return whether the background takes priority over sprites at the given
+    column of the current scanline (i.e., it has the priority bit set and is
+    not transparent there).
+*/
+static bool has_bg_priority(const VDP *vdp, uint8_t dst_col)
+{
+    const VDPLine *line = &vdp->render_line;
+    uint8_t src_row = (vdp->v_counter + get_bg_vscroll(line)) % (28 << 3);
+    uint8_t start_col   = get_bg_hscroll(line) >> 3;
+    uint8_t fine_scroll = get_bg_hscroll(line) % 8;
+
+    uint8_t pos = dst_col - fine_scroll + (6 << 3);
+    uint8_t col = pos >> 3, pixel = pos % 8;
+    uint16_t tile = get_background_tile(vdp, src_row >> 3,
+                                        (32 - start_col + col) % 32);
+    if (!(tile & 0x1000))
+        return false;
+
+    uint8_t vshift = (tile & 0x0400) ? (7 - src_row % 8) : (src_row % 8);
+    uint8_t hshift = (tile & 0x0200) ? (7 - pixel) : pixel;
+    return read_pattern(vdp, tile & 0x01FF, vshift, hshift) != 0;
+}
+
+/*
+    Draw sprites in the current scanline, between the given columns.
+
+    When the render thread is in use, or there is no display, this VDP only
+    raises the sprite flags: the CPU may read them before the render thread
+    gets around to the line, and must see the same ones whether or not
+    anything is shown. Background priority is then looked up directly, as the
+    background itself is not drawn here.
+*/
+static void draw_sprites(VDP *vdp, uint8_t start, uint8_t end)
+{
+    const VDPLine *line = &vdp->render_line;
     uint8_t dst_row = vdp->v_counter - 0x18;
+    uint8_t nsprites = line->nsprites;
+    uint8_t *colbuf = vdp->colbuf;
+    bool pixels = draws_pixels(vdp);
+
+    if (!pixels && nsprites < 2)  // Nothing to collide with
+        return;
 
     while (nsprites-- > 0) {
-        i = spritebuf[nsprites];
-        uint8_t y = sat[i] + 1;
-        uint8_t x = sat[0x80 + 2 * i];
+        uint8_t x = line->sprite_x[nsprites];
         uint8_t vshift;
-        uint16_t pattern;
-
-        if (height == 1) {
-            pattern = get_sgt_offset(vdp) + sat[0x80 + 2 * i + 1];
-            vshift = vdp->v_counter - y;
-        } else if (height == 2) {
-            pattern  = (get_sgt_offset(vdp) + sat[0x80 + 2 * i + 1]) & 0x1FE;
-            pattern |= (vdp->v_counter - y) >> 3;
-            vshift   = (vdp->v_counter - y) % 8;
-        } else {
-            // TODO: sprite doubling
-        }
+        uint16_t pattern = get_sprite_pattern(vdp, line, nsprites, &vshift);
 
         uint8_t pixel, index;
-        uint16_t color;
         int16_t dst_col;
 
         for (pixel = 0; pixel < 8; pixel++) {
             dst_col = x + pixel - (6 << 3);
-            if (dst_col < 0 || dst_col >= 160)
+            if (dst_col < start || dst_col >= end)
                 continue;
-            if (colbuf[dst_col] & COLBUF_BG_PRIORITY)
+            if (pixels ? colbuf[dst_col] & COLBUF_BG_PRIORITY :
+                         has_bg_priority(vdp, dst_col))
                 continue;
 
             index = read_pattern(vdp, pattern, vshift, pixel);
@@ -313,25 +562,229 @@ static void draw_sprites(VDP *vdp, uint8_t *colbuf)
             else
                 colbuf[dst_col] |= COLBUF_OPAQUE_SPRITE;
 
-            if (is_display_visible(vdp)) {
-                color = get_color(vdp, index, 1);
-                draw_pixel(vdp, dst_row, dst_col, color);
-            }
+            if (pixels && is_display_visible(vdp))
+                draw_pixel(vdp, dst_row, dst_col, index + 16);
         }
     }
 }
 
 /*
-    Draw the current scanline.
+    Return whether the given pattern has been written to since the given stamp.
+*/
+static inline bool is_pattern_dirty(const VDP *vdp, uint16_t pattern,
+    uint64_t stamp)
+{
+    return vdp->vram_stamps[pattern] > stamp;
+}
+
+/*
+    Return whether the current scanline would look identical to the output
+    cached for it during the previous frame.
+
+    This holds if the registers and visible sprites are unchanged, and nothing
+    they refer to (CRAM, the name table row, the patterns in that row, and the
+    sprite patterns) has been written to since the line was drawn. VRAM writes
+    are tracked in units of one pattern, so a name table row spans two.
+*/
+static bool is_line_clean(const VDP *vdp, const VDPLine *cache,
+    const VDPLine *line)
+{
+    uint64_t stamp = cache->stamp;
+    uint8_t i;
+
+    if (!cache->valid || vdp->cram_stamp > stamp)
+        return false;
+    if (memcmp(cache->regs, line->regs, 0x0A))  // Line counter doesn't matter
+        return false;
+    if (cache->nsprites != line->nsprites ||
+            memcmp(cache->sprite_y,    line->sprite_y,    line->nsprites) ||
+            memcmp(cache->sprite_x,    line->sprite_x,    line->nsprites) ||
+            memcmp(cache->sprite_name, line->sprite_name, line->nsprites))
+        return false;
+
+    uint8_t src_row = (vdp->v_counter + get_bg_vscroll(line)) % (28 << 3);
+    uint8_t vcell = src_row >> 3;
+    uint16_t pnt_row = (get_pnt_base(vdp) + 64 * vcell) / VDP_PATTERN_SIZE;
+    if (is_pattern_dirty(vdp, pnt_row,     stamp) ||
+        is_pattern_dirty(vdp, pnt_row + 1, stamp))
+        return false;
+
+    uint8_t start_col = get_bg_hscroll(line) >> 3, col, hcell;
+    for (col = 5; col < 20 + 6; col++) {
+        hcell = (32 - start_col + col) % 32;
+        uint16_t tile = get_background_tile(vdp, vcell, hcell);
+        if (is_pattern_dirty(vdp, tile & 0x01FF, stamp))
+            return false;
+    }
+
+    for (i = 0; i < line->nsprites; i++) {
+        uint8_t vshift;
+        uint16_t pattern = get_sprite_pattern(vdp, line, i, &vshift);
+        if (is_pattern_dirty(vdp, pattern, stamp))
+            return false;
+    }
+    return true;
+}
+
+/*
+    Start drawing the current scanline.
+
+    The scroll registers and the line's sprites are latched here, so they stay
+    fixed even if the line is drawn in several pieces.
+*/
+static void begin_scanline(VDP *vdp)
+{
+    memcpy(vdp->render_line.regs, vdp->regs, VDP_REGS);
+    evaluate_sprites(vdp, &vdp->render_line);
+    memset(vdp->colbuf, 0x00, sizeof(vdp->colbuf));
+}
+
+/*
+    Draw the given columns of the current scanline.
+*/
+static void draw_columns(VDP *vdp, uint8_t start, uint8_t end)
+{
+    if (draws_pixels(vdp)) {
+        if (vdp->indices)
+            save_line_palette(vdp, vdp->v_counter - 0x18);
+        draw_background(vdp, start, end);
+    }
+    draw_sprites(vdp, start, end);
+}
+
+/*
+    Draw the whole current scanline, unless it is unchanged since the last
+    frame.
+
+    Sprite flags raised by a line are cached along with its output, so skipping
+    the line raises them again just as drawing it would have. With no display,
+    there is nothing to cache, and only the sprite flags are worked out.
 */
 static void draw_scanline(VDP *vdp)
 {
-    if (!vdp->pixels)
+    if (!has_display(vdp)) {
+        begin_scanline(vdp);
+        draw_sprites(vdp, 0, VDP_SCREEN_WIDTH);
         return;
+    }
+
+    uint8_t row = vdp->v_counter - 0x18, saved_flags = vdp->flags;
+    VDPLine *cache = &vdp->lines[row], *line = &vdp->render_line;
+
+    vdp->flags = 0;
+    begin_scanline(vdp);
+
+    if (!vdp->thread && is_line_clean(vdp, cache, line)) {
+        vdp->flags = saved_flags | cache->flags;
+        vdp->dirty_lines[row] = false;
+        return;
+    }
 
-    uint8_t colbuf[160] = {0x00};
-    draw_background(vdp, colbuf);
-    draw_sprites(vdp, colbuf);
+    draw_columns(vdp, 0, VDP_SCREEN_WIDTH);
+
+    line->valid = true;
+    line->stamp = vdp->stamp;
+    line->flags = vdp->flags;
+    *cache = *line;
+    vdp->flags |= saved_flags;
+    vdp->dirty_lines[row] = true;
+}
+
+/*
+    Draw part of the current scanline, which is being changed mid-line.
+
+    Such lines are never cached, as their output depends on when the changes
+    were made.
+*/
+static void draw_partial_scanline(VDP *vdp, uint8_t start, uint8_t end)
+{
+    uint8_t row = vdp->v_counter - 0x18;
+    if (start == 0)
+        begin_scanline(vdp);
+    draw_columns(vdp, start, end);
+    vdp->lines[row].valid = false;
+    vdp->dirty_lines[row] = true;
+}
+
+/*
+    Draw the screen up to the given row and column, starting from wherever the
+    last call left off.
+
+    Whole rows are drawn (and cached) in one go where possible. Reaching the
+    bottom of the screen starts over at the top for the next frame.
+*/
+static void render_until(VDP *vdp, uint8_t row, uint8_t col)
+{
+    if (row == vdp->render_row && col <= vdp->render_col)
+        return;
+    if (vdp->thread)
+        vdp_thread_push(vdp->thread, CMD_RENDER, row, col);
+
+    uint8_t v_counter = vdp->v_counter;
+    while (vdp->render_row < row) {
+        vdp->v_counter = vdp->render_row + 0x18;
+        if (vdp->render_col == 0)
+            draw_scanline(vdp);
+        else
+            draw_partial_scanline(vdp, vdp->render_col, VDP_SCREEN_WIDTH);
+        vdp->render_row++;
+        vdp->render_col = 0;
+    }
+    if (col > vdp->render_col) {
+        vdp->v_counter = row + 0x18;
+        draw_partial_scanline(vdp, vdp->render_col, col);
+        vdp->render_col = col;
+    }
+    if (vdp->render_row == VDP_SCREEN_HEIGHT)
+        vdp->render_row = 0;
+    vdp->v_counter = v_counter;
+
+    // Anything written from now on happened after these lines were drawn:
+    vdp->stamp++;
+}
+
+/*
+    Return the number of CPU cycles since the current scanline began.
+*/
+static uint32_t get_line_cycles(const VDP *vdp)
+{
+    if (!vdp->clock)
+        return 0;
+    return *vdp->clock - vdp->line_start;
+}
+
+/*
+    Return the screen column the beam has reached on the current scanline.
+
+    The visible part of a line is scanned during the last stretch of the CPU's
+    time slice for it (160 pixels at 1.5 pixels per cycle), matching the
+    order in which vdp_simulate_line() is called.
+*/
+static uint8_t get_beam_column(const VDP *vdp)
+{
+    uint32_t cycles = get_line_cycles(vdp);
+    if (cycles < DISPLAY_START_CYCLE)
+        return 0;
+
+    uint32_t col = (cycles - DISPLAY_START_CYCLE) * 3 / 2;
+    return col < VDP_SCREEN_WIDTH ? col : VDP_SCREEN_WIDTH;
+}
+
+/*
+    Draw everything the beam has passed, so that a change about to be made to
+    the VDP's state does not affect it.
+
+    This is called before each write that could change the display, and before
+    the CPU reads the sprite flags. If partial is set, the current scanline is
+    also drawn up to the beam, so a mid-line change takes effect at the right
+    pixel; otherwise, the current scanline is left alone.
+*/
+static void catch_up(VDP *vdp, bool partial)
+{
+    if (vdp->v_counter < 0x18 || vdp->v_counter >= 0xA8)
+        return;
+    render_until(vdp, vdp->v_counter - 0x18,
+                 partial ? get_beam_column(vdp) : 0);
 }
 
 /*
@@ -367,15 +820,160 @@ static void advance_scanline(VDP *vdp)
 
 /*
     Simulate one line within the VDP.
+
+    Except in lazy mode, the visible part of the line is drawn right away. In
+    lazy mode, it is left for catch_up(), and the screen is only guaranteed to
+    be fully drawn once the last visible line has been simulated.
 */
 void vdp_simulate_line(VDP *vdp)
 {
-    if (vdp->v_counter >= 0x18 && vdp->v_counter < 0xA8)
-        draw_scanline(vdp);
+    if (vdp->v_counter >= 0x18 && vdp->v_counter < 0xA8) {
+        uint8_t row = vdp->v_counter - 0x18;
+        if (vdp->render_mode != VDP_RENDER_LAZY ||
+                row == VDP_SCREEN_HEIGHT - 1)
+            render_until(vdp, row + 1, 0);
+        if (vdp->thread)
+            vdp_thread_flush(vdp->thread);
+    }
     if (vdp->v_counter == 0xC0)
         vdp->flags |= FLAG_FRAME_INT;
     update_line_counter(vdp);
     advance_scanline(vdp);
+    if (vdp->clock)
+        vdp->line_start = *vdp->clock;
+}
+
+/*
+    Run a batch of commands sent to the render thread's copy of the VDP.
+
+    Called on the render thread. The copy draws the screen at exactly the same
+    points as the main VDP, so the output is identical to drawing it there.
+*/
+static void run_commands(void *context, const VDPCommand *cmds, size_t count)
+{
+    VDP *vdp = context;
+
+    for (size_t i = 0; i < count; i++) {
+        const VDPCommand *cmd = &cmds[i];
+        switch (cmd->type) {
+            case CMD_VRAM_WRITE:
+                vdp->vram[cmd->addr] = cmd->value;
+                vdp->vram_stamps[cmd->addr / VDP_PATTERN_SIZE] = vdp->stamp;
+                break;
+            case CMD_CRAM_WRITE:
+                vdp->cram[cmd->addr] = cmd->value;
+                vdp->cram_stamp = vdp->stamp;
+                break;
+            case CMD_REG_WRITE:
+                vdp->regs[cmd->addr] = cmd->value;
+                break;
+            case CMD_RENDER:
+                render_until(vdp, cmd->addr, cmd->value);
+                break;
+        }
+    }
+}
+
+/*
+    Choose how the VDP draws scanlines.
+
+    In VDP_RENDER_SYNC mode (the default), each visible scanline is drawn by
+    vdp_simulate_line() itself. In VDP_RENDER_LAZY mode, nothing is drawn
+    until a write could change lines the beam has already passed, or the
+    visible part of the frame ends; all lines pending at that point are then
+    drawn in one batch. In VDP_RENDER_THREAD mode, VRAM, CRAM and register
+    writes are forwarded to a copy of the VDP on a separate thread, which
+    draws the screen at the same points that sync mode would. Only the sprite
+    flags are still computed here, since the CPU can read them.
+
+    The output is identical in every mode, but vdp_sync() must be called
+    before reading the pixel array.
+*/
+void vdp_set_render_mode(VDP *vdp, VDPRenderMode mode)
+{
+    if (mode == vdp->render_mode)
+        return;
+
+    if (mode == VDP_RENDER_THREAD) {
+        vdp->mirror = cr_malloc(sizeof(VDP));
+        vdp_init(vdp->mirror);
+        vdp_power(vdp->mirror);
+        vdp->thread = vdp_thread_create(run_commands, vdp->mirror);
+    } else if (vdp->thread) {
+        vdp_thread_destroy(vdp->thread);
+        vdp_free(vdp->mirror);
+        free(vdp->mirror);
+        vdp->thread = NULL;
+        vdp->mirror = NULL;
+    }
+
+    vdp->render_mode = mode;
+    vdp_invalidate_lines(vdp);
+}
+
+/*
+    Finish drawing every scanline simulated so far.
+
+    Afterwards, the pixel array and dirty line list describe the current frame
+    up to the last simulated line.
+*/
+void vdp_sync(VDP *vdp)
+{
+    if (vdp->v_counter >= 0x18 && vdp->v_counter < 0xA8)
+        render_until(vdp, vdp->v_counter - 0x18, 0);
+    if (!vdp->thread)
+        return;
+
+    vdp_thread_sync(vdp->thread);
+    memcpy(vdp->dirty_lines, vdp->mirror->dirty_lines,
+           sizeof(vdp->dirty_lines));
+}
+
+/*
+    Attach an indexed display to the VDP, or detach it by passing NULL.
+
+    Instead of ARGB8888 pixels, the VDP will then store one byte per pixel,
+    holding its CRAM entry (0-31), into indices (VDP_SCREEN_WIDTH *
+    VDP_SCREEN_HEIGHT bytes), and the BGR444 colors of those entries for each
+    line into palettes (VDP_SCREEN_HEIGHT * VDP_PALETTE_SIZE values). This is
+    a quarter of the size, and can be turned into pixels with
+    vdp_expand_line(). The pixels array is ignored while this is set.
+*/
+void vdp_draw_indexed(VDP *vdp, uint8_t *indices, uint16_t *palettes)
+{
+    vdp->indices = indices;
+    vdp->palettes = indices ? palettes : NULL;
+    vdp_invalidate_lines(vdp);
+}
+
+/*
+    Convert one line of indexed output into ARGB8888 pixels.
+*/
+void vdp_expand_line(const uint8_t *indices, const uint16_t *palette,
+    uint32_t *pixels)
+{
+    uint32_t colors[VDP_PALETTE_SIZE];
+    for (uint8_t entry = 0; entry < VDP_PALETTE_SIZE; entry++)
+        colors[entry] = bgr444_to_argb(palette[entry]);
+    for (uint8_t x = 0; x < VDP_SCREEN_WIDTH; x++)
+        pixels[x] = colors[indices[x] & (VDP_PALETTE_SIZE - 1)];
+}
+
+/*
+    Return the current value of the H counter.
+
+    The counter runs at half the pixel clock, starting at the left edge of the
+    (Master System's) active display and jumping from 0x93 to 0xE9 during
+    horizontal blanking. The Game Gear has no light gun port to latch it, so
+    it always reflects the beam's current position.
+*/
+uint8_t vdp_read_h_counter(const VDP *vdp)
+{
+    uint32_t cycles = get_line_cycles(vdp) % CYCLES_PER_LINE;
+    uint16_t pixel = (cycles * 3 / 2 + PIXELS_PER_LINE - H_COUNTER_START) %
+                     PIXELS_PER_LINE;
+    uint8_t counter = pixel >> 1;
+    return counter > 0x93 ? counter + (0xE9 - 0x94) : counter;
 }
 
 /*
@@ -394,6 +992,7 @@ void vdp_simulate_line(VDP *vdp)
 */
 uint8_t vdp_read_control(VDP *vdp)
 {
+    catch_up(vdp, false);
     uint8_t status =
         (!!(vdp->flags & FLAG_FRAME_INT) << 7) +
         (!!(vdp->flags & FLAG_SPR_OVF)   << 6) +
@@ -437,7 +1036,8 @@ static void write_reg(VDP *vdp, uint8_t reg, uint8_t byte)
     If the control code indicates a VRAM read, the read buffer will be filled
     with the VRAM at the given control address, which is then incremented. If
     the code indicates a register write, the corresponding register
-    (byte & 0x0F) will be written with the lower byte of the control address.
+    (byte & 0x0F) will be written with the lower byte of the control address;
+    there are only eleven, so writes to registers 11 through 15 do nothing.
 */
 void vdp_write_control(VDP *vdp, uint8_t byte)
 {
@@ -455,8 +1055,13 @@ void vdp_write_control(VDP *vdp, uint8_t byte)
         vdp->control_addr = (vdp->control_addr + 1) & 0x3FFF;
     } else if (vdp->control_code == CODE_REG_WRITE) {
         uint8_t reg = byte & 0x0F;
-        if (reg <= VDP_REGS)
+        if (reg < VDP_REGS) {
+            catch_up(vdp, true);
             write_reg(vdp, reg, vdp->control_addr & 0xFF);
+            if (vdp->thread)
+                vdp_thread_push(vdp->thread, CMD_REG_WRITE, reg,
+                                vdp->control_addr & 0xFF);
+        }
     }
 }
 
@@ -468,8 +1073,17 @@ static void write_cram(VDP *vdp, uint8_t byte)
     if (!(vdp->control_addr % 2)) {
         vdp->cram_latch = byte;
     } else {
+        catch_up(vdp, true);
         vdp->cram[(vdp->control_addr - 1) & 0x3F] = vdp->cram_latch;
         vdp->cram[ vdp->control_addr      & 0x3F] = byte & 0x0F;
+        vdp->cram_stamp = vdp->stamp;
+
+        if (vdp->thread) {
+            vdp_thread_push(vdp->thread, CMD_CRAM_WRITE,
+                            (vdp->control_addr - 1) & 0x3F, vdp->cram_latch);
+            vdp_thread_push(vdp->thread, CMD_CRAM_WRITE,
+                            vdp->control_addr & 0x3F, byte & 0x0F);
+        }
     }
 }
 
@@ -482,10 +1096,16 @@ static void write_cram(VDP *vdp, uint8_t byte)
 */
 void vdp_write_data(VDP *vdp, uint8_t byte)
 {
-    if (vdp->control_code == CODE_CRAM_WRITE)
+    if (vdp->control_code == CODE_CRAM_WRITE) {
         write_cram(vdp, byte);
-    else
+    } else {
+        catch_up(vdp, true);
         vdp->vram[vdp->control_addr] = byte;
+        vdp->vram_stamps[vdp->control_addr / VDP_PATTERN_SIZE] = vdp->stamp;
+        if (vdp->thread)
+            vdp_thread_push(vdp->thread, CMD_VRAM_WRITE,
+                            vdp->control_addr, byte);
+    }
 
     vdp->control_addr = (vdp->control_addr + 1) & 0x3FFF;
     vdp->flags &= ~FLAG_CONTROL;
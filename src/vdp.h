@@ -4,23 +4,65 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define VDP_LINES_PER_FRAME 262
+#define VDP_SCREEN_WIDTH  160
+#define VDP_SCREEN_HEIGHT 144
 #define VDP_VRAM_SIZE (16 * 1024)
 #define VDP_CRAM_SIZE (64)
+#define VDP_PALETTE_SIZE (VDP_CRAM_SIZE / 2)
 #define VDP_REGS 11
+#define VDP_PATTERN_SIZE 32
+#define VDP_PATTERNS (VDP_VRAM_SIZE / VDP_PATTERN_SIZE)
+#define VDP_SPRITES_PER_LINE 8
 
 /* Structs */
 
+typedef enum {
+    VDP_RENDER_SYNC,
+    VDP_RENDER_LAZY,
+    VDP_RENDER_THREAD
+} VDPRenderMode;
+
 typedef struct {
+    bool     valid;
+    uint64_t stamp;
+    uint8_t  regs[VDP_REGS];
+    uint8_t  flags;
+    uint8_t  nsprites;
+    uint8_t  sprite_y[VDP_SPRITES_PER_LINE];
+    uint8_t  sprite_x[VDP_SPRITES_PER_LINE];
+    uint8_t  sprite_name[VDP_SPRITES_PER_LINE];
+} VDPLine;
+
+typedef struct VDP {
     uint32_t *pixels;
+    size_t   pitch;
+    uint8_t  *indices;
+    uint16_t *palettes;
+    VDPRenderMode render_mode;
+    struct VDP *mirror;
+    void *thread;
+    VDPLine lines[VDP_SCREEN_HEIGHT];
+    bool dirty_lines[VDP_SCREEN_HEIGHT];
+
+    const uint64_t *clock;
+    uint64_t line_start;
+    uint8_t  render_row;
+    uint8_t  render_col;
+    VDPLine  render_line;
+    uint8_t  colbuf[VDP_SCREEN_WIDTH];
+
+    uint64_t stamp;
+    uint64_t *vram_stamps;
+    uint64_t cram_stamp;
 
     uint8_t  *vram;
     uint8_t  *cram;
     uint8_t  regs[VDP_REGS];
 
-    uint8_t  h_counter;
     uint8_t  v_counter;
     bool     v_count_jump;
 
@@ -32,12 +74,42 @@ typedef struct {
     uint8_t  cram_latch;
 } VDP;
 
+typedef struct {
+    uint8_t  vram[VDP_VRAM_SIZE];
+    uint8_t  cram[VDP_CRAM_SIZE];
+    uint8_t  regs[VDP_REGS];
+
+    uint64_t line_start;
+    uint8_t  render_row;
+    uint8_t  render_col;
+    VDPLine  render_line;
+    uint8_t  colbuf[VDP_SCREEN_WIDTH];
+
+    uint8_t  v_counter;
+    bool     v_count_jump;
+
+    uint8_t  flags;
+    uint8_t  control_code;
+    uint16_t control_addr;
+    uint8_t  line_count;
+    uint8_t  read_buf;
+    uint8_t  cram_latch;
+} VDPState;
+
 /* Functions */
 
 void vdp_init(VDP*);
 void vdp_free(VDP*);
 void vdp_power(VDP*);
 void vdp_simulate_line(VDP*);
+void vdp_set_render_mode(VDP*, VDPRenderMode);
+void vdp_sync(VDP*);
+void vdp_invalidate_lines(VDP*);
+void vdp_save_state(const VDP*, VDPState*);
+void vdp_load_state(VDP*, const VDPState*);
+void vdp_draw_indexed(VDP*, uint8_t*, uint16_t*);
+void vdp_expand_line(const uint8_t*, const uint16_t*, uint32_t*);
+uint8_t vdp_read_h_counter(const VDP*);
 
 uint8_t vdp_read_control(VDP*);
 uint8_t vdp_read_data(VDP*);
@@ -0,0 +1,161 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include <sched.h>
+
+#include "thread.h"
+#include "../logging.h"
+#include "../util.h"
+
+#define SPIN_LIMIT 256
+#define BATCH_SIZE 512
+
+/*
+    Wake up the render thread if it has gone to sleep waiting for commands.
+*/
+static void wake_thread(VDPThread *thread)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&thread->sleeping, memory_order_relaxed)) {
+        pthread_mutex_lock(&thread->lock);
+        pthread_cond_signal(&thread->wakeup);
+        pthread_mutex_unlock(&thread->lock);
+    }
+}
+
+/*
+    Block the render thread until there are commands to run or it is stopped.
+
+    The sleeping flag is raised before re-checking the queue, so a producer that
+    pushes in between is guaranteed to see it and signal us.
+*/
+static void wait_for_commands(VDPThread *thread)
+{
+    pthread_mutex_lock(&thread->lock);
+    atomic_store_explicit(&thread->sleeping, true, memory_order_relaxed);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (!ring_used(&thread->queue) && !atomic_load(&thread->stopping))
+        pthread_cond_wait(&thread->wakeup, &thread->lock);
+    atomic_store_explicit(&thread->sleeping, false, memory_order_relaxed);
+    pthread_mutex_unlock(&thread->lock);
+}
+
+/*
+    Main loop of the render thread: run commands until told to stop.
+
+    Commands are only removed from the queue after they have been handled, so
+    an empty queue means the thread has caught up completely.
+*/
+static void* run_thread(void *arg)
+{
+    VDPThread *thread = arg;
+    VDPCommand batch[BATCH_SIZE];
+    unsigned idle = 0;
+
+    while (true) {
+        size_t count = ring_peek(&thread->queue, batch, BATCH_SIZE);
+        if (count) {
+            thread->handler(thread->context, batch, count);
+            ring_skip(&thread->queue, count);
+            idle = 0;
+            continue;
+        }
+        if (atomic_load(&thread->stopping))
+            break;
+        if (++idle < SPIN_LIMIT)
+            sched_yield();
+        else
+            wait_for_commands(thread);
+    }
+    return NULL;
+}
+
+/*
+    Create and start a new render thread.
+
+    The handler is called on the render thread with the given context pointer
+    and batches of commands, in the order they were pushed.
+*/
+VDPThread* vdp_thread_create(VDPCommandHandler handler, void *context)
+{
+    VDPThread *thread = cr_malloc(sizeof(VDPThread));
+    ring_init(&thread->queue, VDP_THREAD_QUEUE_SIZE, sizeof(VDPCommand));
+    thread->staged = 0;
+    thread->handler = handler;
+    thread->context = context;
+
+    pthread_mutex_init(&thread->lock, NULL);
+    pthread_cond_init(&thread->wakeup, NULL);
+    atomic_init(&thread->sleeping, false);
+    atomic_init(&thread->stopping, false);
+
+    if (pthread_create(&thread->thread, NULL, run_thread, thread))
+        FATAL_ERRNO("couldn't start the VDP render thread")
+    return thread;
+}
+
+/*
+    Stop a render thread, after it has run all pending commands, and free it.
+*/
+void vdp_thread_destroy(VDPThread *thread)
+{
+    vdp_thread_flush(thread);
+    atomic_store(&thread->stopping, true);
+    pthread_mutex_lock(&thread->lock);
+    pthread_cond_signal(&thread->wakeup);
+    pthread_mutex_unlock(&thread->lock);
+    pthread_join(thread->thread, NULL);
+
+    pthread_cond_destroy(&thread->wakeup);
+    pthread_mutex_destroy(&thread->lock);
+    ring_free(&thread->queue);
+    free(thread);
+}
+
+/*
+    Stage a command for the render thread.
+
+    Staged commands are not visible to the render thread until the next call
+    to vdp_thread_flush(), which the VDP does at scanline boundaries.
+*/
+void vdp_thread_push(VDPThread *thread, uint8_t type, uint16_t addr,
+    uint8_t value)
+{
+    if (thread->staged == VDP_THREAD_STAGE_SIZE)
+        vdp_thread_flush(thread);
+
+    VDPCommand *cmd = &thread->stage[thread->staged++];
+    cmd->type = type;
+    cmd->addr = addr;
+    cmd->value = value;
+}
+
+/*
+    Hand all staged commands over to the render thread.
+
+    If the queue is full, this waits for the render thread to make room.
+*/
+void vdp_thread_flush(VDPThread *thread)
+{
+    size_t done = 0;
+    while (done < thread->staged) {
+        done += ring_write(&thread->queue, thread->stage + done,
+                           thread->staged - done);
+        wake_thread(thread);
+        if (done < thread->staged)
+            sched_yield();
+    }
+    thread->staged = 0;
+}
+
+/*
+    Flush staged commands and block until the render thread has run them all.
+*/
+void vdp_thread_sync(VDPThread *thread)
+{
+    vdp_thread_flush(thread);
+    while (ring_used(&thread->queue)) {
+        wake_thread(thread);
+        sched_yield();
+    }
+}
@@ -0,0 +1,48 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "../ring.h"
+
+#define VDP_THREAD_QUEUE_SIZE (64 * 1024)
+#define VDP_THREAD_STAGE_SIZE 256
+
+/* Structs */
+
+typedef struct {
+    uint8_t type;
+    uint8_t value;
+    uint16_t addr;
+} VDPCommand;
+
+typedef void (*VDPCommandHandler)(void*, const VDPCommand*, size_t);
+
+typedef struct {
+    Ring queue;
+    VDPCommand stage[VDP_THREAD_STAGE_SIZE];
+    size_t staged;
+
+    VDPCommandHandler handler;
+    void *context;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    atomic_bool sleeping;
+    atomic_bool stopping;
+} VDPThread;
+
+/* Functions */
+
+VDPThread* vdp_thread_create(VDPCommandHandler, void*);
+void vdp_thread_destroy(VDPThread*);
+void vdp_thread_push(VDPThread*, uint8_t, uint16_t, uint8_t);
+void vdp_thread_flush(VDPThread*);
+void vdp_thread_sync(VDPThread*);
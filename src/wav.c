@@ -0,0 +1,69 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#include "wav.h"
+#include "logging.h"
+#include "util.h"
+
+#define HEADER_SIZE 44
+#define CHANNELS 2
+#define FRAME_SIZE (CHANNELS * sizeof(int16_t))
+
+/*
+    Write the RIFF header for a 16-bit stereo PCM file of the given length.
+*/
+static void write_header(WavWriter *wav)
+{
+    uint32_t data_size = wav->frames * FRAME_SIZE;
+
+    fwrite("RIFF", 1, 4, wav->fp);
+    write_le(wav->fp, HEADER_SIZE - 8 + data_size, 4);
+    fwrite("WAVEfmt ", 1, 8, wav->fp);
+    write_le(wav->fp, 16, 4);                       // fmt chunk size
+    write_le(wav->fp, 1, 2);                        // PCM
+    write_le(wav->fp, CHANNELS, 2);
+    write_le(wav->fp, wav->rate, 4);
+    write_le(wav->fp, wav->rate * FRAME_SIZE, 4);   // byte rate
+    write_le(wav->fp, FRAME_SIZE, 2);               // block align
+    write_le(wav->fp, 16, 2);                       // bits per sample
+    fwrite("data", 1, 4, wav->fp);
+    write_le(wav->fp, data_size, 4);
+}
+
+/*
+    Open a WAV file for writing 16-bit stereo audio at the given sample rate.
+
+    Return whether it worked.
+*/
+bool wav_open(WavWriter *wav, const char *path, unsigned rate)
+{
+    if (!(wav->fp = fopen(path, "wb"))) {
+        ERROR_ERRNO("couldn't open WAV file '%s' for writing", path)
+        return false;
+    }
+    wav->rate = rate;
+    wav->frames = 0;
+    write_header(wav);
+    return true;
+}
+
+/*
+    Append count interleaved stereo samples to the WAV file.
+*/
+void wav_write(WavWriter *wav, const int16_t *samples, size_t count)
+{
+    for (size_t i = 0; i < CHANNELS * count; i++)
+        write_le(wav->fp, (uint16_t) samples[i], 2);
+    wav->frames += count;
+}
+
+/*
+    Fill in the final lengths and close the WAV file.
+*/
+void wav_close(WavWriter *wav)
+{
+    rewind(wav->fp);
+    write_header(wav);
+    fclose(wav->fp);
+    wav->fp = NULL;
+}
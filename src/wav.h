@@ -0,0 +1,23 @@
+/* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+   Released under the terms of the MIT License. See LICENSE for details. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Structs */
+
+typedef struct {
+    FILE *fp;
+    unsigned rate;
+    uint32_t frames;
+} WavWriter;
+
+/* Functions */
+
+bool wav_open(WavWriter*, const char*, unsigned);
+void wav_write(WavWriter*, const int16_t*, size_t);
+void wav_close(WavWriter*);
@@ -29,6 +29,12 @@ void z80_init(Z80 *z80, MMU *mmu, IO *io)
     z80->except = true;
     z80->exc_code = Z80_EXC_NOT_POWERED;
     z80->exc_data = 0;
+    z80->cycles = 0;
+    z80->instructions = 0;
+    z80->halted_cycles = 0;
+    z80->watch = NULL;
+    z80->watch_arg = NULL;
+    z80->stopped = false;
 }
 
 /*
@@ -285,9 +291,42 @@ static inline void trace_instruction(Z80 *z80)
     disas_instr_free(instr);
 }
 
+/*
+    Run one instruction, or take an interrupt if one is due, and return the
+    number of cycles taken.
+*/
+static inline uint8_t step(Z80 *z80)
+{
+    uint8_t taken;
+
+    if (io_check_irq(z80->io) && z80->regs.iff1 && !z80->irq_wait) {
+        taken = accept_interrupt(z80);
+        z80->cycles += taken;
+        return taken;
+    }
+    if (z80->irq_wait)
+        z80->irq_wait = false;
+
+    uint8_t opcode = mmu_read_byte(z80->mmu, z80->regs.pc);
+    increment_refresh_counter(z80);
+    if (TRACE_LEVEL)
+        trace_instruction(z80);
+    taken = (*instruction_table[opcode])(z80, opcode);
+    z80->cycles += taken;
+    z80->instructions++;
+    return taken;
+}
+
 /*
     Emulate the given number of cycles of the Z80, or until an exception.
 
+    The total number of cycles run is kept in z80->cycles, which never resets;
+    the VDP uses it to find the beam's position within a scanline.
+
+    If a watch is set, it is checked after each instruction (or interrupt
+    taken); once it returns true, this stops early with z80->stopped set, and
+    the cycles not run are left over for the next call.
+
     The return value indicates whether the exception flag is set. If it is,
     then emulation must be stopped because further calls to z80_do_cycles()
     will have no effect. The exception flag can be reset with z80_power().
@@ -295,25 +334,83 @@ static inline void trace_instruction(Z80 *z80)
 bool z80_do_cycles(Z80 *z80, double cycles)
 {
     cycles += z80->pending_cycles;
-    while (cycles > 0 && !z80->except) {
-        if (io_check_irq(z80->io) && z80->regs.iff1 && !z80->irq_wait) {
-            cycles -= accept_interrupt(z80);
-            continue;
+    z80->stopped = false;
+    if (z80->watch) {
+        while (cycles > 0 && !z80->except) {
+            cycles -= step(z80);
+            if (z80->watch(z80->watch_arg)) {
+                z80->stopped = true;
+                break;
+            }
         }
-        if (z80->irq_wait)
-            z80->irq_wait = false;
-
-        uint8_t opcode = mmu_read_byte(z80->mmu, z80->regs.pc);
-        increment_refresh_counter(z80);
-        if (TRACE_LEVEL)
-            trace_instruction(z80);
-        cycles -= (*instruction_table[opcode])(z80, opcode);
+    } else {
+        while (cycles > 0 && !z80->except)
+            cycles -= step(z80);
     }
 
     z80->pending_cycles = cycles;
     return z80->except;
 }
 
+/*
+    Set a check for z80_do_cycles() to make after every instruction, with the
+    given argument, or remove it (NULL, the default).
+*/
+void z80_set_watch(Z80 *z80, Z80Watch watch, void *arg)
+{
+    z80->watch = watch;
+    z80->watch_arg = arg;
+}
+
+/*
+    Take a non-maskable interrupt before the next instruction, counting its
+    cycles against the next call to z80_do_cycles().
+*/
+void z80_nmi(Z80 *z80)
+{
+    TRACE("Z80 triggering NMI")
+    z80->regs.iff1 = 0;
+    stack_push(z80, z80->regs.pc);
+    z80->regs.pc = 0x0066;
+    z80->pending_cycles -= 11;
+    z80->cycles += 11;
+}
+
+/*
+    Save the Z80's state so that it can be restored with z80_load_state().
+*/
+void z80_save_state(const Z80 *z80, Z80State *state)
+{
+    state->regs = z80->regs;
+    state->regs.ixy = NULL;
+    state->regs.ih = state->regs.il = NULL;
+    state->except = z80->except;
+    state->exc_code = z80->exc_code;
+    state->exc_data = z80->exc_data;
+    state->pending_cycles = z80->pending_cycles;
+    state->cycles = z80->cycles;
+    state->instructions = z80->instructions;
+    state->halted_cycles = z80->halted_cycles;
+    state->irq_wait = z80->irq_wait;
+}
+
+/*
+    Restore the Z80's state from a copy made by z80_save_state().
+*/
+void z80_load_state(Z80 *z80, const Z80State *state)
+{
+    z80->regs = state->regs;
+    z80->except = state->except;
+    z80->exc_code = state->exc_code;
+    z80->exc_data = state->exc_data;
+    z80->pending_cycles = state->pending_cycles;
+    z80->cycles = state->cycles;
+    z80->instructions = state->instructions;
+    z80->halted_cycles = state->halted_cycles;
+    z80->irq_wait = state->irq_wait;
+    z80->trace.fresh = true;
+}
+
 /*
     @DEBUG_LEVEL
     Print out all register values to stdout.
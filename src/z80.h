@@ -60,6 +60,12 @@ typedef struct {
     uint64_t counter;
 } Z80TraceInfo;
 
+/*
+    A check made after every instruction while set with z80_set_watch(); if
+    it returns true, z80_do_cycles() stops there.
+*/
+typedef bool (*Z80Watch)(void*);
+
 typedef struct {
     Z80RegFile regs;
     MMU *mmu;
@@ -67,10 +73,32 @@ typedef struct {
     bool except;
     uint8_t exc_code, exc_data;
     double pending_cycles;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t halted_cycles;
     bool irq_wait;
+    Z80Watch watch;
+    void *watch_arg;
+    bool stopped;
     Z80TraceInfo trace;
 } Z80;
 
+/*
+    A copy of the Z80's state, as taken by z80_save_state(). The same goes for
+    the other components' State structs: they hold everything needed to resume
+    emulation exactly, but nothing tied to a particular host or display.
+*/
+typedef struct {
+    Z80RegFile regs;
+    bool except;
+    uint8_t exc_code, exc_data;
+    double pending_cycles;
+    uint64_t cycles;
+    uint64_t instructions;
+    uint64_t halted_cycles;
+    bool irq_wait;
+} Z80State;
+
 #undef REG_PAIR
 #undef REG1
 #undef REG2
@@ -80,4 +108,8 @@ typedef struct {
 void z80_init(Z80*, MMU*, IO*);
 void z80_power(Z80*);
 bool z80_do_cycles(Z80*, double);
+void z80_set_watch(Z80*, Z80Watch, void*);
+void z80_nmi(Z80*);
+void z80_save_state(const Z80*, Z80State*);
+void z80_load_state(Z80*, const Z80State*);
 void z80_dump_registers(const Z80*);
@@ -15,11 +15,11 @@
 
 typedef uint8_t (*DispatchTable[256])(Z80*, uint8_t);
 
-static DispatchTable instruction_table;
-static DispatchTable instruction_table_extended;
-static DispatchTable instruction_table_bits;
-static DispatchTable instruction_table_index;
-static DispatchTable instruction_table_index_bits;
+static const DispatchTable instruction_table;
+static const DispatchTable instruction_table_extended;
+static const DispatchTable instruction_table_bits;
+static const DispatchTable instruction_table_index;
+static const DispatchTable instruction_table_index_bits;
 
 /*
     Unimplemented opcode handler.
@@ -1272,8 +1272,8 @@ static uint8_t z80_inst_nop(Z80 *z80, uint8_t opcode)
 */
 static uint8_t z80_inst_halt(Z80 *z80, uint8_t opcode)
 {
-    (void) z80;
     (void) opcode;
+    z80->halted_cycles += 4;
     return 4;
 }
 
@@ -1,7 +1,7 @@
 /* Copyright (C) 2014-2019 Ben Kurtovic <ben.kurtovic@gmail.com>
    Released under the terms of the MIT License. See LICENSE for details. */
 
-static DispatchTable instruction_table = {
+static const DispatchTable instruction_table = {
     [0x00] = z80_inst_nop,
     [0x01] = z80_inst_ld_dd_nn,
     [0x02] = z80_inst_ld_bcde_a,
@@ -260,7 +260,7 @@ static DispatchTable instruction_table = {
     [0xFF] = z80_inst_rst_p
 };
 
-static DispatchTable instruction_table_extended = {
+static const DispatchTable instruction_table_extended = {
     [0x00] = z80_inst_nop2,
     [0x01] = z80_inst_nop2,
     [0x02] = z80_inst_nop2,
@@ -519,7 +519,7 @@ static DispatchTable instruction_table_extended = {
     [0xFF] = z80_inst_nop2
 };
 
-static DispatchTable instruction_table_bits = {
+static const DispatchTable instruction_table_bits = {
     [0x00] = z80_inst_rlc_r,
     [0x01] = z80_inst_rlc_r,
     [0x02] = z80_inst_rlc_r,
@@ -778,7 +778,7 @@ static DispatchTable instruction_table_bits = {
     [0xFF] = z80_inst_set_b_r
 };
 
-static DispatchTable instruction_table_index = {
+static const DispatchTable instruction_table_index = {
     [0x00] = z80_inst_nop2,
     [0x01] = z80_inst_nop2,
     [0x02] = z80_inst_nop2,
@@ -1037,7 +1037,7 @@ static DispatchTable instruction_table_index = {
     [0xFF] = z80_inst_nop2
 };
 
-static DispatchTable instruction_table_index_bits = {
+static const DispatchTable instruction_table_index_bits = {
     [0x00] = z80_inst_unimplemented,  // TODO
     [0x01] = z80_inst_unimplemented,  // TODO
     [0x02] = z80_inst_unimplemented,  // TODO
@@ -0,0 +1,38 @@
+;; Copyright (C) 2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+;; Released under the terms of the MIT License. See LICENSE for details.
+
+; ----- CRATER UNIT TESTING SUITE ---------------------------------------------
+
+; 01-colors.asm
+; Cycle the backdrop color mid-frame while playing a tone
+
+.rom_size "32 KB"
+
+.org $0000
+main:
+	di
+	ld	sp, $DFF0
+	ld	a, $40			; Register 1: display on
+	out	($BF), a
+	ld	a, $81
+	out	($BF), a
+	ld	a, $8E			; Tone 0: period $0FE, full volume
+	out	($7F), a
+	ld	a, $0F
+	out	($7F), a
+	ld	a, $90
+	out	($7F), a
+	ld	hl, $0000
+
+loop:
+	xor	a			; Point at CRAM entry 0
+	out	($BF), a
+	ld	a, $C0
+	out	($BF), a
+	ld	a, l
+	out	($BE), a
+	ld	a, h
+	out	($BE), a
+	inc	hl
+	ld	($C000), hl
+	jp	loop
@@ -0,0 +1,78 @@
+;; Copyright (C) 2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+;; Released under the terms of the MIT License. See LICENSE for details.
+
+; ----- CRATER UNIT TESTING SUITE ---------------------------------------------
+
+; 02-sprites.asm
+; Put nine sprites on one line, two of them overlapping, and keep the sprite
+; overflow and collision flags that are read back
+
+.rom_size "32 KB"
+
+.org $0000
+main:
+	di
+	ld	sp, $DFF0
+	ld	a, $FF			; Register 5: SAT at $3F00
+	out	($BF), a
+	ld	a, $85
+	out	($BF), a
+	ld	a, $FF			; Register 6: sprite patterns at $2000
+	out	($BF), a
+	ld	a, $86
+	out	($BF), a
+
+	xor	a			; Point at pattern 256
+	out	($BF), a
+	ld	a, $60
+	out	($BF), a
+	ld	b, 32
+	ld	a, $FF
+fill:
+	out	($BE), a
+	dec	b
+	jp	nz, fill
+
+	xor	a			; Point at the SAT's Y coordinates
+	out	($BF), a
+	ld	a, $7F
+	out	($BF), a
+	ld	b, 9
+	ld	a, $3F
+ycoords:
+	out	($BE), a
+	dec	b
+	jp	nz, ycoords
+	ld	a, $D0			; End of the sprite list
+	out	($BE), a
+
+	ld	a, $80			; Point at the SAT's X coordinates and names
+	out	($BF), a
+	ld	a, $7F
+	out	($BF), a
+	ld	b, 9
+	ld	a, $40
+xcoords:
+	out	($BE), a		; Each sprite overlaps the one before it
+	add	a, 4
+	ld	c, a
+	xor	a
+	out	($BE), a
+	ld	a, c
+	dec	b
+	jp	nz, xcoords
+
+	ld	a, $40			; Register 1: display on
+	out	($BF), a
+	ld	a, $81
+	out	($BF), a
+	ld	hl, $C000
+	xor	a
+	ld	(hl), a
+
+loop:
+	in	a, ($BF)		; Keep the sprite flags
+	and	$60
+	or	(hl)
+	ld	(hl), a
+	jp	loop
@@ -0,0 +1,52 @@
+;; Copyright (C) 2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+;; Released under the terms of the MIT License. See LICENSE for details.
+
+; ----- CRATER UNIT TESTING SUITE ---------------------------------------------
+
+; 03-register-11.asm
+; Write to the nonexistent VDP register 11 mid-frame, which should change
+; nothing, then change the backdrop color and note where the beam is
+
+.rom_size "32 KB"
+
+.org $0000
+main:
+	di
+	ld	sp, $DFF0
+	ld	a, $40			; Register 1: display on
+	out	($BF), a
+	ld	a, $81
+	out	($BF), a
+	ld	hl, $C000
+	xor	a
+	ld	(hl), a
+	ld	($C001), a
+
+loop:
+	in	a, ($7E)		; Wait for line $40
+	cp	$40
+	jp	nz, loop
+
+	ld	a, $C8			; Register 11: $C8 (ignored)
+	out	($BF), a
+	ld	a, $8B
+	out	($BF), a
+
+	in	a, ($7E)		; Keep the V counter, which is still $40
+	ld	($C001), a
+	inc	(hl)			; Count the writes
+
+	xor	a			; Point at CRAM entry 0
+	out	($BF), a
+	ld	a, $C0
+	out	($BF), a
+	ld	a, (hl)			; Change the backdrop color
+	out	($BE), a
+	xor	a
+	out	($BE), a
+
+next:
+	in	a, ($7E)		; Wait for the line to end
+	cp	$40
+	jp	z, next
+	jp	loop
@@ -0,0 +1,90 @@
+;; Copyright (C) 2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+;; Released under the terms of the MIT License. See LICENSE for details.
+
+; ----- CRATER UNIT TESTING SUITE ---------------------------------------------
+
+; 04-mid-line.asm
+; Change the horizontal scroll and a background color partway through lines,
+; keeping the H counter read before and after each change
+
+.rom_size "32 KB"
+
+.org $0000
+main:
+	di
+	ld	sp, $DFF0
+	ld	a, $FF			; Register 2: name table at $3800
+	out	($BF), a
+	ld	a, $82
+	out	($BF), a
+
+	xor	a			; Point at pattern 0
+	out	($BF), a
+	ld	a, $40
+	out	($BF), a
+	ld	b, 8
+pattern:
+	ld	a, $F0			; Four pixels of color 1, then four of 0
+	out	($BE), a
+	xor	a
+	out	($BE), a
+	out	($BE), a
+	out	($BE), a
+	dec	b
+	jp	nz, pattern
+
+	ld	a, $02			; Point at CRAM entry 1
+	out	($BF), a
+	ld	a, $C0
+	out	($BF), a
+	ld	a, $FF			; Color 1: white
+	out	($BE), a
+	ld	a, $0F
+	out	($BE), a
+
+	ld	a, $40			; Register 1: display on
+	out	($BF), a
+	ld	a, $81
+	out	($BF), a
+	ld	b, 0
+
+loop:
+	in	a, ($7E)		; Wait for line $30
+	cp	$30
+	jp	nz, loop
+	ld	hl, $C000
+	ld	c, 64
+
+change:
+	in	a, ($7F)		; Keep the H counter before the change
+	ld	(hl), a
+	inc	hl
+
+	ld	a, b			; Register 8: scroll by b
+	out	($BF), a
+	ld	a, $88
+	out	($BF), a
+
+	xor	a			; Point at CRAM entry 0
+	out	($BF), a
+	ld	a, $C0
+	out	($BF), a
+	ld	a, b			; Color 0: b
+	out	($BE), a
+	xor	a
+	out	($BE), a
+
+	in	a, ($7F)		; Keep the H counter after the change
+	ld	(hl), a
+	inc	hl
+	ld	a, b
+	add	a, 3
+	ld	b, a
+	dec	c
+	jp	nz, change
+
+	xor	a			; Register 8: no scroll
+	out	($BF), a
+	ld	a, $88
+	out	($BF), a
+	jp	loop
@@ -0,0 +1,44 @@
+;; Copyright (C) 2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+;; Released under the terms of the MIT License. See LICENSE for details.
+
+; ----- CRATER UNIT TESTING SUITE ---------------------------------------------
+
+; 01-serial-a.asm
+; Send a counter over the serial line whenever it is free, and drive it on the
+; parallel lines; poll for bytes from the other end and keep them at $C000
+
+.rom_size "32 KB"
+
+.org $0000
+main:
+	di
+	ld	sp, $DFF0
+	ld	a, $30			; Serial: send and receive at 4800 baud
+	out	($05), a
+	ld	a, $70			; Drive parallel lines 0-3
+	out	($02), a
+	ld	b, 0
+	ld	hl, $C000
+
+loop:
+	in	a, ($05)		; Still sending?
+	bit	0, a
+	jp	nz, receive
+	ld	a, b
+	out	($03), a
+	inc	b
+	ld	a, b
+	out	($01), a
+
+receive:
+	in	a, ($05)		; Anything received?
+	bit	1, a
+	jp	z, pins
+	in	a, ($04)
+	ld	(hl), a
+	inc	l
+
+pins:
+	in	a, ($01)		; Keep what the other end drives
+	ld	($C100), a
+	jp	loop
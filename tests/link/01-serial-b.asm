@@ -0,0 +1,47 @@
+;; Copyright (C) 2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+;; Released under the terms of the MIT License. See LICENSE for details.
+
+; ----- CRATER UNIT TESTING SUITE ---------------------------------------------
+
+; 01-serial-b.asm
+; Like 01-serial-a.asm, but count from $80 and take received bytes in the NMI
+; handler
+
+.rom_size "32 KB"
+
+.org $0000
+main:
+	di
+	ld	sp, $DFF0
+	ld	a, $38			; Serial: as 01-serial-a.asm, with NMIs
+	out	($05), a
+	ld	a, $0F			; Drive parallel lines 4-6
+	out	($02), a
+	ld	b, $80
+	ld	hl, $C000
+	jp	loop
+
+.org $0066
+nmi:
+	push	af
+	in	a, ($04)
+	ld	(hl), a
+	inc	l
+	pop	af
+	retn
+
+loop:
+	in	a, ($05)		; Still sending?
+	bit	0, a
+	jp	nz, pins
+	ld	a, b
+	out	($03), a
+	inc	b
+	ld	a, b
+	rrca
+	out	($01), a
+
+pins:
+	in	a, ($01)		; Keep what the other end drives
+	ld	($C100), a
+	jp	loop
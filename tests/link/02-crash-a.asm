@@ -0,0 +1,21 @@
+;; Copyright (C) 2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+;; Released under the terms of the MIT License. See LICENSE for details.
+
+; ----- CRATER UNIT TESTING SUITE ---------------------------------------------
+
+; 02-crash-a.asm
+; Hit an unimplemented opcode shortly after power-on, unplugging this end
+
+.rom_size "32 KB"
+
+.org $0000
+main:
+	di
+	ld	sp, $DFF0
+	ld	bc, $1000		; Wait a couple of frames first
+wait:
+	dec	bc
+	ld	a, b
+	or	c
+	jp	nz, wait
+	.byte	$DD, $24		; inc ixh, which crater lacks
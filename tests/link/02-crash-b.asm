@@ -0,0 +1,22 @@
+;; Copyright (C) 2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+;; Released under the terms of the MIT License. See LICENSE for details.
+
+; ----- CRATER UNIT TESTING SUITE ---------------------------------------------
+
+; 02-crash-b.asm
+; Keep changing the parallel lines, long after the other end has stopped
+; reading them
+
+.rom_size "32 KB"
+
+.org $0000
+main:
+	di
+	ld	sp, $DFF0
+	xor	a			; Drive every parallel line
+	out	($02), a
+
+loop:
+	inc	a
+	out	($01), a
+	jp	loop
@@ -1,17 +1,39 @@
 /* Copyright (C) 2014-2016 Ben Kurtovic <ben.kurtovic@gmail.com>
    Released under the terms of the MIT License. See LICENSE for details. */
 
+#if defined __linux__
+    #define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/wait.h>
 
+#include "../src/libcrater.h"
 #include "../src/logging.h"
 #include "../src/util.h"
 
 #define ASM_PREFIX "asm/"
 #define ASM_OUTFILE ASM_PREFIX ".output.gg"
+#define INTEGRATE_PREFIX "integrate/"
+#define INTEGRATE_OUTFILE INTEGRATE_PREFIX ".output.gg"
+#define INTEGRATE_MOVIE INTEGRATE_PREFIX ".output.mov"
+#define INTEGRATE_FRAMES "120"
+#define LINK_PREFIX "link/"
+#define LINK_OUTFILE_A LINK_PREFIX ".output-a.gg"
+#define LINK_OUTFILE_B LINK_PREFIX ".output-b.gg"
+#define LINK_RESULTS LINK_PREFIX ".output.txt"
+#define LINK_TIMEOUT 20  // Seconds
+#define STEP_PREFIX "step/"
+#define STEP_OUTFILE STEP_PREFIX ".output.gg"
+#define STEP_FRAMES 60
+#define STEP_MOVE_FRAME 5
 
 /* Helper macros for reporting test passings/failures */
 
@@ -138,41 +160,471 @@ static bool run_asm_test(const char *src_file, const char *ref_file)
     return diff;
 }
 
-/* --------------------------- Main test runners --------------------------- */
+/*
+    Run a command and return the last state hash it printed (as "State hash:
+    <hex>", in either case), or zero if it didn't print one.
+*/
+static uint64_t get_state_hash(const char *cmd)
+{
+    static const char *label = "tate hash: ";
+    FILE *fp = popen(cmd, "r");
+    if (!fp)
+        return 0;
+
+    char *line = NULL, *found;
+    size_t cap = 0;
+    uint64_t hash = 0;
+
+    while (getline(&line, &cap, fp) > 0) {
+        if ((found = strstr(line, label)))
+            hash = strtoull(found + strlen(label), NULL, 16);
+    }
+    free(line);
+    pclose(fp);
+    return hash;
+}
 
 /*
-    Run tests for the Z80 CPU.
+    Check that the ROM built for an integration test ends up in the same
+    state with no display attached as with one: record a movie of it running
+    headless, then play that back with --bench, which draws every frame.
 */
-static bool test_cpu()
+static bool check_headless()
 {
-    // TODO
+    unlink(INTEGRATE_MOVIE);
+    uint64_t headless = get_state_hash(
+        "../crater --headless --record " INTEGRATE_MOVIE " --frames "
+        INTEGRATE_FRAMES " " INTEGRATE_OUTFILE " 2> /dev/null");
+    uint64_t shown = get_state_hash(
+        "../crater --bench --play " INTEGRATE_MOVIE " --frames "
+        INTEGRATE_FRAMES " --warmup 0 --repeat 1 " INTEGRATE_OUTFILE
+        " 2> /dev/null");
+
+    if (!headless || headless != shown) {
+        FAIL_TEST("state differs with no display: %016llx != %016llx "
+                  "(headless vs. shown)", (unsigned long long) headless,
+                  (unsigned long long) shown)
+        return false;
+    }
     return true;
 }
 
 /*
-    Run tests for the VDP.
+    Check that the movie --search saves for the ROM built for an integration
+    test replays, with a display attached, into the state the search found
+    without one. The search covers 40 frames; the movie holds one more, for
+    its last input to land on, and is played to its end.
 */
-static bool test_vdp()
+static bool check_search()
 {
-    // TODO
+    unlink(INTEGRATE_MOVIE);
+    uint64_t found = get_state_hash(
+        "../crater --search " INTEGRATE_MOVIE " --goal C000 --frames 40 "
+        "--step 20 --beam 2 " INTEGRATE_OUTFILE " 2> /dev/null");
+    uint64_t replayed = get_state_hash(
+        "../crater --bench --play " INTEGRATE_MOVIE " --frames 41 "
+        "--warmup 0 --repeat 1 " INTEGRATE_OUTFILE " 2> /dev/null");
+
+    if (!found || found != replayed) {
+        FAIL_TEST("searched movie replays differently: %016llx != %016llx "
+                  "(searched vs. replayed)", (unsigned long long) found,
+                  (unsigned long long) replayed)
+        return false;
+    }
     return true;
 }
 
 /*
-    Run tests for the SN76489 PSG.
+    Run a single integration test: assemble the given source file into a
+    temporary ROM, then run it in each render mode, checking every frame
+    against the given stream of frame hashes (written with crater --hashes),
+    checking that it runs the same without a display, and that a search on it
+    replays faithfully.
 */
-static bool test_psg()
+static bool run_integrate_test(const char *src_file, const char *ref_file)
 {
-    // TODO
+    static const char *modes[] = {"sync", "lazy", "thread"};
+    char *asm_prefix = "../crater --assemble " INTEGRATE_PREFIX;
+    char *check_prefix = "../crater --check " INTEGRATE_PREFIX;
+    char *cmd = cr_malloc(sizeof(char) * (strlen(asm_prefix) +
+        strlen(src_file) + strlen(ref_file) + strlen(" --render thread ") +
+        strlen(INTEGRATE_OUTFILE) + strlen(" > /dev/null")) + 2);
+
+    // Construct the command by concatenating:
+    //   ../crater --assemble integrate/<src_file> integrate/.output.gg
+    stpcpy(stpcpy(stpcpy(cmd, asm_prefix), src_file), " " INTEGRATE_OUTFILE);
+    unlink(INTEGRATE_OUTFILE);
+    system(cmd);
+
+    //   ../crater --check integrate/<ref_file> --render <mode>
+    //       integrate/.output.gg
+    for (size_t i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+        char *end = stpcpy(stpcpy(cmd, check_prefix), ref_file);
+        end = stpcpy(stpcpy(stpcpy(end, " --render "), modes[i]), " ");
+        stpcpy(end, INTEGRATE_OUTFILE " > /dev/null");
+        if (system(cmd)) {
+            FAIL_TEST("frames differ from reference file in %s render "
+                      "mode: %s", modes[i], ref_file)
+            free(cmd);
+            return false;
+        }
+    }
+    free(cmd);
+    return check_headless() && check_search();
+}
+
+/*
+    Run a command, killing it if it is still going after the given number of
+    seconds. Return whether it finished in time.
+*/
+static bool run_with_timeout(const char *cmd, unsigned seconds)
+{
+    struct timespec tick = {0, 100 * 1000 * 1000};
+    pid_t pid = fork();
+
+    if (pid < 0)
+        return false;
+    if (pid == 0) {
+        execl("/bin/sh", "sh", "-c", cmd, (char*) NULL);
+        _exit(127);
+    }
+
+    for (unsigned i = 0; i < seconds * 10; i++) {
+        if (waitpid(pid, NULL, WNOHANG) == pid)
+            return true;
+        nanosleep(&tick, NULL);
+    }
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return false;
+}
+
+/*
+    Read the state hashes printed by a link run from its saved output into
+    the given array of two. Return whether both were found.
+*/
+static bool read_link_hashes(uint64_t *hashes)
+{
+    static const char *label = "State hash: ";
+    FILE *fp = fopen(LINK_RESULTS, "r");
+    if (!fp)
+        return false;
+
+    char *line = NULL;
+    size_t cap = 0;
+    unsigned found = 0;
+
+    while (getline(&line, &cap, fp) > 0 && found < 2) {
+        if (!strncmp(line, label, strlen(label)))
+            hashes[found++] = strtoull(line + strlen(label), NULL, 16);
+    }
+    free(line);
+    fclose(fp);
+    return found == 2;
+}
+
+/*
+    Run a single link cable test: assemble the given source files into two
+    ROMs, and link them for a few seconds' worth of frames, twice. Both runs
+    must finish (even if one of the Game Gears stops early) and leave both
+    Game Gears in the same states.
+*/
+static bool run_link_test(const char *src_a, const char *src_b)
+{
+    char *asm_prefix = "../crater --assemble " LINK_PREFIX;
+    char *link_cmd = "exec ../crater --link " LINK_OUTFILE_B " --frames 300 "
+                     LINK_OUTFILE_A " > " LINK_RESULTS " 2> /dev/null";
+    char *cmd = cr_malloc(sizeof(char) * (strlen(asm_prefix) +
+        strlen(src_a) + strlen(src_b) + strlen(LINK_OUTFILE_A)) + 2);
+    uint64_t first[2], second[2];
+
+    // Construct the commands by concatenating:
+    //   ../crater --assemble link/<src_file> link/.output-<a|b>.gg
+    unlink(LINK_OUTFILE_A);
+    unlink(LINK_OUTFILE_B);
+    stpcpy(stpcpy(stpcpy(cmd, asm_prefix), src_a), " " LINK_OUTFILE_A);
+    system(cmd);
+    stpcpy(stpcpy(stpcpy(cmd, asm_prefix), src_b), " " LINK_OUTFILE_B);
+    system(cmd);
+    free(cmd);
+
+    for (int run = 0; run < 2; run++) {
+        unlink(LINK_RESULTS);
+        if (!run_with_timeout(link_cmd, LINK_TIMEOUT)) {
+            FAIL_TEST("link run didn't finish within %d seconds",
+                      LINK_TIMEOUT)
+            return false;
+        }
+        if (!read_link_hashes(run ? second : first)) {
+            FAIL_TEST("link run printed no state hashes: %s", LINK_RESULTS)
+            return false;
+        }
+    }
+
+    if (first[0] != second[0] || first[1] != second[1]) {
+        FAIL_TEST("link runs ended differently: %016llx %016llx != "
+                  "%016llx %016llx", (unsigned long long) first[0],
+                  (unsigned long long) first[1],
+                  (unsigned long long) second[0],
+                  (unsigned long long) second[1])
+        return false;
+    }
     return true;
 }
 
 /*
-    Run tests for the assembler.
+    A way of running a GameGear a piece at a time, with the size of each
+    piece, as one of the gamegear_run_*() functions.
 */
-static bool test_asm()
+typedef GGRunReason (*StepFunc)(GameGear*, unsigned);
+
+typedef struct {
+    unsigned every, count;
+} StepBreak;
+
+static GGRunReason step_cycles(GameGear *gg, unsigned cycles)
+{
+    return gamegear_run_cycles(gg, cycles);
+}
+
+static GGRunReason step_lines(GameGear *gg, unsigned lines)
+{
+    return gamegear_run_lines(gg, lines);
+}
+
+/*
+    Predicate for gamegear_run_until() that breaks every so many
+    instructions.
+*/
+static bool break_every(const GameGear *gg, void *arg)
+{
+    StepBreak *brk = arg;
+    (void) gg;
+    return ++brk->count % brk->every == 0;
+}
+
+static GGRunReason step_until(GameGear *gg, unsigned instructions)
+{
+    StepBreak brk = {instructions, 0};
+    return gamegear_run_until(gg, break_every, &brk);
+}
+
+/*
+    The ways each stepping test runs its ROM, all of which must end up in the
+    same state as running it a frame at a time. Some also move the GameGear
+    partway through a line: see move_machine().
+*/
+static const struct {
+    const char *name;
+    StepFunc step;
+    unsigned size;
+    bool move;
+} step_runs[] = {
+    {"gamegear_run_cycles(1)", step_cycles, 1, false},
+    {"gamegear_run_cycles(7)", step_cycles, 7, false},
+    {"gamegear_run_cycles(333)", step_cycles, 333, true},
+    {"gamegear_run_lines(1)", step_lines, 1, false},
+    {"gamegear_run_lines(5)", step_lines, 5, false},
+    {"gamegear_run_until() every instruction", step_until, 1, false},
+    {"gamegear_run_until() every 1000", step_until, 1000, true}
+};
+
+/*
+    Return a hash of a GameGear's state.
+*/
+static uint64_t step_hash(const GameGear *gg, const ROM *rom)
+{
+    GGState *state = cr_malloc(sizeof(GGState));
+    gamegear_save_state(gg, state);
+    uint64_t hash = state_hash(state, rom);
+    free(state);
+    return hash;
+}
+
+/*
+    Return a new GameGear running the given ROM, powered on.
+*/
+static GameGear* step_machine(const ROM *rom)
+{
+    GameGear *gg = gamegear_create();
+    gamegear_load_rom(gg, rom);
+    gamegear_power_on(gg);
+    return gg;
+}
+
+/*
+    Replace a GameGear with a copy of it: fork it, then also load its state
+    into the fork through a serialized snapshot, as if from a state file.
+*/
+static GameGear* move_machine(GameGear *gg, const ROM *rom)
 {
-    FILE *fp = fopen(ASM_PREFIX "manifest", "r");
+    GameGear *fork = gamegear_fork(gg);
+    GGState *state = cr_malloc(sizeof(GGState));
+    uint8_t *buf = cr_malloc(STATE_MAX_SIZE);
+
+    gamegear_save_state(gg, state);
+    size_t size = state_serialize(state, rom, buf, STATE_MAX_SIZE);
+    if (!state_deserialize(state, rom, buf, size))
+        gamegear_load_state(fork, state);
+    free(buf);
+    free(state);
+    gamegear_destroy(gg);
+    return fork;
+}
+
+/*
+    Run the GameGear a piece at a time for STEP_FRAMES frames, finishing the
+    last one with gamegear_run_frame(), or until a piece stops for a reason
+    other than the usual one for its function, which is returned. The
+    GameGear may be replaced on the way.
+*/
+static GGRunReason run_in_pieces(GameGear **gg, const ROM *rom,
+    StepFunc step, unsigned size, bool move)
+{
+    GGRunReason usual = step == step_until ? GG_RUN_BREAK : GG_RUN_BUDGET;
+    GGProfile profile = {0};
+    GGRunReason reason;
+    bool moved = false;
+
+    // gamegear_run_until() also stops at the end of each frame:
+    gamegear_attach_profile(*gg, &profile);
+    while (profile.frames < STEP_FRAMES - 1) {
+        reason = step(*gg, size);
+        if (reason != usual && !(step == step_until &&
+                                 reason == GG_RUN_FRAME))
+            return reason;
+        if (move && !moved && profile.frames >= STEP_MOVE_FRAME &&
+                (*gg)->mid_line) {
+            *gg = move_machine(*gg, rom);
+            gamegear_attach_profile(*gg, &profile);
+            moved = true;
+        }
+    }
+    return gamegear_run_frame(*gg);
+}
+
+/*
+    Check that every gamegear_run_*() function refuses to run a GameGear
+    that is off, whether it was never turned on or was turned off.
+*/
+static bool check_step_off(const ROM *rom)
+{
+    GameGear *gg = gamegear_create();
+    bool off = true;
+
+    gamegear_load_rom(gg, rom);
+    for (int i = 0; i < 2; i++) {
+        off = off && gamegear_run_cycles(gg, 1000) == GG_RUN_OFF &&
+              gamegear_run_lines(gg, 1) == GG_RUN_OFF &&
+              gamegear_run_frame(gg) == GG_RUN_OFF &&
+              step_until(gg, 1) == GG_RUN_OFF;
+        gamegear_power_on(gg);
+        gamegear_run_cycles(gg, 1000);
+        gamegear_power_off(gg);
+    }
+    gamegear_destroy(gg);
+
+    if (!off) {
+        FAIL_TEST("%s", "a GameGear that is off was run")
+        return false;
+    }
+    return true;
+}
+
+/*
+    Check that a GameGear stopped by an exception stays stopped, and where it
+    was, whichever gamegear_run_*() function is called next.
+*/
+static bool check_step_exception(GameGear *gg, const ROM *rom)
+{
+    uint64_t hash = step_hash(gg, rom);
+
+    if (gamegear_run_cycles(gg, 1000) != GG_RUN_EXCEPTION ||
+            gamegear_run_lines(gg, 1) != GG_RUN_EXCEPTION ||
+            gamegear_run_frame(gg) != GG_RUN_EXCEPTION ||
+            step_until(gg, 1) != GG_RUN_EXCEPTION ||
+            step_hash(gg, rom) != hash) {
+        FAIL_TEST("%s", "a GameGear ran on after an exception")
+        return false;
+    }
+    return true;
+}
+
+/*
+    Run a single stepping test: assemble the given source file into a
+    temporary ROM, and run it a frame at a time for STEP_FRAMES frames, or
+    until an exception if "exception" is expected instead of "frame". Then
+    run it again in pieces of every size in step_runs, each of which must
+    stop for the same reason in the same state.
+*/
+static bool run_step_test(const char *src_file, const char *expected)
+{
+    char *asm_prefix = "../crater --assemble " STEP_PREFIX;
+    char *cmd = cr_malloc(sizeof(char) * (strlen(asm_prefix) +
+        strlen(src_file) + strlen(STEP_OUTFILE)) + 2);
+    GGRunReason want = strcmp(expected, "exception") ? GG_RUN_FRAME :
+                       GG_RUN_EXCEPTION;
+    GGRunReason reason = GG_RUN_FRAME;
+    const char *error;
+    bool passed = true;
+    ROM rom;
+
+    // Construct the command by concatenating:
+    //   ../crater --assemble step/<src_file> step/.output.gg
+    stpcpy(stpcpy(stpcpy(cmd, asm_prefix), src_file), " " STEP_OUTFILE);
+    unlink(STEP_OUTFILE);
+    system(cmd);
+    free(cmd);
+
+    if ((error = rom_open(&rom, STEP_OUTFILE))) {
+        FAIL_TEST("couldn't load ROM: %s", error)
+        return false;
+    }
+
+    GameGear *gg = step_machine(&rom);
+    for (int i = 0; i < STEP_FRAMES && reason == GG_RUN_FRAME; i++)
+        reason = gamegear_run_frame(gg);
+    uint64_t hash = step_hash(gg, &rom);
+    gamegear_destroy(gg);
+
+    if (reason != want) {
+        FAIL_TEST("run a frame at a time, stopped for reason %d, not %s",
+                  reason, expected)
+        passed = false;
+    }
+
+    for (size_t i = 0; passed && i < sizeof(step_runs) / sizeof(*step_runs);
+            i++) {
+        gg = step_machine(&rom);
+        reason = run_in_pieces(&gg, &rom, step_runs[i].step,
+                               step_runs[i].size, step_runs[i].move);
+        uint64_t got = step_hash(gg, &rom);
+
+        if (reason != want || got != hash) {
+            FAIL_TEST("run with %s, stopped for reason %d in state %016llx; "
+                      "a frame at a time, %s in %016llx", step_runs[i].name,
+                      reason, (unsigned long long) got, expected,
+                      (unsigned long long) hash)
+            passed = false;
+        } else if (want == GG_RUN_EXCEPTION) {
+            passed = check_step_exception(gg, &rom);
+        }
+        gamegear_destroy(gg);
+    }
+
+    passed = passed && check_step_off(&rom);
+    rom_close(&rom);
+    return passed;
+}
+
+/*
+    Run every test listed in a manifest file, one per line as a source file
+    and a reference file separated by a space, with the given function.
+*/
+static bool run_manifest(const char *path,
+    bool (*run_test)(const char*, const char*))
+{
+    FILE *fp = fopen(path, "r");
     if (!fp) {
         ERROR_ERRNO("couldn't open manifest file")
         return false;
@@ -205,18 +657,57 @@ static bool test_asm()
         }
 
         *(split++) = '\0';
-        if (!run_asm_test(line, split)) {
+        if (!run_test(line, split)) {
             fprintf(stderr, "in test: %s -> %s\n", line, split);
             return false;
         }
         PASS_TEST()
     }
 
-    unlink(ASM_OUTFILE);
+    fclose(fp);
     free(line);
     return true;
 }
 
+/* --------------------------- Main test runners --------------------------- */
+
+/*
+    Run tests for the Z80 CPU.
+*/
+static bool test_cpu()
+{
+    // TODO
+    return true;
+}
+
+/*
+    Run tests for the VDP.
+*/
+static bool test_vdp()
+{
+    // TODO
+    return true;
+}
+
+/*
+    Run tests for the SN76489 PSG.
+*/
+static bool test_psg()
+{
+    // TODO
+    return true;
+}
+
+/*
+    Run tests for the assembler.
+*/
+static bool test_asm()
+{
+    bool passed = run_manifest(ASM_PREFIX "manifest", run_asm_test);
+    unlink(ASM_OUTFILE);
+    return passed;
+}
+
 /*
     Run tests for the disassembler.
 */
@@ -231,8 +722,35 @@ static bool test_dis()
 */
 static bool test_integrate()
 {
-    // TODO
-    return true;
+    bool passed = run_manifest(INTEGRATE_PREFIX "manifest",
+                               run_integrate_test);
+    unlink(INTEGRATE_OUTFILE);
+    unlink(INTEGRATE_MOVIE);
+    return passed;
+}
+
+/*
+    Run tests for the Gear-to-Gear link cable, with two Game Gears on
+    separate threads.
+*/
+static bool test_link()
+{
+    bool passed = run_manifest(LINK_PREFIX "manifest", run_link_test);
+    unlink(LINK_OUTFILE_A);
+    unlink(LINK_OUTFILE_B);
+    unlink(LINK_RESULTS);
+    return passed;
+}
+
+/*
+    Run tests for running a GameGear a piece at a time, e.g. a few cycles or
+    scanlines, or an instruction, at once.
+*/
+static bool test_step()
+{
+    bool passed = run_manifest(STEP_PREFIX "manifest", run_step_test);
+    unlink(STEP_OUTFILE);
+    return passed;
 }
 
 /*
@@ -264,6 +782,12 @@ int main(int argc, char *argv[])
     } else if (!strcmp(component, "integrate")) {
         name = "integration";
         func = test_integrate;
+    } else if (!strcmp(component, "link")) {
+        name = "link cable";
+        func = test_link;
+    } else if (!strcmp(component, "step")) {
+        name = "stepping";
+        func = test_step;
     } else {
         FATAL("unknown component: %s", component)
         return EXIT_FAILURE;
@@ -0,0 +1,68 @@
+;; Copyright (C) 2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+;; Released under the terms of the MIT License. See LICENSE for details.
+
+; ----- CRATER UNIT TESTING SUITE ---------------------------------------------
+
+; 01-interrupts.asm
+; Halt between line and frame interrupts, changing the backdrop color and
+; the tone in each one and keeping the H counter it was taken at
+
+.rom_size "32 KB"
+
+.org $0000
+	jp	main
+
+.org $0038
+interrupt:
+	push	af
+	in	a, ($BF)		; Acknowledge the interrupt
+	in	a, ($7F)		; Keep the H counter
+	ld	($C001), a
+	ld	a, ($C000)		; Count interrupts
+	inc	a
+	ld	($C000), a
+	push	af
+	xor	a			; Point at CRAM entry 0
+	out	($BF), a
+	ld	a, $C0
+	out	($BF), a
+	pop	af
+	out	($BE), a		; Change the backdrop color
+	out	($BE), a
+	and	$0F			; Change tone 0's period
+	or	$80
+	out	($7F), a
+	pop	af
+	ei
+	reti
+
+.org $0066
+	retn
+
+main:
+	di
+	im	1
+	ld	sp, $DFF0
+	ld	a, $10			; Register 0: line interrupts on
+	out	($BF), a
+	ld	a, $80
+	out	($BF), a
+	ld	a, $07			; Register 10: one every eight lines
+	out	($BF), a
+	ld	a, $8A
+	out	($BF), a
+	ld	a, $60			; Register 1: display and frame interrupts on
+	out	($BF), a
+	ld	a, $81
+	out	($BF), a
+	ld	a, $0F			; Tone 0: full volume
+	out	($7F), a
+	ld	a, $90
+	out	($7F), a
+	xor	a
+	ld	($C000), a
+	ei
+
+loop:
+	halt
+	jp	loop
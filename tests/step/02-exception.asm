@@ -0,0 +1,31 @@
+;; Copyright (C) 2019 Ben Kurtovic <ben.kurtovic@gmail.com>
+;; Released under the terms of the MIT License. See LICENSE for details.
+
+; ----- CRATER UNIT TESTING SUITE ---------------------------------------------
+
+; 02-exception.asm
+; Busy-wait through a few frames, then run an opcode crater doesn't implement
+
+.rom_size "32 KB"
+
+.org $0000
+main:
+	di
+	ld	sp, $DFF0
+	ld	b, 10
+
+frame:
+	in	a, ($7E)		; Wait for line $C0, then for the next one
+	cp	$C0
+	jp	nz, frame
+wait:
+	in	a, ($7E)
+	cp	$C0
+	jp	z, wait
+	ld	hl, $C000
+	inc	(hl)
+	dec	b
+	jp	nz, frame
+
+	.byte	$DD, $24		; inc ixh
+	jp	main